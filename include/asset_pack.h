@@ -0,0 +1,105 @@
+#pragma once
+
+#include "mapped_file.h"
+#include "hash.h"
+
+#include <vector>
+
+// Constant asset pack path variables, relative to the build directory
+const std::string ASSET_PACK_PATH = "../assets.pack";
+
+#define ASSET_PACK_MAGIC 0x4b434150 // "PACK"
+#define ASSET_PACK_VERSION 1
+#define ASSET_PACK_NAME_LENGTH 80
+#define ASSET_PACK_ALIGNMENT 16
+
+enum AssetCompression {
+  ASSET_UNCOMPRESSED,
+  ASSET_LZ4,
+  ASSET_ZSTD
+};
+
+/* ------------------------------------------------------------
+ * On disk layout
+ *
+ * AssetPackHeader
+ * AssetPackEntry[num_entries], sorted by name hash
+ * Asset data, each aligned to ASSET_PACK_ALIGNMENT
+ * -----------------------------------------------------------*/
+struct AssetPackHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t num_entries;
+  uint32_t reserved;
+};
+
+struct AssetPackEntry {
+  uint64_t name_hash;
+  uint64_t content_hash; // Of the uncompressed data, checked after decompressing
+  uint64_t offset;
+  uint64_t size;         // Uncompressed
+  uint64_t stored_size;  // In the pack
+  uint32_t compression;
+  uint32_t reserved;
+  char name[ASSET_PACK_NAME_LENGTH];
+};
+
+// The contents of one asset. Uncompressed assets are a view straight into
+// the mapped pack or loose file, compressed ones are decompressed into a
+// buffer owned by this
+class AssetData {
+  public:
+    // Constructors
+    AssetData();
+
+    // Setup functions
+    void Close();
+
+    // Getters
+    const uint8_t* Data() const { return m_data; }
+    size_t Size() const { return m_size; }
+    bool IsOpen() const { return m_data != nullptr; }
+    bool FromPack() const { return m_from_pack; }
+
+  private:
+    friend class AssetPack;
+
+    // Not copyable, views may point into m_buffer
+    AssetData(const AssetData&);
+    AssetData& operator=(const AssetData&);
+
+    const uint8_t* m_data;
+    size_t m_size;
+    bool m_from_pack;
+
+    MappedFile m_file;
+    std::vector<uint8_t> m_buffer;
+};
+
+class AssetPack {
+  public:
+    // Static functions
+    static AssetPack& Get();
+    static std::string AssetName(const std::string&);
+    static bool Compress(AssetCompression, const uint8_t*, size_t, std::vector<uint8_t>&);
+    static bool Decompress(AssetCompression, const uint8_t*, size_t, uint8_t*, size_t);
+
+    // Setup functions
+    bool Open(const std::string&);
+    void Close();
+
+    // Runtime functions, safe to call from any thread once opened
+    bool Load(const std::string&, AssetData&) const;
+    bool Exists(const std::string&) const;
+
+    // Getters
+    bool IsOpen() const { return m_entries != nullptr; }
+
+  private:
+    AssetPack();
+    const AssetPackEntry* Find(const std::string&) const;
+
+    MappedFile m_file;
+    const AssetPackEntry* m_entries;
+    unsigned m_num_entries;
+};
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "graphics_headers.h"
+
+// Axis aligned box with the sphere around it
+struct Bounds {
+  Bounds() : min(0.0f), max(0.0f), center(0.0f), radius(0.0f) {}
+
+  // Grows the box to hold a point, call Finish once every point is added
+  void Add(const glm::vec3& point, bool first) {
+    min = first ? point : glm::min(min, point);
+    max = first ? point : glm::max(max, point);
+  }
+
+  void Add(const Bounds& other, bool first) {
+    Add(other.min, first);
+    Add(other.max, false);
+  }
+
+  void Finish() {
+    center = (min + max) * 0.5f;
+    radius = glm::length(max - min) * 0.5f;
+  }
+
+  glm::vec3 Extents() const { return (max - min) * 0.5f; }
+
+  // The box around this one after a transform, Arvo's method
+  Bounds Transform(const glm::mat4& matrix) const {
+    glm::vec3 new_center = glm::vec3(matrix * glm::vec4(center, 1.0f));
+    glm::vec3 extents = Extents();
+    glm::vec3 new_extents(0.0f);
+    for (unsigned i = 0; i < 3; i++) {
+      for (unsigned j = 0; j < 3; j++) {
+        new_extents[i] += std::fabs(matrix[j][i]) * extents[j];
+      }
+    }
+
+    Bounds result;
+    result.min = new_center - new_extents;
+    result.max = new_center + new_extents;
+    result.Finish();
+    return result;
+  }
+
+  glm::vec3 min, max;
+  glm::vec3 center;
+  float radius;
+};
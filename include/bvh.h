@@ -0,0 +1,85 @@
+#pragma once
+
+#include "frustum_culler.h"
+
+#define BVH_NULL_NODE -1
+
+// Leaves are stored grown by this fraction of their size so small moves
+// don't need a reinsert
+#define BVH_FAT_MARGIN 0.1f
+
+// Bins per axis when evaluating the surface area heuristic
+#define BVH_SAH_BINS 16
+
+// Rebuild with the SAH once this fraction of the proxies were reinserted
+// since the last build
+#define BVH_REBUILD_FRACTION 0.25f
+
+// Node of the tree, children follow their parent after a build
+struct BvhNode {
+  glm::vec3 min;
+  int parent;
+  glm::vec3 max;
+  // BVH_NULL_NODE for leaves
+  int left;
+  int right;
+  // The proxy of a leaf
+  unsigned proxy;
+
+  bool IsLeaf() const { return left == BVH_NULL_NODE; }
+};
+
+struct BvhRayHit {
+  unsigned item;
+  float distance;
+};
+
+// Dynamic bounding volume hierarchy over world space boxes, one proxy per
+// box. Built top down with the SAH, kept up to date by reinserting boxes
+// that leave their fat bounds and rebuilt once enough of them have
+class Bvh {
+  public:
+    // Constructors
+    Bvh();
+
+    // Setup functions
+    unsigned Insert(const Bounds&, unsigned);
+    void Remove(unsigned);
+    void Build();
+    void Clear();
+
+    // Runtime functions
+    bool Update(unsigned, const Bounds&);
+    void Optimize();
+    unsigned QueryFrustum(const Frustum&, std::vector<unsigned>&) const;
+    void QueryRay(const glm::vec3&, const glm::vec3&, float, std::vector<BvhRayHit>&) const;
+    void QuerySphere(const glm::vec3&, float, std::vector<unsigned>&) const;
+    void QueryBox(const glm::vec3&, const glm::vec3&, std::vector<unsigned>&) const;
+
+    // Getters
+    unsigned GetProxyCount() const { return m_proxies.size() - m_free_proxies.size(); }
+    unsigned GetHeight() const;
+
+  private:
+    struct Proxy {
+      int node;
+      unsigned item;
+      // Tight bounds, the leaf holds them grown by the margin
+      glm::vec3 min, max;
+    };
+
+    std::vector<BvhNode> m_nodes;
+    int m_root, m_free_node;
+    std::vector<Proxy> m_proxies;
+    std::vector<unsigned> m_free_proxies;
+    unsigned m_reinserts;
+
+    int AllocateNode();
+    void FreeNode(int);
+    void InsertLeaf(int);
+    void RemoveLeaf(int);
+    void Refit(int);
+    void SetLeafBounds(int, const Proxy&);
+    int BuildRange(std::vector<unsigned>&, unsigned, unsigned, int);
+    void CollectItems(int, std::vector<unsigned>&) const;
+};
@@ -16,6 +16,7 @@ class Engine {
     bool Initialize();
     void LoadGameObjects();
     void LoadLights();
+    void RequestAssets(json);
     Object* ParseConfig(json);
 
     // Runtime functions
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "bounds.h"
+
+// Results of Frustum::ClassifyBox
+#define FRUSTUM_OUTSIDE 0
+#define FRUSTUM_INTERSECT 1
+#define FRUSTUM_INSIDE 2
+
+// Plane mask with every plane still to be tested
+#define FRUSTUM_ALL_PLANES 0x3fu
+
+// Planes of a view frustum, normals point inwards
+struct Frustum {
+  // Static functions
+  static Frustum FromMatrix(const glm::mat4&);
+
+  // Runtime functions
+  bool TestBox(const glm::vec3&, const glm::vec3&) const;
+  int ClassifyBox(const glm::vec3&, const glm::vec3&, unsigned&) const;
+
+  // left, right, bottom, top, near, far as (normal, distance)
+  glm::vec4 planes[6];
+};
+
+// World space boxes kept as separate arrays of centers and extents so
+// they can be tested against a frustum several at a time
+class FrustumCuller {
+  public:
+    // Setup functions
+    unsigned Add();
+    void Clear();
+
+    // Runtime functions
+    void Set(unsigned, const Bounds&);
+    unsigned Cull(const Frustum&);
+    unsigned CullScalar(const Frustum&);
+
+    // Getters
+    unsigned GetSize() const { return m_center_x.size(); }
+    bool IsVisible(unsigned index) const { return m_visible[index] != 0; }
+
+  private:
+    std::vector<float> m_center_x, m_center_y, m_center_z;
+    std::vector<float> m_extent_x, m_extent_y, m_extent_z;
+    // 1 for boxes inside or crossing the frustum after the last cull
+    std::vector<uint8_t> m_visible;
+
+    void Reserve();
+};
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "shader.h"
+
+// Color targets the geometry pass writes: albedo and shininess, the
+// octahedral packed normal, and the material's ambient term
+#define GBUFFER_TARGETS 3
+
+// Render targets of the deferred pipeline. Opaque geometry writes its
+// surface into the G-buffer, the lighting pass then shades each pixel once
+// from it into the light target. Forward and transparent draws go on top
+// of the light target, tested against the G-buffer depth, before it is
+// copied to the window
+class GBuffer {
+  public:
+    // Constructors
+    GBuffer();
+
+    // Setup functions
+    bool Initialize(unsigned, unsigned);
+    void SetShadows(bool shadows) { m_shadows = shadows; }
+    void Destroy();
+
+    // Runtime functions
+    void BeginGeometry();
+    void Resolve(Shader*, const glm::mat4&);
+    void Present();
+
+    // Getters
+    bool IsValid() const { return m_geometry_framebuffer != 0; }
+
+  private:
+    unsigned m_width, m_height;
+
+    // Albedo, normal and material, then the light target
+    GLuint m_targets[GBUFFER_TARGETS];
+    GLuint m_light_target;
+    GLuint m_depth;
+
+    // The geometry pass writes the targets and depth, the lighting pass
+    // only the light target so the depth it samples isn't attached, the
+    // forward passes the light target and depth
+    GLuint m_geometry_framebuffer;
+    GLuint m_light_framebuffer;
+    GLuint m_forward_framebuffer;
+
+    // The fullscreen triangle has no attributes, but core profiles need a
+    // vertex array bound to draw
+    GLuint m_vertex_array;
+
+    UniformHandle m_albedo_handle, m_normal_handle, m_material_handle, m_depth_handle;
+    UniformHandle m_inverse_proj_view_handle;
+
+    // Whether the lighting program samples the shadow maps
+    bool m_shadows;
+
+    GLuint CreateTarget(GLenum, GLenum, GLenum);
+    bool CheckFramebuffer(const char*);
+};
@@ -0,0 +1,110 @@
+#pragma once
+
+#include "vertex_format.h"
+
+// Defragment once less than this fraction of the free space is in one block
+#define GEOMETRY_DEFRAGMENT_THRESHOLD 0.5f
+
+// Below this much free space fragmentation isn't worth a copy
+#define GEOMETRY_DEFRAGMENT_MIN_BYTES (1u << 20)
+
+// A handle to the vertex and index ranges of one mesh
+typedef unsigned GeometryHandle;
+#define INVALID_GEOMETRY_HANDLE 0xffffffffu
+
+// Where a mesh lives in the pool. Indices are relative to base_vertex so
+// the mesh is drawn with glDrawElementsBaseVertex
+struct GeometryAllocation {
+  unsigned arena;
+  unsigned base_vertex, num_vertices;
+  unsigned first_index, num_indices;
+  bool live;
+};
+
+// Matches the layout glMultiDrawElementsIndirect reads
+struct DrawCommand {
+  GLuint count;
+  GLuint instance_count;
+  GLuint first_index;
+  GLint base_vertex;
+  GLuint base_instance;
+};
+
+struct GeometryPoolStats {
+  size_t capacity_bytes, used_bytes;
+  size_t free_bytes, largest_free_bytes;
+  unsigned num_allocations, num_free_blocks, num_buffers;
+  // 0 when each buffer's free space is in one block, approaching 1 as it
+  // splinters
+  float fragmentation;
+};
+
+class GeometryPool {
+  public:
+    // Static functions
+    static GeometryPool& Get();
+
+    // Constructors
+    GeometryPool();
+
+    // Setup functions
+    void Initialize(size_t, size_t);
+    void Destroy();
+
+    // Runtime functions, context thread only
+    GeometryHandle Allocate(unsigned, unsigned, unsigned);
+    void Upload(GeometryHandle, const void*, const unsigned*);
+    void Free(GeometryHandle);
+    void Defragment();
+    GLuint GetVertexArray(GeometryHandle, VertexFormat, unsigned);
+
+    // Getters
+    const GeometryAllocation& GetAllocation(GeometryHandle handle) const { return m_allocations[handle]; }
+    GLuint GetVertexBuffer(GeometryHandle handle) const { return m_arenas[m_allocations[handle].arena].buffer; }
+    GLuint GetIndexBuffer() const { return m_indices.buffer; }
+    GeometryPoolStats GetStats() const;
+    void PrintStats() const;
+
+  private:
+    struct FreeBlock {
+      unsigned offset, count;
+    };
+
+    // One GL buffer suballocated in elements of a fixed size, vertex
+    // buffers are split by stride so base vertices stay whole numbers
+    struct Arena {
+      GLuint buffer;
+      unsigned element_size;
+      unsigned capacity;
+      unsigned used;
+      // Sorted by offset, neighbours are always merged
+      std::vector<FreeBlock> free_blocks;
+    };
+
+    // A vertex array with the attributes of one format enabled for a set
+    // of locations, pointing into one vertex buffer and the index buffer
+    struct VertexArray {
+      GLuint buffer;
+      VertexFormat format;
+      unsigned mask;
+      GLuint vertex_array;
+    };
+
+    void CreateArena(Arena&, unsigned, unsigned);
+    void ReplaceBuffer(Arena&, GLuint);
+    bool AllocateRange(Arena&, unsigned, unsigned&);
+    void FreeRange(Arena&, unsigned, unsigned);
+    void Grow(Arena&, unsigned);
+    void Compact(Arena&, bool);
+    size_t AddStats(const Arena&, GeometryPoolStats&) const;
+
+    size_t m_vertex_size, m_index_size;
+
+    std::vector<Arena> m_arenas;
+    Arena m_indices;
+
+    std::vector<VertexArray> m_vertex_arrays;
+
+    std::vector<GeometryAllocation> m_allocations;
+    std::vector<GeometryHandle> m_free_handles;
+};
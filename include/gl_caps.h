@@ -0,0 +1,23 @@
+#pragma once
+
+#include "graphics_headers.h"
+#include "texture_baker.h"
+
+// Optional OpenGL features, queried once after the context is created
+struct GLCaps {
+  static GLCaps& Get();
+  void Query();
+
+  bool SupportsFormat(TextureFormat) const;
+
+  int major_version, minor_version;
+  bool buffer_storage;
+  bool texture_storage;
+  bool s3tc, bptc;
+  bool anisotropic;
+  // glMultiDrawElementsIndirect with SSBOs and gl_BaseInstanceARB
+  bool multi_draw_indirect;
+  // glTexBufferRange, a buffer texture over part of a buffer
+  bool texture_buffer_range;
+  float max_anisotropy;
+};
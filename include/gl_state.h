@@ -0,0 +1,89 @@
+#pragma once
+
+#include "graphics_headers.h"
+
+// Value of any binding or setting the cache doesn't know, the next call
+// setting it is always issued
+#define GL_STATE_UNKNOWN 0xffffffffu
+
+// Texture units whose bindings are tracked, see the GL_*_POS units in
+// model.h. Units past these are always bound
+#define GL_STATE_TEXTURE_UNITS 16
+
+// Indexed uniform and shader storage binding points tracked per target
+#define GL_STATE_INDEXED_BINDINGS 8
+
+// Buffer and texture targets, and capabilities, tracked. Any other target
+// or capability is passed straight through
+#define GL_STATE_BUFFER_TARGETS 9
+#define GL_STATE_TEXTURE_TARGETS 3
+#define GL_STATE_CAPABILITIES 6
+
+// Shadow copy of the OpenGL state the renderer changes. Every bind and
+// state change goes through here and is dropped when it would set what
+// is already set. Built with GL_STATE_VALIDATE, every dropped call is
+// checked against glGet* first and issued anyway if the copy was wrong.
+// Anything changing GL state behind its back has to call Invalidate
+class GLState {
+  public:
+    // Static functions
+    static GLState& Get();
+
+    // Setup functions
+    void Invalidate();
+
+    // Runtime functions
+    void UseProgram(GLuint);
+    void BindVertexArray(GLuint);
+    void BindBuffer(GLenum, GLuint);
+    void BindBufferBase(GLenum, GLuint, GLuint);
+    void BindBufferRange(GLenum, GLuint, GLuint, GLintptr, GLsizeiptr);
+    void ActiveTexture(GLenum);
+    void BindTexture(GLenum, GLuint);
+    void BindTexture(GLenum, GLenum, GLuint);
+    void BindFramebuffer(GLenum, GLuint);
+    void Enable(GLenum);
+    void Disable(GLenum);
+    void DepthMask(GLboolean);
+    void DepthFunc(GLenum);
+    void ColorMask(GLboolean);
+    void BlendFunc(GLenum, GLenum);
+    void CullFace(GLenum);
+    void Viewport(GLint, GLint, GLsizei, GLsizei);
+    void Scissor(GLint, GLint, GLsizei, GLsizei);
+
+    // Deleting a bound object unbinds it, and its name may come back from
+    // the next glGen*, so the copy forgets it too
+    void DeleteProgram(GLuint);
+    void DeleteVertexArrays(GLsizei, const GLuint*);
+    void DeleteBuffers(GLsizei, const GLuint*);
+    void DeleteTextures(GLsizei, const GLuint*);
+    void DeleteFramebuffers(GLsizei, const GLuint*);
+
+  private:
+    GLState();
+
+    GLuint m_program;
+    GLuint m_vertex_array;
+    GLuint m_buffers[GL_STATE_BUFFER_TARGETS];
+    // Uniform then shader storage indexed bindings, and the range of the
+    // buffer each is bound to. A zero size binds the whole buffer
+    GLuint m_indexed_buffers[2][GL_STATE_INDEXED_BINDINGS];
+    GLintptr m_indexed_offsets[2][GL_STATE_INDEXED_BINDINGS];
+    GLsizeiptr m_indexed_sizes[2][GL_STATE_INDEXED_BINDINGS];
+    GLuint m_active_unit;
+    GLuint m_textures[GL_STATE_TEXTURE_UNITS][GL_STATE_TEXTURE_TARGETS];
+    GLuint m_draw_framebuffer, m_read_framebuffer;
+    GLuint m_capabilities[GL_STATE_CAPABILITIES];
+    GLuint m_depth_mask, m_depth_func, m_color_mask;
+    GLuint m_blend_src, m_blend_dst;
+    GLuint m_cull_face;
+    GLint m_viewport[4], m_scissor[4];
+
+    bool Validate(const char*, GLenum, const GLint*, unsigned);
+    bool Validate(const char*, GLenum, GLuint);
+    bool Filter(bool, const char*, GLenum, const GLint*, unsigned);
+    bool Filter(bool, const char*, GLenum, GLuint);
+    void SetCapability(GLenum, bool);
+    bool FilterIndexed(GLenum, GLuint, GLuint, GLintptr, GLsizeiptr);
+};
@@ -1,6 +1,11 @@
 #pragma once
 
 #include "object.h"
+#include "light_buffer.h"
+#include "light_clusters.h"
+#include "gbuffer.h"
+#include "shadow_scheduler.h"
+#include "bvh.h"
 
 #define CAMERA_MOVE_DELTA 4.0f
 #define CAMERA_ZOOM_DELTA 0.5f
@@ -16,12 +21,15 @@ class Graphics {
     void AddObject(std::string, Object*, bool);
     void AddPointLight(json);
     void AddDirectionalLight(json);
+    void AddSunLight(json);
 
     // Runtime function
     void Update(unsigned);
     void UpdateCamera();
     void UpdateCamera(float, float);
     void UpdateCamera(int);
+    void ToggleDepthPrepass();
+    void TogglePipeline();
     void Render();
 
     // Destructors
@@ -29,14 +37,51 @@ class Graphics {
 
   private:
     Options* options;
+    unsigned m_stats_elapsed;
     std::string ErrorString(GLenum);
+    Shader* LoadShader(const std::string&);
+    Shader* LoadShader(const std::string&, const std::string&);
+    bool InitializeDeferred();
+    void RenderShadows(const Frustum&);
+    void DrawCasters(const ShadowView&, bool);
 
-    std::unordered_map<std::string, std::vector<Object*> > m_render_list;
+    // Every object that can be drawn, indexed by its cull index
+    struct Drawable {
+      Object* object;
+      Shader* shader;
+      // Writes the G-buffer instead of lighting, nullptr if the shader
+      // has no G-buffer version and is drawn forward in either pipeline
+      Shader* gbuffer_shader;
+      unsigned proxy;
+    };
+    std::vector<Drawable> m_drawables;
     std::unordered_map<std::string, Shader*> m_shader_list;
+    RenderQueue m_queue;
+    Shader* m_depth_shader;
+
+    // The deferred pipeline's targets and lighting program, created the
+    // first time it is used
+    bool m_deferred;
+    GBuffer m_gbuffer;
+    Shader* m_lighting_shader;
+    FrustumCuller m_culler;
+    Bvh m_scene;
+    bool m_use_bvh;
+    std::vector<unsigned> m_visible;
+
+    // Shadow maps of the sun and spot lights, drawn with their own queue
+    // before the frame. Casters anywhere in the scene bounds can reach the
+    // view, not just the visible objects
+    ShadowMaps m_shadows;
+    ShadowScheduler m_shadow_scheduler;
+    RenderQueue m_shadow_queue;
+    Bounds m_scene_bounds;
+    std::vector<unsigned> m_casters;
+    OcclusionCuller m_occlusion;
 
     glm::mat4 m_view_matrix, m_projection_matrix;
 
     std::vector<Object*> m_objects;
-    std::vector<PointLight> m_point_lights;
-    std::vector<DirectionalLight> m_directional_lights;
+    LightBuffer m_lights;
+    LightClusters m_clusters;
 };
@@ -28,7 +28,7 @@ extern json config;
 #include <glm/gtx/rotate_vector.hpp>
 #include <glm/ext.hpp>
 
-#define INVALID_UNIFORM_LOCATION 0x7fffffff
+#define INVALID_UNIFORM_LOCATION -1
 
 struct PointLight {
   PointLight(json light):
@@ -63,6 +63,21 @@ struct DirectionalLight {
   float strength, outer_angle, inner_angle;
 };
 
+// A light infinitely far away lighting the whole scene from one direction
+struct SunLight {
+  SunLight(json light):
+      strength(light["LIGHT_STRENGTH"].get<float>()) {
+    direction.x = light["LIGHT_DIRECTION"][0].get<float>();
+    direction.y = light["LIGHT_DIRECTION"][1].get<float>();
+    direction.z = light["LIGHT_DIRECTION"][2].get<float>();
+    color.x = light["LIGHT_COLOR"][0].get<float>();
+    color.y = light["LIGHT_COLOR"][1].get<float>();
+    color.z = light["LIGHT_COLOR"][2].get<float>();
+  }
+  glm::vec3 direction, color;
+  float strength;
+};
+
 struct Vertex {
   Vertex() {}
   Vertex(glm::vec3 p, glm::vec2 u, glm::vec3 n, glm::vec3 t, glm::vec3 b) : position(p), uv(u), normal(n), tangent(t), bitangent(b) {}
@@ -75,7 +90,19 @@ struct Vertex {
 
 struct Options {
   Options(json conf) :
-    eye(conf["EYE"]) {}
+    eye(conf["EYE"]),
+    textures(conf.value("TEXTURES", json::object())),
+    lod(conf.value("LOD", json::object())),
+    geometry(conf.value("GEOMETRY", json::object())),
+    occlusion(conf.value("OCCLUSION", json::object())),
+    shadows(conf.value("SHADOWS", json::object())),
+    vertex_format(conf.value("VERTEX_FORMAT", std::string("full"))),
+    stream_size(conf.value("STREAM_MB", 12u) << 20),
+    multi_draw(conf.value("MULTI_DRAW", true)),
+    culling(conf.value("CULLING", std::string("bvh"))),
+    depth_prepass(conf.value("DEPTH_PREPASS", true)),
+    pipeline(conf.value("PIPELINE", std::string("forward"))),
+    stats_interval_ms(conf.value("STATS_INTERVAL_MS", 0u)) {}
   struct Eye {
     Eye(json eye_conf) :
         FOV(eye_conf["FOV"].get<float>()),
@@ -85,11 +112,82 @@ struct Options {
       phi = eye_conf["TPR"][1].get<float>();
       r = eye_conf["TPR"][2].get<float>();
       look_at = glm::vec3(0.0f);
+      projection_scale = 1.0f;
     }
     glm::vec3 position, look_at;
     float FOV, near_plane, far_plane;
     float theta, phi, r;
+    // Pixels covered by one unit at a distance of one, set with the
+    // projection matrix
+    float projection_scale;
   } eye;
+  struct Textures {
+    Textures(json tex_conf) :
+        upload_budget_ms(tex_conf.value("UPLOAD_BUDGET_MS", 2.0f)),
+        staging_size(tex_conf.value("STAGING_MB", 16u) << 20),
+        anisotropy(tex_conf.value("ANISOTROPY", 8.0f)) {}
+    float upload_budget_ms;
+    unsigned staging_size;
+    float anisotropy;
+  } textures;
+  struct Lod {
+    Lod(json lod_conf) :
+        error_pixels(lod_conf.value("ERROR_PIXELS", 1.0f)),
+        hysteresis(lod_conf.value("HYSTERESIS", 0.25f)) {}
+    float error_pixels;
+    float hysteresis;
+  } lod;
+  struct Geometry {
+    Geometry(json geo_conf) :
+        vertex_size(geo_conf.value("VERTEX_MB", 32u) << 20),
+        index_size(geo_conf.value("INDEX_MB", 16u) << 20) {}
+    unsigned vertex_size;
+    unsigned index_size;
+  } geometry;
+  struct Occlusion {
+    Occlusion(json occ_conf) :
+        enabled(occ_conf.value("ENABLED", true)),
+        width(occ_conf.value("WIDTH", 256u)),
+        height(occ_conf.value("HEIGHT", 128u)) {}
+    bool enabled;
+    // Size of the CPU depth buffer occluders are drawn into
+    unsigned width, height;
+  } occlusion;
+  struct Shadows {
+    Shadows(json shadow_conf) :
+        enabled(shadow_conf.value("ENABLED", true)),
+        cascade_size(shadow_conf.value("CASCADE_SIZE", 1024u)),
+        atlas_size(shadow_conf.value("ATLAS_SIZE", 2048u)),
+        distance(shadow_conf.value("DISTANCE", 60.0f)),
+        pcf(shadow_conf.value("PCF", 2u)),
+        budget_ms(shadow_conf.value("BUDGET_MS", 1.5f)) {}
+    bool enabled;
+    // Size of each sun cascade and of the spot light atlas
+    unsigned cascade_size, atlas_size;
+    // How far from the eye the sun's shadow reaches
+    float distance;
+    // Filter quality, 0 for a single bilinear tap up to 3 for 4x4 taps
+    unsigned pcf;
+    // GPU time the shadow maps drawn each frame may take, the rest are
+    // drawn on later frames
+    float budget_ms;
+  } shadows;
+  // full, packed or quantized, see vertex_format.h
+  std::string vertex_format;
+  // Size of the buffer the per draw data is streamed through, a third of
+  // it per frame. Grown when a frame needs more
+  unsigned stream_size;
+  // Submit with glMultiDrawElementsIndirect when the driver has it
+  bool multi_draw;
+  // bvh to cull through the scene hierarchy, flat to test every object
+  std::string culling;
+  // Lay down depth with a position only pass before shading, toggled with P
+  bool depth_prepass;
+  // forward to light every fragment as it is drawn, deferred to light each
+  // pixel once from a G-buffer. Toggled with G
+  std::string pipeline;
+  // How often to print render stats, 0 to never
+  unsigned stats_interval_ms;
   struct Window {
     std::string name;
     int width, height;
@@ -102,7 +200,10 @@ struct ObjectProps {
     name(obj["NAME"].get<std::string>()),
     transform(obj["TRANSFORM"]),
     model_name(obj["MODEL"].get<std::string>()),
-    shader_name(obj["SHADER"].get<std::string>()) {}
+    shader_name(obj["SHADER"].get<std::string>()),
+    occluder(obj.value("OCCLUDER", false)),
+    transparent(obj.value("TRANSPARENT", false)),
+    dynamic(obj.value("DYNAMIC", false)) {}
   std::string name;
   struct Transform {
     Transform(json trans):
@@ -121,6 +222,13 @@ struct ObjectProps {
     unsigned collision_type, mesh_type;
   } transform;
   std::string model_name, shader_name;
+  // Large solid objects drawn into the occlusion buffer to hide others
+  bool occluder;
+  // Drawn blended after every opaque object, back to front
+  bool transparent;
+  // Moves, so it is drawn into the shadow maps every frame rather than
+  // cached with the static casters
+  bool dynamic;
 };
 
 std::string load_file(std::string);
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <string>
+#include <cstddef>
+#include <cstdint>
+
+// 64 bit FNV-1a constants
+#define FNV_OFFSET_BASIS 0xcbf29ce484222325ull
+#define FNV_PRIME 0x100000001b3ull
+
+/**
+ * Hashes a block of memory with 64 bit FNV-1a
+ * @param  data - The bytes to hash
+ * @param  size - The number of bytes
+ * @param  hash - The hash to continue from
+ * @return      The hash of the bytes
+ */
+inline uint64_t hash_bytes(const void* data, size_t size, uint64_t hash = FNV_OFFSET_BASIS) {
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+  for (size_t i = 0; i < size; i++) {
+    hash = (hash ^ bytes[i]) * FNV_PRIME;
+  }
+  return hash;
+}
+
+inline uint64_t hash_string(const std::string& value) {
+  return hash_bytes(value.data(), value.size());
+}
+
+/**
+ * The same hash as hash_string, usable in constant expressions so string
+ * literals can be hashed at compile time
+ * @param  value - The null terminated string to hash
+ * @param  hash  - The hash to continue from
+ * @return       The hash of the string
+ */
+constexpr uint64_t hash_literal(const char* value, uint64_t hash = FNV_OFFSET_BASIS) {
+  return *value == '\0' ? hash : hash_literal(value + 1, (hash ^ uint8_t(*value)) * FNV_PRIME);
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include "graphics_headers.h"
+
+// Size of the light arrays in the Lights block, passed to the shaders as
+// defines. The block stays under the 16 KiB every driver allows
+#define MAX_POINT_LIGHTS 256
+#define MAX_DIRECTIONAL_LIGHTS 64
+
+// Lights fade out to nothing where strength / distance drops to this, so
+// each one only reaches the clusters within strength / LIGHT_CUTOFF
+#define LIGHT_CUTOFF 0.01f
+
+// Uniform buffer binding point every program's Lights block is bound to
+#define LIGHT_BLOCK_BINDING 0
+const std::string LIGHT_BLOCK_NAME = "Lights";
+
+// std140 mirrors of the structs in shaders/lights.glsl
+struct PointLightData {
+  glm::vec3 position;
+  float strength;
+  glm::vec3 color;
+  float padding;
+};
+
+struct DirectionalLightData {
+  glm::vec3 position;
+  float strength;
+  glm::vec3 direction;
+  float inner_angle;
+  glm::vec3 color;
+  float outer_angle;
+};
+
+struct LightBlock {
+  PointLightData point_lights[MAX_POINT_LIGHTS];
+  DirectionalLightData dir_lights[MAX_DIRECTIONAL_LIGHTS];
+  GLint point_count;
+  GLint directional_count;
+  GLint padding[2];
+  // Pixels to clusters in x and y, then the scale and bias from log depth
+  // to a depth slice
+  glm::vec4 cluster_scale;
+  // Near and far plane the fragment depth is linearized with
+  glm::vec4 cluster_depth;
+  // Normalized direction the sun shines in, w is its strength, 0 without
+  // a sun
+  glm::vec4 sun_direction;
+  glm::vec4 sun_color;
+};
+
+// Holds the scene's lights in one uniform buffer that every shader reads,
+// rewritten only on the frames a light changed
+class LightBuffer {
+  public:
+    // Constructors
+    LightBuffer();
+
+    // Setup functions
+    void Initialize();
+    void Destroy();
+    bool AddPointLight(const PointLight&);
+    bool AddDirectionalLight(const DirectionalLight&);
+
+    // Runtime functions
+    void SetPointLight(unsigned, const PointLight&);
+    void SetDirectionalLight(unsigned, const DirectionalLight&);
+    void SetSun(const SunLight&);
+    void SetClusterParams(const glm::vec4&, const glm::vec4&);
+    void Update();
+
+    // Getters
+    const LightBlock& GetBlock() const { return m_block; }
+
+  private:
+    GLuint m_buffer;
+    LightBlock m_block;
+    bool m_dirty;
+};
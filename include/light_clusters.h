@@ -0,0 +1,57 @@
+#pragma once
+
+#include "light_buffer.h"
+
+// Froxel grid the view frustum is split into, screen tiles in x and y and
+// exponential depth slices in z. Passed to the shaders as defines
+#define CLUSTER_X 16
+#define CLUSTER_Y 9
+#define CLUSTER_Z 24
+#define CLUSTER_COUNT (CLUSTER_X * CLUSTER_Y * CLUSTER_Z)
+
+// Lights kept per cluster, any more touching a cluster are left out of it
+#define CLUSTER_MAX_LIGHTS 128
+
+// Assigns the lights to the clusters they reach on the CPU and hands the
+// shaders a per cluster list through two buffer textures. The grid holds
+// each cluster's offset into the index list and its point and spot light
+// counts, the index list holds the point lights then the spot lights
+class LightClusters {
+  public:
+    // Constructors
+    LightClusters();
+
+    // Setup functions
+    void Initialize();
+    void SetProjection(const glm::mat4&, float, float);
+    void Destroy();
+
+    // Runtime functions
+    void Assign(const glm::mat4&, const LightBlock&);
+    void Upload();
+
+    // Getters
+    float GetSliceScale() const { return m_slice_scale; }
+    float GetSliceBias() const { return m_slice_bias; }
+    unsigned GetIndexCount() const { return m_indices.size(); }
+    unsigned GetPointCount(unsigned cluster) const { return m_grid[cluster * 2 + 1] & 0xffff; }
+    unsigned GetSpotCount(unsigned cluster) const { return m_grid[cluster * 2 + 1] >> 16; }
+
+  private:
+    // View space bounds of every cluster with depth as a positive
+    // distance, one array per component so they are tested four at a time
+    std::vector<float> m_min_x, m_min_y, m_min_z;
+    std::vector<float> m_max_x, m_max_y, m_max_z;
+    float m_near, m_slice_scale, m_slice_bias;
+
+    // Lights found for each cluster before they are packed
+    std::vector<unsigned> m_counts;
+    std::vector<uint16_t> m_cluster_lights;
+
+    std::vector<GLuint> m_grid;
+    std::vector<GLuint> m_indices;
+    GLuint m_grid_buffer, m_grid_texture;
+    GLuint m_index_buffer, m_index_texture;
+
+    void AddSphere(unsigned, const glm::vec3&, float, const glm::vec3*, float);
+};
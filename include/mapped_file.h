@@ -0,0 +1,35 @@
+#pragma once
+
+#include <string>
+#include <cstddef>
+#include <cstdint>
+
+class MappedFile {
+  public:
+    // Constructors
+    MappedFile();
+
+    // Setup functions
+    bool Open(const std::string&);
+    void Close();
+
+    // Getters
+    const uint8_t* Data() const { return m_data; }
+    size_t Size() const { return m_size; }
+    bool IsOpen() const { return m_data != nullptr; }
+
+    // Destructors
+    ~MappedFile();
+
+  private:
+    // Mappings are not copyable
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
+
+    const uint8_t* m_data;
+    size_t m_size;
+};
+
+// File system helpers
+bool stat_file(const std::string&, uint64_t&, uint64_t&);
+bool make_directory(const std::string&);
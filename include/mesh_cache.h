@@ -0,0 +1,72 @@
+#pragma once
+
+#include "graphics_headers.h"
+#include "asset_pack.h"
+
+// Constant cache path variables
+const std::string CACHE_PATH = "../cache/";
+
+// Bump whenever the layout of the cache file or of Vertex changes
+#define MESH_CACHE_VERSION 3
+
+// Most detail levels kept per mesh, including the full mesh
+#define MESH_MAX_LODS 4
+
+// A range of the index buffer drawing one detail level. The error is the
+// object space distance the level may be off from the full mesh
+struct MeshLod {
+  unsigned first_index, num_indices;
+  float error;
+};
+
+// An imported mesh that owns its vertex and index data, every detail
+// level shares the vertices and is stored in the one index array
+struct MeshData {
+  std::vector<Vertex> vertices;
+  std::vector<unsigned> indices;
+  std::vector<MeshLod> lods;
+  glm::vec3 ambient, diffuse, specular;
+  std::string texture_name, normal_name;
+};
+
+// A mesh whose vertex and index data lives elsewhere, either in a
+// MeshData or in a memory mapped cache file
+struct MeshView {
+  MeshView() : vertices(nullptr), num_vertices(0), indices(nullptr), num_indices(0) {}
+  MeshView(const MeshData& data) :
+    vertices(data.vertices.data()), num_vertices(data.vertices.size()),
+    indices(data.indices.data()), num_indices(data.indices.size()), lods(data.lods),
+    ambient(data.ambient), diffuse(data.diffuse), specular(data.specular),
+    texture_name(data.texture_name), normal_name(data.normal_name) {}
+  const Vertex* vertices;
+  unsigned num_vertices;
+  const unsigned* indices;
+  unsigned num_indices;
+  std::vector<MeshLod> lods;
+  glm::vec3 ambient, diffuse, specular;
+  std::string texture_name, normal_name;
+};
+
+class MeshCache {
+  public:
+    // Static functions
+    static std::vector<std::string> FindDependencies(const std::string&);
+
+    // Constructors
+    MeshCache(const std::string&);
+
+    // Setup functions
+    bool Open();
+    bool Write(const std::vector<MeshData>&, const std::vector<std::string>&);
+    void Close();
+
+    // Getters
+    const std::vector<MeshView>& GetMeshes() const { return m_meshes; }
+
+  private:
+    std::string m_model_name;
+    std::string m_cache_path;
+
+    AssetData m_file;
+    std::vector<MeshView> m_meshes;
+};
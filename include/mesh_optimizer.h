@@ -0,0 +1,34 @@
+#pragma once
+
+#include "mesh_cache.h"
+
+// Cache size the vertex cache reordering scores against
+#define FORSYTH_CACHE_SIZE 32
+
+// FIFO cache size used when reporting ACMR / ATVR, close to what current
+// hardware gets out of its post-transform cache
+#define ANALYZE_CACHE_SIZE 16
+
+// Allowed ACMR increase when splitting clusters for overdraw sorting
+#define OVERDRAW_THRESHOLD 1.05f
+
+// Post-transform cache statistics for an index buffer
+struct VertexCacheStats {
+  VertexCacheStats() : acmr(0.0f), atvr(0.0f) {}
+  float acmr; // Vertices transformed per triangle, 0.5 is ideal
+  float atvr; // Vertices transformed per vertex, 1.0 is ideal
+};
+
+class MeshOptimizer {
+  public:
+    // Static functions
+    static void Optimize(MeshData&, VertexCacheStats&, VertexCacheStats&);
+
+    // Individual passes, run in this order
+    static void OptimizeVertexCache(std::vector<unsigned>&, unsigned);
+    static void OptimizeOverdraw(std::vector<unsigned>&, const std::vector<Vertex>&, float);
+    static void OptimizeVertexFetch(std::vector<Vertex>&, std::vector<unsigned>&);
+
+    // Analysis
+    static VertexCacheStats AnalyzeVertexCache(const std::vector<unsigned>&, unsigned, unsigned);
+};
@@ -0,0 +1,20 @@
+#pragma once
+
+#include "mesh_cache.h"
+
+// Each detail level aims for this fraction of the triangles of the last
+#define LOD_REDUCTION 0.5f
+
+// Give up on further levels once one keeps more than this fraction of the
+// last level's triangles, usually because the rest of the mesh is locked
+#define LOD_MIN_REDUCTION 0.8f
+
+// Meshes smaller than this are not worth simplifying
+#define LOD_MIN_TRIANGLES 32
+
+class MeshSimplifier {
+  public:
+    // Static functions
+    static void GenerateLods(MeshData&);
+    static float Simplify(const std::vector<Vertex>&, const std::vector<unsigned>&, unsigned, std::vector<unsigned>&);
+};
@@ -1,6 +1,20 @@
 #pragma once
 
 #include "shader.h"
+#include "mesh_cache.h"
+#include "thread_pool.h"
+#include "texture_streamer.h"
+#include "texture_baker.h"
+#include "vertex_format.h"
+#include "mesh_optimizer.h"
+#include "mesh_simplifier.h"
+#include "asset_pack.h"
+#include "geometry_pool.h"
+#include "render_stats.h"
+#include "bounds.h"
+#include "occlusion_culler.h"
+
+#include <atomic>
 
 #include <Magick++.h>
 #include <assimp/Importer.hpp>
@@ -10,9 +24,27 @@
 
 #define GL_TEXTURE_POS GL_TEXTURE0
 #define GL_NORMAL_POS GL_TEXTURE1
+#define GL_INSTANCE_POS GL_TEXTURE2
+#define GL_LIGHT_GRID_POS GL_TEXTURE3
+#define GL_LIGHT_INDEX_POS GL_TEXTURE4
+#define GL_GBUFFER_ALBEDO_POS GL_TEXTURE5
+#define GL_GBUFFER_NORMAL_POS GL_TEXTURE6
+#define GL_GBUFFER_MATERIAL_POS GL_TEXTURE7
+#define GL_GBUFFER_DEPTH_POS GL_TEXTURE8
+#define GL_SUN_SHADOW_POS GL_TEXTURE9
+#define GL_SPOT_SHADOW_POS GL_TEXTURE10
 
 #define GL_TEXTURE_OFFSET 0
 #define GL_NORMAL_OFFSET 1
+#define GL_INSTANCE_OFFSET 2
+#define GL_LIGHT_GRID_OFFSET 3
+#define GL_LIGHT_INDEX_OFFSET 4
+#define GL_GBUFFER_ALBEDO_OFFSET 5
+#define GL_GBUFFER_NORMAL_OFFSET 6
+#define GL_GBUFFER_MATERIAL_OFFSET 7
+#define GL_GBUFFER_DEPTH_OFFSET 8
+#define GL_SUN_SHADOW_OFFSET 9
+#define GL_SPOT_SHADOW_OFFSET 10
 
 // Constant model path variables
 const std::string MODEL_PATH = "../models/";
@@ -22,6 +54,10 @@ const std::string TEXTURE_PATH = "../textures/";
 
 class Texture {
   public:
+    // Upload states, decoding happens on the thread pool and uploading is
+    // spread across frames by the TextureStreamer
+    enum State { DECODING, DECODED, FAILED, UPLOADING, READY };
+
     // Static functions
     static Texture* LoadTexture(std::string);
 
@@ -29,10 +65,13 @@ class Texture {
     Texture(std::string);
 
     // Setup functions
+    void Decode();
+    bool LoadBaked();
     void InitializeTexture();
 
     // Runtime functions
     void BindTexture(GLenum);
+    GLuint GetBinding(GLenum);
 
     // Public member variables
     bool m_initialized;
@@ -41,38 +80,99 @@ class Texture {
     ~Texture();
 
   private:
-    Magick::Blob* t_Blob;
-    Magick::Image* t_Image;
+    friend class TextureStreamer;
+
+    std::string m_name;
+    std::atomic<int> m_state;
+
+    // Decoded or baked image and its mip chain, released once the upload
+    // is complete. Baked images are used straight from the mapped file
+    TextureImage m_image;
+    AssetData m_baked;
+    const uint8_t* m_data;
+    unsigned m_upload_level, m_upload_row;
+    GLsync m_fence;
 
     GLuint t_Location;
+};
 
-    bool error;
+// Vertices of one mesh converted to the model's vertex format
+struct PackedMesh {
+  std::vector<uint8_t> data;
+  glm::vec3 position_offset, position_scale;
 };
 
 class Model {
   public:
     // Static functions
     static Model* LoadModel(std::string);
+    static void RequestModel(std::string);
+    static void SetVertexFormat(VertexFormat);
 
     // Constructors
     Model(std::string);
 
+    // Setup functions
+    void Upload();
+
     // Runtime functions
-    void DrawModel(Shader*, bool);
+    void DrawMesh(Shader*, unsigned, unsigned, unsigned);
+    DrawCommand GetDrawCommand(unsigned, unsigned) const;
+
+    // Getters
+    VertexFormat GetFormat() const { return m_format; }
+    unsigned GetLodCount() const { return m_lod_errors.size(); }
+    float GetLodError(unsigned lod) const { return m_lod_errors[lod]; }
+    glm::vec3 GetCenter() const { return m_bounds.center; }
+    float GetRadius() const { return m_bounds.radius; }
+    const Bounds& GetBounds() const { return m_bounds; }
+    const OccluderMesh& GetOccluder() const { return m_occluder; }
 
     // Public memeber variables
     struct Mesh {
       Mesh() {}
-      GLuint VB, IB;
-      unsigned num_indices;
+      GeometryHandle geometry;
+      std::vector<MeshLod> lods;
       Texture *texture, *normal;
       glm::vec3 ambient, diffuse, specular;
+      // Meshes with the same textures and colors share an ID
+      unsigned material;
+      // Object space bounds
+      Bounds bounds;
+      // Dequantization for VERTEX_QUANTIZED positions
+      glm::vec3 position_offset, position_scale;
     };
 
     std::vector<Mesh> m_meshes;
 
+    // Destructors
+    ~Model();
+
   private:
-    void LoadMesh(const aiMesh*, const aiMaterial*);
+    bool ImportModel(const std::string&, std::vector<MeshData>&);
+    void LoadMesh(const aiMesh*, const aiMaterial*, MeshData&);
+    void PackMeshes();
+    void ComputeBounds();
+    void BuildOccluder();
+    void UploadMesh(const MeshView&, const PackedMesh&);
+    static unsigned GetMaterialID(const Mesh&);
+
+    // Imported meshes waiting to be uploaded on the context thread
+    MeshCache m_cache;
+    std::vector<MeshData> m_imported;
+    std::vector<MeshView> m_pending;
+    std::vector<PackedMesh> m_packed;
+    VertexFormat m_format;
+
+    // Object space bounds of the whole model and of each pending mesh, and
+    // the worst error of every mesh at each detail level
+    Bounds m_bounds;
+    std::vector<Bounds> m_mesh_bounds;
+    std::vector<float> m_lod_errors;
+
+    // Coarse copy of every mesh kept on the CPU for occlusion culling
+    OccluderMesh m_occluder;
+    bool m_uploaded;
 
     bool error;
 };
@@ -1,6 +1,6 @@
 #pragma once
 
-#include "model.h"
+#include "render_queue.h"
 
 class Object {
   public:
@@ -9,14 +9,20 @@ class Object {
 
     // Initialize functions
     void AddChild(Object*);
+    void SetCullIndex(unsigned index) { m_cull_index = index; }
 
     // Runtime functions
     void Update(unsigned);
-    void Render(Shader*);
+    void Enqueue(RenderQueue&, Shader*, RenderPass);
+    void AddOccluder(OcclusionCuller&);
+    unsigned SelectLod();
 
     // Getters
     glm::mat4 GetModel() { return m_model_matrix; }
     glm::vec3 GetPosition() { return m_position; }
+    const Bounds& GetWorldBounds() const { return m_world_bounds; }
+    unsigned GetCullIndex() const { return m_cull_index; }
+    bool IsOccluder() const { return props.occluder && m_object_model != nullptr; }
 
     // Public data members
     ObjectProps props;
@@ -27,9 +33,15 @@ class Object {
   private:
     Options* options;
     Model* m_object_model;
+    unsigned m_lod;
 
     glm::mat4 m_model_matrix;
     glm::vec3 m_position;
 
+    // The model's bounds moved by the model matrix, and where they are in
+    // the frustum culler
+    Bounds m_world_bounds;
+    unsigned m_cull_index;
+
     std::vector<Object*> children;
 };
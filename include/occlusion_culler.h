@@ -0,0 +1,78 @@
+#pragma once
+
+#include "bounds.h"
+#include "thread_pool.h"
+
+// Pixels per tile of the depth buffer, each tile keeps the farthest depth
+// of its pixels so boxes can be rejected without reading them
+#define OCCLUSION_TILE_WIDTH 8
+#define OCCLUSION_TILE_HEIGHT 4
+
+// Triangles nearer than this to the eye plane are dropped rather than
+// clipped, losing occluder triangles only ever lets more through
+#define OCCLUSION_MIN_W 1e-3f
+
+// Occluders keep at most this many of each mesh's largest triangles
+#define OCCLUDER_MAX_TRIANGLES 256
+
+// Object space triangles standing in for a model when rasterizing
+// occlusion. Every one is a triangle of the model's real surface, so an
+// occluder never covers anything the model itself doesn't
+struct OccluderMesh {
+  std::vector<glm::vec3> vertices;
+  std::vector<unsigned> indices;
+};
+
+// Rasterizes occluders into a small depth buffer on the CPU and tests
+// boxes against it. Rows of tiles are rasterized in parallel by the
+// calling thread and workers of the culler's own, so the frame never
+// waits behind asset loading on the shared pool
+class OcclusionCuller {
+  public:
+    // Constructors
+    OcclusionCuller();
+
+    // Setup functions
+    void Initialize(unsigned, unsigned);
+
+    // Runtime functions
+    void Clear();
+    void AddOccluder(const OccluderMesh&, const glm::mat4&);
+    void Rasterize(const glm::mat4&);
+    bool TestBox(const Bounds&) const;
+
+    // Getters
+    unsigned GetWidth() const { return m_width; }
+    unsigned GetHeight() const { return m_height; }
+    unsigned GetTriangleCount() const { return m_triangles.size(); }
+    unsigned GetThreadCount() const { return m_pool ? m_pool->GetThreadCount() + 1 : 1; }
+    float GetDepth(unsigned x, unsigned y) const { return m_depth[y * m_width + x]; }
+
+  private:
+    // A screen space triangle with its edge functions and depth plane,
+    // edges are positive inside
+    struct Triangle {
+      float edge_a[3], edge_b[3], edge_c[3];
+      float depth_x, depth_y, depth_c;
+      int min_x, min_y, max_x, max_y;
+    };
+
+    unsigned m_width, m_height;
+    unsigned m_tiles_x, m_tiles_y;
+    glm::mat4 m_proj_view;
+
+    // World space occluder triangles queued for the next Rasterize
+    std::vector<glm::vec3> m_vertices;
+    std::vector<Triangle> m_triangles;
+
+    // Window space depth of every pixel, 1 where nothing was drawn
+    std::vector<float> m_depth;
+    std::vector<float> m_tile_max;
+
+    // The frame threads but one, the calling thread takes a share of the
+    // rows itself
+    std::unique_ptr<ThreadPool> m_pool;
+
+    void SetupTriangle(const glm::vec4&, const glm::vec4&, const glm::vec4&);
+    void RasterizeRows(unsigned, unsigned);
+};
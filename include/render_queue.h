@@ -0,0 +1,167 @@
+#pragma once
+
+#include "model.h"
+
+// Layout of a 64 bit sort key, most significant first. Draws are ordered
+// by pass, program and material so state only changes when one of those
+// does, then by mesh so draws of the same mesh can be instanced, then
+// front to back. Transparent draws have to blend back to front whatever
+// they are drawn with, so their depth moves right under the pass and the
+// other fields move down to make room
+#define SORT_KEY_PASS_SHIFT 62
+#define SORT_KEY_TRANSPARENT_DEPTH_SHIFT 46
+#define SORT_KEY_DEPTH_BITS 16
+#define SORT_KEY_SHADER_SHIFT 52
+#define SORT_KEY_MATERIAL_SHIFT 32
+#define SORT_KEY_GEOMETRY_SHIFT 18
+#define SORT_KEY_LOD_SHIFT 16
+#define SORT_KEY_SHADER_BITS 10
+#define SORT_KEY_MATERIAL_BITS 20
+#define SORT_KEY_GEOMETRY_BITS 14
+#define SORT_KEY_LOD_BITS 2
+
+// Runs of at least this many draws of the same mesh are instanced
+#define INSTANCE_MIN_BATCH 2
+
+// Shader storage binding point of the multi draw per draw data
+#define DRAW_DATA_BINDING 1
+
+// Uniform buffer binding point the ObjectBlock of a single draw is bound
+// to, after the lights and the shadows
+#define OBJECT_BLOCK_BINDING 2
+const std::string OBJECT_BLOCK_NAME = "ObjectBlock";
+
+// Passes in the order they are drawn. The depth pass only exists with a
+// depth prepass, it lays down the depth of every opaque draw so the
+// opaque pass shades each pixel once. The deferred pipeline draws the
+// opaque pass into the G-buffer and lights it before the forward pass,
+// which holds the opaque draws without a G-buffer program
+enum RenderPass {
+  RENDER_PASS_DEPTH,
+  RENDER_PASS_OPAQUE,
+  RENDER_PASS_FORWARD,
+  RENDER_PASS_TRANSPARENT
+};
+
+// std430 mirror of DrawData in shaders/instancing.glsl
+struct DrawData {
+  glm::mat4 model_matrix;
+  glm::vec4 position_offset;
+  glm::vec4 position_scale;
+};
+
+// std140 mirror of ObjectBlock in shaders/instancing.glsl
+struct ObjectData {
+  glm::mat4 model_matrix;
+};
+
+// One mesh to draw this frame
+struct RenderItem {
+  Shader* shader;
+  Model* model;
+  unsigned mesh;
+  unsigned lod;
+  const glm::mat4* model_matrix;
+};
+
+// Collects every mesh draw of a frame, sorts them by state and submits
+// them changing only the state that differs from the previous draw. Runs
+// of the same mesh are drawn with one instanced call. With multi draw
+// indirect every run of draws sharing a program, material and vertex
+// buffer is submitted with one call. Each pass sets its own depth and
+// blend state. Everything a draw reads per object is written into the
+// StreamBuffer once per frame and bound from there
+class RenderQueue {
+  public:
+    // Static functions
+    static uint64_t MakeKey(RenderPass, unsigned, unsigned, unsigned, unsigned, float);
+
+    // Constructors
+    RenderQueue();
+
+    // Setup functions
+    void Initialize(bool);
+    void SetDepthPrepass(Shader* shader) { m_depth_shader = shader; }
+    void SetShadows(bool shadows) { m_shadows = shadows; }
+    void Destroy();
+
+    // Runtime functions
+    void Clear();
+    void Add(RenderPass, float, const RenderItem&);
+    void Sort();
+    void Submit(const glm::mat4&);
+    void Submit(const glm::mat4&, RenderPass, RenderPass);
+
+    // Getters
+    unsigned GetSize() const { return m_items.size(); }
+    bool IsMultiDraw() const { return m_multi_draw; }
+    bool IsDepthPrepass() const { return m_depth_shader != nullptr; }
+
+  private:
+    struct SortEntry {
+      uint64_t key;
+      unsigned item;
+    };
+
+    enum BatchMode { BATCH_SINGLE, BATCH_INSTANCED, BATCH_MULTI_DRAW };
+
+    // Consecutive sorted entries drawn with one call
+    struct Batch {
+      unsigned first, count;
+      // First matrix in the instance data for instanced batches, the
+      // command index for multi draw batches and the object data index
+      // for single draws
+      unsigned offset;
+      BatchMode mode;
+    };
+
+    std::vector<RenderItem> m_items;
+    std::vector<SortEntry> m_entries, m_scratch;
+    std::vector<Batch> m_batches;
+    // Whether this frame's batches were built and uploaded, the passes
+    // may be submitted in more than one call
+    bool m_built;
+
+    // Model matrices of every instanced batch, read by the instanced
+    // shaders through a buffer texture over this frame's range of the
+    // stream buffer. Without glTexBufferRange they go through a buffer of
+    // the queue's own, a texture over the whole stream buffer could be
+    // larger than GL_MAX_TEXTURE_BUFFER_SIZE
+    std::vector<glm::mat4> m_instance_data;
+    GLuint m_instance_texture;
+    bool m_instance_range;
+    GLint m_instance_alignment;
+    GLuint m_instance_buffer;
+
+    // Indirect commands and the per draw data they index through their
+    // base instance
+    bool m_multi_draw;
+    std::vector<DrawCommand> m_commands;
+    std::vector<DrawData> m_draw_data;
+
+    // Blocks of the single draws, each bound as a range of its own
+    std::vector<ObjectData> m_object_data;
+    GLsizeiptr m_object_stride;
+    GLint m_storage_alignment;
+
+    // Where this frame's data was written in the stream buffer. Each
+    // records its buffer, a write may have grown the stream buffer
+    GLuint m_command_buffer, m_draw_data_buffer, m_object_buffer;
+    GLintptr m_command_offset, m_draw_data_offset, m_object_offset;
+
+    // Draws every opaque item again with this position only program
+    // first, nullptr without a depth prepass
+    Shader* m_depth_shader;
+
+    // Whether the lit programs sample the shadow maps
+    bool m_shadows;
+
+    void BeginPass(RenderPass);
+    void EndPasses();
+    void BuildBatches();
+    void UploadInstances();
+    void UploadCommands();
+    void UploadObjects();
+    void BindStreams();
+    void BindTexture(GLenum, GLuint, GLuint&);
+};
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <iostream>
+
+// Counters for the work submitted over a number of frames, printed and
+// reset by Graphics every STATS_INTERVAL_MS
+struct RenderStats {
+  // Static functions
+  static RenderStats& Get() {
+    static RenderStats stats;
+    return stats;
+  }
+
+  RenderStats() { Reset(); }
+
+  void Reset() {
+    frames = 0;
+    draw_calls = 0;
+    depth_draw_calls = 0;
+    vertex_array_binds = 0;
+    attribute_calls_avoided = 0;
+    program_binds = 0;
+    texture_binds = 0;
+    program_binds_saved = 0;
+    texture_binds_saved = 0;
+    vertex_array_binds_saved = 0;
+    instanced_draws = 0;
+    instances = 0;
+    multi_draw_calls = 0;
+    multi_draw_commands = 0;
+    objects_tested = 0;
+    objects_culled = 0;
+    objects_drawn = 0;
+    objects_occluded = 0;
+    occluder_triangles = 0;
+    light_indices = 0;
+    shadow_views = 0;
+    shadow_views_cached = 0;
+    shadow_casters = 0;
+    shadow_views_skipped = 0;
+    shadow_gpu_us = 0;
+    gl_calls_issued = 0;
+    gl_calls_filtered = 0;
+    stream_bytes = 0;
+    stream_waits = 0;
+  }
+
+  // Prints the per frame averages
+  void Print() const {
+    if (frames == 0) return;
+    std::cout << "Per frame: " << objects_tested / frames << " objects tested, "
+              << objects_culled / frames << " culled, "
+              << objects_drawn / frames << " drawn, "
+              << objects_occluded / frames << " occluded by "
+              << occluder_triangles / frames << " triangles" << std::endl;
+    std::cout << "Per frame: " << draw_calls / frames << " draws ("
+              << depth_draw_calls / frames << " depth prepass), "
+              << vertex_array_binds / frames << " vertex array binds, "
+              << attribute_calls_avoided / frames << " attribute calls avoided" << std::endl;
+    std::cout << "Per frame: " << program_binds / frames << " program binds ("
+              << program_binds_saved / frames << " saved), "
+              << texture_binds / frames << " texture binds ("
+              << texture_binds_saved / frames << " saved), "
+              << vertex_array_binds_saved / frames << " vertex array binds saved" << std::endl;
+    std::cout << "Per frame: " << instanced_draws / frames << " instanced draws of "
+              << instances / frames << " instances, "
+              << multi_draw_calls / frames << " multi draws of "
+              << multi_draw_commands / frames << " commands" << std::endl;
+    std::cout << "Per frame: " << light_indices / frames << " cluster light indices" << std::endl;
+    std::cout << "Per frame: " << shadow_views / frames << " shadow maps drawn ("
+              << shadow_views_cached / frames << " static layers cached), "
+              << shadow_views_skipped / frames << " skipped, "
+              << shadow_casters / frames << " shadow casters, "
+              << shadow_gpu_us / frames << " us GPU" << std::endl;
+    std::cout << "Per frame: " << gl_calls_issued / frames << " GL state calls issued, "
+              << gl_calls_filtered / frames << " filtered" << std::endl;
+    std::cout << "Per frame: " << stream_bytes / frames / 1024 << " KiB of draw data streamed, "
+              << stream_waits << " waits for the GPU" << std::endl;
+  }
+
+  unsigned frames;
+  // Objects tested against the view frustum and how many were outside it
+  unsigned objects_tested, objects_culled, objects_drawn;
+  // Objects in the frustum hidden by the occluders and the occluder
+  // triangles rasterized
+  unsigned objects_occluded, occluder_triangles;
+  unsigned draw_calls;
+  // Draws spent laying down depth before the opaque pass
+  unsigned depth_draw_calls;
+  unsigned vertex_array_binds;
+  // glEnable/Disable/VertexAttribPointer calls a prebuilt vertex array
+  // saved compared to specifying the attributes for every mesh
+  unsigned attribute_calls_avoided;
+
+  // Binds issued by the render queue and the ones sorting made redundant,
+  // compared to binding everything for every draw
+  unsigned program_binds, texture_binds;
+  unsigned program_binds_saved, texture_binds_saved, vertex_array_binds_saved;
+
+  // Draws the render queue merged into glDrawElementsInstanced calls
+  unsigned instanced_draws, instances;
+
+  // glMultiDrawElementsIndirect calls and the commands they covered
+  unsigned multi_draw_calls, multi_draw_commands;
+
+  // Cluster light list entries, each is one light a fragment in that
+  // cluster loops over
+  unsigned light_indices;
+
+  // Shadow maps drawn, the ones whose static casters were still cached and
+  // the objects drawn into them
+  unsigned shadow_views, shadow_views_cached, shadow_casters;
+  // Shadow maps left as they were this frame, and the GPU time of the
+  // ones drawn as the timer queries come back
+  unsigned shadow_views_skipped, shadow_gpu_us;
+
+  // Binds and state changes passed to GL and the ones the state cache
+  // dropped because they set what was already set
+  unsigned gl_calls_issued, gl_calls_filtered;
+
+  // Bytes written into the stream buffer, and how often a region was
+  // still being read when it came round again
+  unsigned stream_bytes, stream_waits;
+};
@@ -1,13 +1,58 @@
 #pragma once
 
 #include "graphics_headers.h"
+#include "hash.h"
 
 const std::string SHADER_PATH = "../shaders/";
 
+// A uniform name hashed at compile time, UniformID("proj_view_matrix")
+struct UniformID {
+  constexpr UniformID(const char* name) : hash(hash_literal(name)) {}
+  explicit UniformID(const std::string& name) : hash(hash_string(name)) {}
+  uint64_t hash;
+};
+
+// A uniform registered with Shader::RegisterUniform, resolved to a
+// location in every shader once so setting it is an array index
+typedef unsigned UniformHandle;
+
+// Uniforms every shader may use, registered before anything else so their
+// handles are known at compile time
+enum BuiltinUniform {
+  UNIFORM_PROJ_VIEW_MATRIX,
+  UNIFORM_AMBIENT_COLOR,
+  UNIFORM_DIFFUSE_COLOR,
+  UNIFORM_SPECULAR_COLOR,
+  UNIFORM_TEXTURE_SAMPLER,
+  UNIFORM_NORMAL_SAMPLER,
+  UNIFORM_POSITION_OFFSET,
+  UNIFORM_POSITION_SCALE,
+  UNIFORM_INSTANCE_MATRICES,
+  UNIFORM_INSTANCE_OFFSET,
+  UNIFORM_LIGHT_GRID,
+  UNIFORM_LIGHT_INDICES,
+  UNIFORM_SUN_SHADOW,
+  UNIFORM_SPOT_SHADOWS,
+  UNIFORM_BUILTIN_COUNT
+};
+
+// Specialized versions of a shader, loaded from <name>_<suffix>.vert with
+// the base fragment shader
+enum ShaderVariant {
+  SHADER_VARIANT_INSTANCED,  // Model matrices per instance from a buffer texture
+  SHADER_VARIANT_MULTI_DRAW, // Per draw data from an SSBO for multi draw indirect
+  SHADER_VARIANT_COUNT
+};
+
 class Shader {
   public:
     // Static functions
     static Shader* LoadShader(std::string);
+    static Shader* LoadShader(std::string, std::string);
+    static std::string GetVariantSuffix(ShaderVariant);
+    static void AddGlobalDefine(const std::string&);
+    static UniformHandle RegisterUniform(const std::string&);
+    static void AddUniformBlock(const std::string&, GLuint);
 
     // Constructors
     Shader();
@@ -17,20 +62,48 @@ class Shader {
     void Enable();
     bool AddShader(GLenum, std::string);
     bool Finalize();
+    void SetVariant(ShaderVariant variant, Shader* shader) { m_variants[variant] = shader; }
 
     // Uniform functions
-    void uniform1i(const std::string&, GLint);
-    void uniform1f(const std::string&, GLfloat);
-    void uniform3fv(const std::string&, GLsizei, const GLfloat*);
-    void uniformMatrix4fv(const std::string&, GLsizei, GLboolean, const GLfloat*);
+    void uniform1i(UniformHandle, GLint);
+    void uniform1f(UniformHandle, GLfloat);
+    void uniform3fv(UniformHandle, GLsizei, const GLfloat*);
+    void uniformMatrix4fv(UniformHandle, GLsizei, GLboolean, const GLfloat*);
+    GLint GetUniformLocation(UniformHandle);
+    GLint GetUniformLocation(UniformID);
+
+    // Getters
+    unsigned GetAttributeMask() const { return m_attribute_mask; }
+    unsigned GetID() const { return m_id; }
+    Shader* GetVariant(ShaderVariant variant) const { return m_variants[variant]; }
 
     // Destructors
     ~Shader();
 
   private:
     std::string m_shader_name;
+    unsigned m_id;
     GLuint m_shader_program;
+    // The same shader specialized, nullptr where there is no variant
+    Shader* m_variants[SHADER_VARIANT_COUNT];
     std::vector<GLuint> m_shader_object_list;
 
-    GLint GetUniformLocation(const std::string&);
+    // Bit per vertex attribute location the program reads
+    unsigned m_attribute_mask;
+
+    // Every active uniform, sorted by name hash
+    struct UniformSlot {
+      uint64_t hash;
+      GLint location;
+    };
+    std::vector<UniformSlot> m_uniforms;
+
+    // Location of each registered handle and whether its miss was reported
+    std::vector<GLint> m_handle_locations;
+    std::vector<bool> m_handle_warned;
+
+    std::string PreprocessSource(const std::string&, bool);
+    void ReflectUniforms();
+    void ResolveHandles();
+    GLint FindUniform(uint64_t) const;
 };
@@ -0,0 +1,134 @@
+#pragma once
+
+#include "light_buffer.h"
+#include "frustum_culler.h"
+
+// Cascades the sun's shadow is split into along the view, each a layer of
+// one depth texture array
+#define SHADOW_CASCADES 4
+
+// Blend between logarithmic (1) and uniform (0) cascade splits
+#define SHADOW_CASCADE_LAMBDA 0.75f
+
+// Cascades cover this much more than their slice of the view so they only
+// move every few frames, which keeps their static layer cached
+#define SHADOW_CASCADE_SLACK 1.25f
+
+// The sun's depth range is rounded out to this many units so it doesn't
+// change, and throw the cache away, whenever an object moves a little
+#define SHADOW_DEPTH_STEP 16.0f
+
+// Spot light shadows are tiles of one atlas, this many to a side
+#define SHADOW_ATLAS_TILES 4
+#define SHADOW_MAX_SPOTS (SHADOW_ATLAS_TILES * SHADOW_ATLAS_TILES)
+
+// Widest cone a spot light shadow covers, wider cones are only shadowed
+// within it
+#define SHADOW_SPOT_MAX_ANGLE 1.3f
+#define SHADOW_SPOT_NEAR 0.05f
+
+// Slope scaled and constant depth offset of every shadow caster
+#define SHADOW_SLOPE_BIAS 2.0f
+#define SHADOW_CONSTANT_BIAS 4.0f
+
+// Uniform block the shaders find the shadow maps through
+#define SHADOW_BLOCK_BINDING 1
+const std::string SHADOW_BLOCK_NAME = "Shadows";
+
+// std140 mirror of the Shadows block in shaders/shadows.glsl. Matrices and
+// tiles are the ones each map was last drawn with, so maps that weren't
+// redrawn this frame are still sampled where their casters were
+struct ShadowBlock {
+  glm::mat4 cascade_matrices[SHADOW_CASCADES];
+  // View depth each cascade reaches and the world size of its texels
+  glm::vec4 cascade_splits;
+  glm::vec4 cascade_texels;
+  glm::mat4 spot_matrices[SHADOW_MAX_SPOTS];
+  // Atlas tile of each spot light, four to an element, -1 for none
+  glm::ivec4 spot_tiles[MAX_DIRECTIONAL_LIGHTS / 4];
+};
+
+// One shadow map to render, a cascade layer or an atlas tile
+struct ShadowView {
+  glm::mat4 proj_view;
+  bool active;
+  // Layer of the cascade array, or the atlas tile
+  unsigned layer;
+  bool cascade;
+  int x, y, size;
+
+  // Spot light the tile belongs to, -1 for cascades and free tiles, and
+  // the sphere it lights
+  int light;
+  glm::vec3 center;
+  float radius;
+  // World size of a cascade's texels
+  float texel;
+
+  // What the sampled map was last drawn with, the shaders keep using it
+  // until the view is drawn again
+  glm::mat4 rendered_proj_view;
+  int rendered_light;
+  bool rendered;
+
+  // What the static layer was last drawn with, it is redrawn when the
+  // view moves
+  glm::mat4 cached_proj_view;
+  bool cached;
+};
+
+// Cascaded shadow maps for the sun and an atlas of spot light shadow maps.
+// Every view keeps a second, cached depth layer with only the static
+// casters, redrawn when the view moves or the scene changes. When a view
+// is drawn the cached layer is copied in and only the dynamic casters are
+// drawn on top. Views don't have to be drawn every frame, see
+// ShadowScheduler
+class ShadowMaps {
+  public:
+    // Constructors
+    ShadowMaps();
+
+    // Setup functions
+    bool Initialize(unsigned, unsigned, float, unsigned, unsigned);
+    void SetProjection(const glm::mat4&, float, float);
+    void Invalidate();
+    void Destroy();
+
+    // Runtime functions
+    void Update(const glm::mat4&, const LightBlock&, const Bounds&, const Frustum&);
+    bool BeginStatic(unsigned);
+    void BeginDynamic(unsigned);
+    void Finish();
+
+    // Getters
+    bool IsValid() const { return m_buffer != 0; }
+    bool IsStale(unsigned) const;
+    unsigned GetViewCount() const { return m_views.size(); }
+    const ShadowView& GetView(unsigned index) const { return m_views[index]; }
+
+  private:
+    unsigned m_cascade_size, m_atlas_size;
+    unsigned m_window_width, m_window_height;
+    float m_distance;
+
+    // Half the view width and height at a distance of one, and the planes
+    float m_tan_x, m_tan_y, m_near, m_far;
+
+    // Where each cascade is centered until the view leaves its slack
+    glm::vec3 m_cascade_centers[SHADOW_CASCADES];
+    float m_cascade_radii[SHADOW_CASCADES];
+
+    std::vector<ShadowView> m_views;
+    ShadowBlock m_block;
+    GLuint m_buffer;
+
+    // Depth the shaders sample and the static casters cached for it
+    GLuint m_cascades, m_cascade_cache;
+    GLuint m_atlas, m_atlas_cache;
+    GLuint m_framebuffer, m_cache_framebuffer;
+
+    void UpdateCascades(const glm::mat4&, const glm::vec3&, const Bounds&);
+    void UpdateSpots(const LightBlock&, const Frustum&);
+    void Attach(GLuint, const ShadowView&, bool);
+    void BeginView(const ShadowView&);
+};
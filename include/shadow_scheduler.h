@@ -0,0 +1,63 @@
+#pragma once
+
+#include "shadow_maps.h"
+
+// Frames a timer query is left before its result is read, so reading it
+// never waits on the GPU
+#define SHADOW_TIMER_FRAMES 4
+
+// Weight of the newest measurement in the running cost of drawing a view
+#define SHADOW_COST_SMOOTHING 0.1f
+
+// Cost assumed for a view before any timer query has come back
+#define SHADOW_INITIAL_VIEW_MS 0.25f
+
+// Most frames a view goes between redraws while the budget allows it
+#define SHADOW_MAX_INTERVAL 8
+
+// Spot lights covering this many pixels or more of the screen are redrawn
+// every frame, smaller ones proportionally less often
+#define SHADOW_SPOT_FULL_RATE_PIXELS 256.0f
+
+// Picks which shadow views to draw each frame. Every view gets a refresh
+// interval from how much of the screen it shades: the near cascades every
+// frame, each further one half as often, and spot lights by their size
+// on screen, every frame while their light moves. Views that are due are
+// drawn most overdue first within a GPU time budget measured with timer
+// queries. Views whose old map can't be sampled any more are always drawn,
+// the rest keep their map and the matrix it was drawn with
+class ShadowScheduler {
+  public:
+    // Constructors
+    ShadowScheduler();
+
+    // Setup functions
+    void Initialize(float);
+    void Destroy();
+
+    // Runtime functions
+    void Schedule(const ShadowMaps&, const glm::vec3&, float);
+    void BeginFrame();
+    void EndFrame();
+
+    // Getters
+    const std::vector<unsigned>& GetUpdates() const { return m_updates; }
+
+  private:
+    float m_budget_ms;
+    // Running GPU time of drawing one view
+    float m_view_ms;
+
+    // Frames since each view was drawn
+    std::vector<unsigned> m_ages;
+    // Views to draw this frame, and the due ones by how overdue they are
+    std::vector<unsigned> m_updates;
+    std::vector<std::pair<float, unsigned>> m_due;
+
+    // One GL_TIME_ELAPSED query per frame in flight and the views it timed
+    GLuint m_queries[SHADOW_TIMER_FRAMES];
+    unsigned m_query_views[SHADOW_TIMER_FRAMES];
+    unsigned m_frame;
+
+    unsigned Interval(const ShadowView&, const glm::vec3&, float) const;
+};
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "graphics_headers.h"
+
+// Regions the buffer is split into, one per frame in flight. The CPU
+// writes one while the GPU may still be reading the ones before it
+#define STREAM_BUFFER_REGIONS 3
+
+// Every allocation offset is a multiple of this, enough for any uniform,
+// shader storage or texture buffer offset alignment a driver asks for
+#define STREAM_BUFFER_ALIGNMENT 256
+
+// One buffer the per draw data of every frame is written into and drawn
+// from in place. With buffer storage it is mapped once, persistently and
+// coherently, and written with memcpy, otherwise each write maps the range
+// unsynchronized, or is copied in when even that fails. A frame writes its
+// own region, which is fenced when the frame ends and waited on before it
+// is written again. A frame that fills its region moves on to the next
+// one, and the buffer is recreated twice the size when a frame needs
+// every region
+class StreamBuffer {
+  public:
+    // Static functions
+    static StreamBuffer& Get();
+
+    // Constructors
+    StreamBuffer();
+
+    // Setup functions
+    void Initialize(GLsizeiptr);
+    void Destroy();
+
+    // Runtime functions
+    void* Map(GLsizeiptr, GLsizeiptr, GLintptr&);
+    void Unmap();
+    void EndFrame();
+
+    // Getters
+    GLuint GetBuffer() const { return m_buffer; }
+
+  private:
+    void Allocate(GLsizeiptr);
+    void Grow(GLsizeiptr);
+    void Wait(unsigned);
+
+    GLuint m_buffer;
+    GLsizeiptr m_region_size;
+    uint8_t* m_persistent_ptr;
+    GLsync m_fences[STREAM_BUFFER_REGIONS];
+
+    // Region being written, the first one this frame wrote, and the next
+    // free byte in the current one
+    unsigned m_region, m_frame_region;
+    GLsizeiptr m_head;
+
+    // Written instead when a range can't be mapped, copied in by Unmap
+    std::vector<uint8_t> m_staging;
+    GLintptr m_staging_offset;
+    bool m_staged;
+
+    // Buffers replaced by Grow this frame, draws already issued may still
+    // bind them so they are deleted when the frame ends
+    std::vector<GLuint> m_retired;
+};
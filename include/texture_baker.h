@@ -0,0 +1,58 @@
+#pragma once
+
+#include "graphics_headers.h"
+
+// Constant baked texture path variables
+const std::string BAKED_TEXTURE_PATH = "../textures/baked/";
+
+// Compressed formats that may be missing from older GL headers
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+  #define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+  #define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+#ifndef GL_COMPRESSED_RGBA_BPTC_UNORM
+  #define GL_COMPRESSED_RGBA_BPTC_UNORM 0x8E8C
+#endif
+
+enum TextureFormat {
+  TEXTURE_RGBA8,
+  TEXTURE_BC1, // S3TC DXT1, opaque color
+  TEXTURE_BC3, // S3TC DXT5, color with alpha
+  TEXTURE_BC5, // RGTC2, two channel normal maps
+  TEXTURE_BC7  // BPTC, high quality color with alpha
+};
+
+struct TextureLevel {
+  unsigned width, height;
+  size_t offset, size;
+};
+
+// A texture and its full mip chain in one block of memory
+struct TextureImage {
+  TextureImage() : format(TEXTURE_RGBA8), width(0), height(0) {}
+  TextureFormat format;
+  unsigned width, height;
+  std::vector<TextureLevel> levels;
+  std::vector<uint8_t> data;
+};
+
+class TextureBaker {
+  public:
+    // Mip generation and compression
+    static void GenerateMipChain(const uint8_t*, unsigned, unsigned, bool, TextureImage&);
+    static TextureFormat ChooseFormat(const TextureImage&, bool, bool);
+    static void Compress(const TextureImage&, TextureFormat, TextureImage&);
+
+    // KTX container
+    static bool WriteKTX(const std::string&, const TextureImage&, uint64_t, uint64_t);
+    static bool ParseKTX(const uint8_t*, size_t, TextureImage&, uint64_t&, uint64_t&);
+
+    // Format information
+    static GLenum GetInternalFormat(TextureFormat);
+    static unsigned GetBlockSize(TextureFormat);
+    static size_t GetLevelSize(TextureFormat, unsigned, unsigned);
+    static bool IsCompressed(TextureFormat format) { return format != TEXTURE_RGBA8; }
+    static bool IsNormalMap(const std::string&);
+};
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "graphics_headers.h"
+
+#include <deque>
+
+// Number of fenced regions the staging buffer is split into
+#define TEXTURE_STAGING_SEGMENTS 4
+
+class Texture;
+
+class TextureStreamer {
+  public:
+    // Static functions
+    static TextureStreamer& Get();
+
+    // Constructors
+    TextureStreamer();
+
+    // Setup functions
+    bool Initialize(float, unsigned, float);
+    void Destroy();
+
+    // Runtime functions
+    void Enqueue(Texture*);
+    void Update();
+
+    // Getters
+    GLuint GetPlaceholder(GLenum) const;
+
+  private:
+    void RetireUploads();
+    void AllocateStorage(Texture*);
+    bool UploadChunk(Texture*);
+    GLuint CreatePlaceholder(GLubyte, GLubyte, GLubyte, GLubyte);
+
+    float m_budget_ms;
+    float m_anisotropy;
+
+    // Pixel unpack buffer the decoded rows are staged in
+    GLuint m_staging_buffer;
+    GLsizeiptr m_segment_size;
+    uint8_t* m_persistent_ptr;
+    GLsync m_segment_fences[TEXTURE_STAGING_SEGMENTS];
+    unsigned m_segment;
+
+    // Textures waiting to be decoded or uploaded
+    std::deque<Texture*> m_queue;
+    // Textures fully submitted, waiting for the GPU to finish the copy
+    std::vector<Texture*> m_fenced;
+
+    GLuint m_color_placeholder, m_normal_placeholder;
+};
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+// One in this many cores is kept off the shared pool for work every frame
+// waits on, the render thread and the occlusion culler's workers
+#define THREAD_POOL_FRAME_SHARE 4
+
+class ThreadPool {
+  public:
+    // Static functions
+    static ThreadPool& Get();
+    static unsigned GetFrameThreadCount();
+
+    // Constructors
+    ThreadPool(unsigned);
+
+    // Runtime functions
+    void Enqueue(std::function<void()>);
+    unsigned GetThreadCount() const { return m_workers.size(); }
+
+    // Runs a task on the pool and returns a future for its result
+    template<class T>
+    std::shared_future<T> Submit(std::function<T()> task) {
+      std::shared_ptr<std::packaged_task<T()> > packaged(new std::packaged_task<T()>(task));
+      std::shared_future<T> result = packaged->get_future().share();
+      Enqueue([packaged]() { (*packaged)(); });
+      return result;
+    }
+
+    // Destructors
+    ~ThreadPool();
+
+  private:
+    void WorkerLoop();
+
+    std::vector<std::thread> m_workers;
+    std::queue<std::function<void()> > m_tasks;
+
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    bool m_stopping;
+};
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "graphics_headers.h"
+
+// Attribute locations shared by every shader
+#define ATTRIBUTE_POSITION 0
+#define ATTRIBUTE_UV 1
+#define ATTRIBUTE_NORMAL 2
+#define ATTRIBUTE_TANGENT 3
+#define ATTRIBUTE_BITANGENT 4
+#define ATTRIBUTE_COUNT 5
+
+enum VertexFormat {
+  VERTEX_FULL,     // Vertex, every attribute as floats
+  VERTEX_PACKED,   // PackedVertex
+  VERTEX_QUANTIZED // QuantizedVertex
+};
+
+// Float position, half float uv, octahedral normal and tangent with the
+// bitangent reduced to a sign
+struct PackedVertex {
+  glm::vec3 position;
+  uint16_t uv[2];
+  int16_t normal[2];
+  int16_t tangent[4];
+};
+
+// As PackedVertex with the position quantized to the mesh bounds
+struct QuantizedVertex {
+  uint16_t position[4];
+  uint16_t uv[2];
+  int16_t normal[2];
+  int16_t tangent[4];
+};
+
+struct VertexAttribute {
+  GLint size;
+  GLenum type;
+  GLboolean normalized;
+  unsigned offset;
+};
+
+struct VertexLayout {
+  // Static functions
+  static const VertexLayout& Get(VertexFormat);
+  static VertexFormat ParseFormat(const std::string&);
+  static void Pack(const Vertex*, unsigned, VertexFormat, std::vector<uint8_t>&, glm::vec3&, glm::vec3&);
+
+  unsigned stride;
+  // Bit per attribute location stored in this format
+  unsigned attribute_mask;
+  VertexAttribute attributes[ATTRIBUTE_COUNT];
+};
@@ -0,0 +1,83 @@
+#version 330
+
+#include "lights.glsl"
+#include "shadows.glsl"
+
+// Lighting pass of the deferred pipeline, shades each pixel the geometry
+// pass covered with the lights of its cluster, the same way the forward
+// shaders do
+uniform sampler2D gbuffer_albedo;
+uniform sampler2D gbuffer_normal;
+uniform sampler2D gbuffer_material;
+uniform sampler2D gbuffer_depth;
+
+uniform mat4 inverse_proj_view_matrix;
+uniform vec3 eye_position;
+
+out vec4 f_color;
+
+vec2 sign_not_zero(vec2 v) {
+  return vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+}
+
+vec3 octahedral_decode(vec2 e) {
+  vec3 v = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+  if (v.z < 0.0) {
+    v.xy = (1.0 - abs(v.yx)) * sign_not_zero(v.xy);
+  }
+  return normalize(v);
+}
+
+void main(void) {
+  ivec2 pixel = ivec2(gl_FragCoord.xy);
+  float window_depth = texelFetch(gbuffer_depth, pixel, 0).r;
+  if (window_depth == 1.0) {
+    discard;
+  }
+
+  // World space position back from the depth
+  vec2 ndc = gl_FragCoord.xy / vec2(textureSize(gbuffer_depth, 0)) * 2.0 - 1.0;
+  vec4 world = inverse_proj_view_matrix * vec4(ndc, window_depth * 2.0 - 1.0, 1.0);
+  vec3 position = world.xyz / world.w;
+
+  vec4 albedo = texelFetch(gbuffer_albedo, pixel, 0);
+  vec3 normal = octahedral_decode(texelFetch(gbuffer_normal, pixel, 0).xy);
+  vec3 ambient = texelFetch(gbuffer_material, pixel, 0).rgb;
+  vec3 tex_color = albedo.rgb;
+  float shininess = floor(albedo.a * 255.0 + 0.5);
+
+  vec3 diffuse = vec3(0.0, 0.0, 0.0);
+  vec3 specular = vec3(0.0, 0.0, 0.0);
+
+  uvec3 cluster = cluster_lights(window_depth);
+  for (uint n = 0u; n < cluster.y; n++) {
+    int i = cluster_light(cluster.x + n);
+    vec3 light_direction = normalize(point_lights[i].light_position - position);
+    float dist = distance(point_lights[i].light_position, position);
+    vec3 view_direction = normalize(eye_position - position);
+    vec3 reflect_direction = reflect(-light_direction, normal);
+    // Diffuse
+    diffuse += light_falloff(point_lights[i].light_strength, dist) * tex_color * max(dot(normal, light_direction), 0.0) * point_lights[i].light_color;
+    // Specular
+    specular += light_falloff(point_lights[i].light_strength, dist) * pow(max(dot(view_direction, reflect_direction), 0.0), shininess) * point_lights[i].light_color;
+  }
+
+  for (uint n = 0u; n < cluster.z; n++) {
+    int i = cluster_light(cluster.x + cluster.y + n);
+    vec3 point_direction = normalize(position - dir_lights[i].light_position);
+    float dist = distance(dir_lights[i].light_position, position);
+    float theta = dot(point_direction, normalize(dir_lights[i].light_direction));
+    float intensity = theta < 0
+      ? 0.0f
+      : clamp((acos(theta) - dir_lights[i].outer_angle) / (dir_lights[i].inner_angle - dir_lights[i].outer_angle), 0.0, 1.0);
+    diffuse += light_falloff(dir_lights[i].light_strength, dist) * intensity * dir_lights[i].light_color * max(dot(normal, normalize(dir_lights[i].light_position - position)), 0.0) * spot_visibility(i, position);
+  }
+
+  // The sun, dimmed where its cascades are shadowed
+  if (sun_direction.w > 0.0) {
+    diffuse += sun_direction.w * sun_color.rgb * max(dot(normal, -sun_direction.xyz), 0.0) * sun_visibility(position, normal, window_depth);
+  }
+
+  vec3 color = (ambient + specular + diffuse) * tex_color;
+  f_color = vec4(color, 1.0);
+}
@@ -0,0 +1,8 @@
+#version 330
+
+// One triangle covering the screen, the corners come from the vertex
+// index so no vertex buffer is needed
+void main(void) {
+  vec2 corner = vec2(float((gl_VertexID << 1) & 2), float(gl_VertexID & 2));
+  gl_Position = vec4(corner * 2.0 - 1.0, 0.0, 1.0);
+}
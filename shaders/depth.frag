@@ -0,0 +1,5 @@
+#version 330
+
+// Depth prepass, only the depth buffer is written
+void main(void) {
+}
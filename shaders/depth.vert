@@ -0,0 +1,12 @@
+#version 330
+
+#include "instancing.glsl"
+#include "vertex_input.glsl"
+
+uniform mat4 proj_view_matrix;
+
+void main(void) {
+  mat4 model = instance_model_matrix();
+  vec4 v = vec4(vertex_position(), 1.0);
+  gl_Position = (proj_view_matrix * model) * v;
+}
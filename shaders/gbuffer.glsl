@@ -0,0 +1,29 @@
+// Targets of the deferred pipeline's geometry pass, see gbuffer.h. Every
+// program writing the G-buffer stores its surface with write_gbuffer so
+// the lighting pass can shade it the same way the forward shaders do
+
+layout(location = 0) out vec4 g_albedo;
+layout(location = 1) out vec2 g_normal;
+layout(location = 2) out vec4 g_material;
+
+vec2 sign_not_zero(vec2 v) {
+  return vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+}
+
+// Unit vector to two components, decoded by octahedral_decode
+vec2 octahedral_encode(vec3 n) {
+  vec2 e = n.xy / (abs(n.x) + abs(n.y) + abs(n.z));
+  return n.z < 0.0 ? (1.0 - abs(e.yx)) * sign_not_zero(e) : e;
+}
+
+/**
+ * @param albedo    - Surface color, lights and ambient are multiplied by it
+ * @param normal    - World space normal
+ * @param ambient   - Light the surface gets without any light reaching it
+ * @param shininess - Specular exponent, up to 255
+ */
+void write_gbuffer(vec3 albedo, vec3 normal, vec3 ambient, uint shininess) {
+  g_albedo = vec4(albedo, float(min(shininess, 255u)) / 255.0);
+  g_normal = octahedral_encode(normalize(normal));
+  g_material = vec4(ambient, 1.0);
+}
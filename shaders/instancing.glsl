@@ -0,0 +1,48 @@
+// Where the model matrix comes from. Instanced variants define INSTANCED
+// and read one matrix per instance from the buffer texture the render
+// queue fills each frame, as four RGBA32F texels starting at
+// instance_offset. Multi draw variants define MULTI_DRAW and read
+// everything that changes between draws from the draw data buffer, each
+// command's base instance is the index of its first entry. Single draws
+// read their object's block, bound as a range of the stream buffer
+
+#if defined(MULTI_DRAW)
+struct DrawData {
+  mat4 model_matrix;
+  vec4 position_offset;
+  vec4 position_scale;
+};
+
+layout(std430, binding = DRAW_DATA_BINDING) readonly buffer DrawBlock {
+  DrawData draws[];
+};
+
+int draw_index() {
+  return gl_BaseInstanceARB + gl_InstanceID;
+}
+
+mat4 instance_model_matrix() {
+  return draws[draw_index()].model_matrix;
+}
+#elif defined(INSTANCED)
+uniform samplerBuffer instance_matrices;
+uniform int instance_offset;
+
+mat4 instance_model_matrix() {
+  int base = (instance_offset + gl_InstanceID) * 4;
+  return mat4(
+    texelFetch(instance_matrices, base),
+    texelFetch(instance_matrices, base + 1),
+    texelFetch(instance_matrices, base + 2),
+    texelFetch(instance_matrices, base + 3)
+  );
+}
+#else
+layout(std140) uniform ObjectBlock {
+  mat4 model_matrix;
+};
+
+mat4 instance_model_matrix() {
+  return model_matrix;
+}
+#endif
@@ -0,0 +1,68 @@
+// Every light in the scene, shared by all programs through the uniform
+// buffer bound at LIGHT_BLOCK_BINDING, and the lists of the lights reaching
+// each cluster of the view. MAX_POINT_LIGHTS, MAX_DIRECTIONAL_LIGHTS,
+// LIGHT_CUTOFF and CLUSTER_X/Y/Z are defined by the engine, see
+// light_buffer.h and light_clusters.h
+
+// Members are ordered so each struct packs into whole vec4s under std140
+struct PointLight {
+  vec3 light_position;
+  float light_strength;
+  vec3 light_color;
+};
+
+struct DirectionalLight {
+  vec3 light_position;
+  float light_strength;
+  vec3 light_direction;
+  float inner_angle;
+  vec3 light_color;
+  float outer_angle;
+};
+
+layout(std140) uniform Lights {
+  PointLight point_lights[MAX_POINT_LIGHTS];
+  DirectionalLight dir_lights[MAX_DIRECTIONAL_LIGHTS];
+  int point_count;
+  int directional_count;
+  vec4 cluster_scale;
+  vec4 cluster_depth;
+  // Direction the sun shines in and its strength in w, 0 without a sun
+  vec4 sun_direction;
+  vec4 sun_color;
+};
+
+// Offset into light_indices and packed point and spot light counts per
+// cluster, and the light indices themselves
+uniform usamplerBuffer light_grid;
+uniform usamplerBuffer light_indices;
+
+// Distance from the eye along the view of a window space depth
+float view_depth(float window_depth) {
+  float near = cluster_depth.x;
+  float far = cluster_depth.y;
+  return 2.0 * near * far / (far + near - (window_depth * 2.0 - 1.0) * (far - near));
+}
+
+// Where the cluster list of this pixel at a window space depth starts, how
+// many point lights it has and how many spot lights follow them
+uvec3 cluster_lights(float window_depth) {
+  float depth = view_depth(window_depth);
+  ivec3 cell = ivec3(vec3(gl_FragCoord.xy * cluster_scale.xy, log(depth) * cluster_scale.z + cluster_scale.w));
+  cell = clamp(cell, ivec3(0), ivec3(CLUSTER_X - 1, CLUSTER_Y - 1, CLUSTER_Z - 1));
+
+  uvec2 entry = texelFetch(light_grid, cell.x + CLUSTER_X * (cell.y + CLUSTER_Y * cell.z)).xy;
+  return uvec3(entry.x, entry.y & 0xffffu, entry.y >> 16);
+}
+
+int cluster_light(uint index) {
+  return int(texelFetch(light_indices, int(index)).r);
+}
+
+// strength / distance, windowed to reach zero at the distance the light
+// was assigned to clusters up to
+float light_falloff(float strength, float dist) {
+  float reach = dist * LIGHT_CUTOFF / strength;
+  float window = clamp(1.0 - reach * reach * reach * reach, 0.0, 1.0);
+  return strength / dist * window * window;
+}
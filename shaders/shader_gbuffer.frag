@@ -0,0 +1,13 @@
+#version 330
+
+#include "gbuffer.glsl"
+
+smooth in vec3 normal;
+
+uniform vec3 ambient_color;
+uniform vec3 diffuse_color;
+uniform uint refractive_index;
+
+void main(void) {
+  write_gbuffer(diffuse_color, normal, 0.2 * ambient_color, refractive_index);
+}
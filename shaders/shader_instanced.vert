@@ -0,0 +1,4 @@
+#version 330
+
+#define INSTANCED
+#include "shader.vert"
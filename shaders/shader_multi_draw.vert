@@ -0,0 +1,5 @@
+#version 430
+#extension GL_ARB_shader_draw_parameters : require
+
+#define MULTI_DRAW
+#include "shader.vert"
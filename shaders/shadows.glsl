@@ -0,0 +1,92 @@
+// Shadow maps of the sun's cascades and the spot light atlas, see
+// shadow_maps.h. SHADOWS, SHADOW_CASCADES, SHADOW_ATLAS_TILES,
+// SHADOW_MAX_SPOTS and SHADOW_PCF are defined by the engine, without
+// SHADOWS every light is unshadowed. Include after lights.glsl
+
+#ifdef SHADOWS
+
+layout(std140) uniform Shadows {
+  mat4 cascade_matrices[SHADOW_CASCADES];
+  // View depth each cascade reaches and the world size of its texels
+  vec4 cascade_splits;
+  vec4 cascade_texels;
+  mat4 spot_matrices[SHADOW_MAX_SPOTS];
+  // Atlas tile of each spot light, -1 for none
+  ivec4 spot_tiles[MAX_DIRECTIONAL_LIGHTS / 4];
+};
+
+uniform sampler2DArrayShadow sun_shadow;
+uniform sampler2DShadow spot_shadows;
+
+// Every tap is a bilinear 2x2 comparison, SHADOW_PCF 0 takes one and each
+// tier up adds a row and column of taps
+#define SHADOW_PCF_TAPS (SHADOW_PCF + 1)
+
+// Fraction of the sun reaching a point, window_depth picks its cascade
+float sun_visibility(vec3 position, vec3 normal, float window_depth) {
+  float depth = view_depth(window_depth);
+  if (depth > cascade_splits[SHADOW_CASCADES - 1]) {
+    return 1.0;
+  }
+  int cascade = 0;
+  while (cascade < SHADOW_CASCADES - 1 && depth > cascade_splits[cascade]) {
+    cascade++;
+  }
+
+  // Pushed out along the normal by about a texel so surfaces don't shadow
+  // themselves where the sun grazes them
+  vec3 offset = normal * cascade_texels[cascade] * 1.5;
+  vec3 coord = (cascade_matrices[cascade] * vec4(position + offset, 1.0)).xyz * 0.5 + 0.5;
+
+  vec2 texel = 1.0 / vec2(textureSize(sun_shadow, 0).xy);
+  float lit = 0.0;
+  for (int y = 0; y < SHADOW_PCF_TAPS; y++) {
+    for (int x = 0; x < SHADOW_PCF_TAPS; x++) {
+      vec2 tap = (vec2(x, y) - 0.5 * float(SHADOW_PCF_TAPS - 1)) * texel;
+      lit += texture(sun_shadow, vec4(coord.xy + tap, float(cascade), coord.z));
+    }
+  }
+  return lit / float(SHADOW_PCF_TAPS * SHADOW_PCF_TAPS);
+}
+
+// Fraction of a spot light reaching a point, 1 if the light has no tile
+float spot_visibility(int light, vec3 position) {
+  int tile = spot_tiles[light / 4][light % 4];
+  if (tile < 0) {
+    return 1.0;
+  }
+
+  vec4 clip = spot_matrices[tile] * vec4(position, 1.0);
+  vec3 coord = clip.xyz / clip.w * 0.5 + 0.5;
+  if (clip.w <= 0.0 || any(lessThan(coord.xy, vec2(0.0))) || any(greaterThan(coord.xy, vec2(1.0)))) {
+    return 1.0;
+  }
+
+  // Taps stay inside the tile so they never read a neighbouring light
+  float tile_size = 1.0 / float(SHADOW_ATLAS_TILES);
+  vec2 origin = vec2(tile % SHADOW_ATLAS_TILES, tile / SHADOW_ATLAS_TILES) * tile_size;
+  vec2 texel = 1.0 / vec2(textureSize(spot_shadows, 0));
+  vec2 low = origin + 0.5 * texel;
+  vec2 high = origin + tile_size - 0.5 * texel;
+
+  float lit = 0.0;
+  for (int y = 0; y < SHADOW_PCF_TAPS; y++) {
+    for (int x = 0; x < SHADOW_PCF_TAPS; x++) {
+      vec2 tap = (vec2(x, y) - 0.5 * float(SHADOW_PCF_TAPS - 1)) * texel;
+      lit += texture(spot_shadows, vec3(clamp(origin + coord.xy * tile_size + tap, low, high), coord.z));
+    }
+  }
+  return lit / float(SHADOW_PCF_TAPS * SHADOW_PCF_TAPS);
+}
+
+#else
+
+float sun_visibility(vec3 position, vec3 normal, float window_depth) {
+  return 1.0;
+}
+
+float spot_visibility(int light, vec3 position) {
+  return 1.0;
+}
+
+#endif
@@ -0,0 +1,25 @@
+#version 330
+
+#include "gbuffer.glsl"
+
+smooth in vec2 uv;
+in mat3 TBN;
+
+uniform vec3 ambient_color;
+uniform vec3 diffuse_color;
+uniform uint refractive_index;
+
+uniform sampler2D texture_sampler;
+uniform sampler2D normal_sampler;
+
+void main(void) {
+  // Rebuild z so two channel (BC5) normal maps work too
+  vec2 normal_xy = texture(normal_sampler, uv).xy;
+  vec2 unpacked_xy = normal_xy * 2.0 - 1.0;
+  vec3 normal_texel = vec3(normal_xy, 0.5 + 0.5 * sqrt(max(1.0 - dot(unpacked_xy, unpacked_xy), 0.0)));
+  vec3 tex_color = texture(texture_sampler, uv).xyz;
+  if (tex_color == vec3(0.0, 0.0, 0.0)) {
+    tex_color = diffuse_color;
+  }
+  write_gbuffer(tex_color, TBN * normal_texel, 0.2 * ambient_color, refractive_index);
+}
@@ -1,22 +1,7 @@
 #version 330
 
-#define POINT_COUNT 6
-#define DIRECTIONAL_COUNT 3
-
-struct PointLight {
-  vec3 light_position;
-  vec3 light_color;
-  float light_strength;
-};
-
-struct DirectionalLight {
-  vec3 light_position;
-  vec3 light_direction;
-  vec3 light_color;
-  float light_strength;
-  float inner_angle;
-  float outer_angle;
-};
+#include "lights.glsl"
+#include "shadows.glsl"
 
 smooth in vec3 normal;
 smooth in vec2 uv;
@@ -29,9 +14,6 @@ uniform vec3 diffuse_color;
 uniform vec3 specular_color;
 uniform uint refractive_index;
 
-uniform PointLight point_lights[POINT_COUNT];
-uniform DirectionalLight dir_lights[DIRECTIONAL_COUNT];
-
 uniform sampler2D texture_sampler;
 
 out vec4 f_color;
@@ -45,25 +27,34 @@ void main(void) {
   vec3 diffuse = vec3(0.0, 0.0, 0.0);
   vec3 specular = vec3(0.0, 0.0, 0.0);
 
-  for (int i = 0; i < POINT_COUNT; i++) {
+  // Only the lights reaching this fragment's cluster
+  uvec3 cluster = cluster_lights(gl_FragCoord.z);
+  for (uint n = 0u; n < cluster.y; n++) {
+    int i = cluster_light(cluster.x + n);
     vec3 light_direction = normalize(point_lights[i].light_position - position);
     float dist = distance(point_lights[i].light_position, position);
     vec3 view_direction = normalize(eye_position - position);
     vec3 reflect_direction = reflect(-light_direction, normal);
     // Diffuse
-    diffuse += point_lights[i].light_strength / dist * tex_color * max(dot(normal, light_direction), 0.0) * point_lights[i].light_color;
+    diffuse += light_falloff(point_lights[i].light_strength, dist) * tex_color * max(dot(normal, light_direction), 0.0) * point_lights[i].light_color;
     // Specular
-    specular += point_lights[i].light_strength / dist * pow(max(dot(view_direction, reflect_direction), 0.0), refractive_index) * point_lights[i].light_color;
+    specular += light_falloff(point_lights[i].light_strength, dist) * pow(max(dot(view_direction, reflect_direction), 0.0), refractive_index) * point_lights[i].light_color;
   }
 
-  for (int i = 0; i < DIRECTIONAL_COUNT; i++) {
+  for (uint n = 0u; n < cluster.z; n++) {
+    int i = cluster_light(cluster.x + cluster.y + n);
     vec3 point_direction = normalize(position - dir_lights[i].light_position);
     float dist = distance(dir_lights[i].light_position, position);
     float theta = dot(point_direction, normalize(dir_lights[i].light_direction));
     float intensity = theta < 0
       ? 0.0f
       : clamp((acos(theta) - dir_lights[i].outer_angle) / (dir_lights[i].inner_angle - dir_lights[i].outer_angle), 0.0, 1.0);
-    diffuse += dir_lights[i].light_strength / dist * intensity * dir_lights[i].light_color * max(dot(normal, normalize(dir_lights[i].light_position - position)), 0.0);
+    diffuse += light_falloff(dir_lights[i].light_strength, dist) * intensity * dir_lights[i].light_color * max(dot(normal, normalize(dir_lights[i].light_position - position)), 0.0) * spot_visibility(i, position);
+  }
+
+  // The sun, dimmed where its cascades are shadowed
+  if (sun_direction.w > 0.0) {
+    diffuse += sun_direction.w * sun_color.rgb * max(dot(normal, -sun_direction.xyz), 0.0) * sun_visibility(position, normal, gl_FragCoord.z);
   }
 
   vec3 color = (ambient + specular + diffuse) * tex_color;
@@ -1,21 +1,20 @@
 #version 330
 
-layout (location = 0) in vec3 v_position;
-layout (location = 1) in vec2 v_uv;
-layout (location = 2) in vec3 v_normal;
+#include "instancing.glsl"
+#include "vertex_input.glsl"
 
 uniform mat4 proj_view_matrix;
-uniform mat4 model_matrix;
 
 smooth out vec3 normal;
 smooth out vec2 uv;
 smooth out vec3 position;
 
 void main(void) {
-  vec4 v = vec4(v_position, 1.0);
-  gl_Position = (proj_view_matrix * model_matrix) * v;
+  mat4 model = instance_model_matrix();
+  vec4 v = vec4(vertex_position(), 1.0);
+  gl_Position = (proj_view_matrix * model) * v;
 
-  uv = v_uv;
-  normal = normalize(model_matrix * vec4(v_normal, 0.0)).xyz;
-  position = (model_matrix * v).xyz;
+  uv = vertex_uv();
+  normal = normalize(model * vec4(vertex_normal(), 0.0)).xyz;
+  position = (model * v).xyz;
 }
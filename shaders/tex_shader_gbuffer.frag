@@ -0,0 +1,20 @@
+#version 330
+
+#include "gbuffer.glsl"
+
+smooth in vec3 normal;
+smooth in vec2 uv;
+
+uniform vec3 ambient_color;
+uniform vec3 diffuse_color;
+uniform uint refractive_index;
+
+uniform sampler2D texture_sampler;
+
+void main(void) {
+  vec3 tex_color = texture(texture_sampler, uv).xyz;
+  if (tex_color == vec3(0.0, 0.0, 0.0)) {
+    tex_color = diffuse_color;
+  }
+  write_gbuffer(tex_color, normal, 0.2 * ambient_color, refractive_index);
+}
@@ -0,0 +1,84 @@
+// Vertex attributes shared by every vertex shader. The packed layouts are
+// decoded here so the shaders don't depend on the vertex format. Include
+// instancing.glsl first, multi draw shaders read the quantization from
+// the draw data
+
+// The opaque pass tests against the depth prepass with GL_EQUAL, every
+// program has to compute exactly the same position
+invariant gl_Position;
+
+#ifdef PACKED_VERTEX
+layout (location = 0) in vec3 v_position;
+layout (location = 1) in vec2 v_uv;
+layout (location = 2) in vec2 v_normal;
+layout (location = 3) in vec3 v_tangent;
+
+#if defined(QUANTIZED_POSITION) && !defined(MULTI_DRAW)
+uniform vec3 position_offset;
+uniform vec3 position_scale;
+#endif
+
+vec2 sign_not_zero(vec2 v) {
+  return vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+}
+
+vec3 octahedral_decode(vec2 e) {
+  vec3 v = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+  if (v.z < 0.0) {
+    v.xy = (1.0 - abs(v.yx)) * sign_not_zero(v.xy);
+  }
+  return normalize(v);
+}
+
+vec3 vertex_position() {
+#if defined(QUANTIZED_POSITION) && defined(MULTI_DRAW)
+  return draws[draw_index()].position_offset.xyz + v_position * draws[draw_index()].position_scale.xyz;
+#elif defined(QUANTIZED_POSITION)
+  return position_offset + v_position * position_scale;
+#else
+  return v_position;
+#endif
+}
+
+vec2 vertex_uv() {
+  return v_uv;
+}
+
+vec3 vertex_normal() {
+  return octahedral_decode(v_normal);
+}
+
+vec3 vertex_tangent() {
+  return octahedral_decode(v_tangent.xy);
+}
+
+vec3 vertex_bitangent() {
+  return cross(vertex_normal(), vertex_tangent()) * v_tangent.z;
+}
+#else
+layout (location = 0) in vec3 v_position;
+layout (location = 1) in vec2 v_uv;
+layout (location = 2) in vec3 v_normal;
+layout (location = 3) in vec3 v_tangent;
+layout (location = 4) in vec3 v_bitangent;
+
+vec3 vertex_position() {
+  return v_position;
+}
+
+vec2 vertex_uv() {
+  return v_uv;
+}
+
+vec3 vertex_normal() {
+  return v_normal;
+}
+
+vec3 vertex_tangent() {
+  return v_tangent;
+}
+
+vec3 vertex_bitangent() {
+  return v_bitangent;
+}
+#endif
@@ -0,0 +1,237 @@
+#include "asset_pack.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#ifdef ASSET_PACK_LZ4
+  #include <lz4.h>
+#endif
+#ifdef ASSET_PACK_ZSTD
+  #include <zstd.h>
+#endif
+
+/* ------------------------------------------------------------
+ * AssetData
+ * -----------------------------------------------------------*/
+AssetData::AssetData() : m_data(nullptr), m_size(0), m_from_pack(false) {}
+
+void AssetData::Close() {
+  m_file.Close();
+  std::vector<uint8_t>().swap(m_buffer);
+  m_data = nullptr;
+  m_size = 0;
+  m_from_pack = false;
+}
+
+/* ------------------------------------------------------------
+ * AssetPack
+ * -----------------------------------------------------------*/
+AssetPack& AssetPack::Get() {
+  static AssetPack pack;
+  return pack;
+}
+
+AssetPack::AssetPack() : m_entries(nullptr), m_num_entries(0) {}
+
+/**
+ * Turns a path the engine uses into the name the asset is packed under,
+ * "../models/house.obj" is packed as "models/house.obj"
+ * @param  path - The path relative to the build directory
+ * @return      The name of the asset in the pack
+ */
+std::string AssetPack::AssetName(const std::string& path) {
+  std::string name = path;
+  std::replace(name.begin(), name.end(), '\\', '/');
+
+  size_t pos;
+  while ((pos = name.find("/./")) != std::string::npos) {
+    name.erase(pos, 2);
+  }
+  while (name.compare(0, 3, "../") == 0 || name.compare(0, 2, "./") == 0) {
+    name.erase(0, name[0] == '.' && name[1] == '.' ? 3 : 2);
+  }
+  return name;
+}
+
+bool AssetPack::Open(const std::string& path) {
+  Close();
+
+  if (!m_file.Open(path)) {
+    return false;
+  }
+
+  const uint8_t* data = m_file.Data();
+  size_t size = m_file.Size();
+
+  const AssetPackHeader* header = reinterpret_cast<const AssetPackHeader*>(data);
+  if (size < sizeof(AssetPackHeader) ||
+      header->magic != ASSET_PACK_MAGIC ||
+      header->version != ASSET_PACK_VERSION ||
+      size < sizeof(AssetPackHeader) + uint64_t(header->num_entries) * sizeof(AssetPackEntry)) {
+    std::cout << "Asset pack " << path << " is invalid or out of date." << std::endl;
+    m_file.Close();
+    return false;
+  }
+
+  // Make sure every entry lies inside the file so lookups can trust them.
+  // Uncompressed entries are used in place, so they also have to be as
+  // big as they claim
+  const AssetPackEntry* entries = reinterpret_cast<const AssetPackEntry*>(data + sizeof(AssetPackHeader));
+  for (unsigned i = 0; i < header->num_entries; i++) {
+    const AssetPackEntry& entry = entries[i];
+    if (entry.offset > size || entry.stored_size > size - entry.offset) {
+      std::cout << "Asset pack " << path << " is truncated." << std::endl;
+      m_file.Close();
+      return false;
+    }
+    if (entry.compression == ASSET_UNCOMPRESSED && entry.size != entry.stored_size) {
+      std::cout << "Asset pack " << path << " is invalid or out of date." << std::endl;
+      m_file.Close();
+      return false;
+    }
+  }
+
+  m_entries = entries;
+  m_num_entries = header->num_entries;
+  return true;
+}
+
+void AssetPack::Close() {
+  m_file.Close();
+  m_entries = nullptr;
+  m_num_entries = 0;
+}
+
+const AssetPackEntry* AssetPack::Find(const std::string& name) const {
+  if (m_entries == nullptr) return nullptr;
+
+  // Binary search the table of contents by hash, then check the name
+  uint64_t hash = hash_string(name);
+  const AssetPackEntry* end = m_entries + m_num_entries;
+  const AssetPackEntry* entry = std::lower_bound(m_entries, end, hash, [](const AssetPackEntry& e, uint64_t h) {
+    return e.name_hash < h;
+  });
+  for (; entry != end && entry->name_hash == hash; ++entry) {
+    if (strncmp(entry->name, name.c_str(), ASSET_PACK_NAME_LENGTH) == 0) {
+      return entry;
+    }
+  }
+  return nullptr;
+}
+
+/**
+ * Loads an asset from the pack, or from the loose file if the pack is not
+ * open or doesn't have it
+ * @param  path - The path of the asset relative to the build directory
+ * @param  data - Set to the contents of the asset
+ * @return      False if the asset couldn't be found or read
+ */
+bool AssetPack::Load(const std::string& path, AssetData& data) const {
+  data.Close();
+
+  const AssetPackEntry* entry = Find(AssetName(path));
+  if (entry == nullptr) {
+    if (!data.m_file.Open(path)) {
+      return false;
+    }
+    data.m_data = data.m_file.Data();
+    data.m_size = data.m_file.Size();
+    return true;
+  }
+
+  const uint8_t* stored = m_file.Data() + entry->offset;
+  data.m_from_pack = true;
+
+  // Uncompressed assets are used in place. Their content hash isn't
+  // checked, that would read every byte of an asset that is otherwise
+  // only mapped
+  if (entry->compression == ASSET_UNCOMPRESSED) {
+    data.m_data = stored;
+    data.m_size = entry->size;
+    return true;
+  }
+
+  data.m_buffer.resize(entry->size);
+  if (!Decompress(AssetCompression(entry->compression), stored, entry->stored_size, data.m_buffer.data(), entry->size) ||
+      hash_bytes(data.m_buffer.data(), entry->size) != entry->content_hash) {
+    std::cout << "Failed to decompress " << entry->name << " from the asset pack." << std::endl;
+    data.Close();
+    return false;
+  }
+
+  data.m_data = data.m_buffer.data();
+  data.m_size = entry->size;
+  return true;
+}
+
+bool AssetPack::Exists(const std::string& path) const {
+  uint64_t mtime, size;
+  return Find(AssetName(path)) != nullptr || stat_file(path, mtime, size);
+}
+
+/**
+ * Compresses an asset for the pack
+ * @param  compression - The compression to use
+ * @param  source      - The bytes to compress
+ * @param  size        - The number of bytes
+ * @param  output      - Set to the compressed bytes
+ * @return             False if the compression isn't built in
+ */
+bool AssetPack::Compress(AssetCompression compression, const uint8_t* source, size_t size, std::vector<uint8_t>& output) {
+  switch (compression) {
+    case ASSET_UNCOMPRESSED:
+      output.assign(source, source + size);
+      return true;
+
+    #ifdef ASSET_PACK_LZ4
+      case ASSET_LZ4: {
+        output.resize(LZ4_compressBound(size));
+        int written = LZ4_compress_default(
+          reinterpret_cast<const char*>(source), reinterpret_cast<char*>(output.data()), size, output.size()
+        );
+        if (written <= 0) return false;
+        output.resize(written);
+        return true;
+      }
+    #endif
+
+    #ifdef ASSET_PACK_ZSTD
+      case ASSET_ZSTD: {
+        output.resize(ZSTD_compressBound(size));
+        size_t written = ZSTD_compress(output.data(), output.size(), source, size, 19);
+        if (ZSTD_isError(written)) return false;
+        output.resize(written);
+        return true;
+      }
+    #endif
+
+    default:
+      return false;
+  }
+}
+
+bool AssetPack::Decompress(AssetCompression compression, const uint8_t* source, size_t size, uint8_t* output, size_t output_size) {
+  switch (compression) {
+    case ASSET_UNCOMPRESSED:
+      if (size != output_size) return false;
+      memcpy(output, source, size);
+      return true;
+
+    #ifdef ASSET_PACK_LZ4
+      case ASSET_LZ4:
+        return LZ4_decompress_safe(
+          reinterpret_cast<const char*>(source), reinterpret_cast<char*>(output), size, output_size
+        ) == int(output_size);
+    #endif
+
+    #ifdef ASSET_PACK_ZSTD
+      case ASSET_ZSTD:
+        return ZSTD_decompress(output, output_size, source, size) == output_size;
+    #endif
+
+    default:
+      std::cout << "Asset compressed with a codec this build doesn't include." << std::endl;
+      return false;
+  }
+}
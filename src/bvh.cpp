@@ -0,0 +1,503 @@
+#include "bvh.h"
+
+#include <algorithm>
+
+static inline float surface_area(const glm::vec3& min, const glm::vec3& max) {
+  glm::vec3 d = max - min;
+  return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+}
+
+static inline bool boxes_overlap(const glm::vec3& a_min, const glm::vec3& a_max, const glm::vec3& b_min, const glm::vec3& b_max) {
+  return a_min.x <= b_max.x && a_max.x >= b_min.x &&
+         a_min.y <= b_max.y && a_max.y >= b_min.y &&
+         a_min.z <= b_max.z && a_max.z >= b_min.z;
+}
+
+static inline bool box_contains(const glm::vec3& outer_min, const glm::vec3& outer_max, const glm::vec3& min, const glm::vec3& max) {
+  return outer_min.x <= min.x && outer_min.y <= min.y && outer_min.z <= min.z &&
+         max.x <= outer_max.x && max.y <= outer_max.y && max.z <= outer_max.z;
+}
+
+static inline bool box_sphere_overlap(const glm::vec3& min, const glm::vec3& max, const glm::vec3& center, float radius) {
+  glm::vec3 closest = glm::clamp(center, min, max);
+  glm::vec3 d = closest - center;
+  return glm::dot(d, d) <= radius * radius;
+}
+
+// Slab test, sets distance to where the ray enters the box
+static inline bool ray_box(const glm::vec3& origin, const glm::vec3& inverse, float max_distance,
+                           const glm::vec3& min, const glm::vec3& max, float& distance) {
+  float enter = 0.0f, exit = max_distance;
+  for (unsigned i = 0; i < 3; i++) {
+    float t0 = (min[i] - origin[i]) * inverse[i];
+    float t1 = (max[i] - origin[i]) * inverse[i];
+    if (t0 > t1) std::swap(t0, t1);
+    enter = std::max(enter, t0);
+    exit = std::min(exit, t1);
+    if (enter > exit) return false;
+  }
+  distance = enter;
+  return true;
+}
+
+Bvh::Bvh() : m_root(BVH_NULL_NODE), m_free_node(BVH_NULL_NODE), m_reinserts(0) {}
+
+int Bvh::AllocateNode() {
+  int index;
+  if (m_free_node != BVH_NULL_NODE) {
+    index = m_free_node;
+    m_free_node = m_nodes[index].parent;
+  } else {
+    index = m_nodes.size();
+    m_nodes.push_back(BvhNode());
+  }
+
+  BvhNode& node = m_nodes[index];
+  node.parent = node.left = node.right = BVH_NULL_NODE;
+  node.proxy = 0;
+  return index;
+}
+
+// Free nodes are chained through their parent
+void Bvh::FreeNode(int index) {
+  m_nodes[index].parent = m_free_node;
+  m_free_node = index;
+}
+
+void Bvh::SetLeafBounds(int index, const Proxy& proxy) {
+  glm::vec3 margin = (proxy.max - proxy.min) * BVH_FAT_MARGIN;
+  m_nodes[index].min = proxy.min - margin;
+  m_nodes[index].max = proxy.max + margin;
+}
+
+/**
+ * Adds a box to the tree
+ * @param  bounds - The world space bounds
+ * @param  item   - Returned by the queries for this box
+ * @return        The proxy to update or remove the box with
+ */
+unsigned Bvh::Insert(const Bounds& bounds, unsigned item) {
+  unsigned index;
+  if (!m_free_proxies.empty()) {
+    index = m_free_proxies.back();
+    m_free_proxies.pop_back();
+  } else {
+    index = m_proxies.size();
+    m_proxies.push_back(Proxy());
+  }
+
+  Proxy& proxy = m_proxies[index];
+  proxy.item = item;
+  proxy.min = bounds.min;
+  proxy.max = bounds.max;
+  proxy.node = AllocateNode();
+  m_nodes[proxy.node].proxy = index;
+  SetLeafBounds(proxy.node, proxy);
+  InsertLeaf(proxy.node);
+  return index;
+}
+
+void Bvh::Remove(unsigned index) {
+  Proxy& proxy = m_proxies[index];
+  if (proxy.node == BVH_NULL_NODE) return;
+  RemoveLeaf(proxy.node);
+  FreeNode(proxy.node);
+  proxy.node = BVH_NULL_NODE;
+  m_free_proxies.push_back(index);
+}
+
+/**
+ * Moves a box, the leaf is only reinserted once the box leaves its fat
+ * bounds
+ * @param  index  - The proxy
+ * @param  bounds - The new world space bounds
+ * @return        True if the leaf was reinserted, false as well for a
+ *                removed proxy
+ */
+bool Bvh::Update(unsigned index, const Bounds& bounds) {
+  // Removed proxies have no leaf to move
+  if (index >= m_proxies.size()) return false;
+  Proxy& proxy = m_proxies[index];
+  if (proxy.node == BVH_NULL_NODE) return false;
+  proxy.min = bounds.min;
+  proxy.max = bounds.max;
+
+  const BvhNode& leaf = m_nodes[proxy.node];
+  if (box_contains(leaf.min, leaf.max, proxy.min, proxy.max)) return false;
+
+  RemoveLeaf(proxy.node);
+  SetLeafBounds(proxy.node, proxy);
+  InsertLeaf(proxy.node);
+  m_reinserts++;
+  return true;
+}
+
+// Finds the sibling that grows the tree's surface area the least, going
+// down while descending is cheaper than pairing with the current node
+void Bvh::InsertLeaf(int leaf) {
+  if (m_root == BVH_NULL_NODE) {
+    m_root = leaf;
+    m_nodes[leaf].parent = BVH_NULL_NODE;
+    return;
+  }
+
+  glm::vec3 leaf_min = m_nodes[leaf].min, leaf_max = m_nodes[leaf].max;
+  int index = m_root;
+  while (!m_nodes[index].IsLeaf()) {
+    const BvhNode& node = m_nodes[index];
+    float area = surface_area(node.min, node.max);
+    float combined = surface_area(glm::min(node.min, leaf_min), glm::max(node.max, leaf_max));
+
+    // Cost of pairing the leaf with this node, and the increase every
+    // descendant pays for this node growing
+    float cost = 2.0f * combined;
+    float inheritance = 2.0f * (combined - area);
+
+    float child_cost[2];
+    int children[2] = { node.left, node.right };
+    for (unsigned i = 0; i < 2; i++) {
+      const BvhNode& child = m_nodes[children[i]];
+      float grown = surface_area(glm::min(child.min, leaf_min), glm::max(child.max, leaf_max));
+      child_cost[i] = (child.IsLeaf() ? grown : grown - surface_area(child.min, child.max)) + inheritance;
+    }
+
+    if (cost < child_cost[0] && cost < child_cost[1]) break;
+    index = child_cost[0] < child_cost[1] ? children[0] : children[1];
+  }
+
+  // Pair the leaf with the sibling under a new parent
+  int sibling = index;
+  int old_parent = m_nodes[sibling].parent;
+  int new_parent = AllocateNode();
+  m_nodes[new_parent].parent = old_parent;
+  m_nodes[new_parent].left = sibling;
+  m_nodes[new_parent].right = leaf;
+  m_nodes[sibling].parent = new_parent;
+  m_nodes[leaf].parent = new_parent;
+
+  if (old_parent == BVH_NULL_NODE) {
+    m_root = new_parent;
+  } else if (m_nodes[old_parent].left == sibling) {
+    m_nodes[old_parent].left = new_parent;
+  } else {
+    m_nodes[old_parent].right = new_parent;
+  }
+
+  Refit(new_parent);
+}
+
+void Bvh::RemoveLeaf(int leaf) {
+  if (leaf == m_root) {
+    m_root = BVH_NULL_NODE;
+    return;
+  }
+
+  int parent = m_nodes[leaf].parent;
+  int grandparent = m_nodes[parent].parent;
+  int sibling = m_nodes[parent].left == leaf ? m_nodes[parent].right : m_nodes[parent].left;
+
+  // The sibling takes the parent's place
+  m_nodes[sibling].parent = grandparent;
+  if (grandparent == BVH_NULL_NODE) {
+    m_root = sibling;
+  } else {
+    if (m_nodes[grandparent].left == parent) {
+      m_nodes[grandparent].left = sibling;
+    } else {
+      m_nodes[grandparent].right = sibling;
+    }
+    Refit(grandparent);
+  }
+  FreeNode(parent);
+}
+
+// Recomputes the bounds from a node up to the root
+void Bvh::Refit(int index) {
+  while (index != BVH_NULL_NODE) {
+    BvhNode& node = m_nodes[index];
+    node.min = glm::min(m_nodes[node.left].min, m_nodes[node.right].min);
+    node.max = glm::max(m_nodes[node.left].max, m_nodes[node.right].max);
+    index = node.parent;
+  }
+}
+
+// Rebuilds the tree if enough leaves were reinserted to degrade it
+void Bvh::Optimize() {
+  unsigned count = GetProxyCount();
+  if (count > 1 && m_reinserts > count * BVH_REBUILD_FRACTION) {
+    Build();
+  }
+}
+
+// Rebuilds the whole tree top down with the binned SAH. Nodes are laid
+// out depth first so a node's left child follows it
+void Bvh::Build() {
+  std::vector<unsigned> proxies;
+  proxies.reserve(GetProxyCount());
+  for (unsigned i = 0; i < m_proxies.size(); i++) {
+    if (m_proxies[i].node != BVH_NULL_NODE) proxies.push_back(i);
+  }
+
+  m_nodes.clear();
+  m_free_node = BVH_NULL_NODE;
+  m_root = BVH_NULL_NODE;
+  m_reinserts = 0;
+  if (proxies.empty()) return;
+
+  m_nodes.reserve(proxies.size() * 2 - 1);
+  m_root = BuildRange(proxies, 0, proxies.size(), BVH_NULL_NODE);
+}
+
+int Bvh::BuildRange(std::vector<unsigned>& proxies, unsigned first, unsigned last, int parent) {
+  int index = AllocateNode();
+  m_nodes[index].parent = parent;
+
+  if (last - first == 1) {
+    Proxy& proxy = m_proxies[proxies[first]];
+    proxy.node = index;
+    m_nodes[index].proxy = proxies[first];
+    SetLeafBounds(index, proxy);
+    return index;
+  }
+
+  // Bounds of the centers decide where the bins go
+  glm::vec3 center_min = (m_proxies[proxies[first]].min + m_proxies[proxies[first]].max) * 0.5f;
+  glm::vec3 center_max = center_min;
+  for (unsigned i = first + 1; i < last; i++) {
+    glm::vec3 center = (m_proxies[proxies[i]].min + m_proxies[proxies[i]].max) * 0.5f;
+    center_min = glm::min(center_min, center);
+    center_max = glm::max(center_max, center);
+  }
+
+  float best_cost = 0.0f;
+  int best_axis = -1;
+  unsigned best_split = 0;
+  for (unsigned axis = 0; axis < 3; axis++) {
+    float extent = center_max[axis] - center_min[axis];
+    if (extent <= 0.0f) continue;
+    float scale = BVH_SAH_BINS / extent;
+
+    unsigned counts[BVH_SAH_BINS] = { 0 };
+    glm::vec3 bin_min[BVH_SAH_BINS], bin_max[BVH_SAH_BINS];
+    for (unsigned i = first; i < last; i++) {
+      const Proxy& proxy = m_proxies[proxies[i]];
+      float center = (proxy.min[axis] + proxy.max[axis]) * 0.5f;
+      unsigned bin = std::min<unsigned>((center - center_min[axis]) * scale, BVH_SAH_BINS - 1);
+      bin_min[bin] = counts[bin] == 0 ? proxy.min : glm::min(bin_min[bin], proxy.min);
+      bin_max[bin] = counts[bin] == 0 ? proxy.max : glm::max(bin_max[bin], proxy.max);
+      counts[bin]++;
+    }
+
+    // Sweep from the right to get the cost of everything right of each
+    // split, then from the left to add the rest
+    float right_cost[BVH_SAH_BINS];
+    glm::vec3 sweep_min, sweep_max;
+    unsigned count = 0;
+    for (int bin = BVH_SAH_BINS - 1; bin > 0; bin--) {
+      if (counts[bin] > 0) {
+        sweep_min = count == 0 ? bin_min[bin] : glm::min(sweep_min, bin_min[bin]);
+        sweep_max = count == 0 ? bin_max[bin] : glm::max(sweep_max, bin_max[bin]);
+        count += counts[bin];
+      }
+      right_cost[bin] = count == 0 ? 0.0f : count * surface_area(sweep_min, sweep_max);
+    }
+
+    count = 0;
+    for (unsigned split = 1; split < BVH_SAH_BINS; split++) {
+      unsigned bin = split - 1;
+      if (counts[bin] > 0) {
+        sweep_min = count == 0 ? bin_min[bin] : glm::min(sweep_min, bin_min[bin]);
+        sweep_max = count == 0 ? bin_max[bin] : glm::max(sweep_max, bin_max[bin]);
+        count += counts[bin];
+      }
+      if (count == 0 || count == last - first) continue;
+
+      float cost = count * surface_area(sweep_min, sweep_max) + right_cost[split];
+      if (best_axis < 0 || cost < best_cost) {
+        best_cost = cost;
+        best_axis = axis;
+        best_split = split;
+      }
+    }
+  }
+
+  unsigned middle;
+  if (best_axis >= 0) {
+    float scale = BVH_SAH_BINS / (center_max[best_axis] - center_min[best_axis]);
+    float origin = center_min[best_axis];
+    unsigned split = best_split;
+    auto* proxy_list = &m_proxies;
+    middle = std::partition(proxies.begin() + first, proxies.begin() + last, [=](unsigned i) {
+      const Proxy& proxy = (*proxy_list)[i];
+      float center = (proxy.min[best_axis] + proxy.max[best_axis]) * 0.5f;
+      return std::min<unsigned>((center - origin) * scale, BVH_SAH_BINS - 1) < split;
+    }) - proxies.begin();
+  } else {
+    // Every center is in the same place, any split is as good
+    middle = (first + last) / 2;
+  }
+
+  int left = BuildRange(proxies, first, middle, index);
+  int right = BuildRange(proxies, middle, last, index);
+
+  BvhNode& node = m_nodes[index];
+  node.left = left;
+  node.right = right;
+  node.min = glm::min(m_nodes[left].min, m_nodes[right].min);
+  node.max = glm::max(m_nodes[left].max, m_nodes[right].max);
+  return index;
+}
+
+void Bvh::Clear() {
+  m_nodes.clear();
+  m_proxies.clear();
+  m_free_proxies.clear();
+  m_root = BVH_NULL_NODE;
+  m_free_node = BVH_NULL_NODE;
+  m_reinserts = 0;
+}
+
+unsigned Bvh::GetHeight() const {
+  if (m_root == BVH_NULL_NODE) return 0;
+
+  unsigned height = 0;
+  std::vector<std::pair<int, unsigned> > stack(1, std::make_pair(m_root, 1u));
+  while (!stack.empty()) {
+    std::pair<int, unsigned> entry = stack.back();
+    stack.pop_back();
+    height = std::max(height, entry.second);
+    const BvhNode& node = m_nodes[entry.first];
+    if (!node.IsLeaf()) {
+      stack.push_back(std::make_pair(node.left, entry.second + 1));
+      stack.push_back(std::make_pair(node.right, entry.second + 1));
+    }
+  }
+  return height;
+}
+
+// Adds the item of every leaf under a node without testing them
+void Bvh::CollectItems(int index, std::vector<unsigned>& items) const {
+  std::vector<int> stack(1, index);
+  while (!stack.empty()) {
+    const BvhNode& node = m_nodes[stack.back()];
+    stack.pop_back();
+    if (node.IsLeaf()) {
+      items.push_back(m_proxies[node.proxy].item);
+    } else {
+      stack.push_back(node.right);
+      stack.push_back(node.left);
+    }
+  }
+}
+
+/**
+ * Finds every box inside or crossing a frustum. Subtrees entirely inside
+ * are accepted and subtrees entirely outside rejected without testing
+ * their children, and planes a node is inside are skipped below it
+ * @param  frustum - The frustum to test against
+ * @param  items   - The items of the visible boxes are added to this
+ * @return         The number of boxes tested
+ */
+unsigned Bvh::QueryFrustum(const Frustum& frustum, std::vector<unsigned>& items) const {
+  if (m_root == BVH_NULL_NODE) return 0;
+
+  unsigned tested = 0;
+  std::vector<std::pair<int, unsigned> > stack(1, std::make_pair(m_root, FRUSTUM_ALL_PLANES));
+  while (!stack.empty()) {
+    std::pair<int, unsigned> entry = stack.back();
+    stack.pop_back();
+    const BvhNode& node = m_nodes[entry.first];
+    unsigned planes = entry.second;
+    tested++;
+
+    // Leaves are tested with their tight bounds
+    glm::vec3 min = node.min, max = node.max;
+    if (node.IsLeaf()) {
+      min = m_proxies[node.proxy].min;
+      max = m_proxies[node.proxy].max;
+    }
+
+    int result = frustum.ClassifyBox((min + max) * 0.5f, (max - min) * 0.5f, planes);
+    if (result == FRUSTUM_OUTSIDE) continue;
+
+    if (result == FRUSTUM_INSIDE) {
+      CollectItems(entry.first, items);
+    } else if (node.IsLeaf()) {
+      items.push_back(m_proxies[node.proxy].item);
+    } else {
+      stack.push_back(std::make_pair(node.right, planes));
+      stack.push_back(std::make_pair(node.left, planes));
+    }
+  }
+  return tested;
+}
+
+/**
+ * Finds every box a ray hits, nearest first
+ * @param origin       - The start of the ray
+ * @param direction    - The direction of the ray
+ * @param max_distance - How far along the direction to look
+ * @param hits         - Set to the items hit and where the ray enters them
+ */
+void Bvh::QueryRay(const glm::vec3& origin, const glm::vec3& direction, float max_distance, std::vector<BvhRayHit>& hits) const {
+  hits.clear();
+  if (m_root == BVH_NULL_NODE) return;
+
+  glm::vec3 inverse = 1.0f / direction;
+  std::vector<int> stack(1, m_root);
+  while (!stack.empty()) {
+    const BvhNode& node = m_nodes[stack.back()];
+    stack.pop_back();
+
+    float distance;
+    if (node.IsLeaf()) {
+      const Proxy& proxy = m_proxies[node.proxy];
+      if (ray_box(origin, inverse, max_distance, proxy.min, proxy.max, distance)) {
+        hits.push_back(BvhRayHit{ proxy.item, distance });
+      }
+    } else if (ray_box(origin, inverse, max_distance, node.min, node.max, distance)) {
+      stack.push_back(node.right);
+      stack.push_back(node.left);
+    }
+  }
+
+  std::sort(hits.begin(), hits.end(), [](const BvhRayHit& a, const BvhRayHit& b) {
+    return a.distance < b.distance;
+  });
+}
+
+void Bvh::QuerySphere(const glm::vec3& center, float radius, std::vector<unsigned>& items) const {
+  if (m_root == BVH_NULL_NODE) return;
+
+  std::vector<int> stack(1, m_root);
+  while (!stack.empty()) {
+    const BvhNode& node = m_nodes[stack.back()];
+    stack.pop_back();
+
+    if (node.IsLeaf()) {
+      const Proxy& proxy = m_proxies[node.proxy];
+      if (box_sphere_overlap(proxy.min, proxy.max, center, radius)) items.push_back(proxy.item);
+    } else if (box_sphere_overlap(node.min, node.max, center, radius)) {
+      stack.push_back(node.right);
+      stack.push_back(node.left);
+    }
+  }
+}
+
+void Bvh::QueryBox(const glm::vec3& min, const glm::vec3& max, std::vector<unsigned>& items) const {
+  if (m_root == BVH_NULL_NODE) return;
+
+  std::vector<int> stack(1, m_root);
+  while (!stack.empty()) {
+    const BvhNode& node = m_nodes[stack.back()];
+    stack.pop_back();
+
+    if (node.IsLeaf()) {
+      const Proxy& proxy = m_proxies[node.proxy];
+      if (boxes_overlap(proxy.min, proxy.max, min, max)) items.push_back(proxy.item);
+    } else if (boxes_overlap(node.min, node.max, min, max)) {
+      stack.push_back(node.right);
+      stack.push_back(node.left);
+    }
+  }
+}
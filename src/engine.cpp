@@ -43,6 +43,12 @@ bool Engine::Initialize() {
 }
 
 void Engine::LoadGameObjects() {
+  // Start importing every model in the config on the thread pool so the
+  // objects below only have to wait for the GL upload
+  for (auto i : config["OBJECTS"]) {
+    RequestAssets(i);
+  }
+
   // Itterate through game objects and add them to graphics as root objects
   for (auto i : config["OBJECTS"]) {
     Object* tmp = ParseConfig(i);
@@ -58,10 +64,23 @@ void Engine::LoadLights() {
       m_graphics->AddPointLight(i);
     } else if (type == "directional") {
       m_graphics->AddDirectionalLight(i);
+    } else if (type == "sun") {
+      m_graphics->AddSunLight(i);
     }
   }
 }
 
+void Engine::RequestAssets(json obj) {
+  if (obj["MODEL"].get<std::string>() != "") {
+    Model::RequestModel(obj["MODEL"].get<std::string>());
+  }
+
+  // Loop through the dependants requesting their models too
+  for (auto i : obj["DEPENDANTS"]) {
+    RequestAssets(i);
+  }
+}
+
 Object* Engine::ParseConfig(json obj) {
   // Construct the new object from the config
   Object* object = new Object(obj, &options);
@@ -145,7 +164,16 @@ long long Engine::GetCurrentTimeMillis() {
 }
 
 void Engine::KeyDown() {
-
+  switch (m_event.key.keysym.sym) {
+    case SDLK_p: {
+      m_graphics->ToggleDepthPrepass();
+      break;
+    }
+    case SDLK_g: {
+      m_graphics->TogglePipeline();
+      break;
+    }
+  }
 }
 
 void Engine::KeyUp() {
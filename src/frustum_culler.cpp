@@ -0,0 +1,206 @@
+#include "frustum_culler.h"
+
+#if defined(__AVX__)
+  #include <immintrin.h>
+#elif defined(__SSE2__)
+  #include <emmintrin.h>
+#endif
+
+// Boxes are tested this many at a time, the arrays are padded to match
+#if defined(__AVX__)
+  #define CULL_LANES 8
+#elif defined(__SSE2__)
+  #define CULL_LANES 4
+#else
+  #define CULL_LANES 1
+#endif
+
+/**
+ * Extracts the planes from a projection view matrix (Gribb and Hartmann)
+ * @param  matrix - The combined projection and view matrix
+ * @return        The frustum with normalized planes
+ */
+Frustum Frustum::FromMatrix(const glm::mat4& matrix) {
+  Frustum frustum;
+  glm::vec4 row[4];
+  for (unsigned i = 0; i < 4; i++) {
+    row[i] = glm::vec4(matrix[0][i], matrix[1][i], matrix[2][i], matrix[3][i]);
+  }
+
+  frustum.planes[0] = row[3] + row[0];
+  frustum.planes[1] = row[3] - row[0];
+  frustum.planes[2] = row[3] + row[1];
+  frustum.planes[3] = row[3] - row[1];
+  frustum.planes[4] = row[3] + row[2];
+  frustum.planes[5] = row[3] - row[2];
+
+  for (auto& i : frustum.planes) {
+    i = i / glm::length(glm::vec3(i));
+  }
+  return frustum;
+}
+
+// True unless the box is entirely behind one of the planes
+bool Frustum::TestBox(const glm::vec3& center, const glm::vec3& extents) const {
+  for (auto& i : planes) {
+    glm::vec3 normal(i);
+    float distance = glm::dot(normal, center) + i.w;
+    float radius = glm::dot(glm::abs(normal), extents);
+    if (distance + radius < 0.0f) return false;
+  }
+  return true;
+}
+
+/**
+ * Tests a box against the planes still set in a mask, clearing the planes
+ * the box is entirely in front of so children of the box can skip them
+ * @param  center  - The center of the box
+ * @param  extents - Half the size of the box
+ * @param  mask    - Bit per plane to test, updated for the box
+ * @return         FRUSTUM_OUTSIDE, FRUSTUM_INTERSECT or FRUSTUM_INSIDE
+ */
+int Frustum::ClassifyBox(const glm::vec3& center, const glm::vec3& extents, unsigned& mask) const {
+  for (unsigned i = 0; i < 6; i++) {
+    if ((mask & (1u << i)) == 0) continue;
+
+    glm::vec3 normal(planes[i]);
+    float distance = glm::dot(normal, center) + planes[i].w;
+    float radius = glm::dot(glm::abs(normal), extents);
+    if (distance + radius < 0.0f) return FRUSTUM_OUTSIDE;
+    if (distance - radius >= 0.0f) mask &= ~(1u << i);
+  }
+  return mask == 0 ? FRUSTUM_INSIDE : FRUSTUM_INTERSECT;
+}
+
+unsigned FrustumCuller::Add() {
+  unsigned index = m_visible.size();
+  m_visible.push_back(0);
+  Reserve();
+  return index;
+}
+
+void FrustumCuller::Clear() {
+  m_visible.clear();
+  Reserve();
+}
+
+// Keeps the box arrays a whole number of lanes long, the padding boxes
+// are empty and never read back
+void FrustumCuller::Reserve() {
+  unsigned padded = (m_visible.size() + CULL_LANES - 1) / CULL_LANES * CULL_LANES;
+  m_center_x.resize(padded, 0.0f);
+  m_center_y.resize(padded, 0.0f);
+  m_center_z.resize(padded, 0.0f);
+  m_extent_x.resize(padded, 0.0f);
+  m_extent_y.resize(padded, 0.0f);
+  m_extent_z.resize(padded, 0.0f);
+}
+
+void FrustumCuller::Set(unsigned index, const Bounds& bounds) {
+  glm::vec3 extents = bounds.Extents();
+  m_center_x[index] = bounds.center.x;
+  m_center_y[index] = bounds.center.y;
+  m_center_z[index] = bounds.center.z;
+  m_extent_x[index] = extents.x;
+  m_extent_y[index] = extents.y;
+  m_extent_z[index] = extents.z;
+}
+
+/**
+ * Tests every box against the frustum, CULL_LANES boxes at a time
+ * @param  frustum - The frustum to test against
+ * @return         The number of visible boxes
+ */
+unsigned FrustumCuller::Cull(const Frustum& frustum) {
+#if CULL_LANES == 1
+  return CullScalar(frustum);
+#else
+  unsigned count = m_visible.size();
+  unsigned padded = m_center_x.size();
+  unsigned visible = 0;
+
+  #if defined(__AVX__)
+    typedef __m256 lane_t;
+    #define LANE_SET1 _mm256_set1_ps
+    #define LANE_LOAD _mm256_loadu_ps
+    #define LANE_ADD _mm256_add_ps
+    #define LANE_MUL _mm256_mul_ps
+    #define LANE_LESS(a, b) _mm256_cmp_ps(a, b, _CMP_LT_OQ)
+    #define LANE_OR _mm256_or_ps
+    #define LANE_MASK _mm256_movemask_ps
+  #else
+    typedef __m128 lane_t;
+    #define LANE_SET1 _mm_set1_ps
+    #define LANE_LOAD _mm_loadu_ps
+    #define LANE_ADD _mm_add_ps
+    #define LANE_MUL _mm_mul_ps
+    #define LANE_LESS _mm_cmplt_ps
+    #define LANE_OR _mm_or_ps
+    #define LANE_MASK _mm_movemask_ps
+  #endif
+
+  // Broadcast the planes and their absolute normals once
+  lane_t normal_x[6], normal_y[6], normal_z[6], distance[6];
+  lane_t abs_x[6], abs_y[6], abs_z[6];
+  for (unsigned p = 0; p < 6; p++) {
+    const glm::vec4& plane = frustum.planes[p];
+    normal_x[p] = LANE_SET1(plane.x);
+    normal_y[p] = LANE_SET1(plane.y);
+    normal_z[p] = LANE_SET1(plane.z);
+    distance[p] = LANE_SET1(plane.w);
+    abs_x[p] = LANE_SET1(std::fabs(plane.x));
+    abs_y[p] = LANE_SET1(std::fabs(plane.y));
+    abs_z[p] = LANE_SET1(std::fabs(plane.z));
+  }
+  lane_t zero = LANE_SET1(0.0f);
+
+  for (unsigned i = 0; i < padded; i += CULL_LANES) {
+    lane_t center_x = LANE_LOAD(&m_center_x[i]);
+    lane_t center_y = LANE_LOAD(&m_center_y[i]);
+    lane_t center_z = LANE_LOAD(&m_center_z[i]);
+    lane_t extent_x = LANE_LOAD(&m_extent_x[i]);
+    lane_t extent_y = LANE_LOAD(&m_extent_y[i]);
+    lane_t extent_z = LANE_LOAD(&m_extent_z[i]);
+
+    // A lane is culled once it is behind any plane
+    lane_t outside = zero;
+    for (unsigned p = 0; p < 6; p++) {
+      lane_t d = LANE_ADD(LANE_ADD(LANE_MUL(normal_x[p], center_x), LANE_MUL(normal_y[p], center_y)),
+                          LANE_ADD(LANE_MUL(normal_z[p], center_z), distance[p]));
+      lane_t r = LANE_ADD(LANE_ADD(LANE_MUL(abs_x[p], extent_x), LANE_MUL(abs_y[p], extent_y)),
+                          LANE_MUL(abs_z[p], extent_z));
+      outside = LANE_OR(outside, LANE_LESS(LANE_ADD(d, r), zero));
+    }
+
+    int mask = LANE_MASK(outside);
+    unsigned lanes = std::min<unsigned>(CULL_LANES, count - i);
+    for (unsigned j = 0; j < lanes; j++) {
+      uint8_t inside = (mask >> j) & 1 ? 0 : 1;
+      m_visible[i + j] = inside;
+      visible += inside;
+    }
+  }
+
+  #undef LANE_SET1
+  #undef LANE_LOAD
+  #undef LANE_ADD
+  #undef LANE_MUL
+  #undef LANE_LESS
+  #undef LANE_OR
+  #undef LANE_MASK
+
+  return visible;
+#endif
+}
+
+// One box at a time, the reference for Cull
+unsigned FrustumCuller::CullScalar(const Frustum& frustum) {
+  unsigned visible = 0;
+  for (unsigned i = 0; i < m_visible.size(); i++) {
+    glm::vec3 center(m_center_x[i], m_center_y[i], m_center_z[i]);
+    glm::vec3 extents(m_extent_x[i], m_extent_y[i], m_extent_z[i]);
+    m_visible[i] = frustum.TestBox(center, extents) ? 1 : 0;
+    visible += m_visible[i];
+  }
+  return visible;
+}
@@ -0,0 +1,167 @@
+#include "gbuffer.h"
+#include "gl_state.h"
+#include "model.h"
+
+GBuffer::GBuffer() :
+    m_width(0),
+    m_height(0),
+    m_light_target(0),
+    m_depth(0),
+    m_geometry_framebuffer(0),
+    m_light_framebuffer(0),
+    m_forward_framebuffer(0),
+    m_vertex_array(0),
+    m_albedo_handle(Shader::RegisterUniform("gbuffer_albedo")),
+    m_normal_handle(Shader::RegisterUniform("gbuffer_normal")),
+    m_material_handle(Shader::RegisterUniform("gbuffer_material")),
+    m_depth_handle(Shader::RegisterUniform("gbuffer_depth")),
+    m_inverse_proj_view_handle(Shader::RegisterUniform("inverse_proj_view_matrix")),
+    m_shadows(false) {
+  for (unsigned i = 0; i < GBUFFER_TARGETS; i++) {
+    m_targets[i] = 0;
+  }
+}
+
+/**
+ * Creates the targets and the framebuffers drawing to them
+ * @param  width  - Width of the window in pixels
+ * @param  height - Height of the window in pixels
+ * @return        False if the driver can't render to the targets
+ */
+bool GBuffer::Initialize(unsigned width, unsigned height) {
+  m_width = width;
+  m_height = height;
+
+  m_targets[0] = CreateTarget(GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE);
+  m_targets[1] = CreateTarget(GL_RG16F, GL_RG, GL_FLOAT);
+  m_targets[2] = CreateTarget(GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE);
+  m_light_target = CreateTarget(GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE);
+  m_depth = CreateTarget(GL_DEPTH_COMPONENT24, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT);
+
+  static const GLenum draw_buffers[GBUFFER_TARGETS] = {
+    GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2
+  };
+  glGenFramebuffers(1, &m_geometry_framebuffer);
+  GLState::Get().BindFramebuffer(GL_FRAMEBUFFER, m_geometry_framebuffer);
+  for (unsigned i = 0; i < GBUFFER_TARGETS; i++) {
+    glFramebufferTexture2D(GL_FRAMEBUFFER, draw_buffers[i], GL_TEXTURE_2D, m_targets[i], 0);
+  }
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, m_depth, 0);
+  glDrawBuffers(GBUFFER_TARGETS, draw_buffers);
+  if (!CheckFramebuffer("Geometry")) return false;
+
+  glGenFramebuffers(1, &m_light_framebuffer);
+  GLState::Get().BindFramebuffer(GL_FRAMEBUFFER, m_light_framebuffer);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_light_target, 0);
+  if (!CheckFramebuffer("Lighting")) return false;
+
+  glGenFramebuffers(1, &m_forward_framebuffer);
+  GLState::Get().BindFramebuffer(GL_FRAMEBUFFER, m_forward_framebuffer);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_light_target, 0);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, m_depth, 0);
+  if (!CheckFramebuffer("Forward")) return false;
+
+  GLState::Get().BindFramebuffer(GL_FRAMEBUFFER, 0);
+  glGenVertexArrays(1, &m_vertex_array);
+  return true;
+}
+
+GLuint GBuffer::CreateTarget(GLenum internal_format, GLenum format, GLenum type) {
+  GLuint texture;
+  glGenTextures(1, &texture);
+  GLState::Get().BindTexture(GL_TEXTURE_2D, texture);
+  glTexImage2D(GL_TEXTURE_2D, 0, internal_format, m_width, m_height, 0, format, type, nullptr);
+
+  // Read back with texelFetch, one texel per pixel
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  GLState::Get().BindTexture(GL_TEXTURE_2D, 0);
+  return texture;
+}
+
+bool GBuffer::CheckFramebuffer(const char* name) {
+  GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+  if (status == GL_FRAMEBUFFER_COMPLETE) return true;
+
+  std::cout << name << " framebuffer is incomplete, status 0x" << std::hex << status << std::dec << std::endl;
+  GLState::Get().BindFramebuffer(GL_FRAMEBUFFER, 0);
+  Destroy();
+  return false;
+}
+
+// Binds the G-buffer for the opaque draws and clears it, a zero albedo
+// and the far depth mark pixels nothing was drawn to
+void GBuffer::BeginGeometry() {
+  GLState::Get().BindFramebuffer(GL_FRAMEBUFFER, m_geometry_framebuffer);
+  GLfloat clear_color[4];
+  glGetFloatv(GL_COLOR_CLEAR_VALUE, clear_color);
+  glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+  glClearColor(clear_color[0], clear_color[1], clear_color[2], clear_color[3]);
+}
+
+/**
+ * Shades every covered pixel of the G-buffer into the light target, then
+ * leaves the light target and depth bound for the forward passes
+ * @param lighting  - The lighting program, drawn as one fullscreen triangle
+ * @param proj_view - The combined projection and view matrix the G-buffer
+ *                    was drawn with
+ */
+void GBuffer::Resolve(Shader* lighting, const glm::mat4& proj_view) {
+  // Uncovered pixels keep the clear color
+  GLState::Get().BindFramebuffer(GL_FRAMEBUFFER, m_light_framebuffer);
+  glClear(GL_COLOR_BUFFER_BIT);
+
+  const GLuint textures[] = { m_targets[0], m_targets[1], m_targets[2], m_depth };
+  const GLenum units[] = { GL_GBUFFER_ALBEDO_POS, GL_GBUFFER_NORMAL_POS, GL_GBUFFER_MATERIAL_POS, GL_GBUFFER_DEPTH_POS };
+  for (unsigned i = 0; i < 4; i++) {
+    GLState::Get().BindTexture(units[i], GL_TEXTURE_2D, textures[i]);
+  }
+
+  lighting->Enable();
+  lighting->uniform1i(m_albedo_handle, GL_GBUFFER_ALBEDO_OFFSET);
+  lighting->uniform1i(m_normal_handle, GL_GBUFFER_NORMAL_OFFSET);
+  lighting->uniform1i(m_material_handle, GL_GBUFFER_MATERIAL_OFFSET);
+  lighting->uniform1i(m_depth_handle, GL_GBUFFER_DEPTH_OFFSET);
+  lighting->uniform1i(UNIFORM_LIGHT_GRID, GL_LIGHT_GRID_OFFSET);
+  lighting->uniform1i(UNIFORM_LIGHT_INDICES, GL_LIGHT_INDEX_OFFSET);
+  if (m_shadows) {
+    lighting->uniform1i(UNIFORM_SUN_SHADOW, GL_SUN_SHADOW_OFFSET);
+    lighting->uniform1i(UNIFORM_SPOT_SHADOWS, GL_SPOT_SHADOW_OFFSET);
+  }
+  glm::mat4 inverse_proj_view = glm::inverse(proj_view);
+  lighting->uniformMatrix4fv(m_inverse_proj_view_handle, 1, GL_FALSE, glm::value_ptr(inverse_proj_view));
+
+  GLState::Get().Disable(GL_DEPTH_TEST);
+  GLState::Get().BindVertexArray(m_vertex_array);
+  glDrawArrays(GL_TRIANGLES, 0, 3);
+  GLState::Get().Enable(GL_DEPTH_TEST);
+  RenderStats::Get().draw_calls++;
+
+  GLState::Get().BindFramebuffer(GL_FRAMEBUFFER, m_forward_framebuffer);
+}
+
+// Copies the finished light target to the window
+void GBuffer::Present() {
+  GLState::Get().BindFramebuffer(GL_READ_FRAMEBUFFER, m_forward_framebuffer);
+  GLState::Get().BindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+  glBlitFramebuffer(0, 0, m_width, m_height, 0, 0, m_width, m_height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+  GLState::Get().BindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void GBuffer::Destroy() {
+  GLuint framebuffers[] = { m_geometry_framebuffer, m_light_framebuffer, m_forward_framebuffer };
+  GLState::Get().DeleteFramebuffers(3, framebuffers);
+  GLState::Get().DeleteTextures(GBUFFER_TARGETS, m_targets);
+  if (m_light_target != 0) GLState::Get().DeleteTextures(1, &m_light_target);
+  if (m_depth != 0) GLState::Get().DeleteTextures(1, &m_depth);
+  if (m_vertex_array != 0) GLState::Get().DeleteVertexArrays(1, &m_vertex_array);
+
+  m_geometry_framebuffer = m_light_framebuffer = m_forward_framebuffer = 0;
+  for (unsigned i = 0; i < GBUFFER_TARGETS; i++) {
+    m_targets[i] = 0;
+  }
+  m_light_target = m_depth = m_vertex_array = 0;
+}
@@ -0,0 +1,370 @@
+#include "geometry_pool.h"
+#include "gl_state.h"
+
+#include <algorithm>
+
+GeometryPool& GeometryPool::Get() {
+  static GeometryPool pool;
+  return pool;
+}
+
+GeometryPool::GeometryPool() : m_vertex_size(0), m_index_size(0) {
+  m_indices.buffer = 0;
+  m_indices.element_size = sizeof(unsigned);
+  m_indices.capacity = 0;
+  m_indices.used = 0;
+}
+
+/**
+ * Sets the starting size of the buffers, they grow when they run out
+ * @param vertex_size - Bytes reserved for each vertex format
+ * @param index_size  - Bytes reserved for indices
+ */
+void GeometryPool::Initialize(size_t vertex_size, size_t index_size) {
+  m_vertex_size = vertex_size;
+  m_index_size = index_size;
+  CreateArena(m_indices, sizeof(unsigned), m_index_size / sizeof(unsigned));
+}
+
+void GeometryPool::CreateArena(Arena& arena, unsigned element_size, unsigned capacity) {
+  arena.element_size = element_size;
+  arena.capacity = std::max(capacity, 1u);
+  arena.used = 0;
+  arena.free_blocks.assign(1, FreeBlock{ 0, arena.capacity });
+
+  // Bind to the copy targets so the bound vertex array state is untouched
+  glGenBuffers(1, &arena.buffer);
+  GLState::Get().BindBuffer(GL_COPY_WRITE_BUFFER, arena.buffer);
+  glBufferData(GL_COPY_WRITE_BUFFER, GLsizeiptr(arena.capacity) * element_size, nullptr, GL_STATIC_DRAW);
+  GLState::Get().BindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+/**
+ * Reserves room for a mesh
+ * @param  stride       - The size of one vertex in bytes
+ * @param  num_vertices - The number of vertices
+ * @param  num_indices  - The number of indices
+ * @return              A handle to the ranges
+ */
+GeometryHandle GeometryPool::Allocate(unsigned stride, unsigned num_vertices, unsigned num_indices) {
+  // Find or create the arena for this stride
+  unsigned arena = 0;
+  while (arena < m_arenas.size() && m_arenas[arena].element_size != stride) arena++;
+  if (arena == m_arenas.size()) {
+    m_arenas.push_back(Arena());
+    CreateArena(m_arenas.back(), stride, m_vertex_size / stride);
+  }
+
+  GeometryAllocation allocation;
+  allocation.arena = arena;
+  allocation.num_vertices = num_vertices;
+  allocation.num_indices = num_indices;
+  allocation.live = true;
+
+  // Grow the buffers when there is no block big enough
+  if (!AllocateRange(m_arenas[arena], num_vertices, allocation.base_vertex)) {
+    Grow(m_arenas[arena], num_vertices);
+    AllocateRange(m_arenas[arena], num_vertices, allocation.base_vertex);
+  }
+  if (!AllocateRange(m_indices, num_indices, allocation.first_index)) {
+    Grow(m_indices, num_indices);
+    AllocateRange(m_indices, num_indices, allocation.first_index);
+  }
+
+  GeometryHandle handle;
+  if (!m_free_handles.empty()) {
+    handle = m_free_handles.back();
+    m_free_handles.pop_back();
+    m_allocations[handle] = allocation;
+  } else {
+    handle = m_allocations.size();
+    m_allocations.push_back(allocation);
+  }
+  return handle;
+}
+
+void GeometryPool::Upload(GeometryHandle handle, const void* vertices, const unsigned* indices) {
+  const GeometryAllocation& allocation = m_allocations[handle];
+  const Arena& arena = m_arenas[allocation.arena];
+
+  GLState::Get().BindBuffer(GL_COPY_WRITE_BUFFER, arena.buffer);
+  glBufferSubData(
+    GL_COPY_WRITE_BUFFER,
+    GLintptr(allocation.base_vertex) * arena.element_size,
+    GLsizeiptr(allocation.num_vertices) * arena.element_size,
+    vertices
+  );
+
+  GLState::Get().BindBuffer(GL_COPY_WRITE_BUFFER, m_indices.buffer);
+  glBufferSubData(
+    GL_COPY_WRITE_BUFFER,
+    GLintptr(allocation.first_index) * sizeof(unsigned),
+    GLsizeiptr(allocation.num_indices) * sizeof(unsigned),
+    indices
+  );
+  GLState::Get().BindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+void GeometryPool::Free(GeometryHandle handle) {
+  if (handle >= m_allocations.size() || !m_allocations[handle].live) return;
+  GeometryAllocation& allocation = m_allocations[handle];
+
+  FreeRange(m_arenas[allocation.arena], allocation.base_vertex, allocation.num_vertices);
+  FreeRange(m_indices, allocation.first_index, allocation.num_indices);
+  allocation.live = false;
+  m_free_handles.push_back(handle);
+
+  GeometryPoolStats stats = GetStats();
+  if (stats.free_bytes > GEOMETRY_DEFRAGMENT_MIN_BYTES && stats.fragmentation > GEOMETRY_DEFRAGMENT_THRESHOLD) {
+    Defragment();
+  }
+}
+
+// First fit, the lists stay short since neighbours are merged on free
+bool GeometryPool::AllocateRange(Arena& arena, unsigned count, unsigned& offset) {
+  if (count == 0) {
+    offset = 0;
+    return true;
+  }
+
+  for (unsigned i = 0; i < arena.free_blocks.size(); i++) {
+    FreeBlock& block = arena.free_blocks[i];
+    if (block.count < count) continue;
+
+    offset = block.offset;
+    block.offset += count;
+    block.count -= count;
+    if (block.count == 0) {
+      arena.free_blocks.erase(arena.free_blocks.begin() + i);
+    }
+    arena.used += count;
+    return true;
+  }
+  return false;
+}
+
+void GeometryPool::FreeRange(Arena& arena, unsigned offset, unsigned count) {
+  if (count == 0) return;
+  arena.used -= count;
+
+  // Insert in offset order and merge with the blocks either side
+  auto next = std::lower_bound(arena.free_blocks.begin(), arena.free_blocks.end(), offset,
+    [](const FreeBlock& block, unsigned value) { return block.offset < value; });
+  next = arena.free_blocks.insert(next, FreeBlock{ offset, count });
+
+  auto after = next + 1;
+  if (after != arena.free_blocks.end() && next->offset + next->count == after->offset) {
+    next->count += after->count;
+    arena.free_blocks.erase(after);
+  }
+  if (next != arena.free_blocks.begin()) {
+    auto before = next - 1;
+    if (before->offset + before->count == next->offset) {
+      before->count += next->count;
+      arena.free_blocks.erase(next);
+    }
+  }
+}
+
+void GeometryPool::Grow(Arena& arena, unsigned count) {
+  // Try packing what is there first, then double until it fits
+  Compact(arena, true);
+  unsigned largest = 0;
+  for (auto& i : arena.free_blocks) largest = std::max(largest, i.count);
+  if (largest >= count) return;
+
+  unsigned old_capacity = arena.capacity;
+  unsigned capacity = std::max(old_capacity * 2, arena.used + count);
+
+  GLuint buffer;
+  glGenBuffers(1, &buffer);
+  GLState::Get().BindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+  glBufferData(GL_COPY_WRITE_BUFFER, GLsizeiptr(capacity) * arena.element_size, nullptr, GL_STATIC_DRAW);
+  GLState::Get().BindBuffer(GL_COPY_READ_BUFFER, arena.buffer);
+  glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, GLsizeiptr(old_capacity) * arena.element_size);
+  GLState::Get().BindBuffer(GL_COPY_READ_BUFFER, 0);
+  GLState::Get().BindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+  ReplaceBuffer(arena, buffer);
+  arena.capacity = capacity;
+
+  // The new space joins the free block at the end, if there is one
+  if (!arena.free_blocks.empty() && arena.free_blocks.back().offset + arena.free_blocks.back().count == old_capacity) {
+    arena.free_blocks.back().count += capacity - old_capacity;
+  } else {
+    arena.free_blocks.push_back(FreeBlock{ old_capacity, capacity - old_capacity });
+  }
+}
+
+/**
+ * Moves every live range in the arena down to the start of a fresh buffer
+ * so all the free space ends up in one block at the end
+ * @param arena              - The arena to compact
+ * @param only_if_fragmented - Skip the copy when the free space is already in one block
+ */
+void GeometryPool::Compact(Arena& arena, bool only_if_fragmented) {
+  if (arena.free_blocks.size() <= 1 && only_if_fragmented) return;
+  if (arena.free_blocks.empty()) return;
+
+  // Gather the ranges living in this arena in offset order
+  bool indices = &arena == &m_indices;
+  std::vector<GeometryAllocation*> live;
+  for (auto& i : m_allocations) {
+    if (!i.live) continue;
+    if (indices ? i.num_indices > 0 : (&m_arenas[i.arena] == &arena && i.num_vertices > 0)) {
+      live.push_back(&i);
+    }
+  }
+  std::sort(live.begin(), live.end(), [indices](const GeometryAllocation* a, const GeometryAllocation* b) {
+    return indices ? a->first_index < b->first_index : a->base_vertex < b->base_vertex;
+  });
+
+  // Copy into a new buffer so source and destination never overlap
+  GLuint buffer;
+  glGenBuffers(1, &buffer);
+  GLState::Get().BindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+  glBufferData(GL_COPY_WRITE_BUFFER, GLsizeiptr(arena.capacity) * arena.element_size, nullptr, GL_STATIC_DRAW);
+  GLState::Get().BindBuffer(GL_COPY_READ_BUFFER, arena.buffer);
+
+  unsigned offset = 0;
+  for (auto i : live) {
+    unsigned& start = indices ? i->first_index : i->base_vertex;
+    unsigned count = indices ? i->num_indices : i->num_vertices;
+    glCopyBufferSubData(
+      GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+      GLintptr(start) * arena.element_size, GLintptr(offset) * arena.element_size,
+      GLsizeiptr(count) * arena.element_size
+    );
+    start = offset;
+    offset += count;
+  }
+
+  GLState::Get().BindBuffer(GL_COPY_READ_BUFFER, 0);
+  GLState::Get().BindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+  ReplaceBuffer(arena, buffer);
+  arena.free_blocks.clear();
+  if (offset < arena.capacity) {
+    arena.free_blocks.push_back(FreeBlock{ offset, arena.capacity - offset });
+  }
+}
+
+void GeometryPool::ReplaceBuffer(Arena& arena, GLuint buffer) {
+  // Vertex arrays pointing at the old buffer are rebuilt on next use, all
+  // of them point at the index buffer
+  bool indices = &arena == &m_indices;
+  for (unsigned i = 0; i < m_vertex_arrays.size();) {
+    if (indices || m_vertex_arrays[i].buffer == arena.buffer) {
+      GLState::Get().DeleteVertexArrays(1, &m_vertex_arrays[i].vertex_array);
+      m_vertex_arrays[i] = m_vertex_arrays.back();
+      m_vertex_arrays.pop_back();
+    } else {
+      i++;
+    }
+  }
+
+  GLState::Get().DeleteBuffers(1, &arena.buffer);
+  arena.buffer = buffer;
+}
+
+/**
+ * Gets a vertex array for drawing a mesh, built the first time a buffer,
+ * format and set of attributes is seen
+ * @param  handle - The mesh
+ * @param  format - The vertex format of the mesh
+ * @param  mask   - The attribute locations to enable
+ * @return        The vertex array
+ */
+GLuint GeometryPool::GetVertexArray(GeometryHandle handle, VertexFormat format, unsigned mask) {
+  GLuint buffer = GetVertexBuffer(handle);
+  for (auto& i : m_vertex_arrays) {
+    if (i.buffer == buffer && i.format == format && i.mask == mask) {
+      return i.vertex_array;
+    }
+  }
+
+  VertexArray vertex_array;
+  vertex_array.buffer = buffer;
+  vertex_array.format = format;
+  vertex_array.mask = mask;
+  glGenVertexArrays(1, &vertex_array.vertex_array);
+  GLState::Get().BindVertexArray(vertex_array.vertex_array);
+
+  // The element buffer binding is part of the vertex array state
+  GLState::Get().BindBuffer(GL_ARRAY_BUFFER, buffer);
+  GLState::Get().BindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_indices.buffer);
+
+  const VertexLayout& layout = VertexLayout::Get(format);
+  for (unsigned i = 0; i < ATTRIBUTE_COUNT; i++) {
+    if (!(mask & (1u << i))) continue;
+    const VertexAttribute& attribute = layout.attributes[i];
+    glEnableVertexAttribArray(i);
+    glVertexAttribPointer(i, attribute.size, attribute.type, attribute.normalized, layout.stride, (void*)(uintptr_t)attribute.offset);
+  }
+
+  GLState::Get().BindVertexArray(0);
+  GLState::Get().BindBuffer(GL_ARRAY_BUFFER, 0);
+
+  m_vertex_arrays.push_back(vertex_array);
+  return vertex_array.vertex_array;
+}
+
+void GeometryPool::Defragment() {
+  for (auto& i : m_arenas) {
+    Compact(i, true);
+  }
+  Compact(m_indices, true);
+}
+
+size_t GeometryPool::AddStats(const Arena& arena, GeometryPoolStats& stats) const {
+  if (arena.buffer == 0) return 0;
+  size_t largest = 0;
+  stats.capacity_bytes += size_t(arena.capacity) * arena.element_size;
+  stats.used_bytes += size_t(arena.used) * arena.element_size;
+  stats.num_free_blocks += arena.free_blocks.size();
+  stats.num_buffers++;
+  for (auto& i : arena.free_blocks) {
+    stats.free_bytes += size_t(i.count) * arena.element_size;
+    largest = std::max(largest, size_t(i.count) * arena.element_size);
+  }
+  stats.largest_free_bytes = std::max(stats.largest_free_bytes, largest);
+  return largest;
+}
+
+GeometryPoolStats GeometryPool::GetStats() const {
+  GeometryPoolStats stats = GeometryPoolStats();
+  // Each buffer gets one free block without counting as fragmented
+  size_t largest = 0;
+  for (auto& i : m_arenas) {
+    largest += AddStats(i, stats);
+  }
+  largest += AddStats(m_indices, stats);
+  stats.num_allocations = m_allocations.size() - m_free_handles.size();
+  stats.fragmentation = stats.free_bytes > 0 ? 1.0f - float(largest) / float(stats.free_bytes) : 0.0f;
+  return stats;
+}
+
+void GeometryPool::PrintStats() const {
+  GeometryPoolStats stats = GetStats();
+  std::cout << "Geometry pool: " << stats.num_allocations << " meshes in " << stats.num_buffers << " buffers, "
+            << stats.used_bytes / 1024 << " / " << stats.capacity_bytes / 1024 << " KiB used, "
+            << stats.num_free_blocks << " free blocks, " << int(stats.fragmentation * 100.0f) << "% fragmented"
+            << std::endl;
+}
+
+void GeometryPool::Destroy() {
+  for (auto& i : m_vertex_arrays) {
+    GLState::Get().DeleteVertexArrays(1, &i.vertex_array);
+  }
+  m_vertex_arrays.clear();
+  for (auto& i : m_arenas) {
+    GLState::Get().DeleteBuffers(1, &i.buffer);
+  }
+  m_arenas.clear();
+  if (m_indices.buffer != 0) {
+    GLState::Get().DeleteBuffers(1, &m_indices.buffer);
+  }
+  m_indices.buffer = 0;
+  m_allocations.clear();
+  m_free_handles.clear();
+}
@@ -0,0 +1,62 @@
+#include "gl_caps.h"
+
+GLCaps& GLCaps::Get() {
+  static GLCaps caps;
+  return caps;
+}
+
+void GLCaps::Query() {
+  glGetIntegerv(GL_MAJOR_VERSION, &major_version);
+  glGetIntegerv(GL_MINOR_VERSION, &minor_version);
+
+  #if defined(__APPLE__) || defined(MACOSX)
+    // Apple stops at OpenGL 4.1 without extensions
+    buffer_storage = false;
+    texture_storage = false;
+    s3tc = false;
+    bptc = false;
+    anisotropic = false;
+    multi_draw_indirect = false;
+    texture_buffer_range = false;
+  #else
+    buffer_storage = GLEW_ARB_buffer_storage;
+    texture_storage = GLEW_ARB_texture_storage;
+    s3tc = GLEW_EXT_texture_compression_s3tc;
+    bptc = GLEW_ARB_texture_compression_bptc;
+    anisotropic = GLEW_EXT_texture_filter_anisotropic || GLEW_ARB_texture_filter_anisotropic;
+    // Core in 4.3 apart from the shader draw parameters
+    bool gl43 = major_version > 4 || (major_version == 4 && minor_version >= 3);
+    multi_draw_indirect = (gl43 || (GLEW_ARB_multi_draw_indirect && GLEW_ARB_shader_storage_buffer_object)) &&
+                          GLEW_ARB_shader_draw_parameters;
+    texture_buffer_range = gl43 || GLEW_ARB_texture_buffer_range;
+  #endif
+
+  max_anisotropy = 1.0f;
+  #ifdef GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT
+    if (anisotropic) {
+      glGetFloatv(GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT, &max_anisotropy);
+    }
+  #endif
+
+  std::cout << "OpenGL " << major_version << "." << minor_version
+            << ", buffer storage: " << buffer_storage
+            << ", S3TC: " << s3tc
+            << ", BPTC: " << bptc
+            << ", anisotropy: " << max_anisotropy
+            << ", multi draw indirect: " << multi_draw_indirect << std::endl;
+}
+
+bool GLCaps::SupportsFormat(TextureFormat format) const {
+  // Compressed levels are streamed into immutable storage
+  if (TextureBaker::IsCompressed(format) && !texture_storage) {
+    return false;
+  }
+
+  switch (format) {
+    case TEXTURE_BC1:
+    case TEXTURE_BC3: return s3tc;
+    case TEXTURE_BC7: return bptc;
+    // RGTC is core since OpenGL 3.0
+    default: return true;
+  }
+}
@@ -0,0 +1,418 @@
+#include "gl_state.h"
+#include "render_stats.h"
+
+// A target and the glGet name of what is bound to it
+struct BindingTarget {
+  GLenum target, binding;
+};
+
+static const BindingTarget BUFFER_TARGETS[GL_STATE_BUFFER_TARGETS] = {
+  { GL_ARRAY_BUFFER, GL_ARRAY_BUFFER_BINDING },
+  { GL_ELEMENT_ARRAY_BUFFER, GL_ELEMENT_ARRAY_BUFFER_BINDING },
+  { GL_UNIFORM_BUFFER, GL_UNIFORM_BUFFER_BINDING },
+  { GL_TEXTURE_BUFFER, GL_TEXTURE_BUFFER_BINDING },
+  { GL_SHADER_STORAGE_BUFFER, GL_SHADER_STORAGE_BUFFER_BINDING },
+  { GL_DRAW_INDIRECT_BUFFER, GL_DRAW_INDIRECT_BUFFER_BINDING },
+  { GL_PIXEL_UNPACK_BUFFER, GL_PIXEL_UNPACK_BUFFER_BINDING },
+  { GL_COPY_READ_BUFFER, GL_COPY_READ_BUFFER_BINDING },
+  { GL_COPY_WRITE_BUFFER, GL_COPY_WRITE_BUFFER_BINDING }
+};
+
+static const BindingTarget TEXTURE_TARGETS[GL_STATE_TEXTURE_TARGETS] = {
+  { GL_TEXTURE_2D, GL_TEXTURE_BINDING_2D },
+  { GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BINDING_2D_ARRAY },
+  { GL_TEXTURE_BUFFER, GL_TEXTURE_BINDING_BUFFER }
+};
+
+static const GLenum CAPABILITIES[GL_STATE_CAPABILITIES] = {
+  GL_DEPTH_TEST,
+  GL_BLEND,
+  GL_CULL_FACE,
+  GL_SCISSOR_TEST,
+  GL_POLYGON_OFFSET_FILL,
+  GL_DEPTH_CLAMP
+};
+
+// Index of a target in one of the tables above, -1 if it isn't tracked
+static int find_target(const BindingTarget* targets, unsigned count, GLenum target) {
+  for (unsigned i = 0; i < count; i++) {
+    if (targets[i].target == target) return i;
+  }
+  return -1;
+}
+
+// Which of the indexed binding tables a target uses, -1 for neither
+static int find_indexed(GLenum target) {
+  if (target == GL_UNIFORM_BUFFER) return 0;
+  if (target == GL_SHADER_STORAGE_BUFFER) return 1;
+  return -1;
+}
+
+GLState& GLState::Get() {
+  static GLState state;
+  return state;
+}
+
+GLState::GLState() {
+  Invalidate();
+}
+
+// Forgets everything, the next call setting anything is issued. Call after
+// creating the context or running code that doesn't go through the cache
+void GLState::Invalidate() {
+  m_program = GL_STATE_UNKNOWN;
+  m_vertex_array = GL_STATE_UNKNOWN;
+  for (unsigned i = 0; i < GL_STATE_BUFFER_TARGETS; i++) {
+    m_buffers[i] = GL_STATE_UNKNOWN;
+  }
+  for (unsigned i = 0; i < GL_STATE_INDEXED_BINDINGS; i++) {
+    for (unsigned j = 0; j < 2; j++) {
+      m_indexed_buffers[j][i] = GL_STATE_UNKNOWN;
+      m_indexed_offsets[j][i] = 0;
+      m_indexed_sizes[j][i] = 0;
+    }
+  }
+  m_active_unit = GL_STATE_UNKNOWN;
+  for (unsigned i = 0; i < GL_STATE_TEXTURE_UNITS; i++) {
+    for (unsigned j = 0; j < GL_STATE_TEXTURE_TARGETS; j++) {
+      m_textures[i][j] = GL_STATE_UNKNOWN;
+    }
+  }
+  m_draw_framebuffer = GL_STATE_UNKNOWN;
+  m_read_framebuffer = GL_STATE_UNKNOWN;
+  for (unsigned i = 0; i < GL_STATE_CAPABILITIES; i++) {
+    m_capabilities[i] = GL_STATE_UNKNOWN;
+  }
+  m_depth_mask = GL_STATE_UNKNOWN;
+  m_depth_func = GL_STATE_UNKNOWN;
+  m_color_mask = GL_STATE_UNKNOWN;
+  m_blend_src = GL_STATE_UNKNOWN;
+  m_blend_dst = GL_STATE_UNKNOWN;
+  m_cull_face = GL_STATE_UNKNOWN;
+  for (unsigned i = 0; i < 4; i++) {
+    m_viewport[i] = -1;
+    m_scissor[i] = -1;
+  }
+}
+
+/**
+ * Checks the copy against the driver when built with GL_STATE_VALIDATE
+ * @param  name   - What is checked, for the message
+ * @param  pname  - What glGetIntegerv reads it back with, GL_NONE to skip
+ * @param  values - What the copy holds
+ * @param  count  - How many values glGetIntegerv returns
+ * @return        False if the copy is wrong
+ */
+bool GLState::Validate(const char* name, GLenum pname, const GLint* values, unsigned count) {
+  #ifdef GL_STATE_VALIDATE
+    if (pname == GL_NONE) return true;
+    GLint actual[4] = { 0, 0, 0, 0 };
+    glGetIntegerv(pname, actual);
+    for (unsigned i = 0; i < count; i++) {
+      if (actual[i] == values[i]) continue;
+      std::cout << "GL state cache out of sync: " << name << " is " << actual[i]
+                << ", cached " << values[i] << std::endl;
+      return false;
+    }
+  #endif
+  return true;
+}
+
+bool GLState::Validate(const char* name, GLenum pname, GLuint value) {
+  GLint values[1] = { GLint(value) };
+  return Validate(name, pname, values, 1);
+}
+
+/**
+ * Counts a call and decides whether to drop it
+ * @param  cached - Whether the copy says the call changes nothing
+ * @param  name   - What the call sets
+ * @param  pname  - What glGetIntegerv reads it back with, see Validate
+ * @param  values - What the copy holds
+ * @param  count  - How many values glGetIntegerv returns
+ * @return        True to drop the call
+ */
+bool GLState::Filter(bool cached, const char* name, GLenum pname, const GLint* values, unsigned count) {
+  RenderStats& stats = RenderStats::Get();
+  if (cached) cached = Validate(name, pname, values, count);
+  if (cached) {
+    stats.gl_calls_filtered++;
+  } else {
+    stats.gl_calls_issued++;
+  }
+  return cached;
+}
+
+bool GLState::Filter(bool cached, const char* name, GLenum pname, GLuint value) {
+  GLint values[1] = { GLint(value) };
+  return Filter(cached, name, pname, values, 1);
+}
+
+void GLState::UseProgram(GLuint program) {
+  if (Filter(m_program == program, "program", GL_CURRENT_PROGRAM, program)) return;
+  glUseProgram(program);
+  m_program = program;
+}
+
+void GLState::BindVertexArray(GLuint vertex_array) {
+  if (Filter(m_vertex_array == vertex_array, "vertex array", GL_VERTEX_ARRAY_BINDING, vertex_array)) return;
+  glBindVertexArray(vertex_array);
+  m_vertex_array = vertex_array;
+
+  // The element buffer binding belongs to the vertex array
+  m_buffers[find_target(BUFFER_TARGETS, GL_STATE_BUFFER_TARGETS, GL_ELEMENT_ARRAY_BUFFER)] = GL_STATE_UNKNOWN;
+}
+
+void GLState::BindBuffer(GLenum target, GLuint buffer) {
+  int index = find_target(BUFFER_TARGETS, GL_STATE_BUFFER_TARGETS, target);
+  if (index < 0) {
+    Filter(false, "buffer", GL_NONE, buffer);
+    glBindBuffer(target, buffer);
+    return;
+  }
+  if (Filter(m_buffers[index] == buffer, "buffer", BUFFER_TARGETS[index].binding, buffer)) return;
+  glBindBuffer(target, buffer);
+  m_buffers[index] = buffer;
+}
+
+/**
+ * Decides whether to drop an indexed bind and records it if not. Binding
+ * an indexed point binds the generic target as well
+ * @param  target - GL_UNIFORM_BUFFER or GL_SHADER_STORAGE_BUFFER
+ * @param  index  - The binding point
+ * @param  buffer - The buffer
+ * @param  offset - Start of the range bound
+ * @param  size   - Size of the range bound, 0 for the whole buffer
+ * @return        True to drop the call
+ */
+bool GLState::FilterIndexed(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size) {
+  int table = find_indexed(target);
+  int generic = find_target(BUFFER_TARGETS, GL_STATE_BUFFER_TARGETS, target);
+  if (table < 0 || index >= GL_STATE_INDEXED_BINDINGS) {
+    Filter(false, "indexed buffer", GL_NONE, buffer);
+    if (generic >= 0) m_buffers[generic] = buffer;
+    return false;
+  }
+
+  bool cached = m_indexed_buffers[table][index] == buffer && m_indexed_offsets[table][index] == offset &&
+                m_indexed_sizes[table][index] == size && m_buffers[generic] == buffer;
+  #ifdef GL_STATE_VALIDATE
+    if (cached) {
+      GLint actual = 0;
+      glGetIntegeri_v(BUFFER_TARGETS[generic].binding, index, &actual);
+      if (GLuint(actual) != buffer) {
+        std::cout << "GL state cache out of sync: indexed buffer " << index << " is " << actual
+                  << ", cached " << buffer << std::endl;
+        cached = false;
+      }
+    }
+  #endif
+  if (Filter(cached, "buffer", BUFFER_TARGETS[generic].binding, buffer)) return true;
+  m_indexed_buffers[table][index] = buffer;
+  m_indexed_offsets[table][index] = offset;
+  m_indexed_sizes[table][index] = size;
+  m_buffers[generic] = buffer;
+  return false;
+}
+
+void GLState::BindBufferBase(GLenum target, GLuint index, GLuint buffer) {
+  if (FilterIndexed(target, index, buffer, 0, 0)) return;
+  glBindBufferBase(target, index, buffer);
+}
+
+void GLState::BindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size) {
+  if (FilterIndexed(target, index, buffer, offset, size)) return;
+  glBindBufferRange(target, index, buffer, offset, size);
+}
+
+void GLState::ActiveTexture(GLenum unit) {
+  if (Filter(m_active_unit == unit, "active texture", GL_ACTIVE_TEXTURE, unit)) return;
+  glActiveTexture(unit);
+  m_active_unit = unit;
+}
+
+/**
+ * Binds a texture to the active unit, for creating and uploading it
+ * @param target  - The texture target
+ * @param texture - The texture, 0 to unbind
+ */
+void GLState::BindTexture(GLenum target, GLuint texture) {
+  if (m_active_unit == GL_STATE_UNKNOWN) {
+    Filter(false, "texture", GL_NONE, texture);
+    glBindTexture(target, texture);
+    return;
+  }
+  BindTexture(m_active_unit, target, texture);
+}
+
+/**
+ * Binds a texture to a unit, the active unit only changes if the texture
+ * isn't already bound there
+ * @param unit    - The texture unit, GL_TEXTURE0 and up
+ * @param target  - The texture target
+ * @param texture - The texture, 0 to unbind
+ */
+void GLState::BindTexture(GLenum unit, GLenum target, GLuint texture) {
+  unsigned slot = unit - GL_TEXTURE0;
+  int index = find_target(TEXTURE_TARGETS, GL_STATE_TEXTURE_TARGETS, target);
+  if (slot >= GL_STATE_TEXTURE_UNITS || index < 0) {
+    ActiveTexture(unit);
+    Filter(false, "texture", GL_NONE, texture);
+    glBindTexture(target, texture);
+    return;
+  }
+
+  bool cached = m_textures[slot][index] == texture;
+  #ifdef GL_STATE_VALIDATE
+    // Bindings can only be read back from the active unit
+    if (cached) ActiveTexture(unit);
+  #endif
+  if (Filter(cached, "texture", m_active_unit == unit ? TEXTURE_TARGETS[index].binding : GL_NONE, texture)) return;
+  ActiveTexture(unit);
+  glBindTexture(target, texture);
+  m_textures[slot][index] = texture;
+}
+
+void GLState::BindFramebuffer(GLenum target, GLuint framebuffer) {
+  bool draw = target == GL_FRAMEBUFFER || target == GL_DRAW_FRAMEBUFFER;
+  bool read = target == GL_FRAMEBUFFER || target == GL_READ_FRAMEBUFFER;
+  bool cached = (!draw || m_draw_framebuffer == framebuffer) && (!read || m_read_framebuffer == framebuffer);
+  if (cached && draw && read) cached = Validate("read framebuffer", GL_READ_FRAMEBUFFER_BINDING, framebuffer);
+  GLenum pname = draw ? GL_DRAW_FRAMEBUFFER_BINDING : GL_READ_FRAMEBUFFER_BINDING;
+  if (Filter(cached, "framebuffer", pname, framebuffer)) return;
+  glBindFramebuffer(target, framebuffer);
+  if (draw) m_draw_framebuffer = framebuffer;
+  if (read) m_read_framebuffer = framebuffer;
+}
+
+void GLState::SetCapability(GLenum capability, bool enabled) {
+  int index = -1;
+  for (unsigned i = 0; i < GL_STATE_CAPABILITIES; i++) {
+    if (CAPABILITIES[i] == capability) index = i;
+  }
+  GLuint value = enabled ? 1 : 0;
+  if (index >= 0 && Filter(m_capabilities[index] == value, "capability", capability, value)) return;
+  if (index < 0) Filter(false, "capability", GL_NONE, value);
+
+  if (enabled) {
+    glEnable(capability);
+  } else {
+    glDisable(capability);
+  }
+  if (index >= 0) m_capabilities[index] = value;
+}
+
+void GLState::Enable(GLenum capability) {
+  SetCapability(capability, true);
+}
+
+void GLState::Disable(GLenum capability) {
+  SetCapability(capability, false);
+}
+
+void GLState::DepthMask(GLboolean mask) {
+  if (Filter(m_depth_mask == mask, "depth mask", GL_DEPTH_WRITEMASK, mask)) return;
+  glDepthMask(mask);
+  m_depth_mask = mask;
+}
+
+void GLState::DepthFunc(GLenum func) {
+  if (Filter(m_depth_func == func, "depth func", GL_DEPTH_FUNC, func)) return;
+  glDepthFunc(func);
+  m_depth_func = func;
+}
+
+// The renderer only ever writes all of the color channels or none
+void GLState::ColorMask(GLboolean mask) {
+  GLint values[4] = { mask, mask, mask, mask };
+  if (Filter(m_color_mask == mask, "color mask", GL_COLOR_WRITEMASK, values, 4)) return;
+  glColorMask(mask, mask, mask, mask);
+  m_color_mask = mask;
+}
+
+void GLState::BlendFunc(GLenum src, GLenum dst) {
+  bool cached = m_blend_src == src && m_blend_dst == dst;
+  if (cached) cached = Validate("blend source", GL_BLEND_SRC_RGB, src);
+  if (Filter(cached, "blend destination", GL_BLEND_DST_RGB, dst)) return;
+  glBlendFunc(src, dst);
+  m_blend_src = src;
+  m_blend_dst = dst;
+}
+
+void GLState::CullFace(GLenum mode) {
+  if (Filter(m_cull_face == mode, "cull face", GL_CULL_FACE_MODE, mode)) return;
+  glCullFace(mode);
+  m_cull_face = mode;
+}
+
+void GLState::Viewport(GLint x, GLint y, GLsizei width, GLsizei height) {
+  GLint values[4] = { x, y, width, height };
+  bool cached = m_viewport[0] == x && m_viewport[1] == y && m_viewport[2] == width && m_viewport[3] == height;
+  if (Filter(cached, "viewport", GL_VIEWPORT, values, 4)) return;
+  glViewport(x, y, width, height);
+  for (unsigned i = 0; i < 4; i++) {
+    m_viewport[i] = values[i];
+  }
+}
+
+void GLState::Scissor(GLint x, GLint y, GLsizei width, GLsizei height) {
+  GLint values[4] = { x, y, width, height };
+  bool cached = m_scissor[0] == x && m_scissor[1] == y && m_scissor[2] == width && m_scissor[3] == height;
+  if (Filter(cached, "scissor", GL_SCISSOR_BOX, values, 4)) return;
+  glScissor(x, y, width, height);
+  for (unsigned i = 0; i < 4; i++) {
+    m_scissor[i] = values[i];
+  }
+}
+
+// The program stays current until another is used, but may be gone after
+void GLState::DeleteProgram(GLuint program) {
+  if (m_program == program) m_program = GL_STATE_UNKNOWN;
+  glDeleteProgram(program);
+}
+
+void GLState::DeleteVertexArrays(GLsizei count, const GLuint* vertex_arrays) {
+  for (GLsizei i = 0; i < count; i++) {
+    if (vertex_arrays[i] != 0 && m_vertex_array == vertex_arrays[i]) {
+      m_vertex_array = 0;
+      m_buffers[find_target(BUFFER_TARGETS, GL_STATE_BUFFER_TARGETS, GL_ELEMENT_ARRAY_BUFFER)] = GL_STATE_UNKNOWN;
+    }
+  }
+  glDeleteVertexArrays(count, vertex_arrays);
+}
+
+void GLState::DeleteBuffers(GLsizei count, const GLuint* buffers) {
+  for (GLsizei i = 0; i < count; i++) {
+    if (buffers[i] == 0) continue;
+    for (unsigned j = 0; j < GL_STATE_BUFFER_TARGETS; j++) {
+      if (m_buffers[j] == buffers[i]) m_buffers[j] = 0;
+    }
+    for (unsigned j = 0; j < GL_STATE_INDEXED_BINDINGS; j++) {
+      // Drivers differ on whether indexed bindings are reset
+      if (m_indexed_buffers[0][j] == buffers[i]) m_indexed_buffers[0][j] = GL_STATE_UNKNOWN;
+      if (m_indexed_buffers[1][j] == buffers[i]) m_indexed_buffers[1][j] = GL_STATE_UNKNOWN;
+    }
+  }
+  glDeleteBuffers(count, buffers);
+}
+
+void GLState::DeleteTextures(GLsizei count, const GLuint* textures) {
+  for (GLsizei i = 0; i < count; i++) {
+    if (textures[i] == 0) continue;
+    for (unsigned j = 0; j < GL_STATE_TEXTURE_UNITS; j++) {
+      for (unsigned k = 0; k < GL_STATE_TEXTURE_TARGETS; k++) {
+        if (m_textures[j][k] == textures[i]) m_textures[j][k] = 0;
+      }
+    }
+  }
+  glDeleteTextures(count, textures);
+}
+
+void GLState::DeleteFramebuffers(GLsizei count, const GLuint* framebuffers) {
+  for (GLsizei i = 0; i < count; i++) {
+    if (framebuffers[i] == 0) continue;
+    if (m_draw_framebuffer == framebuffers[i]) m_draw_framebuffer = 0;
+    if (m_read_framebuffer == framebuffers[i]) m_read_framebuffer = 0;
+  }
+  glDeleteFramebuffers(count, framebuffers);
+}
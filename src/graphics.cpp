@@ -1,6 +1,16 @@
 #include "graphics.h"
-
-Graphics::Graphics(Options* _options) : options(_options) {}
+#include "gl_caps.h"
+#include "gl_state.h"
+#include "stream_buffer.h"
+#include "vertex_format.h"
+
+Graphics::Graphics(Options* _options) :
+    options(_options),
+    m_stats_elapsed(0),
+    m_depth_shader(nullptr),
+    m_deferred(false),
+    m_lighting_shader(nullptr),
+    m_use_bvh(true) {}
 
 bool Graphics::Initialize() {
   // Used for the linux OS
@@ -22,23 +32,107 @@ bool Graphics::Initialize() {
     }
   #endif
 
+  // Find out which optional features the driver has
+  GLCaps::Get().Query();
+  GLState::Get().Invalidate();
+
   // For OpenGL 3
   GLuint vao;
   glGenVertexArrays(1, &vao);
-  glBindVertexArray(vao);
+  GLState::Get().BindVertexArray(vao);
 
   //enable depth testing
-  glEnable(GL_DEPTH_TEST);
-  glDepthFunc(GL_LEQUAL);
+  GLState::Get().Enable(GL_DEPTH_TEST);
+  GLState::Get().DepthFunc(GL_LEQUAL);
 
-  //enable blending
-  glEnable(GL_BLEND);
-  glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+  // Blending is only enabled for the transparent pass
+  GLState::Get().BlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
   // Enable culling for reduced render load and better on
   // worse graphics cards
-  glEnable(GL_CULL_FACE);
-  glCullFace(GL_BACK);
+  GLState::Get().Enable(GL_CULL_FACE);
+  GLState::Get().CullFace(GL_BACK);
+
+  // Textures are uploaded in the background within a per frame budget
+  if (!TextureStreamer::Get().Initialize(
+        options->textures.upload_budget_ms,
+        options->textures.staging_size,
+        options->textures.anisotropy)) {
+    std::cout << "Texture streamer failed to initialize." << std::endl;
+    return false;
+  }
+
+  // Every mesh is suballocated from a few large buffers
+  GeometryPool::Get().Initialize(options->geometry.vertex_size, options->geometry.index_size);
+
+  // Pick the vertex format before any model or shader is loaded, the
+  // shaders decode the packed attributes themselves
+  VertexFormat format = VertexLayout::ParseFormat(options->vertex_format);
+  if (format != VERTEX_FULL) Shader::AddGlobalDefine("PACKED_VERTEX");
+  if (format == VERTEX_QUANTIZED) Shader::AddGlobalDefine("QUANTIZED_POSITION");
+  Model::SetVertexFormat(format);
+
+  // Every shader reads the lights from one uniform buffer
+  Shader::AddGlobalDefine("MAX_POINT_LIGHTS " + std::to_string(MAX_POINT_LIGHTS));
+  Shader::AddGlobalDefine("MAX_DIRECTIONAL_LIGHTS " + std::to_string(MAX_DIRECTIONAL_LIGHTS));
+  Shader::AddUniformBlock(LIGHT_BLOCK_NAME, LIGHT_BLOCK_BINDING);
+  m_lights.Initialize();
+
+  // Fragments only loop over the lights reaching their cluster
+  Shader::AddGlobalDefine("LIGHT_CUTOFF " + std::to_string(LIGHT_CUTOFF));
+  Shader::AddGlobalDefine("CLUSTER_X " + std::to_string(CLUSTER_X));
+  Shader::AddGlobalDefine("CLUSTER_Y " + std::to_string(CLUSTER_Y));
+  Shader::AddGlobalDefine("CLUSTER_Z " + std::to_string(CLUSTER_Z));
+  m_clusters.Initialize();
+
+  // Shadow maps have to be known to the shaders before any is compiled.
+  // Programs only declare the shadow samplers when the maps exist, unset
+  // ones would share unit 0 with the color texture
+  if (options->shadows.enabled) {
+    if (m_shadows.Initialize(options->shadows.cascade_size, options->shadows.atlas_size, options->shadows.distance,
+                             options->window.width, options->window.height)) {
+      Shader::AddGlobalDefine("SHADOWS");
+      Shader::AddGlobalDefine("SHADOW_CASCADES " + std::to_string(SHADOW_CASCADES));
+      Shader::AddGlobalDefine("SHADOW_ATLAS_TILES " + std::to_string(SHADOW_ATLAS_TILES));
+      Shader::AddGlobalDefine("SHADOW_MAX_SPOTS " + std::to_string(SHADOW_MAX_SPOTS));
+      Shader::AddGlobalDefine("SHADOW_PCF " + std::to_string(std::min(options->shadows.pcf, 3u)));
+      Shader::AddUniformBlock(SHADOW_BLOCK_NAME, SHADOW_BLOCK_BINDING);
+      m_shadow_scheduler.Initialize(options->shadows.budget_ms);
+    } else {
+      std::cout << "Shadow maps unavailable, drawing without shadows." << std::endl;
+    }
+  }
+
+  // Submit each bucket of draws with one indirect call when the driver
+  // can, the classic path is used otherwise
+  bool multi_draw = options->multi_draw && GLCaps::Get().multi_draw_indirect;
+  if (multi_draw) Shader::AddGlobalDefine("DRAW_DATA_BINDING " + std::to_string(DRAW_DATA_BINDING));
+
+  // The queues write everything they draw per object into one buffer
+  // each frame, single draws bind their object's block from it
+  StreamBuffer::Get().Initialize(options->stream_size);
+  Shader::AddUniformBlock(OBJECT_BLOCK_NAME, OBJECT_BLOCK_BINDING);
+  m_queue.Initialize(multi_draw);
+  m_queue.SetShadows(m_shadows.IsValid());
+  m_shadow_queue.Initialize(multi_draw);
+
+  // Position only program every opaque draw goes through first when the
+  // depth prepass is on, so lighting runs once per visible pixel
+  m_depth_shader = LoadShader("depth");
+  if (options->depth_prepass) m_queue.SetDepthPrepass(m_depth_shader);
+
+  // Light each pixel once from a G-buffer when asked, objects without a
+  // G-buffer program are still drawn forward
+  if (options->pipeline == "deferred" && !InitializeDeferred()) {
+    std::cout << "Deferred pipeline unavailable, drawing forward." << std::endl;
+  }
+
+  // Large scenes are culled a subtree at a time, the flat culler tests
+  // every object but has no tree to keep up to date
+  m_use_bvh = options->culling != "flat";
+  if (options->occlusion.enabled) {
+    m_occlusion.Initialize(options->occlusion.width, options->occlusion.height);
+  }
 
   if (!InitializeCamera()) {
     std::cout << "Camera failed to initialize." << std::endl;
@@ -57,6 +151,24 @@ bool Graphics::InitializeCamera() {
     options->eye.far_plane // Dist to far plane
   );
 
+  // Used to turn object space errors into pixels for picking detail levels
+  options->eye.projection_scale = m_projection_matrix[1][1] * options->window.height * 0.5f;
+
+  // The clusters split this projection, the shaders need to find theirs
+  m_clusters.SetProjection(m_projection_matrix, options->eye.near_plane, options->eye.far_plane);
+  m_lights.SetClusterParams(
+    glm::vec4(
+      float(CLUSTER_X) / options->window.width,
+      float(CLUSTER_Y) / options->window.height,
+      m_clusters.GetSliceScale(),
+      m_clusters.GetSliceBias()
+    ),
+    glm::vec4(options->eye.near_plane, options->eye.far_plane, 0.0f, 0.0f)
+  );
+
+  // The cascades split the same view
+  m_shadows.SetProjection(m_projection_matrix, options->eye.near_plane, options->eye.far_plane);
+
   UpdateCamera();
 
   // No potential for error here
@@ -64,28 +176,97 @@ bool Graphics::InitializeCamera() {
 }
 
 void Graphics::AddObject(std::string shader_name, Object* object, bool is_root) {
-  Shader* tmp = Shader::LoadShader(shader_name);
-  m_shader_list[shader_name] = tmp;
+  Shader* tmp = LoadShader(shader_name);
 
-  if (m_render_list.find(shader_name) != m_render_list.end()) {
-    m_render_list[shader_name].push_back(object);
-  } else {
-    std::vector<Object*> temp(1, object);
-    m_render_list[shader_name] = temp;
+  // Loaded whichever pipeline is in use so it can be switched at any time
+  Shader* gbuffer = nullptr;
+  if (AssetPack::Get().Exists(SHADER_PATH + shader_name + "_gbuffer.frag")) {
+    gbuffer = LoadShader(shader_name, shader_name + "_gbuffer");
+  }
+
+  // Objects whose shader failed to load aren't drawn
+  if (tmp != nullptr) {
+    unsigned index = m_culler.Add();
+    object->SetCullIndex(index);
+    m_drawables.push_back({ object, tmp, gbuffer, m_scene.Insert(object->GetWorldBounds(), index) });
+
+    // The cached static casters no longer match the scene
+    m_shadows.Invalidate();
   }
   if (is_root) {
     m_objects.push_back(object);
   }
 }
 
+/**
+ * Loads a shader and the variants of it the render queue can use. Objects
+ * sharing a model are drawn in one call through the instanced variant,
+ * and every draw of a shader through the multi draw variant when the
+ * driver has it
+ * @param  shader_name - The shader name, without the extension
+ * @return             The shader, nullptr if it failed to load
+ */
+Shader* Graphics::LoadShader(const std::string& shader_name) {
+  return LoadShader(shader_name, shader_name);
+}
+
+/**
+ * Loads a program and its variants, each variant's vertex shader with the
+ * same fragment shader
+ * @param  vertex_name   - The base vertex shader name, without the extension
+ * @param  fragment_name - The fragment shader name, without the extension
+ * @return               The shader, nullptr if it failed to load
+ */
+Shader* Graphics::LoadShader(const std::string& vertex_name, const std::string& fragment_name) {
+  Shader* shader = Shader::LoadShader(vertex_name, fragment_name);
+  if (shader == nullptr) return nullptr;
+  std::string suffix = vertex_name == fragment_name ? "" : "+" + fragment_name;
+  m_shader_list[vertex_name + suffix] = shader;
+
+  for (unsigned i = 0; i < SHADER_VARIANT_COUNT; i++) {
+    ShaderVariant variant = ShaderVariant(i);
+    if (variant == SHADER_VARIANT_MULTI_DRAW && !m_queue.IsMultiDraw()) continue;
+
+    std::string variant_name = vertex_name + Shader::GetVariantSuffix(variant);
+    if (shader->GetVariant(variant) != nullptr || !AssetPack::Get().Exists(SHADER_PATH + variant_name + ".vert")) continue;
+
+    Shader* variant_shader = Shader::LoadShader(variant_name, fragment_name);
+    shader->SetVariant(variant, variant_shader);
+    m_shader_list[variant_name + "+" + fragment_name] = variant_shader;
+  }
+  return shader;
+}
+
+// Creates the G-buffer and loads the lighting program the first time the
+// deferred pipeline is picked
+bool Graphics::InitializeDeferred() {
+  if (m_gbuffer.IsValid()) {
+    m_deferred = true;
+    return true;
+  }
+
+  m_lighting_shader = LoadShader("deferred");
+  if (m_lighting_shader == nullptr || !m_gbuffer.Initialize(options->window.width, options->window.height)) {
+    return false;
+  }
+  m_gbuffer.SetShadows(m_shadows.IsValid());
+  m_deferred = true;
+  return true;
+}
+
 void Graphics::AddPointLight(json light) {
   PointLight point_light(light);
-  m_point_lights.push_back(point_light);
+  m_lights.AddPointLight(point_light);
 }
 
 void Graphics::AddDirectionalLight(json light) {
   DirectionalLight directional_light(light);
-  m_directional_lights.push_back(directional_light);
+  m_lights.AddDirectionalLight(directional_light);
+}
+
+void Graphics::AddSunLight(json light) {
+  SunLight sun_light(light);
+  m_lights.SetSun(sun_light);
 }
 
 void Graphics::Update(unsigned dt) {
@@ -94,6 +275,30 @@ void Graphics::Update(unsigned dt) {
   for (auto i : m_objects) {
     i->Update(dt);
   }
+
+  // Hand the moved bounds to the culler, only objects leaving their fat
+  // bounds in the tree are reinserted
+  for (unsigned i = 0; i < m_drawables.size(); i++) {
+    m_scene_bounds.Add(m_drawables[i].object->GetWorldBounds(), i == 0);
+  }
+  for (auto& i : m_drawables) {
+    if (m_use_bvh) {
+      m_scene.Update(i.proxy, i.object->GetWorldBounds());
+    } else {
+      m_culler.Set(i.object->GetCullIndex(), i.object->GetWorldBounds());
+    }
+  }
+  if (m_use_bvh) m_scene.Optimize();
+
+  // Report what the last few seconds of frames cost and how full the
+  // geometry pool got as models arrived
+  m_stats_elapsed += dt;
+  if (options->stats_interval_ms > 0 && m_stats_elapsed >= options->stats_interval_ms) {
+    RenderStats::Get().Print();
+    GeometryPool::Get().PrintStats();
+    RenderStats::Get().Reset();
+    m_stats_elapsed = 0;
+  }
 }
 
 void Graphics::UpdateCamera() {
@@ -144,50 +349,168 @@ void Graphics::UpdateCamera(int zoom) {
   UpdateCamera();
 }
 
+// Switches between the forward and deferred pipelines for A/B comparisons
+void Graphics::TogglePipeline() {
+  if (m_deferred) {
+    m_deferred = false;
+  } else if (!InitializeDeferred()) {
+    std::cout << "Deferred pipeline unavailable." << std::endl;
+    return;
+  }
+  std::cout << "Pipeline " << (m_deferred ? "deferred" : "forward") << std::endl;
+}
+
+// Switches the depth prepass on or off for A/B comparisons, the render
+// stats show the draws it costs
+void Graphics::ToggleDepthPrepass() {
+  if (m_depth_shader == nullptr) return;
+  m_queue.SetDepthPrepass(m_queue.IsDepthPrepass() ? nullptr : m_depth_shader);
+  std::cout << "Depth prepass " << (m_queue.IsDepthPrepass() ? "on" : "off") << std::endl;
+}
+
 void Graphics::Render() {
+  // Continue streaming textures
+  TextureStreamer::Get().Update();
+  RenderStats::Get().frames++;
+
   // Bind the view buffer
-  glBindBuffer(GL_FRAMEBUFFER, 0);
+  GLState::Get().BindFramebuffer(GL_FRAMEBUFFER, 0);
 
   // Clear the screen
   glClearColor(0.0, 0.0, 0.2, 1.0);
   glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
+  // Upload the lights if any changed, every shader reads the same buffer
+  m_lights.Update();
+
+  // Bin the lights into the view's clusters
+  m_clusters.Assign(m_view_matrix, m_lights.GetBlock());
+  m_clusters.Upload();
+  RenderStats::Get().light_indices += m_clusters.GetIndexCount();
+
   // Combine projection and view matrices
   glm::mat4 proj_view = m_projection_matrix * m_view_matrix;
 
-  // Itterate through through our shaders
-  for (auto i : m_shader_list) {
-    // If the shader failed to load
-    if (i.second == nullptr) continue;
-    // Enable the current shader
-    i.second->Enable();
-
-    for (unsigned j = 0; j < m_point_lights.size(); j++) {
-      std::string basename = "point_lights[" + std::to_string(j) + "]";
-      i.second->uniform3fv(basename + ".light_position", 1, glm::value_ptr(m_point_lights[j].position));
-      i.second->uniform3fv(basename + ".light_color", 1, glm::value_ptr(m_point_lights[j].color));
-      i.second->uniform1f(basename + ".light_strength", m_point_lights[j].strength);
+  // Find the objects in view, the tree counts the boxes it tested
+  // rather than every object
+  RenderStats& stats = RenderStats::Get();
+  Frustum frustum = Frustum::FromMatrix(proj_view);
+  m_visible.clear();
+  if (m_use_bvh) {
+    stats.objects_tested += m_scene.QueryFrustum(frustum, m_visible);
+  } else {
+    m_culler.Cull(frustum);
+    stats.objects_tested += m_culler.GetSize();
+    for (unsigned i = 0; i < m_culler.GetSize(); i++) {
+      if (m_culler.IsVisible(i)) m_visible.push_back(i);
     }
-
-    for (unsigned j = 0; j < m_directional_lights.size(); j++) {
-      std::string basename = "dir_lights[" + std::to_string(j) + "]";
-      i.second->uniform3fv(basename + ".light_position", 1, glm::value_ptr(m_directional_lights[j].position));
-      i.second->uniform3fv(basename + ".light_direction", 1, glm::value_ptr(m_directional_lights[j].direction));
-      i.second->uniform3fv(basename + ".light_color", 1, glm::value_ptr(m_directional_lights[j].color));
-      i.second->uniform1f(basename + ".light_strength", m_directional_lights[j].strength);
-      i.second->uniform1f(basename + ".outer_angle", m_directional_lights[j].outer_angle);
-      i.second->uniform1f(basename + ".inner_angle", m_directional_lights[j].inner_angle);
+  }
+  stats.objects_culled += m_drawables.size() - m_visible.size();
+
+  // Draw the visible occluders into the CPU depth buffer and drop every
+  // other object they hide. Occluders are always drawn, their hulls would
+  // hide themselves
+  if (options->occlusion.enabled) {
+    m_occlusion.Clear();
+    for (auto i : m_visible) {
+      m_drawables[i].object->AddOccluder(m_occlusion);
+    }
+    m_occlusion.Rasterize(proj_view);
+    stats.occluder_triangles += m_occlusion.GetTriangleCount();
+
+    unsigned kept = 0;
+    for (auto i : m_visible) {
+      Object* object = m_drawables[i].object;
+      if (object->IsOccluder() || m_occlusion.TestBox(object->GetWorldBounds())) {
+        m_visible[kept++] = i;
+      } else {
+        stats.objects_occluded++;
+      }
+    }
+    m_visible.resize(kept);
+  }
+  stats.objects_drawn += m_visible.size();
+
+  // The shadow maps this frame's lighting reads
+  if (m_shadows.IsValid()) RenderShadows(frustum);
+
+  // Queue every mesh of every visible object, then draw them sorted so
+  // state only changes between draws that need it
+  m_queue.Clear();
+  for (auto i : m_visible) {
+    const Drawable& drawable = m_drawables[i];
+    if (m_deferred && drawable.gbuffer_shader != nullptr && !drawable.object->props.transparent) {
+      drawable.object->Enqueue(m_queue, drawable.gbuffer_shader, RENDER_PASS_OPAQUE);
+    } else {
+      drawable.object->Enqueue(m_queue, drawable.shader, m_deferred ? RENDER_PASS_FORWARD : RENDER_PASS_OPAQUE);
     }
+  }
+  m_queue.Sort();
+
+  // Deferred, the opaque pass fills the G-buffer and is lit once per
+  // pixel before the forward and transparent draws go on top
+  if (m_deferred) {
+    m_gbuffer.BeginGeometry();
+    m_queue.Submit(proj_view, RENDER_PASS_DEPTH, RENDER_PASS_OPAQUE);
+    m_gbuffer.Resolve(m_lighting_shader, proj_view);
+    m_queue.Submit(proj_view, RENDER_PASS_FORWARD, RENDER_PASS_TRANSPARENT);
+    m_gbuffer.Present();
+  } else {
+    m_queue.Submit(proj_view);
+  }
 
-    // Send uniforms to shader
-    i.second->uniformMatrix4fv("proj_view_matrix", 1, GL_FALSE, glm::value_ptr(proj_view));
+  // Everything this frame streamed is drawn, fence it
+  StreamBuffer::Get().EndFrame();
+}
 
-    // Itterate through all the objects to be rendered
-    // by the currently active shader
-    for (auto j : m_render_list[i.first]) {
-      j->Render(i.second);
+// Places the shadow views around the frame and draws the ones the
+// scheduler picked. Static casters are only drawn into a view's cached
+// layer when the view moved, the dynamic ones on top of a copy of it
+void Graphics::RenderShadows(const Frustum& frustum) {
+  m_shadows.Update(m_view_matrix, m_lights.GetBlock(), m_scene_bounds, frustum);
+  m_shadow_scheduler.Schedule(m_shadows, options->eye.position, options->eye.projection_scale);
+
+  m_shadow_scheduler.BeginFrame();
+  for (auto i : m_shadow_scheduler.GetUpdates()) {
+    const ShadowView& view = m_shadows.GetView(i);
+    if (m_shadows.BeginStatic(i)) DrawCasters(view, false);
+    m_shadows.BeginDynamic(i);
+    DrawCasters(view, true);
+  }
+  m_shadow_scheduler.EndFrame();
+  m_shadows.Finish();
+}
+
+/**
+ * Draws the depth of every caster a shadow view sees
+ * @param view    - The shadow view, its framebuffer already bound
+ * @param dynamic - Draw the dynamic casters, or the static ones
+ */
+void Graphics::DrawCasters(const ShadowView& view, bool dynamic) {
+  RenderStats& stats = RenderStats::Get();
+  Frustum frustum = Frustum::FromMatrix(view.proj_view);
+  m_casters.clear();
+  if (m_use_bvh) {
+    stats.objects_tested += m_scene.QueryFrustum(frustum, m_casters);
+  } else {
+    m_culler.Cull(frustum);
+    stats.objects_tested += m_culler.GetSize();
+    for (unsigned i = 0; i < m_culler.GetSize(); i++) {
+      if (m_culler.IsVisible(i)) m_casters.push_back(i);
     }
   }
+
+  // Transparent objects let the light through
+  m_shadow_queue.Clear();
+  for (auto i : m_casters) {
+    Object* object = m_drawables[i].object;
+    if (object->props.transparent || object->props.dynamic != dynamic) continue;
+    object->Enqueue(m_shadow_queue, m_depth_shader, RENDER_PASS_DEPTH);
+    stats.shadow_casters++;
+  }
+  if (m_shadow_queue.GetSize() == 0) return;
+  m_shadow_queue.Sort();
+  m_shadow_queue.Submit(view.proj_view);
 }
 
 std::string Graphics::ErrorString(GLenum error) {
@@ -235,4 +558,15 @@ Graphics::~Graphics() {
     i = nullptr;
   }
   m_objects.clear();
+
+  TextureStreamer::Get().Destroy();
+  GeometryPool::Get().Destroy();
+  m_lights.Destroy();
+  m_clusters.Destroy();
+  m_gbuffer.Destroy();
+  m_shadows.Destroy();
+  m_shadow_scheduler.Destroy();
+  m_queue.Destroy();
+  m_shadow_queue.Destroy();
+  StreamBuffer::Get().Destroy();
 }
@@ -0,0 +1,98 @@
+#include "light_buffer.h"
+#include "gl_state.h"
+
+static_assert(sizeof(PointLightData) == 32, "PointLightData must match the std140 layout");
+static_assert(sizeof(DirectionalLightData) == 48, "DirectionalLightData must match the std140 layout");
+static_assert(sizeof(LightBlock) % 16 == 0, "LightBlock must match the std140 layout");
+
+LightBuffer::LightBuffer() : m_buffer(0), m_block(), m_dirty(true) {}
+
+void LightBuffer::Initialize() {
+  glGenBuffers(1, &m_buffer);
+  GLState::Get().BindBuffer(GL_UNIFORM_BUFFER, m_buffer);
+  glBufferData(GL_UNIFORM_BUFFER, sizeof(LightBlock), nullptr, GL_DYNAMIC_DRAW);
+  GLState::Get().BindBuffer(GL_UNIFORM_BUFFER, 0);
+
+  // Stays bound for the whole run, every program reads it from here
+  GLState::Get().BindBufferBase(GL_UNIFORM_BUFFER, LIGHT_BLOCK_BINDING, m_buffer);
+  m_dirty = true;
+}
+
+/**
+ * Adds a point light to the end of the block
+ * @param  light - The light to add
+ * @return       False if the block is already full
+ */
+bool LightBuffer::AddPointLight(const PointLight& light) {
+  if (m_block.point_count >= MAX_POINT_LIGHTS) {
+    std::cout << "Too many point lights, the limit is " << MAX_POINT_LIGHTS << std::endl;
+    return false;
+  }
+  SetPointLight(m_block.point_count++, light);
+  return true;
+}
+
+/**
+ * Adds a directional light to the end of the block
+ * @param  light - The light to add
+ * @return       False if the block is already full
+ */
+bool LightBuffer::AddDirectionalLight(const DirectionalLight& light) {
+  if (m_block.directional_count >= MAX_DIRECTIONAL_LIGHTS) {
+    std::cout << "Too many directional lights, the limit is " << MAX_DIRECTIONAL_LIGHTS << std::endl;
+    return false;
+  }
+  SetDirectionalLight(m_block.directional_count++, light);
+  return true;
+}
+
+void LightBuffer::SetPointLight(unsigned index, const PointLight& light) {
+  PointLightData& data = m_block.point_lights[index];
+  data.position = light.position;
+  data.strength = light.strength;
+  data.color = light.color;
+  m_dirty = true;
+}
+
+void LightBuffer::SetDirectionalLight(unsigned index, const DirectionalLight& light) {
+  DirectionalLightData& data = m_block.dir_lights[index];
+  data.position = light.position;
+  data.strength = light.strength;
+  data.direction = light.direction;
+  data.inner_angle = light.inner_angle;
+  data.color = light.color;
+  data.outer_angle = light.outer_angle;
+  m_dirty = true;
+}
+
+void LightBuffer::SetSun(const SunLight& light) {
+  m_block.sun_direction = glm::vec4(glm::normalize(light.direction), light.strength);
+  m_block.sun_color = glm::vec4(light.color, 0.0f);
+  m_dirty = true;
+}
+
+/**
+ * Sets how fragments find their cluster, see LightClusters
+ * @param scale - Pixels to clusters in x and y, slice scale and bias
+ * @param depth - The near and far plane
+ */
+void LightBuffer::SetClusterParams(const glm::vec4& scale, const glm::vec4& depth) {
+  m_block.cluster_scale = scale;
+  m_block.cluster_depth = depth;
+  m_dirty = true;
+}
+
+// Uploads the block if any light changed since the last frame
+void LightBuffer::Update() {
+  if (!m_dirty || m_buffer == 0) return;
+
+  GLState::Get().BindBuffer(GL_UNIFORM_BUFFER, m_buffer);
+  glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(LightBlock), &m_block);
+  GLState::Get().BindBuffer(GL_UNIFORM_BUFFER, 0);
+  m_dirty = false;
+}
+
+void LightBuffer::Destroy() {
+  if (m_buffer != 0) GLState::Get().DeleteBuffers(1, &m_buffer);
+  m_buffer = 0;
+}
@@ -0,0 +1,224 @@
+#include "light_clusters.h"
+#include "gl_state.h"
+#include "model.h"
+
+#if defined(__SSE2__)
+  #include <emmintrin.h>
+#endif
+
+static_assert((CLUSTER_X * CLUSTER_Y) % 4 == 0, "Each slice must be a whole number of SIMD lanes");
+
+LightClusters::LightClusters() :
+    m_near(0.1f),
+    m_slice_scale(1.0f),
+    m_slice_bias(0.0f),
+    m_grid_buffer(0),
+    m_grid_texture(0),
+    m_index_buffer(0),
+    m_index_texture(0) {}
+
+void LightClusters::Initialize() {
+  m_counts.assign(CLUSTER_COUNT, 0);
+  m_cluster_lights.resize(CLUSTER_COUNT * CLUSTER_MAX_LIGHTS);
+  m_grid.assign(CLUSTER_COUNT * 2, 0);
+
+  // The grid is an offset and packed counts per cluster, the indices one
+  // light each
+  glGenBuffers(1, &m_grid_buffer);
+  GLState::Get().BindBuffer(GL_TEXTURE_BUFFER, m_grid_buffer);
+  glBufferData(GL_TEXTURE_BUFFER, m_grid.size() * sizeof(GLuint), nullptr, GL_STREAM_DRAW);
+  glGenBuffers(1, &m_index_buffer);
+  GLState::Get().BindBuffer(GL_TEXTURE_BUFFER, m_index_buffer);
+  glBufferData(GL_TEXTURE_BUFFER, sizeof(GLuint), nullptr, GL_STREAM_DRAW);
+  GLState::Get().BindBuffer(GL_TEXTURE_BUFFER, 0);
+
+  glGenTextures(1, &m_grid_texture);
+  GLState::Get().BindTexture(GL_TEXTURE_BUFFER, m_grid_texture);
+  glTexBuffer(GL_TEXTURE_BUFFER, GL_RG32UI, m_grid_buffer);
+  glGenTextures(1, &m_index_texture);
+  GLState::Get().BindTexture(GL_TEXTURE_BUFFER, m_index_texture);
+  glTexBuffer(GL_TEXTURE_BUFFER, GL_R32UI, m_index_buffer);
+  GLState::Get().BindTexture(GL_TEXTURE_BUFFER, 0);
+}
+
+/**
+ * Rebuilds the view space bounds of every cluster, call whenever the
+ * projection changes
+ * @param projection - The projection matrix
+ * @param near       - Distance to the near plane
+ * @param far        - Distance to the far plane
+ */
+void LightClusters::SetProjection(const glm::mat4& projection, float near, float far) {
+  // Depth slices grow exponentially so clusters stay roughly cube shaped
+  float log_range = std::log(far / near);
+  m_near = near;
+  m_slice_scale = CLUSTER_Z / log_range;
+  m_slice_bias = -CLUSTER_Z * std::log(near) / log_range;
+
+  // Half the view width and height at a distance of one
+  float tan_x = 1.0f / projection[0][0];
+  float tan_y = 1.0f / projection[1][1];
+
+  m_min_x.resize(CLUSTER_COUNT);
+  m_min_y.resize(CLUSTER_COUNT);
+  m_min_z.resize(CLUSTER_COUNT);
+  m_max_x.resize(CLUSTER_COUNT);
+  m_max_y.resize(CLUSTER_COUNT);
+  m_max_z.resize(CLUSTER_COUNT);
+  for (unsigned z = 0; z < CLUSTER_Z; z++) {
+    float slice_near = near * std::pow(far / near, float(z) / CLUSTER_Z);
+    float slice_far = near * std::pow(far / near, float(z + 1) / CLUSTER_Z);
+    for (unsigned y = 0; y < CLUSTER_Y; y++) {
+      float y0 = (-1.0f + 2.0f * y / CLUSTER_Y) * tan_y;
+      float y1 = (-1.0f + 2.0f * (y + 1) / CLUSTER_Y) * tan_y;
+      for (unsigned x = 0; x < CLUSTER_X; x++) {
+        float x0 = (-1.0f + 2.0f * x / CLUSTER_X) * tan_x;
+        float x1 = (-1.0f + 2.0f * (x + 1) / CLUSTER_X) * tan_x;
+
+        // The tile's sides spread out with depth, take both ends
+        unsigned i = x + CLUSTER_X * (y + CLUSTER_Y * z);
+        m_min_x[i] = std::min(x0 * slice_near, x0 * slice_far);
+        m_max_x[i] = std::max(x1 * slice_near, x1 * slice_far);
+        m_min_y[i] = std::min(y0 * slice_near, y0 * slice_far);
+        m_max_y[i] = std::max(y1 * slice_near, y1 * slice_far);
+        m_min_z[i] = slice_near;
+        m_max_z[i] = slice_far;
+      }
+    }
+  }
+}
+
+/**
+ * Adds a light to every cluster its bounding sphere touches, and for spot
+ * lights that its cone reaches too
+ * @param light          - Index written to the clusters' lists
+ * @param center         - Cluster space center, view space with depth positive
+ * @param radius         - Distance the light reaches
+ * @param cone_direction - Cluster space direction of a spot light, nullptr
+ *                         for point lights
+ * @param cone_angle     - Half angle of the spot light's cone
+ */
+void LightClusters::AddSphere(unsigned light, const glm::vec3& center, float radius, const glm::vec3* cone_direction, float cone_angle) {
+  float nearest = center.z - radius, farthest = center.z + radius;
+  if (farthest < m_near) return;
+
+  int first = std::max(0, int(std::floor(std::log(std::max(nearest, m_near)) * m_slice_scale + m_slice_bias)));
+  int last = std::min(CLUSTER_Z - 1, int(std::floor(std::log(farthest) * m_slice_scale + m_slice_bias)));
+  float radius2 = radius * radius;
+  float cone_cos = std::cos(cone_angle), cone_sin = std::sin(cone_angle);
+
+  for (int z = first; z <= last; z++) {
+    unsigned begin = z * CLUSTER_X * CLUSTER_Y;
+    unsigned end = begin + CLUSTER_X * CLUSTER_Y;
+    for (unsigned i = begin; i < end; i += 4) {
+      // Squared distance from the center to each cluster's box
+      int mask;
+#if defined(__SSE2__)
+      __m128 zero = _mm_setzero_ps();
+      __m128 cx = _mm_set1_ps(center.x), cy = _mm_set1_ps(center.y), cz = _mm_set1_ps(center.z);
+      __m128 dx = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&m_min_x[i]), cx), _mm_sub_ps(cx, _mm_loadu_ps(&m_max_x[i]))), zero);
+      __m128 dy = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&m_min_y[i]), cy), _mm_sub_ps(cy, _mm_loadu_ps(&m_max_y[i]))), zero);
+      __m128 dz = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&m_min_z[i]), cz), _mm_sub_ps(cz, _mm_loadu_ps(&m_max_z[i]))), zero);
+      __m128 distance2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+      mask = _mm_movemask_ps(_mm_cmple_ps(distance2, _mm_set1_ps(radius2)));
+#else
+      mask = 0;
+      for (unsigned j = 0; j < 4; j++) {
+        float dx = std::max(std::max(m_min_x[i + j] - center.x, center.x - m_max_x[i + j]), 0.0f);
+        float dy = std::max(std::max(m_min_y[i + j] - center.y, center.y - m_max_y[i + j]), 0.0f);
+        float dz = std::max(std::max(m_min_z[i + j] - center.z, center.z - m_max_z[i + j]), 0.0f);
+        if (dx * dx + dy * dy + dz * dz <= radius2) mask |= 1 << j;
+      }
+#endif
+      for (unsigned j = 0; j < 4; j++) {
+        if ((mask & (1 << j)) == 0) continue;
+        unsigned cluster = i + j;
+
+        // Spot lights skip clusters whose bounding sphere is outside the
+        // cone (Wronski)
+        if (cone_direction != nullptr) {
+          glm::vec3 low(m_min_x[cluster], m_min_y[cluster], m_min_z[cluster]);
+          glm::vec3 high(m_max_x[cluster], m_max_y[cluster], m_max_z[cluster]);
+          glm::vec3 offset = (low + high) * 0.5f - center;
+          float cluster_radius = glm::length(high - low) * 0.5f;
+          float along = glm::dot(offset, *cone_direction);
+          float across = std::sqrt(std::max(glm::dot(offset, offset) - along * along, 0.0f));
+          if (cone_cos * across - along * cone_sin > cluster_radius || along < -cluster_radius) continue;
+        }
+
+        if (m_counts[cluster] < CLUSTER_MAX_LIGHTS) {
+          m_cluster_lights[cluster * CLUSTER_MAX_LIGHTS + m_counts[cluster]++] = light;
+        }
+      }
+    }
+  }
+}
+
+/**
+ * Finds the lights reaching every cluster and packs the lists
+ * @param view   - The view matrix
+ * @param lights - The lights as uploaded to the shaders
+ */
+void LightClusters::Assign(const glm::mat4& view, const LightBlock& lights) {
+  std::fill(m_counts.begin(), m_counts.end(), 0);
+
+  for (int i = 0; i < lights.point_count; i++) {
+    const PointLightData& light = lights.point_lights[i];
+    float radius = light.strength / LIGHT_CUTOFF;
+    if (radius <= 0.0f) continue;
+    glm::vec3 center(view * glm::vec4(light.position, 1.0f));
+    AddSphere(i, glm::vec3(center.x, center.y, -center.z), radius, nullptr, 0.0f);
+  }
+
+  // Points are listed first in each cluster
+  std::vector<unsigned> point_counts(m_counts);
+
+  for (int i = 0; i < lights.directional_count; i++) {
+    const DirectionalLightData& light = lights.dir_lights[i];
+    float radius = light.strength / LIGHT_CUTOFF;
+    if (radius <= 0.0f) continue;
+    glm::vec3 center(view * glm::vec4(light.position, 1.0f));
+    glm::vec3 direction(view * glm::vec4(glm::normalize(light.direction), 0.0f));
+    direction.z = -direction.z;
+
+    // The shaders light nothing behind the light, and past the outer
+    // angle when it is the wider of the two
+    float angle = float(M_PI) / 2.0f;
+    if (light.inner_angle <= light.outer_angle) angle = std::min(angle, light.outer_angle);
+    AddSphere(i, glm::vec3(center.x, center.y, -center.z), radius, &direction, angle);
+  }
+
+  m_indices.clear();
+  for (unsigned i = 0; i < CLUSTER_COUNT; i++) {
+    m_grid[i * 2] = m_indices.size();
+    m_grid[i * 2 + 1] = point_counts[i] | ((m_counts[i] - point_counts[i]) << 16);
+    const uint16_t* list = &m_cluster_lights[i * CLUSTER_MAX_LIGHTS];
+    m_indices.insert(m_indices.end(), list, list + m_counts[i]);
+  }
+}
+
+// Uploads the lists and binds them to their texture units for the frame
+void LightClusters::Upload() {
+  if (m_grid_buffer == 0) return;
+
+  // Orphan last frame's storage rather than wait for the GPU to finish
+  // reading it
+  GLState::Get().BindBuffer(GL_TEXTURE_BUFFER, m_grid_buffer);
+  glBufferData(GL_TEXTURE_BUFFER, m_grid.size() * sizeof(GLuint), m_grid.data(), GL_STREAM_DRAW);
+  GLState::Get().BindBuffer(GL_TEXTURE_BUFFER, m_index_buffer);
+  glBufferData(GL_TEXTURE_BUFFER, std::max<size_t>(m_indices.size(), 1) * sizeof(GLuint),
+               m_indices.empty() ? nullptr : m_indices.data(), GL_STREAM_DRAW);
+  GLState::Get().BindBuffer(GL_TEXTURE_BUFFER, 0);
+
+  GLState::Get().BindTexture(GL_LIGHT_GRID_POS, GL_TEXTURE_BUFFER, m_grid_texture);
+  GLState::Get().BindTexture(GL_LIGHT_INDEX_POS, GL_TEXTURE_BUFFER, m_index_texture);
+}
+
+void LightClusters::Destroy() {
+  if (m_grid_texture != 0) GLState::Get().DeleteTextures(1, &m_grid_texture);
+  if (m_index_texture != 0) GLState::Get().DeleteTextures(1, &m_index_texture);
+  if (m_grid_buffer != 0) GLState::Get().DeleteBuffers(1, &m_grid_buffer);
+  if (m_index_buffer != 0) GLState::Get().DeleteBuffers(1, &m_index_buffer);
+  m_grid_texture = m_index_texture = 0;
+  m_grid_buffer = m_index_buffer = 0;
+}
@@ -1,19 +1,20 @@
 #include "engine.h"
+#include "asset_pack.h"
 
 json config;
 void GetConfig(std::string filename);
 
 /**
- * Loads a file and returns a string
+ * Loads a file from the asset pack or disk and returns a string
  * @param  filename - The filename of the file to read.
  * @return          The string containing the contents of the file.
  */
 std::string load_file(std::string filename) {
-  std::fstream file(filename.c_str(), std::ios::in);
-  std::string result( (std::istreambuf_iterator<char>(file)),
-                      (std::istreambuf_iterator<char>()));
-  file.close();
-  return result;
+  AssetData file;
+  if (!AssetPack::Get().Load(filename, file)) {
+    return "";
+  }
+  return std::string(reinterpret_cast<const char*>(file.Data()), file.Size());
 }
 
 /**
@@ -26,7 +27,15 @@ std::string clip_path(std::string full_path) {
   return full_path.substr(pos + 1);
 }
 
-int main() {
+int main(int argc, char** argv) {
+  // Magick has to be set up before textures are decoded on worker threads
+  Magick::InitializeMagick(*argv);
+
+  // Load assets from the pack when there is one, loose files otherwise
+  if (AssetPack::Get().Open(ASSET_PACK_PATH)) {
+    std::cout << "Loading assets from " << ASSET_PACK_PATH << std::endl;
+  }
+
   GetConfig("../include/config.json");
   Engine* engine = new Engine("Window test", 800, 600);
 
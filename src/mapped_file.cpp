@@ -0,0 +1,79 @@
+#include "mapped_file.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+MappedFile::MappedFile() : m_data(nullptr), m_size(0) {}
+
+bool MappedFile::Open(const std::string& filename) {
+  Close();
+
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+
+  struct stat info;
+  if (fstat(fd, &info) != 0 || info.st_size == 0) {
+    close(fd);
+    return false;
+  }
+
+  void* data = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  // The mapping keeps its own reference to the file
+  close(fd);
+
+  if (data == MAP_FAILED) {
+    return false;
+  }
+
+  m_data = static_cast<const uint8_t*>(data);
+  m_size = info.st_size;
+  return true;
+}
+
+void MappedFile::Close() {
+  if (m_data != nullptr) {
+    munmap(const_cast<uint8_t*>(m_data), m_size);
+  }
+  m_data = nullptr;
+  m_size = 0;
+}
+
+MappedFile::~MappedFile() {
+  Close();
+}
+
+/**
+ * Gets the modification time and size of a file
+ * @param  filename - The path to the file
+ * @param  mtime    - Set to the modification time in nanoseconds
+ * @param  size     - Set to the size of the file in bytes
+ * @return          False if the file does not exist
+ */
+bool stat_file(const std::string& filename, uint64_t& mtime, uint64_t& size) {
+  struct stat info;
+  if (stat(filename.c_str(), &info) != 0) {
+    return false;
+  }
+
+  #if defined(__APPLE__) || defined(MACOSX)
+    mtime = uint64_t(info.st_mtimespec.tv_sec) * 1000000000ull + info.st_mtimespec.tv_nsec;
+  #else
+    mtime = uint64_t(info.st_mtim.tv_sec) * 1000000000ull + info.st_mtim.tv_nsec;
+  #endif
+  size = info.st_size;
+  return true;
+}
+
+/**
+ * Creates a directory if it doesn't already exist
+ * @param  path - The directory to create
+ * @return      True if the directory exists afterwards
+ */
+bool make_directory(const std::string& path) {
+  return mkdir(path.c_str(), 0755) == 0 || errno == EEXIST;
+}
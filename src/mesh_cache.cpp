@@ -0,0 +1,247 @@
+#include "mesh_cache.h"
+#include "model.h"
+
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <sstream>
+
+#define MESH_CACHE_MAGIC 0x4853454d // "MESH"
+#define MESH_CACHE_NAME_LENGTH 128
+#define MESH_CACHE_ALIGNMENT 16
+
+/* ------------------------------------------------------------
+ * On disk layout
+ *
+ * MeshCacheHeader
+ * MeshCacheDependency[num_dependencies]
+ * MeshCacheEntry[num_meshes]
+ * Vertex and index arrays, each aligned to MESH_CACHE_ALIGNMENT
+ * -----------------------------------------------------------*/
+struct MeshCacheHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t vertex_size;
+  uint32_t num_meshes;
+  uint32_t num_dependencies;
+  uint32_t reserved;
+};
+
+struct MeshCacheDependency {
+  char name[MESH_CACHE_NAME_LENGTH];
+  uint64_t mtime, size;
+};
+
+struct MeshCacheEntry {
+  uint64_t vertex_offset, index_offset;
+  uint32_t num_vertices, num_indices;
+  float ambient[3], diffuse[3], specular[3];
+  uint32_t num_lods;
+  MeshLod lods[MESH_MAX_LODS];
+  char texture_name[MESH_CACHE_NAME_LENGTH];
+  char normal_name[MESH_CACHE_NAME_LENGTH];
+};
+
+static uint64_t align_offset(uint64_t offset) {
+  return (offset + MESH_CACHE_ALIGNMENT - 1) & ~uint64_t(MESH_CACHE_ALIGNMENT - 1);
+}
+
+static bool copy_name(char* dest, const std::string& name) {
+  if (name.size() >= MESH_CACHE_NAME_LENGTH) return false;
+  memset(dest, 0, MESH_CACHE_NAME_LENGTH);
+  memcpy(dest, name.c_str(), name.size());
+  return true;
+}
+
+/**
+ * Finds the files an OBJ model is built from, the model itself and
+ * every material library it references
+ * @param  model_name - The name of the model file
+ * @return            The names of the files relative to MODEL_PATH
+ */
+std::vector<std::string> MeshCache::FindDependencies(const std::string& model_name) {
+  std::vector<std::string> dependencies(1, model_name);
+
+  std::istringstream model(load_file(MODEL_PATH + model_name));
+  std::string line;
+  while (std::getline(model, line)) {
+    if (line.compare(0, 7, "mtllib ") != 0) continue;
+
+    std::istringstream libraries(line.substr(7));
+    std::string library;
+    while (libraries >> library) {
+      dependencies.push_back(library);
+    }
+  }
+
+  return dependencies;
+}
+
+MeshCache::MeshCache(const std::string& model_name) :
+  m_model_name(model_name),
+  m_cache_path(CACHE_PATH + model_name + ".mesh") {}
+
+bool MeshCache::Open() {
+  if (!AssetPack::Get().Load(m_cache_path, m_file)) {
+    return false;
+  }
+
+  const uint8_t* data = m_file.Data();
+  size_t size = m_file.Size();
+
+  // Validate the header
+  if (size < sizeof(MeshCacheHeader)) {
+    Close();
+    return false;
+  }
+  const MeshCacheHeader* header = reinterpret_cast<const MeshCacheHeader*>(data);
+  if (header->magic != MESH_CACHE_MAGIC ||
+      header->version != MESH_CACHE_VERSION ||
+      header->vertex_size != sizeof(Vertex)) {
+    std::cout << "Mesh cache for " << m_model_name << " is out of date." << std::endl;
+    Close();
+    return false;
+  }
+
+  uint64_t tables_size = sizeof(MeshCacheHeader) +
+    uint64_t(header->num_dependencies) * sizeof(MeshCacheDependency) +
+    uint64_t(header->num_meshes) * sizeof(MeshCacheEntry);
+  if (size < tables_size) {
+    Close();
+    return false;
+  }
+
+  // Rebuild if any of the source files changed since the cache was written,
+  // a packed cache was packed with its sources
+  const MeshCacheDependency* dependencies =
+    reinterpret_cast<const MeshCacheDependency*>(data + sizeof(MeshCacheHeader));
+  for (unsigned i = 0; i < header->num_dependencies && !m_file.FromPack(); i++) {
+    std::string name(dependencies[i].name, strnlen(dependencies[i].name, MESH_CACHE_NAME_LENGTH));
+    uint64_t mtime, file_size;
+    if (!stat_file(MODEL_PATH + name, mtime, file_size) ||
+        mtime != dependencies[i].mtime ||
+        file_size != dependencies[i].size) {
+      std::cout << "Mesh cache for " << m_model_name << " is stale, " << name << " changed." << std::endl;
+      Close();
+      return false;
+    }
+  }
+
+  // Build views into the mapped file
+  const MeshCacheEntry* entries =
+    reinterpret_cast<const MeshCacheEntry*>(dependencies + header->num_dependencies);
+  m_meshes.clear();
+  for (unsigned i = 0; i < header->num_meshes; i++) {
+    const MeshCacheEntry& entry = entries[i];
+    if (entry.vertex_offset + uint64_t(entry.num_vertices) * sizeof(Vertex) > size ||
+        entry.index_offset + uint64_t(entry.num_indices) * sizeof(unsigned) > size) {
+      Close();
+      return false;
+    }
+
+    MeshView view;
+    view.vertices = reinterpret_cast<const Vertex*>(data + entry.vertex_offset);
+    view.num_vertices = entry.num_vertices;
+    view.indices = reinterpret_cast<const unsigned*>(data + entry.index_offset);
+    view.num_indices = entry.num_indices;
+    for (unsigned j = 0; j < entry.num_lods && j < MESH_MAX_LODS; j++) {
+      if (uint64_t(entry.lods[j].first_index) + entry.lods[j].num_indices > entry.num_indices) {
+        Close();
+        return false;
+      }
+      view.lods.push_back(entry.lods[j]);
+    }
+    view.ambient = glm::make_vec3(entry.ambient);
+    view.diffuse = glm::make_vec3(entry.diffuse);
+    view.specular = glm::make_vec3(entry.specular);
+    view.texture_name = std::string(entry.texture_name, strnlen(entry.texture_name, MESH_CACHE_NAME_LENGTH));
+    view.normal_name = std::string(entry.normal_name, strnlen(entry.normal_name, MESH_CACHE_NAME_LENGTH));
+    m_meshes.push_back(view);
+  }
+
+  return true;
+}
+
+void MeshCache::Close() {
+  m_meshes.clear();
+  m_file.Close();
+}
+
+bool MeshCache::Write(const std::vector<MeshData>& meshes, const std::vector<std::string>& dependency_names) {
+  MeshCacheHeader header;
+  header.magic = MESH_CACHE_MAGIC;
+  header.version = MESH_CACHE_VERSION;
+  header.vertex_size = sizeof(Vertex);
+  header.num_meshes = meshes.size();
+  header.num_dependencies = dependency_names.size();
+  header.reserved = 0;
+
+  // Record the state of the source files
+  std::vector<MeshCacheDependency> dependencies(dependency_names.size());
+  for (unsigned i = 0; i < dependency_names.size(); i++) {
+    if (!copy_name(dependencies[i].name, dependency_names[i]) ||
+        !stat_file(MODEL_PATH + dependency_names[i], dependencies[i].mtime, dependencies[i].size)) {
+      return false;
+    }
+  }
+
+  // Lay out the vertex and index arrays after the tables
+  uint64_t offset = sizeof(MeshCacheHeader) +
+    dependencies.size() * sizeof(MeshCacheDependency) +
+    meshes.size() * sizeof(MeshCacheEntry);
+  std::vector<MeshCacheEntry> entries(meshes.size());
+  for (unsigned i = 0; i < meshes.size(); i++) {
+    MeshCacheEntry& entry = entries[i];
+    memset(&entry, 0, sizeof(entry));
+    entry.num_vertices = meshes[i].vertices.size();
+    entry.num_indices = meshes[i].indices.size();
+    entry.num_lods = std::min<size_t>(meshes[i].lods.size(), MESH_MAX_LODS);
+    for (unsigned j = 0; j < entry.num_lods; j++) {
+      entry.lods[j] = meshes[i].lods[j];
+    }
+    memcpy(entry.ambient, glm::value_ptr(meshes[i].ambient), sizeof(entry.ambient));
+    memcpy(entry.diffuse, glm::value_ptr(meshes[i].diffuse), sizeof(entry.diffuse));
+    memcpy(entry.specular, glm::value_ptr(meshes[i].specular), sizeof(entry.specular));
+    if (!copy_name(entry.texture_name, meshes[i].texture_name) ||
+        !copy_name(entry.normal_name, meshes[i].normal_name)) {
+      return false;
+    }
+
+    entry.vertex_offset = offset = align_offset(offset);
+    offset += entry.num_vertices * sizeof(Vertex);
+    entry.index_offset = offset = align_offset(offset);
+    offset += entry.num_indices * sizeof(unsigned);
+  }
+
+  if (!make_directory(CACHE_PATH)) {
+    return false;
+  }
+
+  // Write to a temporary file and move it into place so a reader never
+  // maps a half written cache
+  std::string temp_path = m_cache_path + ".tmp";
+  std::ofstream file(temp_path.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+  if (!file) {
+    return false;
+  }
+
+  file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  file.write(reinterpret_cast<const char*>(dependencies.data()), dependencies.size() * sizeof(MeshCacheDependency));
+  file.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(MeshCacheEntry));
+
+  const char padding[MESH_CACHE_ALIGNMENT] = { 0 };
+  for (unsigned i = 0; i < meshes.size(); i++) {
+    file.write(padding, entries[i].vertex_offset - uint64_t(file.tellp()));
+    file.write(reinterpret_cast<const char*>(meshes[i].vertices.data()), meshes[i].vertices.size() * sizeof(Vertex));
+    file.write(padding, entries[i].index_offset - uint64_t(file.tellp()));
+    file.write(reinterpret_cast<const char*>(meshes[i].indices.data()), meshes[i].indices.size() * sizeof(unsigned));
+  }
+
+  file.close();
+  if (!file || rename(temp_path.c_str(), m_cache_path.c_str()) != 0) {
+    remove(temp_path.c_str());
+    return false;
+  }
+
+  return true;
+}
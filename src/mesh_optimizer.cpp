@@ -0,0 +1,315 @@
+#include "mesh_optimizer.h"
+
+#include <algorithm>
+#include <cmath>
+
+/**
+ * Runs every pass over one mesh
+ * @param mesh   - The mesh to reorder in place
+ * @param before - Set to the cache statistics of the original order
+ * @param after  - Set to the cache statistics of the optimized order
+ */
+void MeshOptimizer::Optimize(MeshData& mesh, VertexCacheStats& before, VertexCacheStats& after) {
+  before = AnalyzeVertexCache(mesh.indices, mesh.vertices.size(), ANALYZE_CACHE_SIZE);
+
+  OptimizeVertexCache(mesh.indices, mesh.vertices.size());
+  OptimizeOverdraw(mesh.indices, mesh.vertices, OVERDRAW_THRESHOLD);
+  OptimizeVertexFetch(mesh.vertices, mesh.indices);
+
+  after = AnalyzeVertexCache(mesh.indices, mesh.vertices.size(), ANALYZE_CACHE_SIZE);
+}
+
+/* ------------------------------------------------------------
+ * Vertex cache, Forsyth's linear-speed vertex cache optimisation
+ * -----------------------------------------------------------*/
+static float vertex_score(int cache_position, unsigned remaining) {
+  // No triangles left to draw, never pick this vertex again
+  if (remaining == 0) return -1.0f;
+
+  float score = 0.0f;
+  if (cache_position >= 0) {
+    // The last triangle's vertices get a fixed score so the next
+    // triangle doesn't just reuse one of its edges
+    if (cache_position < 3) {
+      score = 0.75f;
+    } else {
+      float scale = 1.0f / (FORSYTH_CACHE_SIZE - 3);
+      score = std::pow(1.0f - (cache_position - 3) * scale, 1.5f);
+    }
+  }
+
+  // Favour vertices with few triangles left so they don't get stranded
+  score += 2.0f / std::sqrt(float(remaining));
+  return score;
+}
+
+void MeshOptimizer::OptimizeVertexCache(std::vector<unsigned>& indices, unsigned num_vertices) {
+  unsigned num_triangles = indices.size() / 3;
+  if (num_triangles == 0) return;
+
+  // Build the vertex to triangle adjacency
+  std::vector<unsigned> remaining(num_vertices, 0), offsets(num_vertices + 1, 0);
+  for (auto i : indices) {
+    remaining[i]++;
+  }
+  for (unsigned v = 0; v < num_vertices; v++) {
+    offsets[v + 1] = offsets[v] + remaining[v];
+  }
+  std::vector<unsigned> adjacency(indices.size()), fill(offsets.begin(), offsets.end() - 1);
+  for (unsigned t = 0; t < num_triangles; t++) {
+    for (unsigned k = 0; k < 3; k++) {
+      adjacency[fill[indices[t * 3 + k]]++] = t;
+    }
+  }
+
+  std::vector<int> cache_position(num_vertices, -1);
+  std::vector<float> scores(num_vertices);
+  for (unsigned v = 0; v < num_vertices; v++) {
+    scores[v] = vertex_score(-1, remaining[v]);
+  }
+
+  std::vector<float> triangle_scores(num_triangles);
+  std::vector<bool> emitted(num_triangles, false);
+  int best = -1;
+  float best_score = -1.0f;
+  for (unsigned t = 0; t < num_triangles; t++) {
+    const unsigned* tri = &indices[t * 3];
+    triangle_scores[t] = scores[tri[0]] + scores[tri[1]] + scores[tri[2]];
+    if (triangle_scores[t] > best_score) {
+      best_score = triangle_scores[t];
+      best = t;
+    }
+  }
+
+  std::vector<unsigned> output;
+  output.reserve(indices.size());
+  std::vector<unsigned> cache, next_cache;
+  cache.reserve(FORSYTH_CACHE_SIZE + 3);
+  next_cache.reserve(FORSYTH_CACHE_SIZE + 3);
+  unsigned cursor = 0;
+
+  for (unsigned n = 0; n < num_triangles; n++) {
+    // Dead end, carry on from the next triangle in the original order
+    if (best < 0) {
+      while (emitted[cursor]) cursor++;
+      best = cursor;
+    }
+
+    const unsigned* tri = &indices[best * 3];
+    emitted[best] = true;
+    output.insert(output.end(), tri, tri + 3);
+
+    // Take the triangle out of its vertices' adjacency lists
+    for (unsigned k = 0; k < 3; k++) {
+      unsigned v = tri[k];
+      unsigned* begin = &adjacency[offsets[v]];
+      unsigned* end = begin + remaining[v];
+      unsigned* found = std::find(begin, end, unsigned(best));
+      *found = *(end - 1);
+      remaining[v]--;
+    }
+
+    // The triangle's vertices move to the front of the cache
+    next_cache.clear();
+    for (unsigned k = 0; k < 3; k++) {
+      if (std::find(next_cache.begin(), next_cache.end(), tri[k]) == next_cache.end()) next_cache.push_back(tri[k]);
+    }
+    for (auto v : cache) {
+      if (v != tri[0] && v != tri[1] && v != tri[2]) next_cache.push_back(v);
+    }
+
+    // Rescore everything that was or is in the cache
+    for (unsigned i = 0; i < next_cache.size(); i++) {
+      unsigned v = next_cache[i];
+      cache_position[v] = i < FORSYTH_CACHE_SIZE ? int(i) : -1;
+      scores[v] = vertex_score(cache_position[v], remaining[v]);
+    }
+
+    // And every triangle they touch, picking the best for next time
+    best = -1;
+    best_score = -1.0f;
+    for (auto v : next_cache) {
+      for (unsigned i = offsets[v]; i < offsets[v] + remaining[v]; i++) {
+        unsigned t = adjacency[i];
+        const unsigned* other = &indices[t * 3];
+        triangle_scores[t] = scores[other[0]] + scores[other[1]] + scores[other[2]];
+        if (triangle_scores[t] > best_score) {
+          best_score = triangle_scores[t];
+          best = t;
+        }
+      }
+    }
+
+    if (next_cache.size() > FORSYTH_CACHE_SIZE) next_cache.resize(FORSYTH_CACHE_SIZE);
+    cache.swap(next_cache);
+  }
+
+  indices.swap(output);
+}
+
+/* ------------------------------------------------------------
+ * Overdraw, Tipsy style cluster sorting
+ * -----------------------------------------------------------*/
+// Simulates a FIFO cache over a range of triangles, returns the misses
+// and records the first triangle of every run that missed all 3 vertices
+static unsigned simulate_cache(const std::vector<unsigned>& indices, unsigned first, unsigned last, unsigned num_vertices,
+                               std::vector<unsigned>* hard_boundaries) {
+  std::vector<unsigned> timestamps(num_vertices, 0);
+  unsigned time = ANALYZE_CACHE_SIZE + 1, misses = 0;
+
+  for (unsigned t = first; t < last; t++) {
+    unsigned triangle_misses = 0;
+    for (unsigned k = 0; k < 3; k++) {
+      unsigned v = indices[t * 3 + k];
+      if (time - timestamps[v] > ANALYZE_CACHE_SIZE) {
+        timestamps[v] = time++;
+        triangle_misses++;
+      }
+    }
+    misses += triangle_misses;
+    if (hard_boundaries != nullptr && triangle_misses == 3 && t != first) {
+      hard_boundaries->push_back(t);
+    }
+  }
+  return misses;
+}
+
+void MeshOptimizer::OptimizeOverdraw(std::vector<unsigned>& indices, const std::vector<Vertex>& vertices, float threshold) {
+  unsigned num_triangles = indices.size() / 3;
+  if (num_triangles == 0) return;
+
+  // Hard boundaries are where the cache order already starts over
+  std::vector<unsigned> hard(1, 0);
+  simulate_cache(indices, 0, num_triangles, vertices.size(), &hard);
+  hard.push_back(num_triangles);
+
+  // Split the hard clusters further as long as the pieces still keep
+  // their ACMR within the threshold of the whole cluster
+  std::vector<unsigned> clusters;
+  for (unsigned c = 0; c + 1 < hard.size(); c++) {
+    unsigned first = hard[c], last = hard[c + 1];
+    float cluster_acmr = float(simulate_cache(indices, first, last, vertices.size(), nullptr)) / (last - first);
+
+    unsigned start = first;
+    clusters.push_back(start);
+    std::vector<bool> cached(vertices.size(), false);
+    std::vector<unsigned> fifo;
+    unsigned misses = 0;
+    for (unsigned t = first; t < last; t++) {
+      for (unsigned k = 0; k < 3; k++) {
+        unsigned v = indices[t * 3 + k];
+        if (!cached[v]) {
+          cached[v] = true;
+          fifo.push_back(v);
+          misses++;
+          if (fifo.size() > ANALYZE_CACHE_SIZE) {
+            cached[fifo.front()] = false;
+            fifo.erase(fifo.begin());
+          }
+        }
+      }
+
+      // Start a new cluster with a cold cache once this one is cheap enough
+      unsigned count = t - start + 1;
+      if (t + 1 < last && count >= 8 && float(misses) / count <= cluster_acmr * threshold) {
+        start = t + 1;
+        clusters.push_back(start);
+        for (auto v : fifo) cached[v] = false;
+        fifo.clear();
+        misses = 0;
+      }
+    }
+  }
+  clusters.push_back(num_triangles);
+
+  // Mesh centroid, weighted by area
+  glm::vec3 mesh_centroid(0.0f);
+  float mesh_area = 0.0f;
+  std::vector<glm::vec3> centroids(clusters.size() - 1, glm::vec3(0.0f)), normals(clusters.size() - 1, glm::vec3(0.0f));
+  for (unsigned c = 0; c + 1 < clusters.size(); c++) {
+    float area = 0.0f;
+    for (unsigned t = clusters[c]; t < clusters[c + 1]; t++) {
+      const glm::vec3& a = vertices[indices[t * 3 + 0]].position;
+      const glm::vec3& b = vertices[indices[t * 3 + 1]].position;
+      const glm::vec3& d = vertices[indices[t * 3 + 2]].position;
+      glm::vec3 normal = glm::cross(b - a, d - a);
+      float triangle_area = glm::length(normal);
+      centroids[c] += (a + b + d) * (triangle_area / 3.0f);
+      normals[c] += normal;
+      area += triangle_area;
+    }
+    mesh_centroid += centroids[c];
+    mesh_area += area;
+    if (area > 0.0f) centroids[c] /= area;
+  }
+  if (mesh_area > 0.0f) mesh_centroid /= mesh_area;
+
+  // Draw the clusters that face outwards the most first, they are the
+  // most likely to occlude the rest of the mesh
+  std::vector<float> sort_keys(clusters.size() - 1);
+  std::vector<unsigned> order(clusters.size() - 1);
+  for (unsigned c = 0; c < order.size(); c++) {
+    float length = glm::length(normals[c]);
+    glm::vec3 normal = length > 0.0f ? normals[c] / length : glm::vec3(0.0f);
+    sort_keys[c] = glm::dot(centroids[c] - mesh_centroid, normal);
+    order[c] = c;
+  }
+  std::stable_sort(order.begin(), order.end(), [&sort_keys](unsigned a, unsigned b) {
+    return sort_keys[a] > sort_keys[b];
+  });
+
+  std::vector<unsigned> output;
+  output.reserve(indices.size());
+  for (auto c : order) {
+    output.insert(output.end(), indices.begin() + clusters[c] * 3, indices.begin() + clusters[c + 1] * 3);
+  }
+  indices.swap(output);
+}
+
+/* ------------------------------------------------------------
+ * Vertex fetch, store vertices in the order they are first used
+ * -----------------------------------------------------------*/
+void MeshOptimizer::OptimizeVertexFetch(std::vector<Vertex>& vertices, std::vector<unsigned>& indices) {
+  const unsigned unused = ~0u;
+  std::vector<unsigned> remap(vertices.size(), unused);
+  std::vector<Vertex> output;
+  output.reserve(vertices.size());
+
+  // Vertices no triangle uses are dropped
+  for (auto& i : indices) {
+    if (remap[i] == unused) {
+      remap[i] = output.size();
+      output.push_back(vertices[i]);
+    }
+    i = remap[i];
+  }
+  vertices.swap(output);
+}
+
+/* ------------------------------------------------------------
+ * Analysis
+ * -----------------------------------------------------------*/
+/**
+ * Simulates a FIFO post-transform cache over an index buffer
+ * @param  indices      - The triangle list
+ * @param  num_vertices - The number of vertices the indices refer to
+ * @param  cache_size   - The number of entries in the simulated cache
+ * @return              The average cache miss ratios
+ */
+VertexCacheStats MeshOptimizer::AnalyzeVertexCache(const std::vector<unsigned>& indices, unsigned num_vertices, unsigned cache_size) {
+  VertexCacheStats stats;
+  if (indices.empty() || num_vertices == 0) return stats;
+
+  std::vector<unsigned> timestamps(num_vertices, 0);
+  unsigned time = cache_size + 1, misses = 0;
+  for (auto v : indices) {
+    if (time - timestamps[v] > cache_size) {
+      timestamps[v] = time++;
+      misses++;
+    }
+  }
+
+  stats.acmr = float(misses) / (indices.size() / 3);
+  stats.atvr = float(misses) / num_vertices;
+  return stats;
+}
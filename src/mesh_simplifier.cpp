@@ -0,0 +1,251 @@
+#include "mesh_simplifier.h"
+#include "mesh_optimizer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <queue>
+
+/* ------------------------------------------------------------
+ * Quadric error metrics, Garland and Heckbert
+ * -----------------------------------------------------------*/
+// Symmetric 4x4 matrix summing the squared distance to a set of planes
+struct Quadric {
+  Quadric() {
+    for (unsigned i = 0; i < 10; i++) m[i] = 0.0;
+  }
+  Quadric(const glm::vec3& normal, float distance) {
+    double x = normal.x, y = normal.y, z = normal.z, d = distance;
+    m[0] = x * x; m[1] = x * y; m[2] = x * z; m[3] = x * d;
+    m[4] = y * y; m[5] = y * z; m[6] = y * d;
+    m[7] = z * z; m[8] = z * d;
+    m[9] = d * d;
+  }
+  Quadric& operator+=(const Quadric& other) {
+    for (unsigned i = 0; i < 10; i++) m[i] += other.m[i];
+    return *this;
+  }
+  double Error(const glm::vec3& p) const {
+    double x = p.x, y = p.y, z = p.z;
+    return m[0] * x * x + 2.0 * m[1] * x * y + 2.0 * m[2] * x * z + 2.0 * m[3] * x +
+           m[4] * y * y + 2.0 * m[5] * y * z + 2.0 * m[6] * y +
+           m[7] * z * z + 2.0 * m[8] * z +
+           m[9];
+  }
+  double m[10];
+};
+
+// Moving vertex 'from' onto vertex 'to', cheapest first
+struct Collapse {
+  double cost;
+  unsigned from, to;
+  bool operator<(const Collapse& other) const { return cost > other.cost; }
+};
+
+static inline uint64_t edge_key(unsigned a, unsigned b) {
+  return a < b ? (uint64_t(a) << 32) | b : (uint64_t(b) << 32) | a;
+}
+
+/**
+ * Builds one detail level by collapsing edges until the target is reached.
+ * Vertices are only ever moved onto other vertices so the result indexes
+ * the same vertex array. Borders and attribute seams are kept in place
+ * @param  vertices       - The vertices of the mesh
+ * @param  indices        - The triangles to simplify
+ * @param  target_indices - The number of indices to aim for
+ * @param  result         - Set to the simplified triangles
+ * @return                The object space error of the result
+ */
+float MeshSimplifier::Simplify(const std::vector<Vertex>& vertices, const std::vector<unsigned>& indices,
+                               unsigned target_indices, std::vector<unsigned>& result) {
+  unsigned num_vertices = vertices.size();
+  unsigned num_triangles = indices.size() / 3;
+
+  // Vertices that share a position with another are on a uv or normal
+  // seam, moving them would tear the surface open
+  std::vector<unsigned> sorted(num_vertices), canonical(num_vertices);
+  for (unsigned i = 0; i < num_vertices; i++) sorted[i] = i;
+  std::sort(sorted.begin(), sorted.end(), [&vertices](unsigned a, unsigned b) {
+    const glm::vec3& pa = vertices[a].position;
+    const glm::vec3& pb = vertices[b].position;
+    if (pa.x != pb.x) return pa.x < pb.x;
+    if (pa.y != pb.y) return pa.y < pb.y;
+    return pa.z < pb.z;
+  });
+
+  std::vector<bool> locked(num_vertices, false);
+  for (unsigned i = 0; i < num_vertices;) {
+    unsigned j = i + 1;
+    while (j < num_vertices && vertices[sorted[j]].position == vertices[sorted[i]].position) j++;
+    for (unsigned k = i; k < j; k++) {
+      canonical[sorted[k]] = sorted[i];
+      if (j - i > 1) locked[sorted[k]] = true;
+    }
+    i = j;
+  }
+
+  // Count how many triangles use each edge of the welded mesh, anything
+  // but two is a border or non-manifold edge
+  std::vector<unsigned> triangles;
+  triangles.reserve(indices.size());
+  std::unordered_map<uint64_t, unsigned> edge_counts;
+  for (unsigned t = 0; t < num_triangles; t++) {
+    const unsigned* tri = &indices[t * 3];
+    if (tri[0] == tri[1] || tri[1] == tri[2] || tri[0] == tri[2]) continue;
+    triangles.insert(triangles.end(), tri, tri + 3);
+    for (unsigned k = 0; k < 3; k++) {
+      edge_counts[edge_key(canonical[tri[k]], canonical[tri[(k + 1) % 3]])]++;
+    }
+  }
+  num_triangles = triangles.size() / 3;
+
+  std::vector<Quadric> quadrics(num_vertices);
+  std::vector<std::vector<unsigned> > adjacency(num_vertices);
+  for (unsigned t = 0; t < num_triangles; t++) {
+    const unsigned* tri = &triangles[t * 3];
+    for (unsigned k = 0; k < 3; k++) {
+      if (edge_counts[edge_key(canonical[tri[k]], canonical[tri[(k + 1) % 3]])] != 2) {
+        locked[tri[k]] = true;
+        locked[tri[(k + 1) % 3]] = true;
+      }
+      adjacency[tri[k]].push_back(t);
+    }
+
+    const glm::vec3& p0 = vertices[tri[0]].position;
+    glm::vec3 normal = glm::cross(vertices[tri[1]].position - p0, vertices[tri[2]].position - p0);
+    float length = glm::length(normal);
+    if (length == 0.0f) continue;
+    normal /= length;
+    Quadric plane(normal, -glm::dot(normal, p0));
+    for (unsigned k = 0; k < 3; k++) {
+      quadrics[tri[k]] += plane;
+    }
+  }
+
+  std::priority_queue<Collapse> queue;
+  for (unsigned t = 0; t < num_triangles; t++) {
+    for (unsigned k = 0; k < 3; k++) {
+      unsigned a = triangles[t * 3 + k], b = triangles[t * 3 + (k + 1) % 3];
+      Quadric q = quadrics[a];
+      q += quadrics[b];
+      if (!locked[a]) queue.push({ q.Error(vertices[b].position), a, b });
+      if (!locked[b]) queue.push({ q.Error(vertices[a].position), b, a });
+    }
+  }
+
+  std::vector<bool> removed(num_triangles, false), collapsed(num_vertices, false);
+  unsigned live_triangles = num_triangles;
+  double max_error = 0.0;
+
+  while (live_triangles * 3 > target_indices && !queue.empty()) {
+    Collapse collapse = queue.top();
+    queue.pop();
+    unsigned from = collapse.from, to = collapse.to;
+    if (collapsed[from] || collapsed[to]) continue;
+
+    // Costs only grow as quadrics merge, so a stale entry is pushed back
+    // with its current cost instead of being trusted
+    Quadric q = quadrics[from];
+    q += quadrics[to];
+    double cost = q.Error(vertices[to].position);
+    if (cost > collapse.cost * 1.0001 + 1e-12) {
+      queue.push({ cost, from, to });
+      continue;
+    }
+
+    // Make sure the two are still connected and that moving the vertex
+    // doesn't fold any triangle over
+    bool connected = false, flipped = false;
+    const glm::vec3& target = vertices[to].position;
+    for (auto t : adjacency[from]) {
+      if (removed[t]) continue;
+      const unsigned* tri = &triangles[t * 3];
+      if (tri[0] == to || tri[1] == to || tri[2] == to) {
+        connected = true;
+        continue;
+      }
+      glm::vec3 p[3], moved[3];
+      for (unsigned k = 0; k < 3; k++) {
+        p[k] = moved[k] = vertices[tri[k]].position;
+        if (tri[k] == from) moved[k] = target;
+      }
+      glm::vec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+      glm::vec3 after = glm::cross(moved[1] - moved[0], moved[2] - moved[0]);
+      if (glm::dot(before, after) <= 0.0f) {
+        flipped = true;
+        break;
+      }
+    }
+    if (!connected || flipped) continue;
+
+    // Move the vertex, triangles on the collapsed edge disappear
+    for (auto t : adjacency[from]) {
+      if (removed[t]) continue;
+      unsigned* tri = &triangles[t * 3];
+      if (tri[0] == to || tri[1] == to || tri[2] == to) {
+        removed[t] = true;
+        live_triangles--;
+        continue;
+      }
+      for (unsigned k = 0; k < 3; k++) {
+        if (tri[k] == from) tri[k] = to;
+      }
+      adjacency[to].push_back(t);
+    }
+    adjacency[from].clear();
+    collapsed[from] = true;
+    quadrics[to] = q;
+    max_error = std::max(max_error, cost);
+
+    // Requeue every edge around the merged vertex with its new cost
+    for (auto t : adjacency[to]) {
+      if (removed[t]) continue;
+      for (unsigned k = 0; k < 3; k++) {
+        unsigned other = triangles[t * 3 + k];
+        if (other == to) continue;
+        Quadric merged = quadrics[to];
+        merged += quadrics[other];
+        if (!locked[to]) queue.push({ merged.Error(vertices[other].position), to, other });
+        if (!locked[other]) queue.push({ merged.Error(target), other, to });
+      }
+    }
+  }
+
+  result.clear();
+  result.reserve(live_triangles * 3);
+  for (unsigned t = 0; t < num_triangles; t++) {
+    if (!removed[t]) result.insert(result.end(), &triangles[t * 3], &triangles[t * 3] + 3);
+  }
+
+  return float(std::sqrt(max_error));
+}
+
+/**
+ * Appends coarser detail levels to a mesh, each one simplified from the
+ * full mesh and reordered for the vertex cache
+ * @param mesh - The mesh, its indices must only contain the full level
+ */
+void MeshSimplifier::GenerateLods(MeshData& mesh) {
+  mesh.lods.clear();
+  MeshLod full = { 0, unsigned(mesh.indices.size()), 0.0f };
+  mesh.lods.push_back(full);
+
+  std::vector<unsigned> source = mesh.indices;
+  unsigned target = source.size();
+  for (unsigned level = 1; level < MESH_MAX_LODS; level++) {
+    target = unsigned(target / 3 * LOD_REDUCTION) * 3;
+    if (target < LOD_MIN_TRIANGLES * 3) break;
+
+    std::vector<unsigned> simplified;
+    float error = Simplify(mesh.vertices, source, target, simplified);
+
+    const MeshLod& last = mesh.lods.back();
+    if (simplified.size() > last.num_indices * LOD_MIN_REDUCTION) break;
+
+    MeshOptimizer::OptimizeVertexCache(simplified, mesh.vertices.size());
+
+    // Keep the errors increasing so coarser always means less accurate
+    MeshLod lod = { unsigned(mesh.indices.size()), unsigned(simplified.size()), std::max(error, last.error) };
+    mesh.indices.insert(mesh.indices.end(), simplified.begin(), simplified.end());
+    mesh.lods.push_back(lod);
+  }
+}
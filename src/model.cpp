@@ -1,46 +1,118 @@
 #include "model.h"
+#include "gl_caps.h"
+#include "gl_state.h"
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <assimp/IOStream.hpp>
+#include <assimp/IOSystem.hpp>
 
 /* ------------------------------------------------------------
  * Texture Class - For loading textures
  * -----------------------------------------------------------*/
 Texture* Texture::LoadTexture(std::string texture_name) {
   // So we don't load the same texture more than once
+  static std::mutex texture_mutex;
   static std::unordered_map<std::string, Texture*> texture_map;
 
+  std::lock_guard<std::mutex> lock(texture_mutex);
+
   // If the texture already exists in the map return it
   if (texture_map.find(texture_name) != texture_map.end()) {
     return texture_map[texture_name];
   }
 
-  // Else create a new texture
+  // Else create a new texture and decode it on the thread pool, it can be
+  // bound straight away and shows a placeholder until it is uploaded
   Texture* new_texture = new Texture(texture_name);
+  ThreadPool::Get().Enqueue([new_texture]() { new_texture->Decode(); });
 
-  // If an error occurred return nullptr
-  if (new_texture->error) {
-    return nullptr;
-  }
-
-  // Else insert the new texture into the map and return it
+  // Insert the new texture into the map and return it
   texture_map[texture_name] = new_texture;
   return new_texture;
 }
 
-Texture::Texture(std::string texture_name) {
-  error = false;
+Texture::Texture(std::string texture_name) :
+    m_initialized(false),
+    m_name(texture_name),
+    m_state(DECODING),
+    m_data(nullptr),
+    m_upload_level(0),
+    m_upload_row(0),
+    m_fence(0),
+    t_Location(0) {}
+
+void Texture::Decode() {
+  // Prefer an offline baked texture when the driver can sample it
+  if (LoadBaked()) {
+    m_state = DECODED;
+    return;
+  }
+
+  AssetData file;
+  if (!AssetPack::Get().Load(TEXTURE_PATH + m_name, file)) {
+    std::cout << "Failed to load texture " << m_name << ", file not found." << std::endl;
+    m_state = FAILED;
+    return;
+  }
 
   try {
-    // Load image
-    t_Image = new Magick::Image(TEXTURE_PATH + texture_name);
-    t_Blob = new Magick::Blob();
-    t_Image->magick("JPEG");
-    // Write image data to blob
-    t_Image->write(t_Blob, "RGBA");
+    // Load image, the extension tells Magick what formats like TGA are
+    // since they have no signature
+    Magick::Image image;
+    std::string extension = m_name.substr(m_name.find_last_of('.') + 1);
+    std::transform(extension.begin(), extension.end(), extension.begin(), ::toupper);
+    image.magick(extension);
+    image.read(Magick::Blob(file.Data(), file.Size()));
+    Magick::Blob blob;
+    // Write 8 bit image data to blob
+    image.write(&blob, "RGBA", 8);
+
+    // Build the mip chain here instead of on the context thread
+    TextureBaker::GenerateMipChain(
+      static_cast<const uint8_t*>(blob.data()),
+      image.columns(),
+      image.rows(),
+      TextureBaker::IsNormalMap(m_name),
+      m_image
+    );
+    m_data = m_image.data.data();
+    m_state = DECODED;
   } catch(Magick::Error& err) {
-    std::cout << "Failed to load texture " << texture_name <<  ", Error: " << err.what() << std::endl;
-    error = true;
+    std::cout << "Failed to load texture " << m_name <<  ", Error: " << err.what() << std::endl;
+    m_state = FAILED;
+  }
+}
+
+bool Texture::LoadBaked() {
+  if (!AssetPack::Get().Load(BAKED_TEXTURE_PATH + m_name + ".ktx", m_baked)) {
+    return false;
+  }
+
+  uint64_t source_mtime, source_size, mtime, size;
+  if (!TextureBaker::ParseKTX(m_baked.Data(), m_baked.Size(), m_image, source_mtime, source_size)) {
+    std::cout << "Baked texture " << m_name << " is not a valid KTX file." << std::endl;
+    m_baked.Close();
+    return false;
+  }
+
+  // Ignore the bake if the source image changed since, packed textures
+  // were packed with their sources
+  if (!m_baked.FromPack() && stat_file(TEXTURE_PATH + m_name, mtime, size) && (mtime != source_mtime || size != source_size)) {
+    std::cout << "Baked texture " << m_name << " is stale, rebake it." << std::endl;
+    m_baked.Close();
+    return false;
   }
 
-  m_initialized = false;
+  if (!GLCaps::Get().SupportsFormat(m_image.format)) {
+    std::cout << "Baked texture " << m_name << " uses an unsupported format, falling back to RGBA8." << std::endl;
+    m_baked.Close();
+    return false;
+  }
+
+  m_data = m_baked.Data();
+  return true;
 }
 
 void Texture::InitializeTexture() {
@@ -48,156 +120,398 @@ void Texture::InitializeTexture() {
     // Gen new texture location
     glGenTextures(1, &t_Location);
     // Bind newly generated texture to active
-    glBindTexture(GL_TEXTURE_2D, t_Location);
-
-    glTexImage2D(
-      GL_TEXTURE_2D,
-      0,
-      GL_RGBA,
-      t_Image->columns(),
-      t_Image->rows(),
-      0,
-      GL_RGBA,
-      GL_UNSIGNED_BYTE,
-      t_Blob->data()
-    );
+    GLState::Get().BindTexture(GL_TEXTURE_2D, t_Location);
 
+    // The minification filter is set once the mip chain is known
     glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_LINEAR);
 
-    glBindTexture(GL_TEXTURE_2D, 0);
+    GLState::Get().BindTexture(GL_TEXTURE_2D, 0);
 
-    delete t_Image;
-    delete t_Blob;
-
-    t_Image = nullptr;
-    t_Blob = nullptr;
+    // The pixels are uploaded across the next frames once decoded
+    TextureStreamer::Get().Enqueue(this);
 
     m_initialized = true;
   }
 }
 
 void Texture::BindTexture(GLenum t_Target) {
-  glActiveTexture(t_Target);
-  glBindTexture(GL_TEXTURE_2D, t_Location);
+  GLState::Get().BindTexture(t_Target, GL_TEXTURE_2D, GetBinding(t_Target));
+}
+
+// The texture to bind to a unit, the placeholder until the upload is done
+GLuint Texture::GetBinding(GLenum t_Target) {
+  return m_state == READY ? t_Location : TextureStreamer::Get().GetPlaceholder(t_Target);
 }
 
 Texture::~Texture() {
-  if (!m_initialized) {
-    delete t_Image;
-    delete t_Blob;
-    t_Image = nullptr;
-    t_Blob = nullptr;
+  if (m_fence != 0) {
+    glDeleteSync(m_fence);
+  }
+  if (t_Location != 0) {
+    GLState::Get().DeleteTextures(1, &t_Location);
   }
 }
 
+/* ------------------------------------------------------------
+ * Asset IO - So assimp reads models and materials through the pack
+ * -----------------------------------------------------------*/
+class AssetIOStream : public Assimp::IOStream {
+  public:
+    AssetIOStream() : m_position(0) {}
+
+    size_t Read(void* buffer, size_t size, size_t count) {
+      if (size == 0) return 0;
+      size_t available = (m_data.Size() - m_position) / size;
+      count = std::min(count, available);
+      memcpy(buffer, m_data.Data() + m_position, size * count);
+      m_position += size * count;
+      return count;
+    }
+
+    size_t Write(const void*, size_t, size_t) { return 0; }
+
+    aiReturn Seek(size_t offset, aiOrigin origin) {
+      size_t base = origin == aiOrigin_SET ? 0 : origin == aiOrigin_CUR ? m_position : m_data.Size();
+      if (base + offset > m_data.Size()) return aiReturn_FAILURE;
+      m_position = base + offset;
+      return aiReturn_SUCCESS;
+    }
+
+    size_t Tell() const { return m_position; }
+    size_t FileSize() const { return m_data.Size(); }
+    void Flush() {}
+
+    AssetData m_data;
+    size_t m_position;
+};
+
+class AssetIOSystem : public Assimp::IOSystem {
+  public:
+    bool Exists(const char* path) const {
+      return AssetPack::Get().Exists(path);
+    }
+
+    char getOsSeparator() const { return '/'; }
+
+    Assimp::IOStream* Open(const char* path, const char* mode) {
+      // Assets are read only
+      if (strchr(mode, 'w') != nullptr) return nullptr;
+
+      AssetIOStream* stream = new AssetIOStream();
+      if (!AssetPack::Get().Load(path, stream->m_data)) {
+        delete stream;
+        return nullptr;
+      }
+      return stream;
+    }
+
+    void Close(Assimp::IOStream* stream) {
+      delete stream;
+    }
+};
+
 /* ------------------------------------------------------------
  * Model Class - For loading models
  * -----------------------------------------------------------*/
-Model* Model::LoadModel(std::string model_name) {
-  // So we dont load the same model more than once
-  static std::unordered_map<std::string, Model*> model_map;
+// So we dont load the same model more than once, requests from any
+// thread share one import
+static std::mutex model_mutex;
+static std::unordered_map<std::string, std::shared_future<Model*> > model_map;
+
+// Format the vertex buffers are packed into, set before any model is requested
+static VertexFormat vertex_format = VERTEX_FULL;
+
+void Model::SetVertexFormat(VertexFormat format) {
+  vertex_format = format;
+}
 
-  // If the model is already loaded return a pointer to it
+void Model::RequestModel(std::string model_name) {
+  std::lock_guard<std::mutex> lock(model_mutex);
+
+  // If the model is already loaded or loading there is nothing to do
   if (model_map.find(model_name) != model_map.end()) {
-    return model_map[model_name];
+    return;
   }
 
-  // Else create a new model
-  Model* new_model = new Model(model_name);
+  // Else import the model on the thread pool
+  model_map[model_name] = ThreadPool::Get().Submit<Model*>([model_name]() -> Model* {
+    Model* new_model = new Model(model_name);
+
+    // If an error occured return nullptr
+    if (new_model->error) {
+      delete new_model;
+      return nullptr;
+    }
+
+    // Start decoding the textures the model needs
+    for (auto& i : new_model->m_pending) {
+      if (i.texture_name != "") Texture::LoadTexture(i.texture_name);
+      if (i.normal_name != "") Texture::LoadTexture(i.normal_name);
+    }
+
+    return new_model;
+  });
+}
 
-  // If an error occured return nullptr
-  if (new_model->error) {
-    return nullptr;
+Model* Model::LoadModel(std::string model_name) {
+  std::shared_future<Model*> model;
+  RequestModel(model_name);
+  {
+    std::lock_guard<std::mutex> lock(model_mutex);
+    model = model_map[model_name];
   }
 
-  // Else insert the new model into the map and return a pointer
-  // to the new model
-  model_map[model_name] = new_model;
+  // Wait for the import to finish, then create the GL objects on this
+  // thread if that hasn't happened yet
+  Model* new_model = model.get();
+  if (new_model != nullptr) {
+    new_model->Upload();
+  }
   return new_model;
 }
 
-Model::Model(std::string model_name) {
+Model::Model(std::string model_name) : m_cache(model_name), m_format(vertex_format), m_uploaded(false) {
   error = false;
+
+  // Warm start, use the meshes straight from the memory mapped cache
+  if (m_cache.Open()) {
+    m_pending = m_cache.GetMeshes();
+    ComputeBounds();
+    BuildOccluder();
+    PackMeshes();
+    return;
+  }
+
+  // Cold start, import with assimp and bake the cache for next time
+  if (!ImportModel(model_name, m_imported)) {
+    error = true;
+    return;
+  }
+
+  if (!m_cache.Write(m_imported, MeshCache::FindDependencies(model_name))) {
+    std::cout << "Failed to write mesh cache for " << model_name << std::endl;
+  }
+
+  for (auto& i : m_imported) {
+    m_pending.push_back(MeshView(i));
+  }
+  ComputeBounds();
+  BuildOccluder();
+  PackMeshes();
+}
+
+void Model::ComputeBounds() {
+  m_mesh_bounds.resize(m_pending.size());
+  m_bounds = Bounds();
+  for (unsigned i = 0; i < m_pending.size(); i++) {
+    const MeshView& mesh = m_pending[i];
+    Bounds& bounds = m_mesh_bounds[i];
+    for (unsigned j = 0; j < mesh.num_vertices; j++) {
+      bounds.Add(mesh.vertices[j].position, j == 0);
+    }
+    bounds.Finish();
+    m_bounds.Add(bounds, i == 0);
+  }
+  m_bounds.Finish();
+
+  // A level the mesh doesn't have falls back to its coarsest one
+  unsigned levels = 1;
+  for (auto& i : m_pending) {
+    levels = std::max<unsigned>(levels, i.lods.size());
+  }
+  m_lod_errors.assign(levels, 0.0f);
+  for (auto& i : m_pending) {
+    for (unsigned j = 1; j < levels && !i.lods.empty(); j++) {
+      const MeshLod& lod = i.lods[std::min<unsigned>(j, i.lods.size() - 1)];
+      m_lod_errors[j] = std::max(m_lod_errors[j], lod.error);
+    }
+  }
+}
+
+// Takes the full detail triangles of each mesh, keeping only the largest
+// if there are too many, and the positions they use. Simplified levels
+// fill in concave parts and may stick out of the real surface, a subset
+// of its triangles can only ever hide less
+void Model::BuildOccluder() {
+  m_occluder = OccluderMesh();
+  for (auto& i : m_pending) {
+    unsigned first = 0, count = i.num_indices;
+    if (!i.lods.empty()) {
+      first = i.lods.front().first_index;
+      count = i.lods.front().num_indices;
+    }
+    std::vector<unsigned> indices(i.indices + first, i.indices + first + count);
+
+    if (indices.size() > OCCLUDER_MAX_TRIANGLES * 3) {
+      std::vector<std::pair<float, unsigned> > areas;
+      for (unsigned j = 0; j + 2 < indices.size(); j += 3) {
+        const glm::vec3& a = i.vertices[indices[j]].position;
+        const glm::vec3& b = i.vertices[indices[j + 1]].position;
+        const glm::vec3& c = i.vertices[indices[j + 2]].position;
+        areas.push_back(std::make_pair(glm::length(glm::cross(b - a, c - a)), j));
+      }
+      std::nth_element(areas.begin(), areas.begin() + OCCLUDER_MAX_TRIANGLES, areas.end(),
+                       std::greater<std::pair<float, unsigned> >());
+
+      std::vector<unsigned> largest;
+      for (unsigned j = 0; j < OCCLUDER_MAX_TRIANGLES; j++) {
+        largest.insert(largest.end(), indices.begin() + areas[j].second, indices.begin() + areas[j].second + 3);
+      }
+      indices.swap(largest);
+    }
+
+    std::unordered_map<unsigned, unsigned> remap;
+    for (auto j : indices) {
+      auto found = remap.find(j);
+      if (found == remap.end()) {
+        found = remap.insert(std::make_pair(j, unsigned(m_occluder.vertices.size()))).first;
+        m_occluder.vertices.push_back(i.vertices[j].position);
+      }
+      m_occluder.indices.push_back(found->second);
+    }
+  }
+}
+
+void Model::PackMeshes() {
+  // Full vertices are uploaded straight from the mesh views
+  if (m_format == VERTEX_FULL) return;
+
+  m_packed.resize(m_pending.size());
+  for (unsigned i = 0; i < m_pending.size(); i++) {
+    VertexLayout::Pack(
+      m_pending[i].vertices, m_pending[i].num_vertices, m_format,
+      m_packed[i].data, m_packed[i].position_offset, m_packed[i].position_scale
+    );
+  }
+}
+
+void Model::Upload() {
+  if (m_uploaded) return;
+
+  PackedMesh full;
+  full.position_offset = glm::vec3(0.0f);
+  full.position_scale = glm::vec3(1.0f);
+  for (unsigned i = 0; i < m_pending.size(); i++) {
+    UploadMesh(m_pending[i], m_format == VERTEX_FULL ? full : m_packed[i]);
+  }
+
+  // The GL buffers own the data now
+  m_pending.clear();
+  m_packed.clear();
+  m_mesh_bounds.clear();
+  m_imported.clear();
+  m_cache.Close();
+  m_uploaded = true;
+}
+
+Model::~Model() {
+  for (auto& i : m_meshes) {
+    GeometryPool::Get().Free(i.geometry);
+  }
+  m_meshes.clear();
+}
+
+bool Model::ImportModel(const std::string& model_name, std::vector<MeshData>& meshes) {
   // Import the image from the file
   Assimp::Importer importer;
+  // The importer takes ownership of the IO system
+  importer.SetIOHandler(new AssetIOSystem());
   const aiScene* scene = importer.ReadFile(
     MODEL_PATH + model_name,
     aiProcessPreset_TargetRealtime_Fast | aiProcess_FlipUVs
   );
 
-  if (scene) { // If there were no errors load the meshes
-    aiMesh* mesh;
-    aiMaterial* material;
-    for (unsigned int i = 0; i < scene->mNumMeshes; i++) {
-      mesh = scene->mMeshes[i];
-      material = scene->mMaterials[mesh->mMaterialIndex];
-      LoadMesh(mesh, material);
-    }
-  } else { // Else set error flag
+  if (!scene) { // If there was an error report it
     std::cout << "Error loading scene, " << importer.GetErrorString() << std::endl;
-    error = true;
+    return false;
   }
-}
 
-void Model::DrawModel(Shader* shader, bool draw_complex) {
-  // Loop through meshes
-  for (auto i : m_meshes) {
-    // Enable attribute pointers
-    glEnableVertexAttribArray(0);
-    glEnableVertexAttribArray(1);
-    glEnableVertexAttribArray(2);
-    glEnableVertexAttribArray(3);
-    glEnableVertexAttribArray(4);
-
-    glBindBuffer(GL_ARRAY_BUFFER, i.VB);
-
-    // Give offsets for attrib pointers
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), 0);
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, uv));
-    glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, normal));
-    glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, tangent));
-    glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, bitangent));
-
-    if (draw_complex) {
-      // Pass uniforms
-      shader->uniform3fv("ambient_color", 1, glm::value_ptr(i.ambient));
-      shader->uniform3fv("diffuse_color", 1, glm::value_ptr(i.diffuse));
-      shader->uniform3fv("specular_color", 1, glm::value_ptr(i.specular));
-
-      // Pass texture
-      if (i.texture != nullptr) {
-        i.texture->BindTexture(GL_TEXTURE_POS);
-        shader->uniform1i("texture_sampler", GL_TEXTURE_OFFSET);
-      }
+  // Else load the meshes
+  meshes.resize(scene->mNumMeshes);
+  for (unsigned int i = 0; i < scene->mNumMeshes; i++) {
+    aiMesh* mesh = scene->mMeshes[i];
+    aiMaterial* material = scene->mMaterials[mesh->mMaterialIndex];
+    LoadMesh(mesh, material, meshes[i]);
+  }
 
-      // Pass normal
-      if (i.normal != nullptr) {
-        i.normal->BindTexture(GL_NORMAL_POS);
-        shader->uniform1i("normal_sampler", GL_NORMAL_OFFSET);
-      }
-    }
+  // Reorder for the post-transform cache and overdraw and build the
+  // detail levels, the result is baked into the mesh cache so this only
+  // runs on a cold start
+  unsigned total_triangles = 0, before_vertices = 0, after_vertices = 0;
+  float before_misses = 0.0f, after_misses = 0.0f;
+  for (auto& i : meshes) {
+    VertexCacheStats before, after;
+    before_vertices += i.vertices.size();
+    MeshOptimizer::Optimize(i, before, after);
+    total_triangles += i.indices.size() / 3;
+    after_vertices += i.vertices.size();
+    before_misses += before.acmr * (i.indices.size() / 3);
+    after_misses += after.acmr * (i.indices.size() / 3);
+    MeshSimplifier::GenerateLods(i);
+  }
 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, i.IB);
+  if (total_triangles > 0 && after_vertices > 0) {
+    std::cout << "Optimized " << model_name
+              << ", ACMR " << before_misses / total_triangles << " -> " << after_misses / total_triangles
+              << ", ATVR " << before_misses / before_vertices << " -> " << after_misses / after_vertices << std::endl;
+  }
 
-    // Draw the triagles
-    glDrawElements(GL_TRIANGLES, i.num_indices, GL_UNSIGNED_INT, 0);
+  return true;
+}
 
-    glDisableVertexAttribArray(0);
-    glDisableVertexAttribArray(1);
-    glDisableVertexAttribArray(2);
-    glDisableVertexAttribArray(3);
-    glDisableVertexAttribArray(4);
+/**
+ * Gets the index range of one mesh at a detail level, with one instance
+ * @param  mesh - The index of the mesh
+ * @param  lod  - The detail level, clamped to the coarsest the mesh has
+ * @return      The draw command for the mesh
+ */
+DrawCommand Model::GetDrawCommand(unsigned mesh, unsigned lod) const {
+  const Mesh& i = m_meshes[mesh];
+  const GeometryAllocation& geometry = GeometryPool::Get().GetAllocation(i.geometry);
+  const MeshLod& level = i.lods[std::min<unsigned>(lod, i.lods.size() - 1)];
+
+  DrawCommand command;
+  command.count = level.num_indices;
+  command.instance_count = 1;
+  command.first_index = geometry.first_index + level.first_index;
+  command.base_vertex = geometry.base_vertex;
+  command.base_instance = 0;
+  return command;
+}
 
-    // Set active texture to nothing
-    glBindTexture(GL_TEXTURE_2D, 0);
+/**
+ * Draws one mesh, the render queue has already bound its vertex array,
+ * textures and material
+ * @param shader    - The active shader
+ * @param mesh      - The index of the mesh
+ * @param lod       - The detail level to draw, clamped to the coarsest the
+ *                    mesh has
+ * @param instances - The number of instances, more than one needs an
+ *                    instanced shader
+ */
+void Model::DrawMesh(Shader* shader, unsigned mesh, unsigned lod, unsigned instances) {
+  const Mesh& i = m_meshes[mesh];
+
+  if (m_format == VERTEX_QUANTIZED) {
+    shader->uniform3fv(UNIFORM_POSITION_OFFSET, 1, glm::value_ptr(i.position_offset));
+    shader->uniform3fv(UNIFORM_POSITION_SCALE, 1, glm::value_ptr(i.position_scale));
   }
+
+  DrawCommand command = GetDrawCommand(mesh, lod);
+  const void* offset = (void*)(uintptr_t)(command.first_index * sizeof(unsigned));
+  if (instances > 1) {
+    glDrawElementsInstancedBaseVertex(GL_TRIANGLES, command.count, GL_UNSIGNED_INT, offset, instances, command.base_vertex);
+  } else {
+    glDrawElementsBaseVertex(GL_TRIANGLES, command.count, GL_UNSIGNED_INT, offset, command.base_vertex);
+  }
+  RenderStats::Get().draw_calls++;
 }
 
-void Model::LoadMesh(const aiMesh* mesh, const aiMaterial* material) {
-  std::vector<Vertex> Vertices;
-  std::vector<unsigned int> Indices;
-  Model::Mesh new_mesh;
+void Model::LoadMesh(const aiMesh* mesh, const aiMaterial* material, MeshData& data) {
+  std::vector<Vertex>& Vertices = data.vertices;
+  std::vector<unsigned int>& Indices = data.indices;
+  Vertices.reserve(mesh->mNumVertices);
+  Indices.reserve(mesh->mNumFaces * 3);
 
   for (unsigned int i = 0; i < mesh->mNumVertices; i++) {
     aiVector3D& position = mesh->mVertices[i];
@@ -236,57 +550,93 @@ void Model::LoadMesh(const aiMesh* mesh, const aiMaterial* material) {
   material->Get(AI_MATKEY_COLOR_DIFFUSE, diff);
   material->Get(AI_MATKEY_COLOR_SPECULAR, spec);
 
-  new_mesh.ambient = glm::vec3(amb.r, amb.g, amb.b);
-  new_mesh.diffuse = glm::vec3(diff.r, diff.g, diff.b);
-  new_mesh.specular = glm::vec3(spec.r, spec.g, spec.b);
+  data.ambient = glm::vec3(amb.r, amb.g, amb.b);
+  data.diffuse = glm::vec3(diff.r, diff.g, diff.b);
+  data.specular = glm::vec3(spec.r, spec.g, spec.b);
 
   {
     aiString pathname;
     material->Get(AI_MATKEY_TEXTURE(aiTextureType_DIFFUSE, 0), pathname);
-    std::string filename = clip_path(pathname.C_Str());
-
-    if (filename != "") {
-      new_mesh.texture = Texture::LoadTexture(filename);
-    } else {
-      new_mesh.texture = nullptr;
-    }
-    if (new_mesh.texture != nullptr) {
-      new_mesh.texture->InitializeTexture();
-    }
+    data.texture_name = clip_path(pathname.C_Str());
   }
   {
     aiString pathname;
     material->Get(AI_MATKEY_TEXTURE(aiTextureType_NORMALS, 0), pathname);
-    std::string filename = clip_path(pathname.C_Str());
+    data.normal_name = clip_path(pathname.C_Str());
+  }
+}
 
-    if (filename != "") {
-      new_mesh.normal = Texture::LoadTexture(filename);
-    } else {
-      new_mesh.normal = nullptr;
-    }
-    if (new_mesh.normal != nullptr) {
-      new_mesh.normal->InitializeTexture();
+/**
+ * Finds the ID of the mesh's material, meshes that look the same share one
+ * so the render queue can draw them without changing state
+ * @param  mesh - The mesh with its textures and colors set
+ * @return      The material ID
+ */
+unsigned Model::GetMaterialID(const Mesh& mesh) {
+  struct Material {
+    Texture *texture, *normal;
+    glm::vec3 ambient, diffuse, specular;
+  };
+  // Only called from the context thread
+  static std::vector<Material> materials;
+
+  for (unsigned i = 0; i < materials.size(); i++) {
+    const Material& material = materials[i];
+    if (material.texture == mesh.texture && material.normal == mesh.normal &&
+        material.ambient == mesh.ambient && material.diffuse == mesh.diffuse &&
+        material.specular == mesh.specular) {
+      return i;
     }
   }
+  materials.push_back(Material{ mesh.texture, mesh.normal, mesh.ambient, mesh.diffuse, mesh.specular });
+  return materials.size() - 1;
+}
 
-  glGenBuffers(1, &new_mesh.VB);
-  glBindBuffer(GL_ARRAY_BUFFER, new_mesh.VB);
-  glBufferData(
-    GL_ARRAY_BUFFER,
-    sizeof(Vertex) * Vertices.size(),
-    &Vertices[0],
-    GL_STATIC_DRAW
-  );
+void Model::UploadMesh(const MeshView& data, const PackedMesh& packed) {
+  Model::Mesh new_mesh;
+
+  new_mesh.position_offset = packed.position_offset;
+  new_mesh.position_scale = packed.position_scale;
+
+  new_mesh.ambient = data.ambient;
+  new_mesh.diffuse = data.diffuse;
+  new_mesh.specular = data.specular;
 
-  glGenBuffers(1, &new_mesh.IB);
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, new_mesh.IB);
-  glBufferData(
-    GL_ELEMENT_ARRAY_BUFFER,
-    sizeof(unsigned int) * Indices.size(),
-    &Indices[0],
-    GL_STATIC_DRAW
+  if (data.texture_name != "") {
+    new_mesh.texture = Texture::LoadTexture(data.texture_name);
+  } else {
+    new_mesh.texture = nullptr;
+  }
+  if (new_mesh.texture != nullptr) {
+    new_mesh.texture->InitializeTexture();
+  }
+
+  if (data.normal_name != "") {
+    new_mesh.normal = Texture::LoadTexture(data.normal_name);
+  } else {
+    new_mesh.normal = nullptr;
+  }
+  if (new_mesh.normal != nullptr) {
+    new_mesh.normal->InitializeTexture();
+  }
+
+  new_mesh.material = GetMaterialID(new_mesh);
+  new_mesh.bounds = m_mesh_bounds[m_meshes.size()];
+
+  // Suballocate the vertices and every detail level's indices from the
+  // shared geometry pool
+  new_mesh.geometry = GeometryPool::Get().Allocate(VertexLayout::Get(m_format).stride, data.num_vertices, data.num_indices);
+  GeometryPool::Get().Upload(
+    new_mesh.geometry,
+    m_format == VERTEX_FULL ? static_cast<const void*>(data.vertices) : packed.data.data(),
+    data.indices
   );
 
-  new_mesh.num_indices = Indices.size();
+  // Caches without detail levels draw the whole index buffer
+  new_mesh.lods = data.lods;
+  if (new_mesh.lods.empty()) {
+    MeshLod full = { 0, data.num_indices, 0.0f };
+    new_mesh.lods.push_back(full);
+  }
   m_meshes.push_back(new_mesh);
 }
@@ -1,6 +1,6 @@
 #include "object.h"
 
-Object::Object(json _props, Options* _options) : props(_props), options(_options) {
+Object::Object(json _props, Options* _options) : props(_props), options(_options), m_object_model(nullptr), m_lod(0), m_cull_index(0) {
   // If object has a model, load it
   if (props.model_name != "") {
     m_object_model = Model::LoadModel(props.model_name);
@@ -13,11 +13,72 @@ void Object::AddChild(Object* child) {
 
 void Object::Update(unsigned dt) {
   m_model_matrix = glm::mat4(1.0f);
+
+  if (m_object_model != nullptr) {
+    m_world_bounds = m_object_model->GetBounds().Transform(m_model_matrix);
+  }
+
+  for (auto i : children) {
+    i->Update(dt);
+  }
 }
 
-void Object::Render(Shader* shader) {
-  shader->uniformMatrix4fv("model_matrix", 1, GL_FALSE, glm::value_ptr(m_model_matrix));
-  m_object_model->DrawModel(shader, true);
+/**
+ * Queues every mesh of the object's model
+ * @param queue       - The frame's render queue
+ * @param shader      - The program to draw the meshes with
+ * @param opaque_pass - The pass opaque meshes go in, transparent meshes
+ *                      always go in the transparent pass
+ */
+void Object::Enqueue(RenderQueue& queue, Shader* shader, RenderPass opaque_pass) {
+  if (m_object_model == nullptr) return;
+  m_lod = SelectLod();
+
+  // Opaque meshes are drawn front to back within each material and
+  // transparent ones back to front
+  RenderPass pass = props.transparent ? RENDER_PASS_TRANSPARENT : opaque_pass;
+  glm::vec3 center = glm::vec3(m_model_matrix * glm::vec4(m_object_model->GetCenter(), 1.0f));
+  float depth = glm::length(center - options->eye.position);
+
+  RenderItem item = { shader, m_object_model, 0, m_lod, &m_model_matrix };
+  for (unsigned i = 0; i < m_object_model->m_meshes.size(); i++) {
+    item.mesh = i;
+    queue.Add(pass, depth, item);
+  }
+}
+
+void Object::AddOccluder(OcclusionCuller& culler) {
+  if (!IsOccluder()) return;
+  culler.AddOccluder(m_object_model->GetOccluder(), m_model_matrix);
+}
+
+unsigned Object::SelectLod() {
+  unsigned count = m_object_model->GetLodCount();
+  if (count <= 1) return 0;
+
+  // Distance from the eye to the nearest point of the bounding sphere
+  float scale = std::max(glm::length(glm::vec3(m_model_matrix[0])),
+                std::max(glm::length(glm::vec3(m_model_matrix[1])), glm::length(glm::vec3(m_model_matrix[2]))));
+  glm::vec3 center = glm::vec3(m_model_matrix * glm::vec4(m_object_model->GetCenter(), 1.0f));
+  float distance = glm::length(center - options->eye.position) - m_object_model->GetRadius() * scale;
+  distance = std::max(distance, options->eye.near_plane);
+
+  // Pixels on screen covered by one unit of object space error
+  float pixels = options->eye.projection_scale * scale / distance;
+  float threshold = options->lod.error_pixels;
+  float hysteresis = options->lod.hysteresis;
+
+  // Only go coarser once the error is comfortably under the threshold
+  // and only go finer once it is comfortably over, so objects sitting on
+  // the boundary don't pop back and forth
+  unsigned lod = std::min(m_lod, count - 1);
+  while (lod + 1 < count && m_object_model->GetLodError(lod + 1) * pixels <= threshold * (1.0f - hysteresis)) {
+    lod++;
+  }
+  while (lod > 0 && m_object_model->GetLodError(lod) * pixels > threshold * (1.0f + hysteresis)) {
+    lod--;
+  }
+  return lod;
 }
 
 Object::~Object() {
@@ -0,0 +1,241 @@
+#include "occlusion_culler.h"
+
+#if defined(__SSE2__)
+  #include <emmintrin.h>
+#endif
+
+OcclusionCuller::OcclusionCuller() : m_width(0), m_height(0), m_tiles_x(0), m_tiles_y(0) {}
+
+/**
+ * Allocates the depth buffer, the size is rounded up to whole tiles
+ * @param width  - Width of the depth buffer in pixels
+ * @param height - Height of the depth buffer in pixels
+ */
+void OcclusionCuller::Initialize(unsigned width, unsigned height) {
+  m_tiles_x = std::max(1u, (width + OCCLUSION_TILE_WIDTH - 1) / OCCLUSION_TILE_WIDTH);
+  m_tiles_y = std::max(1u, (height + OCCLUSION_TILE_HEIGHT - 1) / OCCLUSION_TILE_HEIGHT);
+  m_width = m_tiles_x * OCCLUSION_TILE_WIDTH;
+  m_height = m_tiles_y * OCCLUSION_TILE_HEIGHT;
+  m_depth.assign(m_width * m_height, 1.0f);
+  m_tile_max.assign(m_tiles_x * m_tiles_y, 1.0f);
+
+  // The calling thread is one of the frame threads
+  unsigned workers = ThreadPool::GetFrameThreadCount() - 1;
+  if (workers > 0) m_pool.reset(new ThreadPool(workers));
+}
+
+void OcclusionCuller::Clear() {
+  m_vertices.clear();
+  m_triangles.clear();
+}
+
+/**
+ * Queues the triangles of an occluder for the next Rasterize
+ * @param mesh  - The occluder in object space
+ * @param model - The object's model matrix
+ */
+void OcclusionCuller::AddOccluder(const OccluderMesh& mesh, const glm::mat4& model) {
+  for (auto i : mesh.indices) {
+    m_vertices.push_back(glm::vec3(model * glm::vec4(mesh.vertices[i], 1.0f)));
+  }
+}
+
+void OcclusionCuller::SetupTriangle(const glm::vec4& c0, const glm::vec4& c1, const glm::vec4& c2) {
+  // Dropping a triangle crossing the eye plane can only hide less
+  if (c0.w < OCCLUSION_MIN_W || c1.w < OCCLUSION_MIN_W || c2.w < OCCLUSION_MIN_W) return;
+
+  // Window space with y up, so front faces keep their counter clockwise
+  // winding and a positive area
+  glm::vec3 v[3];
+  const glm::vec4* clip[3] = { &c0, &c1, &c2 };
+  for (unsigned i = 0; i < 3; i++) {
+    const glm::vec4& c = *clip[i];
+    v[i] = glm::vec3(
+      (c.x / c.w * 0.5f + 0.5f) * m_width,
+      (c.y / c.w * 0.5f + 0.5f) * m_height,
+      c.z / c.w * 0.5f + 0.5f
+    );
+  }
+
+  float area = (v[1].x - v[0].x) * (v[2].y - v[0].y) - (v[2].x - v[0].x) * (v[1].y - v[0].y);
+  if (area <= 0.0f) return;
+
+  Triangle triangle;
+  triangle.min_x = std::max(0, int(std::floor(std::min(v[0].x, std::min(v[1].x, v[2].x)))));
+  triangle.min_y = std::max(0, int(std::floor(std::min(v[0].y, std::min(v[1].y, v[2].y)))));
+  triangle.max_x = std::min(int(m_width) - 1, int(std::ceil(std::max(v[0].x, std::max(v[1].x, v[2].x)))));
+  triangle.max_y = std::min(int(m_height) - 1, int(std::ceil(std::max(v[0].y, std::max(v[1].y, v[2].y)))));
+  if (triangle.min_x > triangle.max_x || triangle.min_y > triangle.max_y) return;
+
+  for (unsigned i = 0; i < 3; i++) {
+    const glm::vec3& a = v[i];
+    const glm::vec3& b = v[(i + 1) % 3];
+    triangle.edge_a[i] = a.y - b.y;
+    triangle.edge_b[i] = b.x - a.x;
+    triangle.edge_c[i] = a.x * b.y - a.y * b.x;
+  }
+
+  // Depth is affine in window space, solve for its gradient
+  float inverse_area = 1.0f / area;
+  triangle.depth_x = ((v[1].z - v[0].z) * (v[2].y - v[0].y) - (v[2].z - v[0].z) * (v[1].y - v[0].y)) * inverse_area;
+  triangle.depth_y = ((v[2].z - v[0].z) * (v[1].x - v[0].x) - (v[1].z - v[0].z) * (v[2].x - v[0].x)) * inverse_area;
+  triangle.depth_c = v[0].z - triangle.depth_x * v[0].x - triangle.depth_y * v[0].y;
+  m_triangles.push_back(triangle);
+}
+
+/**
+ * Draws every queued occluder into the depth buffer. Triangles are set up
+ * once, then each worker fills its own rows of tiles so no two threads
+ * write the same pixel
+ * @param proj_view - The combined projection and view matrix
+ */
+void OcclusionCuller::Rasterize(const glm::mat4& proj_view) {
+  m_proj_view = proj_view;
+  m_triangles.clear();
+  for (unsigned i = 0; i + 2 < m_vertices.size(); i += 3) {
+    SetupTriangle(
+      proj_view * glm::vec4(m_vertices[i], 1.0f),
+      proj_view * glm::vec4(m_vertices[i + 1], 1.0f),
+      proj_view * glm::vec4(m_vertices[i + 2], 1.0f)
+    );
+  }
+
+  // The last share of the rows is rasterized here while the workers do
+  // the rest
+  unsigned workers = m_pool ? m_pool->GetThreadCount() : 0;
+  unsigned tasks = std::min(m_tiles_y, workers + 1);
+  std::vector<std::shared_future<bool> > results;
+  for (unsigned i = 0; i + 1 < tasks; i++) {
+    unsigned first = m_tiles_y * i / tasks;
+    unsigned last = m_tiles_y * (i + 1) / tasks;
+    results.push_back(m_pool->Submit<bool>([this, first, last]() {
+      RasterizeRows(first, last);
+      return true;
+    }));
+  }
+  RasterizeRows(m_tiles_y * (tasks - 1) / tasks, m_tiles_y);
+  for (auto& i : results) {
+    i.wait();
+  }
+}
+
+// Clears and fills the tile rows [first, last), then finds the farthest
+// depth left in each of their tiles
+void OcclusionCuller::RasterizeRows(unsigned first, unsigned last) {
+  int row_min = first * OCCLUSION_TILE_HEIGHT;
+  int row_max = last * OCCLUSION_TILE_HEIGHT - 1;
+  std::fill(m_depth.begin() + row_min * m_width, m_depth.begin() + (row_max + 1) * m_width, 1.0f);
+
+  for (auto& t : m_triangles) {
+    int min_y = std::max(t.min_y, row_min);
+    int max_y = std::min(t.max_y, row_max);
+    if (min_y > max_y) continue;
+
+    // Pixels are tested at their centers, four at a time
+    int min_x = t.min_x & ~3;
+    for (int y = min_y; y <= max_y; y++) {
+      float py = y + 0.5f;
+      float* row = &m_depth[y * m_width];
+#if defined(__SSE2__)
+      __m128 zero = _mm_setzero_ps();
+      __m128 step = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+      __m128 a0 = _mm_set1_ps(t.edge_a[0]), a1 = _mm_set1_ps(t.edge_a[1]), a2 = _mm_set1_ps(t.edge_a[2]);
+      __m128 b0 = _mm_set1_ps(t.edge_b[0] * py + t.edge_c[0]);
+      __m128 b1 = _mm_set1_ps(t.edge_b[1] * py + t.edge_c[1]);
+      __m128 b2 = _mm_set1_ps(t.edge_b[2] * py + t.edge_c[2]);
+      __m128 dx = _mm_set1_ps(t.depth_x);
+      __m128 dc = _mm_set1_ps(t.depth_y * py + t.depth_c);
+      for (int x = min_x; x <= t.max_x; x += 4) {
+        __m128 px = _mm_add_ps(_mm_set1_ps(float(x)), step);
+        __m128 e0 = _mm_add_ps(_mm_mul_ps(a0, px), b0);
+        __m128 e1 = _mm_add_ps(_mm_mul_ps(a1, px), b1);
+        __m128 e2 = _mm_add_ps(_mm_mul_ps(a2, px), b2);
+        __m128 inside = _mm_and_ps(_mm_cmpge_ps(e0, zero), _mm_and_ps(_mm_cmpge_ps(e1, zero), _mm_cmpge_ps(e2, zero)));
+        if (_mm_movemask_ps(inside) == 0) continue;
+
+        __m128 old_depth = _mm_loadu_ps(row + x);
+        __m128 depth = _mm_min_ps(old_depth, _mm_add_ps(_mm_mul_ps(dx, px), dc));
+        _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, depth), _mm_andnot_ps(inside, old_depth)));
+      }
+#else
+      for (int x = min_x; x <= t.max_x; x++) {
+        float px = x + 0.5f;
+        bool inside = true;
+        for (unsigned e = 0; e < 3; e++) {
+          inside = inside && t.edge_a[e] * px + t.edge_b[e] * py + t.edge_c[e] >= 0.0f;
+        }
+        if (inside) row[x] = std::min(row[x], t.depth_x * px + t.depth_y * py + t.depth_c);
+      }
+#endif
+    }
+  }
+
+  for (unsigned ty = first; ty < last; ty++) {
+    for (unsigned tx = 0; tx < m_tiles_x; tx++) {
+      float farthest = 0.0f;
+      for (unsigned y = 0; y < OCCLUSION_TILE_HEIGHT; y++) {
+        const float* row = &m_depth[(ty * OCCLUSION_TILE_HEIGHT + y) * m_width + tx * OCCLUSION_TILE_WIDTH];
+        for (unsigned x = 0; x < OCCLUSION_TILE_WIDTH; x++) {
+          farthest = std::max(farthest, row[x]);
+        }
+      }
+      m_tile_max[ty * m_tiles_x + tx] = farthest;
+    }
+  }
+}
+
+/**
+ * Tests a box against the occluders drawn by the last Rasterize. Tiles
+ * whose farthest depth is in front of the box are skipped whole, the rest
+ * are checked pixel by pixel
+ * @param  bounds - World space bounds of the box
+ * @return        False only if every pixel the box covers is occluded
+ */
+bool OcclusionCuller::TestBox(const Bounds& bounds) const {
+  // Screen rectangle and nearest depth of the eight corners
+  glm::vec3 low(0.0f), high(0.0f);
+  for (unsigned i = 0; i < 8; i++) {
+    glm::vec3 corner((i & 1) ? bounds.max.x : bounds.min.x,
+                     (i & 2) ? bounds.max.y : bounds.min.y,
+                     (i & 4) ? bounds.max.z : bounds.min.z);
+    glm::vec4 clip = m_proj_view * glm::vec4(corner, 1.0f);
+
+    // Boxes crossing the eye plane are too close to reject
+    if (clip.w < OCCLUSION_MIN_W) return true;
+
+    glm::vec3 window(
+      (clip.x / clip.w * 0.5f + 0.5f) * m_width,
+      (clip.y / clip.w * 0.5f + 0.5f) * m_height,
+      clip.z / clip.w * 0.5f + 0.5f
+    );
+    low = i == 0 ? window : glm::min(low, window);
+    high = i == 0 ? window : glm::max(high, window);
+  }
+
+  int min_x = std::max(0, int(std::floor(low.x)));
+  int min_y = std::max(0, int(std::floor(low.y)));
+  int max_x = std::min(int(m_width) - 1, int(std::floor(high.x)));
+  int max_y = std::min(int(m_height) - 1, int(std::floor(high.y)));
+
+  // Leave boxes off the screen to the frustum culler
+  if (min_x > max_x || min_y > max_y) return true;
+
+  float nearest = low.z;
+  for (int ty = min_y / OCCLUSION_TILE_HEIGHT; ty <= max_y / OCCLUSION_TILE_HEIGHT; ty++) {
+    for (int tx = min_x / OCCLUSION_TILE_WIDTH; tx <= max_x / OCCLUSION_TILE_WIDTH; tx++) {
+      if (m_tile_max[ty * m_tiles_x + tx] < nearest) continue;
+
+      int y0 = std::max(min_y, ty * OCCLUSION_TILE_HEIGHT);
+      int y1 = std::min(max_y, ty * OCCLUSION_TILE_HEIGHT + OCCLUSION_TILE_HEIGHT - 1);
+      int x0 = std::max(min_x, tx * OCCLUSION_TILE_WIDTH);
+      int x1 = std::min(max_x, tx * OCCLUSION_TILE_WIDTH + OCCLUSION_TILE_WIDTH - 1);
+      for (int y = y0; y <= y1; y++) {
+        const float* row = &m_depth[y * m_width];
+        for (int x = x0; x <= x1; x++) {
+          if (row[x] >= nearest) return true;
+        }
+      }
+    }
+  }
+  return false;
+}
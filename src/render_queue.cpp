@@ -0,0 +1,505 @@
+#include "render_queue.h"
+#include "gl_caps.h"
+#include "gl_state.h"
+#include "stream_buffer.h"
+
+#include <cstring>
+
+/**
+ * Builds the key a draw is sorted by
+ * @param  pass     - The pass the draw belongs to
+ * @param  shader   - The ID of the program
+ * @param  material - The ID of the mesh's material
+ * @param  geometry - The mesh's geometry handle
+ * @param  lod      - The detail level drawn
+ * @param  depth    - Distance from the eye, opaque draws go front to back
+ *                    and transparent ones back to front
+ * @return          The sort key
+ */
+uint64_t RenderQueue::MakeKey(RenderPass pass, unsigned shader, unsigned material, unsigned geometry, unsigned lod, float depth) {
+  // Positive floats order the same as their bit patterns, the top half
+  // keeps the exponent and enough mantissa to order objects
+  uint32_t depth_bits;
+  depth = std::max(depth, 0.0f);
+  memcpy(&depth_bits, &depth, sizeof(depth_bits));
+  depth_bits >>= 32 - SORT_KEY_DEPTH_BITS;
+
+  uint64_t state = (uint64_t(shader & ((1u << SORT_KEY_SHADER_BITS) - 1)) << SORT_KEY_SHADER_SHIFT) |
+                   (uint64_t(material & ((1u << SORT_KEY_MATERIAL_BITS) - 1)) << SORT_KEY_MATERIAL_SHIFT) |
+                   (uint64_t(geometry & ((1u << SORT_KEY_GEOMETRY_BITS) - 1)) << SORT_KEY_GEOMETRY_SHIFT) |
+                   (uint64_t(lod & ((1u << SORT_KEY_LOD_BITS) - 1)) << SORT_KEY_LOD_SHIFT);
+
+  if (pass == RENDER_PASS_TRANSPARENT) {
+    // Back to front first, state only breaks ties between equal depths
+    uint64_t back_to_front = ((1u << SORT_KEY_DEPTH_BITS) - 1) - depth_bits;
+    return (uint64_t(pass) << SORT_KEY_PASS_SHIFT) |
+           (back_to_front << SORT_KEY_TRANSPARENT_DEPTH_SHIFT) |
+           (state >> SORT_KEY_DEPTH_BITS);
+  }
+  return (uint64_t(pass) << SORT_KEY_PASS_SHIFT) | state | uint64_t(depth_bits);
+}
+
+RenderQueue::RenderQueue() :
+    m_built(false),
+    m_instance_texture(0),
+    m_instance_range(false),
+    m_instance_alignment(1),
+    m_instance_buffer(0),
+    m_multi_draw(false),
+    m_object_stride(sizeof(ObjectData)),
+    m_storage_alignment(1),
+    m_command_buffer(0),
+    m_draw_data_buffer(0),
+    m_object_buffer(0),
+    m_command_offset(0),
+    m_draw_data_offset(0),
+    m_object_offset(0),
+    m_depth_shader(nullptr),
+    m_shadows(false) {}
+
+/**
+ * Creates the instance texture, the data it reads and everything else
+ * per draw is written into the StreamBuffer, which has to be initialized
+ * @param multi_draw - Submit with glMultiDrawElementsIndirect, the caller
+ *                     checks the driver supports it
+ */
+void RenderQueue::Initialize(bool multi_draw) {
+  glGenTextures(1, &m_instance_texture);
+  m_instance_range = GLCaps::Get().texture_buffer_range;
+  if (m_instance_range) {
+    glGetIntegerv(GL_TEXTURE_BUFFER_OFFSET_ALIGNMENT, &m_instance_alignment);
+  } else {
+    glGenBuffers(1, &m_instance_buffer);
+  }
+
+  // Every single draw's block starts where a range may be bound
+  GLint alignment = 1;
+  glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+  m_object_stride = (sizeof(ObjectData) + alignment - 1) / alignment * alignment;
+
+  m_multi_draw = multi_draw;
+  if (m_multi_draw) {
+    glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &m_storage_alignment);
+  }
+}
+
+void RenderQueue::Clear() {
+  m_items.clear();
+  m_entries.clear();
+  m_built = false;
+}
+
+void RenderQueue::Add(RenderPass pass, float depth, const RenderItem& item) {
+  const Model::Mesh& mesh = item.model->m_meshes[item.mesh];
+  uint64_t key = MakeKey(pass, item.shader->GetID(), mesh.material, mesh.geometry, item.lod, depth);
+  m_entries.push_back(SortEntry{ key, unsigned(m_items.size()) });
+  m_items.push_back(item);
+
+  // The depth pass has no material, so every draw of a mesh lands next to
+  // each other whatever it is textured with
+  if (pass == RENDER_PASS_OPAQUE && m_depth_shader != nullptr) {
+    RenderItem depth_item = item;
+    depth_item.shader = m_depth_shader;
+    key = MakeKey(RENDER_PASS_DEPTH, m_depth_shader->GetID(), 0, mesh.geometry, item.lod, depth);
+    m_entries.push_back(SortEntry{ key, unsigned(m_items.size()) });
+    m_items.push_back(depth_item);
+  }
+}
+
+// Least significant digit radix sort on the keys, a byte per pass.
+// Bytes every key shares are skipped, which is often most of them
+void RenderQueue::Sort() {
+  unsigned count = m_entries.size();
+  if (count < 2) return;
+  m_scratch.resize(count);
+
+  unsigned histograms[8][256];
+  memset(histograms, 0, sizeof(histograms));
+  for (auto& i : m_entries) {
+    for (unsigned byte = 0; byte < 8; byte++) {
+      histograms[byte][(i.key >> (byte * 8)) & 0xff]++;
+    }
+  }
+
+  for (unsigned byte = 0; byte < 8; byte++) {
+    unsigned* histogram = histograms[byte];
+    if (histogram[(m_entries[0].key >> (byte * 8)) & 0xff] == count) continue;
+
+    // Turn the counts into starting offsets
+    unsigned offset = 0;
+    for (unsigned i = 0; i < 256; i++) {
+      unsigned bucket = histogram[i];
+      histogram[i] = offset;
+      offset += bucket;
+    }
+
+    for (auto& i : m_entries) {
+      m_scratch[histogram[(i.key >> (byte * 8)) & 0xff]++] = i;
+    }
+    m_entries.swap(m_scratch);
+  }
+}
+
+// Splits the sorted entries into draws. Depth and opaque runs of the same
+// mesh at the same detail level become one instanced draw when the shader
+// has an instanced or multi draw variant. With multi draw every draw
+// becomes an indirect command instead
+void RenderQueue::BuildBatches() {
+  m_batches.clear();
+  m_instance_data.clear();
+  m_commands.clear();
+  m_draw_data.clear();
+  m_object_data.clear();
+  // Meshes of the same object drawn one after another share a block
+  const glm::mat4* object_matrix = nullptr;
+
+  unsigned count = m_entries.size();
+  for (unsigned first = 0; first < count;) {
+    const RenderItem& item = m_items[m_entries[first].item];
+    bool opaque = (m_entries[first].key >> SORT_KEY_PASS_SHIFT) != RENDER_PASS_TRANSPARENT;
+    bool multi_draw = m_multi_draw && item.shader->GetVariant(SHADER_VARIANT_MULTI_DRAW) != nullptr;
+    bool instanced = multi_draw || item.shader->GetVariant(SHADER_VARIANT_INSTANCED) != nullptr;
+
+    unsigned last = first + 1;
+    if (opaque && instanced) {
+      while (last < count) {
+        const RenderItem& next = m_items[m_entries[last].item];
+        if ((m_entries[last].key >> SORT_KEY_PASS_SHIFT) != (m_entries[first].key >> SORT_KEY_PASS_SHIFT) ||
+            next.shader != item.shader || next.model != item.model || next.mesh != item.mesh || next.lod != item.lod) {
+          break;
+        }
+        last++;
+      }
+    }
+
+    if (multi_draw) {
+      // One command for the run, its instances index the draw data from
+      // the command's base instance
+      DrawCommand command = item.model->GetDrawCommand(item.mesh, item.lod);
+      command.instance_count = last - first;
+      command.base_instance = m_draw_data.size();
+
+      const Model::Mesh& mesh = item.model->m_meshes[item.mesh];
+      for (unsigned i = first; i < last; i++) {
+        DrawData data;
+        data.model_matrix = *m_items[m_entries[i].item].model_matrix;
+        data.position_offset = glm::vec4(mesh.position_offset, 0.0f);
+        data.position_scale = glm::vec4(mesh.position_scale, 0.0f);
+        m_draw_data.push_back(data);
+      }
+
+      m_batches.push_back(Batch{ first, last - first, unsigned(m_commands.size()), BATCH_MULTI_DRAW });
+      m_commands.push_back(command);
+    } else if (last - first >= INSTANCE_MIN_BATCH) {
+      m_batches.push_back(Batch{ first, last - first, unsigned(m_instance_data.size()), BATCH_INSTANCED });
+      for (unsigned i = first; i < last; i++) {
+        m_instance_data.push_back(*m_items[m_entries[i].item].model_matrix);
+      }
+    } else {
+      // Too short to instance, draw each entry on its own
+      for (unsigned i = first; i < last; i++) {
+        const glm::mat4* model_matrix = m_items[m_entries[i].item].model_matrix;
+        if (model_matrix != object_matrix) {
+          object_matrix = model_matrix;
+          m_object_data.push_back(ObjectData{ *model_matrix });
+        }
+        m_batches.push_back(Batch{ i, 1, unsigned(m_object_data.size() - 1), BATCH_SINGLE });
+      }
+    }
+    first = last;
+  }
+}
+
+void RenderQueue::UploadInstances() {
+  if (m_instance_data.empty()) return;
+  GLsizeiptr size = m_instance_data.size() * sizeof(glm::mat4);
+  GLState::Get().BindTexture(GL_INSTANCE_POS, GL_TEXTURE_BUFFER, m_instance_texture);
+
+  // A cached bind leaves the active unit alone, the texture is only
+  // edited through the active one
+  GLState::Get().ActiveTexture(GL_INSTANCE_POS);
+
+  if (!m_instance_range) {
+    // Orphan last frame's storage rather than wait for the GPU to finish
+    // reading it
+    GLState::Get().BindBuffer(GL_TEXTURE_BUFFER, m_instance_buffer);
+    glBufferData(GL_TEXTURE_BUFFER, size, m_instance_data.data(), GL_STREAM_DRAW);
+    GLState::Get().BindBuffer(GL_TEXTURE_BUFFER, 0);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, m_instance_buffer);
+    return;
+  }
+
+  // The texture starts at this frame's first matrix, whichever buffer
+  // the stream wrote it to
+  StreamBuffer& stream = StreamBuffer::Get();
+  GLintptr offset = 0;
+  memcpy(stream.Map(size, std::max<GLsizeiptr>(m_instance_alignment, sizeof(glm::vec4)), offset), m_instance_data.data(), size);
+  stream.Unmap();
+  glTexBufferRange(GL_TEXTURE_BUFFER, GL_RGBA32F, stream.GetBuffer(), offset, size);
+}
+
+void RenderQueue::UploadCommands() {
+  if (m_commands.empty()) return;
+  StreamBuffer& stream = StreamBuffer::Get();
+
+  GLsizeiptr size = m_commands.size() * sizeof(DrawCommand);
+  memcpy(stream.Map(size, sizeof(GLuint), m_command_offset), m_commands.data(), size);
+  stream.Unmap();
+  m_command_buffer = stream.GetBuffer();
+
+  size = m_draw_data.size() * sizeof(DrawData);
+  memcpy(stream.Map(size, m_storage_alignment, m_draw_data_offset), m_draw_data.data(), size);
+  stream.Unmap();
+  m_draw_data_buffer = stream.GetBuffer();
+}
+
+void RenderQueue::UploadObjects() {
+  if (m_object_data.empty()) return;
+  StreamBuffer& stream = StreamBuffer::Get();
+
+  uint8_t* data = static_cast<uint8_t*>(stream.Map(m_object_data.size() * m_object_stride, m_object_stride, m_object_offset));
+  for (unsigned i = 0; i < m_object_data.size(); i++) {
+    memcpy(data + i * m_object_stride, &m_object_data[i], sizeof(ObjectData));
+  }
+  stream.Unmap();
+  m_object_buffer = stream.GetBuffer();
+}
+
+// Points the instance texture, the indirect commands and the draw data
+// at this frame's data, other queues may have bound their own since
+void RenderQueue::BindStreams() {
+  if (!m_instance_data.empty()) {
+    GLState::Get().BindTexture(GL_INSTANCE_POS, GL_TEXTURE_BUFFER, m_instance_texture);
+  }
+  if (!m_commands.empty()) {
+    GLState::Get().BindBuffer(GL_DRAW_INDIRECT_BUFFER, m_command_buffer);
+    GLState::Get().BindBufferRange(GL_SHADER_STORAGE_BUFFER, DRAW_DATA_BINDING, m_draw_data_buffer,
+                                   m_draw_data_offset, m_draw_data.size() * sizeof(DrawData));
+  }
+}
+
+// Depth and blend state for a pass. With a depth prepass the opaque pass
+// only shades the pixels whose depth matches what the prepass wrote
+void RenderQueue::BeginPass(RenderPass pass) {
+  switch (pass) {
+    case RENDER_PASS_DEPTH: {
+      GLState::Get().ColorMask(GL_FALSE);
+      GLState::Get().DepthMask(GL_TRUE);
+      GLState::Get().DepthFunc(GL_LEQUAL);
+      GLState::Get().Disable(GL_BLEND);
+      break;
+    }
+    case RENDER_PASS_OPAQUE: {
+      GLState::Get().ColorMask(GL_TRUE);
+      GLState::Get().DepthMask(m_depth_shader != nullptr ? GL_FALSE : GL_TRUE);
+      GLState::Get().DepthFunc(m_depth_shader != nullptr ? GL_EQUAL : GL_LEQUAL);
+      GLState::Get().Disable(GL_BLEND);
+      break;
+    }
+    case RENDER_PASS_FORWARD: {
+      // Tested against and adding to the depth the G-buffer was drawn with
+      GLState::Get().ColorMask(GL_TRUE);
+      GLState::Get().DepthMask(GL_TRUE);
+      GLState::Get().DepthFunc(GL_LEQUAL);
+      GLState::Get().Disable(GL_BLEND);
+      break;
+    }
+    case RENDER_PASS_TRANSPARENT: {
+      // Sorted back to front, tested against the opaque depth but never
+      // hiding each other
+      GLState::Get().ColorMask(GL_TRUE);
+      GLState::Get().DepthMask(GL_FALSE);
+      GLState::Get().DepthFunc(GL_LEQUAL);
+      GLState::Get().Enable(GL_BLEND);
+      break;
+    }
+  }
+}
+
+// Leaves the state Graphics::Initialize set up, so clears write depth
+void RenderQueue::EndPasses() {
+  GLState::Get().ColorMask(GL_TRUE);
+  GLState::Get().DepthMask(GL_TRUE);
+  GLState::Get().DepthFunc(GL_LEQUAL);
+  GLState::Get().Disable(GL_BLEND);
+}
+
+void RenderQueue::BindTexture(GLenum unit, GLuint texture, GLuint& bound) {
+  RenderStats& stats = RenderStats::Get();
+  if (texture == bound) {
+    stats.texture_binds_saved++;
+    return;
+  }
+  GLState::Get().BindTexture(unit, GL_TEXTURE_2D, texture);
+  bound = texture;
+  stats.texture_binds++;
+}
+
+/**
+ * Draws every queued item in key order
+ * @param proj_view - The combined projection and view matrix
+ */
+void RenderQueue::Submit(const glm::mat4& proj_view) {
+  Submit(proj_view, RENDER_PASS_DEPTH, RENDER_PASS_TRANSPARENT);
+}
+
+/**
+ * Draws the queued items of a range of passes in key order, the batches
+ * are built by the first call of the frame
+ * @param proj_view - The combined projection and view matrix
+ * @param first     - The first pass to draw
+ * @param last      - The last pass to draw
+ */
+void RenderQueue::Submit(const glm::mat4& proj_view, RenderPass first, RenderPass last) {
+  RenderStats& stats = RenderStats::Get();
+  GeometryPool& pool = GeometryPool::Get();
+
+  if (!m_built) {
+    BuildBatches();
+    UploadInstances();
+    UploadCommands();
+    UploadObjects();
+    m_built = true;
+  }
+  BindStreams();
+
+  int pass = -1;
+  Shader* shader = nullptr;
+  GLuint vertex_array = 0;
+  unsigned material = 0xffffffffu;
+  // Whatever a unit holds from before is only known to the state cache
+  GLuint bound_textures[2] = { GL_STATE_UNKNOWN, GL_STATE_UNKNOWN };
+
+  for (unsigned b = 0; b < m_batches.size();) {
+    const Batch& batch = m_batches[b];
+    const RenderItem& item = m_items[m_entries[batch.first].item];
+    const Model::Mesh& mesh = item.model->m_meshes[item.mesh];
+
+    // Entries are sorted by pass first so each pass starts once
+    int batch_pass = int(m_entries[batch.first].key >> SORT_KEY_PASS_SHIFT);
+    if (batch_pass < first) {
+      b++;
+      continue;
+    }
+    if (batch_pass > last) break;
+    bool depth_only = batch_pass == RENDER_PASS_DEPTH;
+    if (batch_pass != pass) {
+      pass = batch_pass;
+      BeginPass(RenderPass(pass));
+    }
+
+    Shader* batch_shader = item.shader;
+    if (batch.mode == BATCH_INSTANCED) batch_shader = item.shader->GetVariant(SHADER_VARIANT_INSTANCED);
+    if (batch.mode == BATCH_MULTI_DRAW) batch_shader = item.shader->GetVariant(SHADER_VARIANT_MULTI_DRAW);
+
+    // Program and the uniforms shared by the whole frame
+    if (batch_shader != shader) {
+      shader = batch_shader;
+      shader->Enable();
+      shader->uniformMatrix4fv(UNIFORM_PROJ_VIEW_MATRIX, 1, GL_FALSE, glm::value_ptr(proj_view));
+      if (!depth_only) {
+        shader->uniform1i(UNIFORM_TEXTURE_SAMPLER, GL_TEXTURE_OFFSET);
+        shader->uniform1i(UNIFORM_NORMAL_SAMPLER, GL_NORMAL_OFFSET);
+        shader->uniform1i(UNIFORM_LIGHT_GRID, GL_LIGHT_GRID_OFFSET);
+        shader->uniform1i(UNIFORM_LIGHT_INDICES, GL_LIGHT_INDEX_OFFSET);
+        if (m_shadows) {
+          shader->uniform1i(UNIFORM_SUN_SHADOW, GL_SUN_SHADOW_OFFSET);
+          shader->uniform1i(UNIFORM_SPOT_SHADOWS, GL_SPOT_SHADOW_OFFSET);
+        }
+      }
+      if (batch.mode == BATCH_INSTANCED) shader->uniform1i(UNIFORM_INSTANCE_MATRICES, GL_INSTANCE_OFFSET);
+      stats.program_binds++;
+
+      // Uniforms belong to the program, send them again. The object
+      // blocks are bound to the context and stay
+      material = 0xffffffffu;
+    } else {
+      stats.program_binds_saved++;
+    }
+
+    // Only feed the attributes this shader actually reads
+    unsigned mask = shader->GetAttributeMask() & VertexLayout::Get(item.model->GetFormat()).attribute_mask;
+    GLuint mesh_array = pool.GetVertexArray(mesh.geometry, item.model->GetFormat(), mask);
+    if (mesh_array != vertex_array) {
+      vertex_array = mesh_array;
+      GLState::Get().BindVertexArray(vertex_array);
+      stats.vertex_array_binds++;
+      stats.attribute_calls_avoided += 3 * __builtin_popcount(mask);
+    } else {
+      stats.vertex_array_binds_saved++;
+    }
+
+    if (batch.mode == BATCH_INSTANCED) {
+      shader->uniform1i(UNIFORM_INSTANCE_OFFSET, batch.offset);
+    } else if (batch.mode == BATCH_SINGLE) {
+      GLState::Get().BindBufferRange(GL_UNIFORM_BUFFER, OBJECT_BLOCK_BINDING, m_object_buffer,
+                                     m_object_offset + batch.offset * m_object_stride, sizeof(ObjectData));
+    }
+
+    // The depth pass reads nothing but positions
+    if (!depth_only && mesh.material != material) {
+      material = mesh.material;
+      shader->uniform3fv(UNIFORM_AMBIENT_COLOR, 1, glm::value_ptr(mesh.ambient));
+      shader->uniform3fv(UNIFORM_DIFFUSE_COLOR, 1, glm::value_ptr(mesh.diffuse));
+      shader->uniform3fv(UNIFORM_SPECULAR_COLOR, 1, glm::value_ptr(mesh.specular));
+
+      // Meshes without a texture sample nothing and use their material color
+      BindTexture(GL_TEXTURE_POS, mesh.texture != nullptr ? mesh.texture->GetBinding(GL_TEXTURE_POS) : 0, bound_textures[GL_TEXTURE_OFFSET]);
+      BindTexture(GL_NORMAL_POS, mesh.normal != nullptr ? mesh.normal->GetBinding(GL_NORMAL_POS) : 0, bound_textures[GL_NORMAL_OFFSET]);
+    } else if (!depth_only) {
+      stats.texture_binds_saved += 2;
+    }
+
+    if (batch.mode != BATCH_MULTI_DRAW) {
+      item.model->DrawMesh(shader, item.mesh, item.lod, batch.count);
+      if (depth_only) stats.depth_draw_calls++;
+      if (batch.mode == BATCH_INSTANCED) {
+        stats.instanced_draws++;
+        stats.instances += batch.count;
+      }
+      b++;
+      continue;
+    }
+
+    // Everything after this batch with the same state goes in the same
+    // call, the per draw data covers the rest
+    GLuint vertex_buffer = pool.GetVertexBuffer(mesh.geometry);
+    unsigned last = b + 1;
+    while (last < m_batches.size() && m_batches[last].mode == BATCH_MULTI_DRAW) {
+      const RenderItem& next = m_items[m_entries[m_batches[last].first].item];
+      const Model::Mesh& next_mesh = next.model->m_meshes[next.mesh];
+      if ((m_entries[m_batches[last].first].key >> SORT_KEY_PASS_SHIFT) != uint64_t(batch_pass) ||
+          next.shader != item.shader || (!depth_only && next_mesh.material != mesh.material) ||
+          next.model->GetFormat() != item.model->GetFormat() ||
+          pool.GetVertexBuffer(next_mesh.geometry) != vertex_buffer) {
+        break;
+      }
+      last++;
+    }
+
+    glMultiDrawElementsIndirect(
+      GL_TRIANGLES, GL_UNSIGNED_INT,
+      (void*)(uintptr_t)(m_command_offset + batch.offset * sizeof(DrawCommand)),
+      last - b, 0
+    );
+    stats.draw_calls++;
+    if (depth_only) stats.depth_draw_calls++;
+    stats.multi_draw_calls++;
+    stats.multi_draw_commands += last - b;
+    b = last;
+  }
+
+  // Leave the depth and blend state as the rest of the renderer expects.
+  // Textures stay bound, the next frame's binds of the same ones are
+  // dropped by the state cache
+  EndPasses();
+}
+
+// The other buffers belong to the StreamBuffer
+void RenderQueue::Destroy() {
+  if (m_instance_texture != 0) GLState::Get().DeleteTextures(1, &m_instance_texture);
+  if (m_instance_buffer != 0) GLState::Get().DeleteBuffers(1, &m_instance_buffer);
+  m_instance_texture = 0;
+  m_instance_buffer = 0;
+  m_command_buffer = m_draw_data_buffer = m_object_buffer = 0;
+}
@@ -1,8 +1,33 @@
 #include "shader.h"
+#include "gl_state.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <sstream>
 
 Shader* Shader::LoadShader(std::string shader_name) {
+  return LoadShader(shader_name, shader_name);
+}
+
+std::string Shader::GetVariantSuffix(ShaderVariant variant) {
+  switch (variant) {
+    case SHADER_VARIANT_INSTANCED: return "_instanced";
+    case SHADER_VARIANT_MULTI_DRAW: return "_multi_draw";
+    default: return "";
+  }
+}
+
+/**
+ * Loads a program from a vertex and fragment shader with different names,
+ * used for variants such as tex_shader_instanced.vert with tex_shader.frag
+ * @param  vertex_name   - The vertex shader name, without the extension
+ * @param  fragment_name - The fragment shader name, without the extension
+ * @return               The shader, nullptr if it failed to load
+ */
+Shader* Shader::LoadShader(std::string vertex_name, std::string fragment_name) {
   // So we dont load the same shader more than once
   static std::unordered_map<std::string, Shader*> shader_map;
+  std::string shader_name = vertex_name == fragment_name ? vertex_name : vertex_name + "+" + fragment_name;
 
   // If we have already loaded the shader return a pointer to it
   if (shader_map.find(shader_name) != shader_map.end()) {
@@ -11,6 +36,7 @@ Shader* Shader::LoadShader(std::string shader_name) {
 
   // Else create a new shader
   Shader* new_shader = new Shader();
+  new_shader->m_shader_name = shader_name;
 
   // Set up the shader program
   if(!new_shader->Initialize()) {
@@ -19,13 +45,13 @@ Shader* Shader::LoadShader(std::string shader_name) {
   }
 
   // Add the vertex shader
-  if(!new_shader->AddShader(GL_VERTEX_SHADER, shader_name)) {
+  if(!new_shader->AddShader(GL_VERTEX_SHADER, vertex_name)) {
     std::cout << "Vertex shader failed to initialize." << std::endl;
     return nullptr;
   }
 
   // Add the fragment shader
-  if(!new_shader->AddShader(GL_FRAGMENT_SHADER, shader_name)) {
+  if(!new_shader->AddShader(GL_FRAGMENT_SHADER, fragment_name)) {
     std::cout << "Fragment shader failed to initialize." << std::endl;
     return nullptr;
   }
@@ -37,12 +63,80 @@ Shader* Shader::LoadShader(std::string shader_name) {
   }
 
   // Insert the new shader into the map and return a pointer
-  // to it.
+  // to it. The ID orders draws by program in the render queue
+  new_shader->m_id = shader_map.size();
   shader_map[shader_name] = new_shader;
   return new_shader;
 }
 
-Shader::Shader() :  m_shader_program(0) {}
+// Defines prepended to every shader, set up before any shader is loaded
+static std::vector<std::string> global_defines;
+
+void Shader::AddGlobalDefine(const std::string& define) {
+  global_defines.push_back(define);
+}
+
+// Uniform blocks and the buffer binding point each is read from
+static std::vector<std::pair<std::string, GLuint> > uniform_blocks;
+
+void Shader::AddUniformBlock(const std::string& name, GLuint binding) {
+  uniform_blocks.push_back(std::make_pair(name, binding));
+}
+
+// Names of the registered uniforms, indexed by handle, starting with the
+// builtins in BuiltinUniform order
+static const char* BUILTIN_UNIFORM_NAMES[UNIFORM_BUILTIN_COUNT] = {
+  "proj_view_matrix",
+  "ambient_color",
+  "diffuse_color",
+  "specular_color",
+  "texture_sampler",
+  "normal_sampler",
+  "position_offset",
+  "position_scale",
+  "instance_matrices",
+  "instance_offset",
+  "light_grid",
+  "light_indices",
+  "sun_shadow",
+  "spot_shadows"
+};
+
+static std::vector<std::string>& uniform_names() {
+  static std::vector<std::string> names(BUILTIN_UNIFORM_NAMES, BUILTIN_UNIFORM_NAMES + UNIFORM_BUILTIN_COUNT);
+  return names;
+}
+
+static std::vector<uint64_t>& uniform_hashes() {
+  static std::vector<uint64_t> hashes;
+  if (hashes.empty()) {
+    for (auto& i : uniform_names()) hashes.push_back(hash_string(i));
+  }
+  return hashes;
+}
+
+/**
+ * Registers a uniform name so it can be set by handle, call this during
+ * setup rather than every frame
+ * @param  name - The full name of the uniform, e.g. point_lights[0].light_color
+ * @return      The handle of the uniform
+ */
+UniformHandle Shader::RegisterUniform(const std::string& name) {
+  std::vector<uint64_t>& hashes = uniform_hashes();
+  uint64_t hash = hash_string(name);
+  for (unsigned i = 0; i < hashes.size(); i++) {
+    if (hashes[i] == hash) return i;
+  }
+  uniform_names().push_back(name);
+  hashes.push_back(hash);
+  return hashes.size() - 1;
+}
+
+Shader::Shader() : m_id(0), m_shader_program(0), m_attribute_mask(0) {
+  for (unsigned i = 0; i < SHADER_VARIANT_COUNT; i++) {
+    m_variants[i] = nullptr;
+  }
+}
 
 bool Shader::Initialize()
 {
@@ -59,7 +153,7 @@ bool Shader::Initialize()
 
 void Shader::Enable()
 {
-    glUseProgram(m_shader_program);
+    GLState::Get().UseProgram(m_shader_program);
 }
 
 // Use this method to add shaders to the program. When finished - call finalize()
@@ -76,6 +170,8 @@ bool Shader::AddShader(GLenum ShaderType, std::string shader_name)
     s = load_file(SHADER_PATH + shader_name + std::string(".frag")).c_str();
   }
 
+  s = PreprocessSource(s, false);
+
   GLuint ShaderObj = glCreateShader(ShaderType);
 
   if (ShaderObj == 0)
@@ -137,6 +233,30 @@ bool Shader::Finalize()
     return false;
   }
 
+  // Find out which vertex attributes the program actually reads
+  GLint attribute_count = 0;
+  glGetProgramiv(m_shader_program, GL_ACTIVE_ATTRIBUTES, &attribute_count);
+  for (GLint i = 0; i < attribute_count; i++) {
+    GLchar name[256];
+    GLint size;
+    GLenum type;
+    glGetActiveAttrib(m_shader_program, i, sizeof(name), NULL, &size, &type, name);
+    GLint location = glGetAttribLocation(m_shader_program, name);
+    if (location >= 0 && location < 32) {
+      m_attribute_mask |= 1u << location;
+    }
+  }
+
+  // Point the program's uniform blocks at their shared buffers
+  for (auto& i : uniform_blocks) {
+    GLuint index = glGetUniformBlockIndex(m_shader_program, i.first.c_str());
+    if (index != GL_INVALID_INDEX) glUniformBlockBinding(m_shader_program, index, i.second);
+  }
+
+  // Record where every uniform lives so nothing is looked up by name
+  // while rendering
+  ReflectUniforms();
+
   // Delete the intermediate shader objects that have been added to the program
   for (auto it : m_shader_object_list)
   {
@@ -148,59 +268,132 @@ bool Shader::Finalize()
   return true;
 }
 
-void Shader::uniform1i(const std::string& name, GLint value) {
-  GLint location = GetUniformLocation(name);
+// Resolves #include "file" lines and adds the global defines after the
+// #version line. Included files may be whole shaders, their #version
+// line is dropped so variants can include the shader they specialize
+std::string Shader::PreprocessSource(const std::string& source, bool included) {
+  std::istringstream input(source);
+  std::ostringstream output;
+  std::string line;
+  bool versioned = false;
+
+  while (std::getline(input, line)) {
+    if (line.compare(0, 9, "#include ") == 0) {
+      auto start = line.find('"'), end = line.rfind('"');
+      if (start != std::string::npos && end > start) {
+        output << PreprocessSource(load_file(SHADER_PATH + line.substr(start + 1, end - start - 1)), true) << "\n";
+        continue;
+      }
+    }
+
+    if (included && line.compare(0, 8, "#version") == 0) continue;
+
+    output << line << "\n";
 
-  if (location == INVALID_UNIFORM_LOCATION) {
-    std::cout << "Invalid location of uniform (" << name << ")" << std::endl;
-    return;
+    if (!versioned && line.compare(0, 8, "#version") == 0) {
+      for (auto& i : global_defines) {
+        output << "#define " << i << "\n";
+      }
+      versioned = true;
+    }
   }
 
-  glUniform1i(location, value);
+  return output.str();
 }
 
-void Shader::uniform1f(const std::string& name, GLfloat value) {
-  GLint location = GetUniformLocation(name);
-
-  if (location == INVALID_UNIFORM_LOCATION) {
-    std::cout << "Invalid location of uniform (" << name << ")" << std::endl;
-    return;
+void Shader::ReflectUniforms() {
+  GLint uniform_count = 0;
+  glGetProgramiv(m_shader_program, GL_ACTIVE_UNIFORMS, &uniform_count);
+
+  m_uniforms.clear();
+  for (GLint i = 0; i < uniform_count; i++) {
+    GLchar name[256];
+    GLsizei length;
+    GLint size;
+    GLenum type;
+    glGetActiveUniform(m_shader_program, i, sizeof(name), &length, &size, &type, name);
+
+    std::string uniform_name(name, length);
+    GLint location = glGetUniformLocation(m_shader_program, uniform_name.c_str());
+    // Uniforms in blocks have no location
+    if (location < 0) continue;
+
+    // Arrays of basic types are reported once as name[0], give every
+    // element and the bare name an entry
+    if (size > 1 && uniform_name.size() > 3 && uniform_name.compare(uniform_name.size() - 3, 3, "[0]") == 0) {
+      std::string base = uniform_name.substr(0, uniform_name.size() - 3);
+      m_uniforms.push_back(UniformSlot{ hash_string(base), location });
+      for (GLint j = 0; j < size; j++) {
+        std::string element = base + "[" + std::to_string(j) + "]";
+        m_uniforms.push_back(UniformSlot{ hash_string(element), glGetUniformLocation(m_shader_program, element.c_str()) });
+      }
+    } else {
+      m_uniforms.push_back(UniformSlot{ hash_string(uniform_name), location });
+    }
   }
 
-  glUniform1f(location, value);
+  std::sort(m_uniforms.begin(), m_uniforms.end(), [](const UniformSlot& a, const UniformSlot& b) {
+    return a.hash < b.hash;
+  });
+
+  m_handle_locations.clear();
+  m_handle_warned.clear();
+  ResolveHandles();
 }
 
-void Shader::uniform3fv(const std::string& name, GLsizei size, const GLfloat* value) {
-  GLint location = GetUniformLocation(name);
+GLint Shader::FindUniform(uint64_t hash) const {
+  auto slot = std::lower_bound(m_uniforms.begin(), m_uniforms.end(), hash, [](const UniformSlot& a, uint64_t h) {
+    return a.hash < h;
+  });
+  return slot != m_uniforms.end() && slot->hash == hash ? slot->location : INVALID_UNIFORM_LOCATION;
+}
 
-  if (location == INVALID_UNIFORM_LOCATION) {
-    std::cout << "Invalid location of uniform (" << name << ")" << std::endl;
-    return;
+// Looks up the location of every handle registered since the last call
+void Shader::ResolveHandles() {
+  const std::vector<uint64_t>& hashes = uniform_hashes();
+  for (unsigned i = m_handle_locations.size(); i < hashes.size(); i++) {
+    m_handle_locations.push_back(FindUniform(hashes[i]));
+    m_handle_warned.push_back(false);
   }
+}
 
-  glUniform3fv(location, size, value);
+void Shader::uniform1i(UniformHandle handle, GLint value) {
+  GLint location = GetUniformLocation(handle);
+  if (location != INVALID_UNIFORM_LOCATION) glUniform1i(location, value);
 }
 
-void Shader::uniformMatrix4fv(const std::string& name, GLsizei size, GLboolean transpose, const GLfloat* value) {
-  GLint location = GetUniformLocation(name);
+void Shader::uniform1f(UniformHandle handle, GLfloat value) {
+  GLint location = GetUniformLocation(handle);
+  if (location != INVALID_UNIFORM_LOCATION) glUniform1f(location, value);
+}
 
-  if (location == INVALID_UNIFORM_LOCATION) {
-    std::cout << "Invalid location of uniform (" << name << ")" << std::endl;
-    return;
-  }
+void Shader::uniform3fv(UniformHandle handle, GLsizei size, const GLfloat* value) {
+  GLint location = GetUniformLocation(handle);
+  if (location != INVALID_UNIFORM_LOCATION) glUniform3fv(location, size, value);
+}
 
-  glUniformMatrix4fv(location, size, transpose, value);
+void Shader::uniformMatrix4fv(UniformHandle handle, GLsizei size, GLboolean transpose, const GLfloat* value) {
+  GLint location = GetUniformLocation(handle);
+  if (location != INVALID_UNIFORM_LOCATION) glUniformMatrix4fv(location, size, transpose, value);
 }
 
-GLint Shader::GetUniformLocation(const std::string& pUniformName)
-{
-    GLuint Location = glGetUniformLocation(m_shader_program, pUniformName.c_str());
+GLint Shader::GetUniformLocation(UniformHandle handle) {
+  // Handles registered after this shader was loaded are resolved once
+  if (handle >= m_handle_locations.size()) {
+    ResolveHandles();
+  }
 
-    if (Location == INVALID_UNIFORM_LOCATION) {
-        fprintf(stderr, "Warning! Unable to get the location of uniform '%s'\n", pUniformName.c_str());
-    }
+  GLint location = m_handle_locations[handle];
+  if (location == INVALID_UNIFORM_LOCATION && !m_handle_warned[handle]) {
+    fprintf(stderr, "Warning! Unable to get the location of uniform '%s' in shader '%s'\n",
+            uniform_names()[handle].c_str(), m_shader_name.c_str());
+    m_handle_warned[handle] = true;
+  }
+  return location;
+}
 
-    return Location;
+GLint Shader::GetUniformLocation(UniformID id) {
+  return FindUniform(id.hash);
 }
 
 Shader::~Shader() {
@@ -211,7 +404,7 @@ Shader::~Shader() {
 
   if (m_shader_program != 0)
   {
-    glDeleteProgram(m_shader_program);
+    GLState::Get().DeleteProgram(m_shader_program);
     m_shader_program = 0;
   }
 }
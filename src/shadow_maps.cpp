@@ -0,0 +1,408 @@
+#include "shadow_maps.h"
+#include "gl_state.h"
+#include "model.h"
+
+static_assert(sizeof(ShadowBlock) % 16 == 0, "ShadowBlock must match the std140 layout");
+static_assert(SHADOW_CASCADES == 4, "Cascade splits are passed as one vec4");
+
+// Creates a depth texture, arrays when layers is above zero. Sampled ones
+// compare against the reference depth so every tap is a bilinear 2x2 test
+static GLuint create_depth_texture(unsigned size, unsigned layers, bool sampled) {
+  GLenum target = layers > 0 ? GL_TEXTURE_2D_ARRAY : GL_TEXTURE_2D;
+  GLuint texture;
+  glGenTextures(1, &texture);
+  GLState::Get().BindTexture(target, texture);
+  if (layers > 0) {
+    glTexImage3D(target, 0, GL_DEPTH_COMPONENT24, size, size, layers, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, nullptr);
+  } else {
+    glTexImage2D(target, 0, GL_DEPTH_COMPONENT24, size, size, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, nullptr);
+  }
+  glTexParameteri(target, GL_TEXTURE_MIN_FILTER, sampled ? GL_LINEAR : GL_NEAREST);
+  glTexParameteri(target, GL_TEXTURE_MAG_FILTER, sampled ? GL_LINEAR : GL_NEAREST);
+  glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  if (sampled) {
+    glTexParameteri(target, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+    glTexParameteri(target, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+  }
+  GLState::Get().BindTexture(target, 0);
+  return texture;
+}
+
+ShadowMaps::ShadowMaps() :
+    m_cascade_size(0),
+    m_atlas_size(0),
+    m_window_width(0),
+    m_window_height(0),
+    m_distance(0.0f),
+    m_tan_x(1.0f),
+    m_tan_y(1.0f),
+    m_near(0.1f),
+    m_far(100.0f),
+    m_block(),
+    m_buffer(0),
+    m_cascades(0),
+    m_cascade_cache(0),
+    m_atlas(0),
+    m_atlas_cache(0),
+    m_framebuffer(0),
+    m_cache_framebuffer(0) {
+  for (unsigned i = 0; i < SHADOW_CASCADES; i++) {
+    m_cascade_centers[i] = glm::vec3(0.0f);
+    m_cascade_radii[i] = 0.0f;
+  }
+}
+
+/**
+ * Creates the shadow maps, their caches and the uniform buffer
+ * @param  cascade_size  - Width and height of each sun cascade
+ * @param  atlas_size    - Width and height of the spot light atlas
+ * @param  distance      - How far from the eye the sun casts shadows
+ * @param  window_width  - Viewport restored after drawing the shadows
+ * @param  window_height - Viewport restored after drawing the shadows
+ * @return               False if the driver can't render to the maps
+ */
+bool ShadowMaps::Initialize(unsigned cascade_size, unsigned atlas_size, float distance, unsigned window_width, unsigned window_height) {
+  m_cascade_size = cascade_size;
+  m_atlas_size = atlas_size - atlas_size % SHADOW_ATLAS_TILES;
+  m_distance = distance;
+  m_window_width = window_width;
+  m_window_height = window_height;
+
+  m_cascades = create_depth_texture(m_cascade_size, SHADOW_CASCADES, true);
+  m_cascade_cache = create_depth_texture(m_cascade_size, SHADOW_CASCADES, false);
+  m_atlas = create_depth_texture(m_atlas_size, 0, true);
+  m_atlas_cache = create_depth_texture(m_atlas_size, 0, false);
+
+  // Depth only, the draw and read buffers have to say so before GL 4.1
+  GLuint framebuffers[2];
+  glGenFramebuffers(2, framebuffers);
+  m_framebuffer = framebuffers[0];
+  m_cache_framebuffer = framebuffers[1];
+  for (auto i : framebuffers) {
+    GLState::Get().BindFramebuffer(GL_FRAMEBUFFER, i);
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+    glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, i == m_framebuffer ? m_cascades : m_cascade_cache, 0, 0);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+      std::cout << "Shadow framebuffer is incomplete." << std::endl;
+      GLState::Get().BindFramebuffer(GL_FRAMEBUFFER, 0);
+      Destroy();
+      return false;
+    }
+  }
+  GLState::Get().BindFramebuffer(GL_FRAMEBUFFER, 0);
+
+  m_views.resize(SHADOW_CASCADES + SHADOW_MAX_SPOTS);
+  unsigned tile_size = m_atlas_size / SHADOW_ATLAS_TILES;
+  for (unsigned i = 0; i < m_views.size(); i++) {
+    ShadowView& view = m_views[i];
+    view.active = false;
+    view.cached = false;
+    view.cascade = i < SHADOW_CASCADES;
+    view.layer = view.cascade ? i : i - SHADOW_CASCADES;
+    view.x = view.cascade ? 0 : (view.layer % SHADOW_ATLAS_TILES) * tile_size;
+    view.y = view.cascade ? 0 : (view.layer / SHADOW_ATLAS_TILES) * tile_size;
+    view.size = view.cascade ? m_cascade_size : tile_size;
+    view.light = -1;
+    view.radius = 0.0f;
+    view.texel = 0.0f;
+    view.rendered_light = -1;
+    view.rendered = false;
+  }
+
+  int* tiles = &m_block.spot_tiles[0].x;
+  for (unsigned i = 0; i < MAX_DIRECTIONAL_LIGHTS; i++) {
+    tiles[i] = -1;
+  }
+
+  glGenBuffers(1, &m_buffer);
+  GLState::Get().BindBuffer(GL_UNIFORM_BUFFER, m_buffer);
+  glBufferData(GL_UNIFORM_BUFFER, sizeof(ShadowBlock), nullptr, GL_DYNAMIC_DRAW);
+  GLState::Get().BindBuffer(GL_UNIFORM_BUFFER, 0);
+  GLState::Get().BindBufferBase(GL_UNIFORM_BUFFER, SHADOW_BLOCK_BINDING, m_buffer);
+  return true;
+}
+
+/**
+ * Keeps what the cascades are fit to, call whenever the projection changes
+ * @param projection - The projection matrix
+ * @param near       - Distance to the near plane
+ * @param far        - Distance to the far plane
+ */
+void ShadowMaps::SetProjection(const glm::mat4& projection, float near, float far) {
+  m_tan_x = 1.0f / projection[0][0];
+  m_tan_y = 1.0f / projection[1][1];
+  m_near = near;
+  m_far = far;
+
+  // Refit every cascade on the next update
+  for (unsigned i = 0; i < SHADOW_CASCADES; i++) {
+    m_cascade_radii[i] = 0.0f;
+  }
+}
+
+// Static casters were added or removed, every cached layer is redrawn
+void ShadowMaps::Invalidate() {
+  for (auto& i : m_views) {
+    i.cached = false;
+  }
+}
+
+/**
+ * Places every shadow view where the frame needs it. The shaders keep
+ * sampling each map with what it was drawn with until it is drawn again
+ * @param view    - The camera's view matrix
+ * @param lights  - The lights as uploaded to the shaders
+ * @param scene   - Bounds of every object, casters may be anywhere in it
+ * @param frustum - The camera's frustum, spot lights out of it get no map
+ */
+void ShadowMaps::Update(const glm::mat4& view, const LightBlock& lights, const Bounds& scene, const Frustum& frustum) {
+  if (m_buffer == 0) return;
+
+  glm::vec3 sun_direction(lights.sun_direction);
+  if (lights.sun_direction.w > 0.0f) {
+    UpdateCascades(glm::inverse(view), sun_direction, scene);
+  } else {
+    for (unsigned i = 0; i < SHADOW_CASCADES; i++) {
+      m_views[i].active = false;
+    }
+  }
+  UpdateSpots(lights, frustum);
+}
+
+// Fits each cascade's ortho box around its slice of the view. The box is
+// fit to the slice's bounding sphere, so it keeps its size as the camera
+// turns, and snapped to whole texels so edges don't shimmer as it moves
+void ShadowMaps::UpdateCascades(const glm::mat4& camera, const glm::vec3& direction, const Bounds& scene) {
+  glm::vec3 up = std::fabs(direction.y) > 0.99f ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+  glm::mat4 light_view = glm::lookAt(glm::vec3(0.0f), direction, up);
+
+  // Distances along the sun direction every caster lies within
+  float scene_min = 0.0f, scene_max = 0.0f;
+  for (unsigned i = 0; i < 8; i++) {
+    glm::vec3 corner((i & 1) ? scene.max.x : scene.min.x, (i & 2) ? scene.max.y : scene.min.y, (i & 4) ? scene.max.z : scene.min.z);
+    float distance = -(light_view * glm::vec4(corner, 1.0f)).z;
+    scene_min = i == 0 ? distance : std::min(scene_min, distance);
+    scene_max = i == 0 ? distance : std::max(scene_max, distance);
+  }
+
+  float near = m_near;
+  float far = std::min(m_far, m_distance);
+  float split_near = near;
+  for (unsigned c = 0; c < SHADOW_CASCADES; c++) {
+    float t = float(c + 1) / SHADOW_CASCADES;
+    float split_far = SHADOW_CASCADE_LAMBDA * near * std::pow(far / near, t) +
+                      (1.0f - SHADOW_CASCADE_LAMBDA) * (near + (far - near) * t);
+
+    // Sphere around the slice in view space, the same every frame until
+    // the projection changes
+    glm::vec3 center(0.0f, 0.0f, -(split_near + split_far) * 0.5f);
+    float radius = 0.0f;
+    for (unsigned i = 0; i < 8; i++) {
+      float depth = (i & 4) ? split_far : split_near;
+      glm::vec3 corner(((i & 1) ? 1.0f : -1.0f) * m_tan_x * depth, ((i & 2) ? 1.0f : -1.0f) * m_tan_y * depth, -depth);
+      radius = std::max(radius, glm::length(corner - center));
+    }
+    float cover = radius * SHADOW_CASCADE_SLACK;
+
+    // Only move once the slice would leave the area covered
+    glm::vec3 world_center(camera * glm::vec4(center, 1.0f));
+    if (m_cascade_radii[c] != radius || glm::length(world_center - m_cascade_centers[c]) > cover - radius) {
+      m_cascade_centers[c] = world_center;
+      m_cascade_radii[c] = radius;
+    }
+
+    float texel = 2.0f * cover / m_cascade_size;
+    glm::vec3 anchor(light_view * glm::vec4(m_cascade_centers[c], 1.0f));
+    anchor.x = std::floor(anchor.x / texel) * texel;
+    anchor.y = std::floor(anchor.y / texel) * texel;
+
+    float depth_min = std::floor(std::min(scene_min, -anchor.z - cover) / SHADOW_DEPTH_STEP) * SHADOW_DEPTH_STEP;
+    float depth_max = std::ceil(std::max(scene_max, -anchor.z + cover) / SHADOW_DEPTH_STEP) * SHADOW_DEPTH_STEP;
+    glm::mat4 projection = glm::ortho(anchor.x - cover, anchor.x + cover, anchor.y - cover, anchor.y + cover, depth_min, depth_max);
+
+    ShadowView& view = m_views[c];
+    view.active = true;
+    view.proj_view = projection * light_view;
+    view.center = m_cascade_centers[c];
+    view.radius = cover;
+    view.texel = texel;
+    m_block.cascade_splits[c] = split_far;
+    split_near = split_far;
+  }
+}
+
+// Gives the spot lights reaching the view an atlas tile each, in the
+// order they were added, until the atlas is full. Lights keep their tile
+// while they stay in view, and get their old one back if it wasn't taken,
+// so a tile that isn't redrawn still holds their map
+void ShadowMaps::UpdateSpots(const LightBlock& lights, const Frustum& frustum) {
+  bool reaches[MAX_DIRECTIONAL_LIGHTS] = {};
+  int slots[MAX_DIRECTIONAL_LIGHTS];
+  for (int i = 0; i < lights.directional_count; i++) {
+    const DirectionalLightData& light = lights.dir_lights[i];
+    float range = light.strength / LIGHT_CUTOFF;
+    reaches[i] = range > SHADOW_SPOT_NEAR && frustum.TestBox(light.position, glm::vec3(range));
+    slots[i] = -1;
+  }
+
+  // Free the tiles of lights that left the view
+  for (unsigned slot = 0; slot < SHADOW_MAX_SPOTS; slot++) {
+    ShadowView& view = m_views[SHADOW_CASCADES + slot];
+    if (view.light >= 0 && (view.light >= lights.directional_count || !reaches[view.light])) view.light = -1;
+    if (view.light >= 0) slots[view.light] = slot;
+  }
+
+  for (int i = 0; i < lights.directional_count; i++) {
+    if (!reaches[i] || slots[i] >= 0) continue;
+    int free = -1;
+    for (unsigned slot = 0; slot < SHADOW_MAX_SPOTS; slot++) {
+      const ShadowView& view = m_views[SHADOW_CASCADES + slot];
+      if (view.light >= 0) continue;
+      if (free < 0 || view.rendered_light == i) free = slot;
+      if (view.rendered_light == i) break;
+    }
+    if (free < 0) break;
+    m_views[SHADOW_CASCADES + free].light = i;
+  }
+
+  for (unsigned slot = 0; slot < SHADOW_MAX_SPOTS; slot++) {
+    ShadowView& view = m_views[SHADOW_CASCADES + slot];
+    view.active = view.light >= 0;
+    if (!view.active) continue;
+    const DirectionalLightData& light = lights.dir_lights[view.light];
+    float range = light.strength / LIGHT_CUTOFF;
+
+    // The cone the shaders light, see LightClusters::Assign
+    float angle = float(M_PI) / 2.0f;
+    if (light.inner_angle <= light.outer_angle) angle = std::min(angle, light.outer_angle);
+    angle = std::min(angle, SHADOW_SPOT_MAX_ANGLE);
+
+    glm::vec3 direction = glm::normalize(light.direction);
+    glm::vec3 up = std::fabs(direction.y) > 0.99f ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+    view.proj_view = glm::perspective(2.0f * angle, 1.0f, SHADOW_SPOT_NEAR, range) *
+                     glm::lookAt(light.position, light.position + direction, up);
+    view.center = light.position;
+    view.radius = range;
+  }
+}
+
+/**
+ * Whether a view's map can't be sampled until it is drawn again, because
+ * it never was, its tile went to another light or its cascade moved. A
+ * cascade only moves once its slice leaves what the old one covers
+ * @param  index - The view
+ * @return         True if the view has to be drawn this frame
+ */
+bool ShadowMaps::IsStale(unsigned index) const {
+  const ShadowView& view = m_views[index];
+  if (!view.rendered) return true;
+  if (view.cascade) return view.proj_view != view.rendered_proj_view;
+  return view.light != view.rendered_light;
+}
+
+void ShadowMaps::Attach(GLuint framebuffer, const ShadowView& view, bool cache) {
+  GLState::Get().BindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+  if (view.cascade) {
+    glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, cache ? m_cascade_cache : m_cascades, 0, view.layer);
+  } else {
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, cache ? m_atlas_cache : m_atlas, 0);
+  }
+}
+
+// Limits drawing to the view's layer or tile, with the caster bias. Depth
+// clamping keeps casters in front of the near plane casting
+void ShadowMaps::BeginView(const ShadowView& view) {
+  GLState::Get().Viewport(view.x, view.y, view.size, view.size);
+  GLState::Get().Scissor(view.x, view.y, view.size, view.size);
+  GLState::Get().Enable(GL_SCISSOR_TEST);
+  GLState::Get().Enable(GL_POLYGON_OFFSET_FILL);
+  glPolygonOffset(SHADOW_SLOPE_BIAS, SHADOW_CONSTANT_BIAS);
+  GLState::Get().Enable(GL_DEPTH_CLAMP);
+}
+
+/**
+ * Binds a view's cached layer when it has to be redrawn, the caller then
+ * draws the static casters
+ * @param  index - The view
+ * @return       False if the cached layer is still good
+ */
+bool ShadowMaps::BeginStatic(unsigned index) {
+  ShadowView& view = m_views[index];
+  if (view.cached && view.cached_proj_view == view.proj_view) {
+    RenderStats::Get().shadow_views_cached++;
+    return false;
+  }
+
+  Attach(m_cache_framebuffer, view, true);
+  BeginView(view);
+  glClear(GL_DEPTH_BUFFER_BIT);
+  view.cached = true;
+  view.cached_proj_view = view.proj_view;
+  return true;
+}
+
+/**
+ * Copies a view's cached layer into the sampled map and binds it, the
+ * caller then draws the dynamic casters. The shaders sample the map with
+ * the view's current matrix from now on
+ * @param index - The view
+ */
+void ShadowMaps::BeginDynamic(unsigned index) {
+  ShadowView& view = m_views[index];
+  Attach(m_cache_framebuffer, view, true);
+  Attach(m_framebuffer, view, false);
+  BeginView(view);
+
+  GLState::Get().BindFramebuffer(GL_READ_FRAMEBUFFER, m_cache_framebuffer);
+  glBlitFramebuffer(view.x, view.y, view.x + view.size, view.y + view.size,
+                    view.x, view.y, view.x + view.size, view.y + view.size,
+                    GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+  GLState::Get().BindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+  RenderStats::Get().shadow_views++;
+
+  if (view.cascade) {
+    m_block.cascade_matrices[view.layer] = view.proj_view;
+    m_block.cascade_texels[view.layer] = view.texel;
+  } else {
+    // The tile no longer holds the light it was drawn for before
+    int* tiles = &m_block.spot_tiles[0].x;
+    if (view.rendered_light >= 0 && tiles[view.rendered_light] == int(view.layer)) tiles[view.rendered_light] = -1;
+    tiles[view.light] = view.layer;
+    m_block.spot_matrices[view.layer] = view.proj_view;
+  }
+  view.rendered = true;
+  view.rendered_proj_view = view.proj_view;
+  view.rendered_light = view.light;
+}
+
+// Restores the window's framebuffer and state, and uploads and binds the
+// maps for the frame's shading
+void ShadowMaps::Finish() {
+  GLState::Get().BindBuffer(GL_UNIFORM_BUFFER, m_buffer);
+  glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(ShadowBlock), &m_block);
+  GLState::Get().BindBuffer(GL_UNIFORM_BUFFER, 0);
+
+  GLState::Get().Disable(GL_SCISSOR_TEST);
+  GLState::Get().Disable(GL_POLYGON_OFFSET_FILL);
+  GLState::Get().Disable(GL_DEPTH_CLAMP);
+  GLState::Get().BindFramebuffer(GL_FRAMEBUFFER, 0);
+  GLState::Get().Viewport(0, 0, m_window_width, m_window_height);
+
+  GLState::Get().BindTexture(GL_SUN_SHADOW_POS, GL_TEXTURE_2D_ARRAY, m_cascades);
+  GLState::Get().BindTexture(GL_SPOT_SHADOW_POS, GL_TEXTURE_2D, m_atlas);
+}
+
+void ShadowMaps::Destroy() {
+  GLuint textures[] = { m_cascades, m_cascade_cache, m_atlas, m_atlas_cache };
+  GLState::Get().DeleteTextures(4, textures);
+  GLuint framebuffers[] = { m_framebuffer, m_cache_framebuffer };
+  GLState::Get().DeleteFramebuffers(2, framebuffers);
+  if (m_buffer != 0) GLState::Get().DeleteBuffers(1, &m_buffer);
+
+  m_cascades = m_cascade_cache = m_atlas = m_atlas_cache = 0;
+  m_framebuffer = m_cache_framebuffer = 0;
+  m_buffer = 0;
+  m_views.clear();
+}
@@ -0,0 +1,126 @@
+#include "shadow_scheduler.h"
+#include "render_stats.h"
+
+#include <algorithm>
+#include <functional>
+
+ShadowScheduler::ShadowScheduler() :
+    m_budget_ms(0.0f),
+    m_view_ms(SHADOW_INITIAL_VIEW_MS),
+    m_frame(0) {
+  for (unsigned i = 0; i < SHADOW_TIMER_FRAMES; i++) {
+    m_queries[i] = 0;
+    m_query_views[i] = 0;
+  }
+}
+
+/**
+ * Creates the timer queries
+ * @param budget_ms - GPU time the views drawn in a frame may take, views
+ *                    that have to be drawn are drawn regardless
+ */
+void ShadowScheduler::Initialize(float budget_ms) {
+  m_budget_ms = budget_ms;
+  glGenQueries(SHADOW_TIMER_FRAMES, m_queries);
+}
+
+void ShadowScheduler::Destroy() {
+  if (m_queries[0] != 0) glDeleteQueries(SHADOW_TIMER_FRAMES, m_queries);
+  for (unsigned i = 0; i < SHADOW_TIMER_FRAMES; i++) {
+    m_queries[i] = 0;
+  }
+}
+
+/**
+ * Picks the views to draw this frame, see GetUpdates
+ * @param shadows          - The shadow maps, updated for the frame
+ * @param eye              - The camera position
+ * @param projection_scale - Pixels covered by one unit at a distance of one
+ */
+void ShadowScheduler::Schedule(const ShadowMaps& shadows, const glm::vec3& eye, float projection_scale) {
+  RenderStats& stats = RenderStats::Get();
+  m_ages.resize(shadows.GetViewCount(), 0);
+  m_updates.clear();
+  m_due.clear();
+
+  // Views that can't be sampled as they are come first, whatever they cost
+  float spent = 0.0f;
+  for (unsigned i = 0; i < shadows.GetViewCount(); i++) {
+    const ShadowView& view = shadows.GetView(i);
+    if (!view.active) continue;
+    if (shadows.IsStale(i)) {
+      m_updates.push_back(i);
+      spent += m_view_ms;
+      continue;
+    }
+
+    unsigned interval = Interval(view, eye, projection_scale);
+    if (++m_ages[i] >= interval) {
+      m_due.push_back(std::make_pair(float(m_ages[i]) / interval, i));
+    } else {
+      stats.shadow_views_skipped++;
+    }
+  }
+
+  // Then the most overdue within the budget. At least one view is drawn
+  // every frame so none waits forever when the budget is tight
+  std::sort(m_due.begin(), m_due.end(), std::greater<std::pair<float, unsigned>>());
+  for (auto& i : m_due) {
+    if (m_updates.empty() || spent + m_view_ms <= m_budget_ms) {
+      m_updates.push_back(i.second);
+      spent += m_view_ms;
+    } else {
+      stats.shadow_views_skipped++;
+    }
+  }
+
+  for (auto i : m_updates) {
+    m_ages[i] = 0;
+  }
+}
+
+// Frames between redraws of a view, 1 to draw it every frame
+unsigned ShadowScheduler::Interval(const ShadowView& view, const glm::vec3& eye, float projection_scale) const {
+  // Each cascade covers about twice the area of the one before at half
+  // the detail on screen
+  if (view.cascade) {
+    return std::min(1u << view.layer, unsigned(SHADOW_MAX_INTERVAL));
+  }
+
+  // A moving light moves every shadow it casts
+  if (view.proj_view != view.rendered_proj_view) return 1;
+
+  float distance = glm::length(view.center - eye) - view.radius;
+  if (distance <= 0.0f) return 1;
+  float pixels = view.radius / distance * projection_scale;
+  float interval = std::ceil(SHADOW_SPOT_FULL_RATE_PIXELS / std::max(pixels, 1.0f));
+  return unsigned(std::min(interval, float(SHADOW_MAX_INTERVAL)));
+}
+
+// Starts timing the frame's views, after reading the query of the frame
+// that used the same slot if the GPU has finished it
+void ShadowScheduler::BeginFrame() {
+  unsigned slot = m_frame % SHADOW_TIMER_FRAMES;
+  if (m_query_views[slot] > 0) {
+    GLint available = 0;
+    glGetQueryObjectiv(m_queries[slot], GL_QUERY_RESULT_AVAILABLE, &available);
+    if (available) {
+      GLuint64 elapsed = 0;
+      glGetQueryObjectui64v(m_queries[slot], GL_QUERY_RESULT, &elapsed);
+      float view_ms = float(elapsed) / 1e6f / m_query_views[slot];
+      m_view_ms += SHADOW_COST_SMOOTHING * (view_ms - m_view_ms);
+      RenderStats::Get().shadow_gpu_us += unsigned(elapsed / 1000);
+    }
+    m_query_views[slot] = 0;
+  }
+
+  if (!m_updates.empty()) glBeginQuery(GL_TIME_ELAPSED, m_queries[slot]);
+}
+
+void ShadowScheduler::EndFrame() {
+  if (!m_updates.empty()) {
+    glEndQuery(GL_TIME_ELAPSED);
+    m_query_views[m_frame % SHADOW_TIMER_FRAMES] = m_updates.size();
+  }
+  m_frame++;
+}
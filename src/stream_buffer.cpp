@@ -0,0 +1,196 @@
+#include "stream_buffer.h"
+#include "gl_caps.h"
+#include "gl_state.h"
+#include "render_stats.h"
+
+// How long to block in one glClientWaitSync before trying again
+#define STREAM_WAIT_TIMEOUT_NS 1000000000ull
+
+StreamBuffer& StreamBuffer::Get() {
+  static StreamBuffer stream;
+  return stream;
+}
+
+StreamBuffer::StreamBuffer() :
+    m_buffer(0),
+    m_region_size(0),
+    m_persistent_ptr(nullptr),
+    m_region(0),
+    m_frame_region(0),
+    m_head(0),
+    m_staging_offset(0),
+    m_staged(false) {
+  for (unsigned i = 0; i < STREAM_BUFFER_REGIONS; i++) {
+    m_fences[i] = 0;
+  }
+}
+
+/**
+ * Creates the buffer
+ * @param size - Size of the whole buffer, each frame writes a third of it
+ */
+void StreamBuffer::Initialize(GLsizeiptr size) {
+  Allocate(size / STREAM_BUFFER_REGIONS);
+}
+
+// Creates and maps the buffer with regions of the given size, rounded up
+// so every region starts aligned
+void StreamBuffer::Allocate(GLsizeiptr region_size) {
+  m_region_size = (region_size + STREAM_BUFFER_ALIGNMENT - 1) / STREAM_BUFFER_ALIGNMENT * STREAM_BUFFER_ALIGNMENT;
+  m_region = m_frame_region = 0;
+  m_head = 0;
+
+  glGenBuffers(1, &m_buffer);
+  GLState::Get().BindBuffer(GL_COPY_WRITE_BUFFER, m_buffer);
+
+  // Storage made with glBufferStorage can't be reallocated, if it can't
+  // be mapped persistently each write maps its range instead
+  bool immutable = false;
+  #ifdef GL_MAP_PERSISTENT_BIT
+    if (GLCaps::Get().buffer_storage) {
+      GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+      glBufferStorage(GL_COPY_WRITE_BUFFER, m_region_size * STREAM_BUFFER_REGIONS, nullptr, flags | GL_DYNAMIC_STORAGE_BIT);
+      immutable = true;
+      m_persistent_ptr = static_cast<uint8_t*>(glMapBufferRange(
+        GL_COPY_WRITE_BUFFER, 0, m_region_size * STREAM_BUFFER_REGIONS, flags
+      ));
+    }
+  #endif
+
+  if (!immutable) {
+    glBufferData(GL_COPY_WRITE_BUFFER, m_region_size * STREAM_BUFFER_REGIONS, nullptr, GL_STREAM_DRAW);
+  }
+
+  GLState::Get().BindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+/**
+ * Reserves space in the current frame's region and maps it for writing,
+ * call Unmap once written and before drawing with it
+ * @param  size      - Bytes to write
+ * @param  alignment - What the offset has to be a multiple of, at most
+ *                     STREAM_BUFFER_ALIGNMENT
+ * @param  offset    - Set to where the data starts in GetBuffer
+ * @return           Where to write the data
+ */
+void* StreamBuffer::Map(GLsizeiptr size, GLsizeiptr alignment, GLintptr& offset) {
+  GLsizeiptr start = (m_head + alignment - 1) / alignment * alignment;
+  if (start + size > m_region_size) {
+    unsigned next = (m_region + 1) % STREAM_BUFFER_REGIONS;
+    if (size > m_region_size || next == m_frame_region) {
+      Grow(size);
+    } else {
+      Wait(next);
+      m_region = next;
+    }
+    start = 0;
+  }
+  m_head = start + size;
+  offset = m_region * m_region_size + start;
+  RenderStats::Get().stream_bytes += size;
+
+  if (m_persistent_ptr != nullptr) return m_persistent_ptr + offset;
+
+  // The fences already keep the GPU off the range
+  GLState::Get().BindBuffer(GL_COPY_WRITE_BUFFER, m_buffer);
+  void* data = glMapBufferRange(
+    GL_COPY_WRITE_BUFFER, offset, size,
+    GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT
+  );
+  if (data != nullptr) return data;
+
+  // The driver couldn't map it, Unmap copies the data in instead
+  m_staging.resize(size);
+  m_staging_offset = offset;
+  m_staged = true;
+  return m_staging.data();
+}
+
+void StreamBuffer::Unmap() {
+  if (m_persistent_ptr != nullptr) return;
+  GLState::Get().BindBuffer(GL_COPY_WRITE_BUFFER, m_buffer);
+  if (m_staged) {
+    glBufferSubData(GL_COPY_WRITE_BUFFER, m_staging_offset, m_staging.size(), m_staging.data());
+    m_staged = false;
+  } else {
+    glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+  }
+  GLState::Get().BindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+// Fences the regions this frame wrote and moves on to a fresh one, waiting
+// for the GPU if it is still reading it from STREAM_BUFFER_REGIONS frames ago
+void StreamBuffer::EndFrame() {
+  for (auto i : m_retired) {
+    GLState::Get().DeleteBuffers(1, &i);
+  }
+  m_retired.clear();
+
+  if (m_region == m_frame_region && m_head == 0) return;
+  for (unsigned i = m_frame_region;; i = (i + 1) % STREAM_BUFFER_REGIONS) {
+    m_fences[i] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    if (i == m_region) break;
+  }
+
+  m_region = (m_region + 1) % STREAM_BUFFER_REGIONS;
+  m_frame_region = m_region;
+  m_head = 0;
+  Wait(m_region);
+}
+
+// Blocks until the GPU is done with a region
+void StreamBuffer::Wait(unsigned region) {
+  GLsync& fence = m_fences[region];
+  if (fence == 0) return;
+
+  if (glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED) {
+    RenderStats::Get().stream_waits++;
+    while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, STREAM_WAIT_TIMEOUT_NS) == GL_TIMEOUT_EXPIRED) {}
+  }
+  glDeleteSync(fence);
+  fence = 0;
+}
+
+// Replaces the buffer with one whose regions fit the frame, the data the
+// frame already wrote stays in the old one
+void StreamBuffer::Grow(GLsizeiptr size) {
+  GLsizeiptr region_size = std::max(m_region_size * 2, size);
+  std::cout << "Stream buffer grown to " << region_size * STREAM_BUFFER_REGIONS / 1024 << " KiB" << std::endl;
+
+  if (m_persistent_ptr != nullptr) {
+    GLState::Get().BindBuffer(GL_COPY_WRITE_BUFFER, m_buffer);
+    glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+    GLState::Get().BindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    m_persistent_ptr = nullptr;
+  }
+  m_retired.push_back(m_buffer);
+
+  // Nothing has read the new buffer yet
+  for (unsigned i = 0; i < STREAM_BUFFER_REGIONS; i++) {
+    if (m_fences[i] != 0) glDeleteSync(m_fences[i]);
+    m_fences[i] = 0;
+  }
+  Allocate(region_size);
+}
+
+void StreamBuffer::Destroy() {
+  for (unsigned i = 0; i < STREAM_BUFFER_REGIONS; i++) {
+    if (m_fences[i] != 0) glDeleteSync(m_fences[i]);
+    m_fences[i] = 0;
+  }
+
+  if (m_buffer != 0) {
+    if (m_persistent_ptr != nullptr) {
+      GLState::Get().BindBuffer(GL_COPY_WRITE_BUFFER, m_buffer);
+      glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+      GLState::Get().BindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    }
+    GLState::Get().DeleteBuffers(1, &m_buffer);
+  }
+  for (auto i : m_retired) {
+    GLState::Get().DeleteBuffers(1, &i);
+  }
+  m_retired.clear();
+  m_buffer = 0;
+  m_persistent_ptr = nullptr;
+}
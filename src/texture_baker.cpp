@@ -0,0 +1,568 @@
+#include "texture_baker.h"
+
+#include <cmath>
+#include <cstring>
+#include <cstdio>
+#include <sstream>
+
+/* ------------------------------------------------------------
+ * Mip generation
+ * -----------------------------------------------------------*/
+static inline unsigned clamp_index(unsigned value, unsigned size) {
+  return value < size ? value : size - 1;
+}
+
+void TextureBaker::GenerateMipChain(const uint8_t* rgba, unsigned width, unsigned height, bool normal_map, TextureImage& image) {
+  image.format = TEXTURE_RGBA8;
+  image.width = width;
+  image.height = height;
+  image.levels.clear();
+
+  // Work out the size of every level down to 1x1
+  size_t total = 0;
+  for (unsigned w = width, h = height; ; w = std::max(1u, w / 2), h = std::max(1u, h / 2)) {
+    TextureLevel level = { w, h, total, size_t(w) * h * 4 };
+    image.levels.push_back(level);
+    total += level.size;
+    if (w == 1 && h == 1) break;
+  }
+
+  image.data.resize(total);
+  memcpy(image.data.data(), rgba, image.levels[0].size);
+
+  // Box filter each level from the one above it
+  for (unsigned l = 1; l < image.levels.size(); l++) {
+    const TextureLevel& src_level = image.levels[l - 1];
+    const TextureLevel& dst_level = image.levels[l];
+    const uint8_t* src = image.data.data() + src_level.offset;
+    uint8_t* dst = image.data.data() + dst_level.offset;
+
+    for (unsigned y = 0; y < dst_level.height; y++) {
+      for (unsigned x = 0; x < dst_level.width; x++) {
+        unsigned x0 = clamp_index(x * 2, src_level.width), x1 = clamp_index(x * 2 + 1, src_level.width);
+        unsigned y0 = clamp_index(y * 2, src_level.height), y1 = clamp_index(y * 2 + 1, src_level.height);
+        const uint8_t* taps[4] = {
+          src + (y0 * src_level.width + x0) * 4, src + (y0 * src_level.width + x1) * 4,
+          src + (y1 * src_level.width + x0) * 4, src + (y1 * src_level.width + x1) * 4
+        };
+        uint8_t* out = dst + (y * dst_level.width + x) * 4;
+
+        if (normal_map) {
+          // Average the unpacked normals and renormalize so the chain
+          // doesn't get shorter with every level
+          glm::vec3 normal(0.0f);
+          for (unsigned t = 0; t < 4; t++) {
+            normal += glm::vec3(taps[t][0], taps[t][1], taps[t][2]) / 127.5f - 1.0f;
+          }
+          float length = glm::length(normal);
+          normal = length > 0.0f ? normal / length : glm::vec3(0.0f, 0.0f, 1.0f);
+          for (unsigned c = 0; c < 3; c++) {
+            out[c] = uint8_t(glm::clamp((normal[c] + 1.0f) * 127.5f + 0.5f, 0.0f, 255.0f));
+          }
+          out[3] = (taps[0][3] + taps[1][3] + taps[2][3] + taps[3][3] + 2) / 4;
+        } else {
+          for (unsigned c = 0; c < 4; c++) {
+            out[c] = (taps[0][c] + taps[1][c] + taps[2][c] + taps[3][c] + 2) / 4;
+          }
+        }
+      }
+    }
+  }
+}
+
+TextureFormat TextureBaker::ChooseFormat(const TextureImage& image, bool normal_map, bool allow_bc7) {
+  if (normal_map) {
+    return TEXTURE_BC5;
+  }
+  if (allow_bc7) {
+    return TEXTURE_BC7;
+  }
+
+  // Only pay for an alpha channel when the image uses one
+  const TextureLevel& level = image.levels[0];
+  bool has_alpha = false;
+  for (size_t i = level.offset + 3; i < level.offset + level.size; i += 4) {
+    if (image.data[i] != 255) {
+      has_alpha = true;
+      break;
+    }
+  }
+  return has_alpha ? TEXTURE_BC3 : TEXTURE_BC1;
+}
+
+/* ------------------------------------------------------------
+ * Block encoders
+ * -----------------------------------------------------------*/
+static inline int color_distance(const int* a, const int* b, unsigned channels) {
+  int distance = 0;
+  for (unsigned c = 0; c < channels; c++) {
+    distance += (a[c] - b[c]) * (a[c] - b[c]);
+  }
+  return distance;
+}
+
+// Finds the endpoints of the line through the block's colors that best fits
+// them, the principal axis is found with a few power iterations
+static void fit_endpoints(const uint8_t block[16][4], unsigned channels, float start[4], float end[4]) {
+  float mean[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+  for (unsigned i = 0; i < 16; i++) {
+    for (unsigned c = 0; c < channels; c++) mean[c] += block[i][c] / 16.0f;
+  }
+
+  float covariance[4][4] = { { 0.0f } };
+  for (unsigned i = 0; i < 16; i++) {
+    for (unsigned a = 0; a < channels; a++) {
+      for (unsigned b = 0; b < channels; b++) {
+        covariance[a][b] += (block[i][a] - mean[a]) * (block[i][b] - mean[b]);
+      }
+    }
+  }
+
+  float axis[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+  for (unsigned iteration = 0; iteration < 8; iteration++) {
+    float next[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    float largest = 0.0f;
+    for (unsigned a = 0; a < channels; a++) {
+      for (unsigned b = 0; b < channels; b++) next[a] += covariance[a][b] * axis[b];
+      largest = std::max(largest, std::fabs(next[a]));
+    }
+    // Flat block, any axis will do
+    if (largest == 0.0f) break;
+    for (unsigned c = 0; c < channels; c++) axis[c] = next[c] / largest;
+  }
+
+  float length = 0.0f;
+  for (unsigned c = 0; c < channels; c++) length += axis[c] * axis[c];
+  length = std::sqrt(length);
+
+  // Project the colors onto the axis to find its extent
+  float low = 0.0f, high = 0.0f;
+  for (unsigned i = 0; i < 16; i++) {
+    float t = 0.0f;
+    for (unsigned c = 0; c < channels; c++) t += (block[i][c] - mean[c]) * axis[c] / length;
+    low = std::min(low, t);
+    high = std::max(high, t);
+  }
+
+  for (unsigned c = 0; c < channels; c++) {
+    start[c] = glm::clamp(mean[c] + axis[c] / length * high, 0.0f, 255.0f);
+    end[c] = glm::clamp(mean[c] + axis[c] / length * low, 0.0f, 255.0f);
+  }
+}
+
+static inline uint16_t pack_565(const float* color) {
+  unsigned r = unsigned(color[0] * 31.0f / 255.0f + 0.5f);
+  unsigned g = unsigned(color[1] * 63.0f / 255.0f + 0.5f);
+  unsigned b = unsigned(color[2] * 31.0f / 255.0f + 0.5f);
+  return (r << 11) | (g << 5) | b;
+}
+
+static inline void unpack_565(uint16_t packed, int* color) {
+  int r = packed >> 11, g = (packed >> 5) & 63, b = packed & 31;
+  color[0] = (r << 3) | (r >> 2);
+  color[1] = (g << 2) | (g >> 4);
+  color[2] = (b << 3) | (b >> 2);
+}
+
+// BC1 color block, always in four color mode so it is valid inside BC3 too
+static void encode_color_block(const uint8_t block[16][4], uint8_t* out) {
+  float start[4], end[4];
+  fit_endpoints(block, 3, start, end);
+
+  uint16_t color0 = pack_565(start), color1 = pack_565(end);
+  if (color0 < color1) std::swap(color0, color1);
+
+  int palette[4][3];
+  unpack_565(color0, palette[0]);
+  unpack_565(color1, palette[1]);
+  for (unsigned c = 0; c < 3; c++) {
+    palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+    palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+  }
+
+  uint32_t indices = 0;
+  if (color0 != color1) {
+    for (unsigned i = 0; i < 16; i++) {
+      int pixel[3] = { block[i][0], block[i][1], block[i][2] };
+      unsigned best = 0;
+      int best_distance = color_distance(pixel, palette[0], 3);
+      for (unsigned p = 1; p < 4; p++) {
+        int distance = color_distance(pixel, palette[p], 3);
+        if (distance < best_distance) {
+          best = p;
+          best_distance = distance;
+        }
+      }
+      indices |= best << (i * 2);
+    }
+  }
+
+  out[0] = color0 & 0xff;
+  out[1] = color0 >> 8;
+  out[2] = color1 & 0xff;
+  out[3] = color1 >> 8;
+  for (unsigned i = 0; i < 4; i++) out[4 + i] = (indices >> (i * 8)) & 0xff;
+}
+
+// BC4 single channel block, used for BC3 alpha and both BC5 channels
+static void encode_channel_block(const uint8_t block[16][4], unsigned channel, uint8_t* out) {
+  int low = 255, high = 0;
+  for (unsigned i = 0; i < 16; i++) {
+    low = std::min<int>(low, block[i][channel]);
+    high = std::max<int>(high, block[i][channel]);
+  }
+
+  // Eight value mode, endpoints then six interpolated values
+  int palette[8] = { high, low };
+  for (unsigned p = 1; p < 7; p++) {
+    palette[p + 1] = ((7 - p) * high + p * low) / 7;
+  }
+
+  uint64_t indices = 0;
+  if (high != low) {
+    for (unsigned i = 0; i < 16; i++) {
+      int value = block[i][channel];
+      unsigned best = 0;
+      for (unsigned p = 1; p < 8; p++) {
+        if (std::abs(value - palette[p]) < std::abs(value - palette[best])) best = p;
+      }
+      indices |= uint64_t(best) << (i * 3);
+    }
+  }
+
+  out[0] = high;
+  out[1] = low;
+  for (unsigned i = 0; i < 6; i++) out[2 + i] = (indices >> (i * 8)) & 0xff;
+}
+
+static inline void write_bits(uint8_t* out, unsigned& position, unsigned value, unsigned count) {
+  for (unsigned i = 0; i < count; i++, position++) {
+    if (value & (1u << i)) out[position / 8] |= 1 << (position % 8);
+  }
+}
+
+// BC7 mode 6, one subset with 7 bit RGBA endpoints, a p-bit per endpoint
+// and 4 bit indices
+static void encode_bptc_block(const uint8_t block[16][4], uint8_t* out) {
+  static const int weights[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+  float endpoints[2][4];
+  fit_endpoints(block, 4, endpoints[0], endpoints[1]);
+
+  // Quantize each endpoint, trying both p-bits
+  int quantized[2][4], p_bits[2], decoded[2][4];
+  for (unsigned e = 0; e < 2; e++) {
+    float best_error = -1.0f;
+    for (int p = 0; p < 2; p++) {
+      int candidate[4];
+      float error = 0.0f;
+      for (unsigned c = 0; c < 4; c++) {
+        candidate[c] = glm::clamp(int((endpoints[e][c] - p) / 2.0f + 0.5f), 0, 127);
+        float difference = (candidate[c] * 2 + p) - endpoints[e][c];
+        error += difference * difference;
+      }
+      if (best_error < 0.0f || error < best_error) {
+        best_error = error;
+        p_bits[e] = p;
+        for (unsigned c = 0; c < 4; c++) quantized[e][c] = candidate[c];
+      }
+    }
+    for (unsigned c = 0; c < 4; c++) decoded[e][c] = quantized[e][c] * 2 + p_bits[e];
+  }
+
+  int palette[16][4];
+  for (unsigned p = 0; p < 16; p++) {
+    for (unsigned c = 0; c < 4; c++) {
+      palette[p][c] = ((64 - weights[p]) * decoded[0][c] + weights[p] * decoded[1][c] + 32) >> 6;
+    }
+  }
+
+  unsigned indices[16];
+  for (unsigned i = 0; i < 16; i++) {
+    int pixel[4] = { block[i][0], block[i][1], block[i][2], block[i][3] };
+    indices[i] = 0;
+    int best_distance = color_distance(pixel, palette[0], 4);
+    for (unsigned p = 1; p < 16; p++) {
+      int distance = color_distance(pixel, palette[p], 4);
+      if (distance < best_distance) {
+        indices[i] = p;
+        best_distance = distance;
+      }
+    }
+  }
+
+  // The first index is stored without its top bit, swap the endpoints if
+  // it would be set
+  if (indices[0] & 8) {
+    for (unsigned c = 0; c < 4; c++) std::swap(quantized[0][c], quantized[1][c]);
+    std::swap(p_bits[0], p_bits[1]);
+    for (unsigned i = 0; i < 16; i++) indices[i] = 15 - indices[i];
+  }
+
+  memset(out, 0, 16);
+  unsigned position = 0;
+  write_bits(out, position, 1 << 6, 7);
+  for (unsigned c = 0; c < 4; c++) {
+    write_bits(out, position, quantized[0][c], 7);
+    write_bits(out, position, quantized[1][c], 7);
+  }
+  write_bits(out, position, p_bits[0], 1);
+  write_bits(out, position, p_bits[1], 1);
+  write_bits(out, position, indices[0], 3);
+  for (unsigned i = 1; i < 16; i++) {
+    write_bits(out, position, indices[i], 4);
+  }
+}
+
+void TextureBaker::Compress(const TextureImage& source, TextureFormat format, TextureImage& image) {
+  image.format = format;
+  image.width = source.width;
+  image.height = source.height;
+  image.levels.clear();
+
+  if (format == TEXTURE_RGBA8) {
+    image.levels = source.levels;
+    image.data = source.data;
+    return;
+  }
+
+  unsigned block_size = GetBlockSize(format);
+  size_t total = 0;
+  for (auto& i : source.levels) {
+    TextureLevel level = { i.width, i.height, total, GetLevelSize(format, i.width, i.height) };
+    image.levels.push_back(level);
+    total += level.size;
+  }
+  image.data.assign(total, 0);
+
+  for (unsigned l = 0; l < source.levels.size(); l++) {
+    const TextureLevel& level = source.levels[l];
+    const uint8_t* src = source.data.data() + level.offset;
+    uint8_t* out = image.data.data() + image.levels[l].offset;
+
+    for (unsigned by = 0; by < level.height; by += 4) {
+      for (unsigned bx = 0; bx < level.width; bx += 4, out += block_size) {
+        // Gather the block, repeating edge pixels on partial blocks
+        uint8_t block[16][4];
+        for (unsigned y = 0; y < 4; y++) {
+          for (unsigned x = 0; x < 4; x++) {
+            unsigned sx = clamp_index(bx + x, level.width), sy = clamp_index(by + y, level.height);
+            memcpy(block[y * 4 + x], src + (sy * level.width + sx) * 4, 4);
+          }
+        }
+
+        switch (format) {
+          case TEXTURE_BC1: {
+            encode_color_block(block, out);
+            break;
+          }
+          case TEXTURE_BC3: {
+            encode_channel_block(block, 3, out);
+            encode_color_block(block, out + 8);
+            break;
+          }
+          case TEXTURE_BC5: {
+            encode_channel_block(block, 0, out);
+            encode_channel_block(block, 1, out + 8);
+            break;
+          }
+          case TEXTURE_BC7: {
+            encode_bptc_block(block, out);
+            break;
+          }
+          default: break;
+        }
+      }
+    }
+  }
+}
+
+/* ------------------------------------------------------------
+ * KTX 1.1 container
+ * -----------------------------------------------------------*/
+static const uint8_t KTX_IDENTIFIER[12] = { 0xAB, 'K', 'T', 'X', ' ', '1', '1', 0xBB, '\r', '\n', 0x1A, '\n' };
+static const uint32_t KTX_ENDIANNESS = 0x04030201;
+static const char KTX_SOURCE_KEY[] = "ogs.source";
+
+struct KTXHeader {
+  uint8_t identifier[12];
+  uint32_t endianness;
+  uint32_t gl_type, gl_type_size, gl_format;
+  uint32_t gl_internal_format, gl_base_internal_format;
+  uint32_t pixel_width, pixel_height, pixel_depth;
+  uint32_t number_of_array_elements, number_of_faces, number_of_mipmap_levels;
+  uint32_t bytes_of_key_value_data;
+};
+
+static inline size_t pad_4(size_t size) {
+  return (size + 3) & ~size_t(3);
+}
+
+bool TextureBaker::WriteKTX(const std::string& filename, const TextureImage& image, uint64_t source_mtime, uint64_t source_size) {
+  // The state of the source image, so stale bakes can be detected
+  std::ostringstream source;
+  source << source_mtime << " " << source_size;
+  std::string key_value = std::string(KTX_SOURCE_KEY) + '\0' + source.str() + '\0';
+  uint32_t key_value_size = key_value.size();
+
+  KTXHeader header;
+  memcpy(header.identifier, KTX_IDENTIFIER, sizeof(KTX_IDENTIFIER));
+  header.endianness = KTX_ENDIANNESS;
+  header.gl_type = IsCompressed(image.format) ? 0 : GL_UNSIGNED_BYTE;
+  header.gl_type_size = 1;
+  header.gl_format = IsCompressed(image.format) ? 0 : GL_RGBA;
+  header.gl_internal_format = GetInternalFormat(image.format);
+  header.gl_base_internal_format = image.format == TEXTURE_BC5 ? GL_RG : (image.format == TEXTURE_BC1 ? GL_RGB : GL_RGBA);
+  header.pixel_width = image.width;
+  header.pixel_height = image.height;
+  header.pixel_depth = 0;
+  header.number_of_array_elements = 0;
+  header.number_of_faces = 1;
+  header.number_of_mipmap_levels = image.levels.size();
+  header.bytes_of_key_value_data = pad_4(sizeof(uint32_t) + key_value_size);
+
+  std::string temp_path = filename + ".tmp";
+  std::ofstream file(temp_path.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+  if (!file) {
+    return false;
+  }
+
+  const char padding[4] = { 0 };
+  file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  file.write(reinterpret_cast<const char*>(&key_value_size), sizeof(key_value_size));
+  file.write(key_value.data(), key_value_size);
+  file.write(padding, header.bytes_of_key_value_data - sizeof(uint32_t) - key_value_size);
+
+  for (auto& i : image.levels) {
+    uint32_t image_size = i.size;
+    file.write(reinterpret_cast<const char*>(&image_size), sizeof(image_size));
+    file.write(reinterpret_cast<const char*>(image.data.data() + i.offset), i.size);
+    file.write(padding, pad_4(i.size) - i.size);
+  }
+
+  file.close();
+  if (!file || rename(temp_path.c_str(), filename.c_str()) != 0) {
+    remove(temp_path.c_str());
+    return false;
+  }
+
+  return true;
+}
+
+/**
+ * Reads the level table of a KTX file without copying the image data
+ * @param  data          - The contents of the KTX file
+ * @param  size          - The size of the file in bytes
+ * @param  image         - Set to the format and levels, offsets are relative to data
+ * @param  source_mtime  - Set to the modification time of the baked source image
+ * @param  source_size   - Set to the size of the baked source image
+ * @return               False if the file isn't a KTX file we can use
+ */
+bool TextureBaker::ParseKTX(const uint8_t* data, size_t size, TextureImage& image, uint64_t& source_mtime, uint64_t& source_size) {
+  if (size < sizeof(KTXHeader)) return false;
+
+  const KTXHeader* header = reinterpret_cast<const KTXHeader*>(data);
+  if (memcmp(header->identifier, KTX_IDENTIFIER, sizeof(KTX_IDENTIFIER)) != 0 ||
+      header->endianness != KTX_ENDIANNESS ||
+      header->number_of_faces != 1 ||
+      header->pixel_depth > 1 ||
+      header->number_of_array_elements > 0 ||
+      header->number_of_mipmap_levels == 0) {
+    return false;
+  }
+
+  switch (header->gl_internal_format) {
+    case GL_RGBA8: image.format = TEXTURE_RGBA8; break;
+    case GL_COMPRESSED_RGB_S3TC_DXT1_EXT: image.format = TEXTURE_BC1; break;
+    case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT: image.format = TEXTURE_BC3; break;
+    case GL_COMPRESSED_RG_RGTC2: image.format = TEXTURE_BC5; break;
+    case GL_COMPRESSED_RGBA_BPTC_UNORM: image.format = TEXTURE_BC7; break;
+    default: return false;
+  }
+  image.width = header->pixel_width;
+  image.height = std::max(1u, header->pixel_height);
+
+  // Look for the source stamp in the key value data
+  source_mtime = source_size = 0;
+  size_t offset = sizeof(KTXHeader);
+  size_t key_value_end = offset + header->bytes_of_key_value_data;
+  if (key_value_end > size) return false;
+  while (offset + sizeof(uint32_t) <= key_value_end) {
+    uint32_t pair_size;
+    memcpy(&pair_size, data + offset, sizeof(pair_size));
+    const char* pair = reinterpret_cast<const char*>(data + offset + sizeof(uint32_t));
+    if (offset + sizeof(uint32_t) + pair_size > key_value_end) return false;
+
+    std::string key(pair, strnlen(pair, pair_size));
+    if (key == KTX_SOURCE_KEY && key.size() < pair_size) {
+      std::istringstream value(std::string(pair + key.size() + 1, pair_size - key.size() - 1));
+      value >> source_mtime >> source_size;
+    }
+    offset += pad_4(sizeof(uint32_t) + pair_size);
+  }
+  offset = key_value_end;
+
+  // Record where every level lives
+  image.levels.clear();
+  unsigned width = image.width, height = image.height;
+  for (unsigned l = 0; l < header->number_of_mipmap_levels; l++) {
+    if (offset + sizeof(uint32_t) > size) return false;
+    uint32_t image_size;
+    memcpy(&image_size, data + offset, sizeof(image_size));
+    offset += sizeof(uint32_t);
+    if (offset + image_size > size ||
+        image_size != GetLevelSize(image.format, width, height)) {
+      return false;
+    }
+
+    TextureLevel level = { width, height, offset, image_size };
+    image.levels.push_back(level);
+
+    offset += pad_4(image_size);
+    width = std::max(1u, width / 2);
+    height = std::max(1u, height / 2);
+  }
+
+  return true;
+}
+
+/* ------------------------------------------------------------
+ * Format information
+ * -----------------------------------------------------------*/
+GLenum TextureBaker::GetInternalFormat(TextureFormat format) {
+  switch (format) {
+    case TEXTURE_BC1: return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+    case TEXTURE_BC3: return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+    case TEXTURE_BC5: return GL_COMPRESSED_RG_RGTC2;
+    case TEXTURE_BC7: return GL_COMPRESSED_RGBA_BPTC_UNORM;
+    default: return GL_RGBA8;
+  }
+}
+
+unsigned TextureBaker::GetBlockSize(TextureFormat format) {
+  switch (format) {
+    case TEXTURE_BC1: return 8;
+    case TEXTURE_BC3: return 16;
+    case TEXTURE_BC5: return 16;
+    case TEXTURE_BC7: return 16;
+    default: return 4;
+  }
+}
+
+/**
+ * Bytes one level takes, compressed formats store whole 4x4 blocks
+ * @param  format - The format of the level
+ * @param  width  - Width of the level in pixels
+ * @param  height - Height of the level in pixels
+ * @return        The size in bytes
+ */
+size_t TextureBaker::GetLevelSize(TextureFormat format, unsigned width, unsigned height) {
+  if (!IsCompressed(format)) {
+    return size_t(width) * height * GetBlockSize(format);
+  }
+  return size_t((width + 3) / 4) * ((height + 3) / 4) * GetBlockSize(format);
+}
+
+bool TextureBaker::IsNormalMap(const std::string& texture_name) {
+  return texture_name.find("normal") != std::string::npos;
+}
@@ -0,0 +1,289 @@
+#include "texture_streamer.h"
+#include "gl_caps.h"
+#include "gl_state.h"
+#include "model.h"
+
+#include <chrono>
+#include <cstring>
+
+TextureStreamer& TextureStreamer::Get() {
+  static TextureStreamer streamer;
+  return streamer;
+}
+
+TextureStreamer::TextureStreamer() :
+    m_budget_ms(0.0f),
+    m_anisotropy(1.0f),
+    m_staging_buffer(0),
+    m_segment_size(0),
+    m_persistent_ptr(nullptr),
+    m_segment(0),
+    m_color_placeholder(0),
+    m_normal_placeholder(0) {
+  for (unsigned i = 0; i < TEXTURE_STAGING_SEGMENTS; i++) {
+    m_segment_fences[i] = 0;
+  }
+}
+
+bool TextureStreamer::Initialize(float budget_ms, unsigned staging_size, float anisotropy) {
+  m_budget_ms = budget_ms;
+  m_anisotropy = std::min(anisotropy, GLCaps::Get().max_anisotropy);
+  m_segment_size = staging_size / TEXTURE_STAGING_SEGMENTS;
+
+  // A black texel makes the shaders fall back to the material color and a
+  // flat normal leaves the surface normal unchanged
+  m_color_placeholder = CreatePlaceholder(0, 0, 0, 255);
+  m_normal_placeholder = CreatePlaceholder(128, 128, 255, 255);
+
+  glGenBuffers(1, &m_staging_buffer);
+  GLState::Get().BindBuffer(GL_PIXEL_UNPACK_BUFFER, m_staging_buffer);
+
+  // Storage made with glBufferStorage can't be reallocated, if it can't
+  // be mapped persistently it is mapped a chunk at a time instead
+  bool immutable = false;
+  #ifdef GL_MAP_PERSISTENT_BIT
+    if (GLCaps::Get().buffer_storage) {
+      // Map once and write straight into the buffer for the rest of the run
+      GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+      glBufferStorage(GL_PIXEL_UNPACK_BUFFER, m_segment_size * TEXTURE_STAGING_SEGMENTS, nullptr, flags | GL_DYNAMIC_STORAGE_BIT);
+      immutable = true;
+      m_persistent_ptr = static_cast<uint8_t*>(glMapBufferRange(
+        GL_PIXEL_UNPACK_BUFFER, 0, m_segment_size * TEXTURE_STAGING_SEGMENTS, flags
+      ));
+    }
+  #endif
+
+  if (!immutable) {
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, m_segment_size * TEXTURE_STAGING_SEGMENTS, nullptr, GL_STREAM_DRAW);
+  }
+
+  GLState::Get().BindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  return true;
+}
+
+void TextureStreamer::Enqueue(Texture* texture) {
+  m_queue.push_back(texture);
+}
+
+void TextureStreamer::Update() {
+  auto start = std::chrono::steady_clock::now();
+
+  RetireUploads();
+
+  // Upload decoded textures in chunks until the frame budget runs out
+  auto i = m_queue.begin();
+  while (i != m_queue.end()) {
+    std::chrono::duration<float, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    if (elapsed.count() > m_budget_ms) break;
+
+    Texture* texture = *i;
+    int state = texture->m_state;
+
+    // Still decoding on a worker, try the next one
+    if (state == Texture::DECODING) {
+      ++i;
+      continue;
+    }
+
+    // Decoding failed, the placeholder stays bound
+    if (state == Texture::FAILED) {
+      i = m_queue.erase(i);
+      continue;
+    }
+
+    // Allocate storage before the first chunk
+    if (state == Texture::DECODED) {
+      AllocateStorage(texture);
+      texture->m_state = Texture::UPLOADING;
+    }
+
+    // The staging buffer is still in use by the GPU, continue next frame
+    if (!UploadChunk(texture)) break;
+
+    // Fence the last chunk so we know when the texture can be sampled
+    if (texture->m_upload_level == texture->m_image.levels.size()) {
+      texture->m_fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+      m_fenced.push_back(texture);
+      i = m_queue.erase(i);
+    }
+  }
+}
+
+void TextureStreamer::RetireUploads() {
+  for (unsigned i = 0; i < m_fenced.size();) {
+    Texture* texture = m_fenced[i];
+    GLenum status = glClientWaitSync(texture->m_fence, 0, 0);
+    if (status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED) {
+      glDeleteSync(texture->m_fence);
+      texture->m_fence = 0;
+      texture->m_state = Texture::READY;
+
+      // The GPU has its own copy now
+      std::vector<uint8_t>().swap(texture->m_image.data);
+      texture->m_baked.Close();
+      texture->m_data = nullptr;
+
+      m_fenced[i] = m_fenced.back();
+      m_fenced.pop_back();
+    } else {
+      i++;
+    }
+  }
+}
+
+void TextureStreamer::AllocateStorage(Texture* texture) {
+  const TextureImage& image = texture->m_image;
+  GLsizei levels = image.levels.size();
+
+  GLState::Get().BindTexture(GL_TEXTURE_2D, texture->t_Location);
+
+  #ifdef GL_VERSION_4_2
+    if (GLCaps::Get().texture_storage) {
+      glTexStorage2D(GL_TEXTURE_2D, levels, TextureBaker::GetInternalFormat(image.format), image.width, image.height);
+    } else
+  #endif
+  {
+    // Only uncompressed textures get here, see GLCaps::SupportsFormat
+    for (GLsizei i = 0; i < levels; i++) {
+      glTexImage2D(GL_TEXTURE_2D, i, GL_RGBA8, image.levels[i].width, image.levels[i].height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    }
+  }
+
+  // Trilinear filtering across the whole chain
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, levels > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+  #ifdef GL_TEXTURE_MAX_ANISOTROPY_EXT
+    if (GLCaps::Get().anisotropic) {
+      glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT, m_anisotropy);
+    }
+  #endif
+
+  GLState::Get().BindTexture(GL_TEXTURE_2D, 0);
+
+  texture->m_upload_level = 0;
+  texture->m_upload_row = 0;
+}
+
+bool TextureStreamer::UploadChunk(Texture* texture) {
+  // Wait for the GPU to finish reading the segment we are about to reuse
+  GLsync& fence = m_segment_fences[m_segment];
+  if (fence != 0) {
+    if (glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED) {
+      return false;
+    }
+    glDeleteSync(fence);
+    fence = 0;
+  }
+
+  const TextureImage& image = texture->m_image;
+  const TextureLevel& level = image.levels[texture->m_upload_level];
+  bool compressed = TextureBaker::IsCompressed(image.format);
+
+  // Compressed levels are copied a row of blocks at a time
+  unsigned row_height = compressed ? 4 : 1;
+  unsigned total_rows = (level.height + row_height - 1) / row_height;
+  GLsizeiptr row_size = level.size / total_rows;
+  unsigned rows = std::min<GLsizeiptr>(total_rows - texture->m_upload_row, m_segment_size / row_size);
+  const uint8_t* source = texture->m_data + level.offset + row_size * texture->m_upload_row;
+
+  // A single row doesn't fit in a segment, upload it from client memory
+  bool staged = rows > 0;
+  if (!staged) rows = 1;
+
+  GLsizeiptr size = row_size * rows;
+  GLintptr offset = m_segment * m_segment_size;
+  const void* pixels = source;
+
+  if (staged) {
+    GLState::Get().BindBuffer(GL_PIXEL_UNPACK_BUFFER, m_staging_buffer);
+
+    if (m_persistent_ptr != nullptr) {
+      memcpy(m_persistent_ptr + offset, source, size);
+    } else {
+      void* staging = glMapBufferRange(
+        GL_PIXEL_UNPACK_BUFFER, offset, size,
+        GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT
+      );
+      if (staging != nullptr) {
+        memcpy(staging, source, size);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+      } else {
+        // The driver couldn't map it, let it copy the rows in instead
+        glBufferSubData(GL_PIXEL_UNPACK_BUFFER, offset, size, source);
+      }
+    }
+
+    // Copy from the staging buffer offset into the texture
+    pixels = reinterpret_cast<const void*>(offset);
+  }
+
+  GLint y = texture->m_upload_row * row_height;
+  GLsizei height = std::min<GLsizei>(rows * row_height, level.height - y);
+
+  GLState::Get().BindTexture(GL_TEXTURE_2D, texture->t_Location);
+  if (compressed) {
+    glCompressedTexSubImage2D(
+      GL_TEXTURE_2D, texture->m_upload_level,
+      0, y, level.width, height,
+      TextureBaker::GetInternalFormat(image.format), size, pixels
+    );
+  } else {
+    glTexSubImage2D(
+      GL_TEXTURE_2D, texture->m_upload_level,
+      0, y, level.width, height,
+      GL_RGBA, GL_UNSIGNED_BYTE, pixels
+    );
+  }
+  GLState::Get().BindTexture(GL_TEXTURE_2D, 0);
+
+  if (staged) {
+    GLState::Get().BindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    m_segment = (m_segment + 1) % TEXTURE_STAGING_SEGMENTS;
+  }
+
+  // Move on to the next level once this one is done
+  texture->m_upload_row += rows;
+  if (texture->m_upload_row == total_rows) {
+    texture->m_upload_level++;
+    texture->m_upload_row = 0;
+  }
+  return true;
+}
+
+GLuint TextureStreamer::GetPlaceholder(GLenum unit) const {
+  return unit == GL_NORMAL_POS ? m_normal_placeholder : m_color_placeholder;
+}
+
+GLuint TextureStreamer::CreatePlaceholder(GLubyte r, GLubyte g, GLubyte b, GLubyte a) {
+  GLubyte texel[4] = { r, g, b, a };
+  GLuint location;
+  glGenTextures(1, &location);
+  GLState::Get().BindTexture(GL_TEXTURE_2D, location);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, texel);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  GLState::Get().BindTexture(GL_TEXTURE_2D, 0);
+  return location;
+}
+
+void TextureStreamer::Destroy() {
+  for (unsigned i = 0; i < TEXTURE_STAGING_SEGMENTS; i++) {
+    if (m_segment_fences[i] != 0) glDeleteSync(m_segment_fences[i]);
+    m_segment_fences[i] = 0;
+  }
+
+  if (m_staging_buffer != 0) {
+    GLState::Get().BindBuffer(GL_PIXEL_UNPACK_BUFFER, m_staging_buffer);
+    if (m_persistent_ptr != nullptr) glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    GLState::Get().BindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    GLState::Get().DeleteBuffers(1, &m_staging_buffer);
+  }
+  m_staging_buffer = 0;
+  m_persistent_ptr = nullptr;
+
+  GLState::Get().DeleteTextures(1, &m_color_placeholder);
+  GLState::Get().DeleteTextures(1, &m_normal_placeholder);
+  m_queue.clear();
+  m_fenced.clear();
+}
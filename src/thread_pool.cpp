@@ -0,0 +1,63 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+
+ThreadPool& ThreadPool::Get() {
+  // One worker per core the frame threads leave
+  unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+  static ThreadPool pool(std::max(1u, cores - GetFrameThreadCount()));
+  return pool;
+}
+
+/**
+ * Threads the frame may keep busy alongside the shared pool without
+ * running more threads than there are cores
+ * @return At least one, the render thread
+ */
+unsigned ThreadPool::GetFrameThreadCount() {
+  unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+  return std::max(1u, cores / THREAD_POOL_FRAME_SHARE);
+}
+
+ThreadPool::ThreadPool(unsigned thread_count) : m_stopping(false) {
+  for (unsigned i = 0; i < thread_count; i++) {
+    m_workers.push_back(std::thread(&ThreadPool::WorkerLoop, this));
+  }
+}
+
+void ThreadPool::Enqueue(std::function<void()> task) {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_tasks.push(task);
+  }
+  m_condition.notify_one();
+}
+
+void ThreadPool::WorkerLoop() {
+  while (true) {
+    std::function<void()> task;
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_condition.wait(lock, [this]() { return m_stopping || !m_tasks.empty(); });
+
+      // Drain the queue before exiting
+      if (m_tasks.empty()) return;
+
+      task = m_tasks.front();
+      m_tasks.pop();
+    }
+    task();
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stopping = true;
+  }
+  m_condition.notify_all();
+
+  for (auto& i : m_workers) {
+    i.join();
+  }
+}
@@ -0,0 +1,139 @@
+#include "vertex_format.h"
+
+#include <glm/gtc/packing.hpp>
+#include <cstring>
+
+static VertexLayout make_full_layout() {
+  VertexLayout layout;
+  layout.stride = sizeof(Vertex);
+  layout.attribute_mask = (1u << ATTRIBUTE_COUNT) - 1;
+  layout.attributes[ATTRIBUTE_POSITION] = { 3, GL_FLOAT, GL_FALSE, offsetof(Vertex, position) };
+  layout.attributes[ATTRIBUTE_UV] = { 2, GL_FLOAT, GL_FALSE, offsetof(Vertex, uv) };
+  layout.attributes[ATTRIBUTE_NORMAL] = { 3, GL_FLOAT, GL_FALSE, offsetof(Vertex, normal) };
+  layout.attributes[ATTRIBUTE_TANGENT] = { 3, GL_FLOAT, GL_FALSE, offsetof(Vertex, tangent) };
+  layout.attributes[ATTRIBUTE_BITANGENT] = { 3, GL_FLOAT, GL_FALSE, offsetof(Vertex, bitangent) };
+  return layout;
+}
+
+template<class T>
+static VertexLayout make_packed_layout(GLint position_size, GLenum position_type, GLboolean position_normalized) {
+  VertexLayout layout;
+  layout.stride = sizeof(T);
+  // The bitangent is rebuilt from the normal, tangent and sign
+  layout.attribute_mask = (1u << ATTRIBUTE_COUNT) - 1 - (1u << ATTRIBUTE_BITANGENT);
+  layout.attributes[ATTRIBUTE_POSITION] = { position_size, position_type, position_normalized, offsetof(T, position) };
+  layout.attributes[ATTRIBUTE_UV] = { 2, GL_HALF_FLOAT, GL_FALSE, offsetof(T, uv) };
+  layout.attributes[ATTRIBUTE_NORMAL] = { 2, GL_SHORT, GL_TRUE, offsetof(T, normal) };
+  layout.attributes[ATTRIBUTE_TANGENT] = { 3, GL_SHORT, GL_TRUE, offsetof(T, tangent) };
+  layout.attributes[ATTRIBUTE_BITANGENT] = { 0, GL_FLOAT, GL_FALSE, 0 };
+  return layout;
+}
+
+const VertexLayout& VertexLayout::Get(VertexFormat format) {
+  static const VertexLayout layouts[] = {
+    make_full_layout(),
+    make_packed_layout<PackedVertex>(3, GL_FLOAT, GL_FALSE),
+    make_packed_layout<QuantizedVertex>(3, GL_UNSIGNED_SHORT, GL_TRUE)
+  };
+  return layouts[format];
+}
+
+VertexFormat VertexLayout::ParseFormat(const std::string& name) {
+  if (name == "packed") return VERTEX_PACKED;
+  if (name == "quantized") return VERTEX_QUANTIZED;
+  if (name != "full") {
+    std::cout << "Unknown vertex format " << name << ", using full." << std::endl;
+  }
+  return VERTEX_FULL;
+}
+
+static inline int16_t pack_snorm(float value) {
+  return int16_t(glm::clamp(value, -1.0f, 1.0f) * 32767.0f + (value >= 0.0f ? 0.5f : -0.5f));
+}
+
+// Octahedral encoding, folds the unit sphere onto a square
+static inline void pack_octahedral(glm::vec3 v, int16_t* out) {
+  float norm = std::fabs(v.x) + std::fabs(v.y) + std::fabs(v.z);
+  if (norm == 0.0f) {
+    v = glm::vec3(0.0f, 0.0f, 1.0f);
+    norm = 1.0f;
+  }
+  v /= norm;
+
+  float x = v.x, y = v.y;
+  if (v.z < 0.0f) {
+    x = (1.0f - std::fabs(v.y)) * (v.x >= 0.0f ? 1.0f : -1.0f);
+    y = (1.0f - std::fabs(v.x)) * (v.y >= 0.0f ? 1.0f : -1.0f);
+  }
+  out[0] = pack_snorm(x);
+  out[1] = pack_snorm(y);
+}
+
+template<class T>
+static inline void pack_common(const Vertex& vertex, T& packed) {
+  packed.uv[0] = glm::packHalf1x16(vertex.uv.x);
+  packed.uv[1] = glm::packHalf1x16(vertex.uv.y);
+  pack_octahedral(vertex.normal, packed.normal);
+  pack_octahedral(vertex.tangent, packed.tangent);
+
+  // Which way the bitangent points relative to cross(normal, tangent)
+  float handedness = glm::dot(glm::cross(vertex.normal, vertex.tangent), vertex.bitangent);
+  packed.tangent[2] = handedness < 0.0f ? -32767 : 32767;
+  packed.tangent[3] = 0;
+}
+
+/**
+ * Converts full vertices to a packed format
+ * @param vertices     - The vertices to pack
+ * @param num_vertices - The number of vertices
+ * @param format       - The format to pack to
+ * @param data         - Set to the packed vertices
+ * @param offset       - Set to the minimum corner of the quantization bounds
+ * @param scale        - Set to the extent of the quantization bounds
+ */
+void VertexLayout::Pack(const Vertex* vertices, unsigned num_vertices, VertexFormat format,
+                        std::vector<uint8_t>& data, glm::vec3& offset, glm::vec3& scale) {
+  offset = glm::vec3(0.0f);
+  scale = glm::vec3(1.0f);
+
+  if (format == VERTEX_FULL) {
+    data.assign(reinterpret_cast<const uint8_t*>(vertices), reinterpret_cast<const uint8_t*>(vertices + num_vertices));
+    return;
+  }
+
+  if (format == VERTEX_PACKED) {
+    data.resize(num_vertices * sizeof(PackedVertex));
+    PackedVertex* packed = reinterpret_cast<PackedVertex*>(data.data());
+    for (unsigned i = 0; i < num_vertices; i++) {
+      packed[i].position = vertices[i].position;
+      pack_common(vertices[i], packed[i]);
+    }
+    return;
+  }
+
+  // Quantize positions to 16 bits across the mesh bounds
+  glm::vec3 low(0.0f), high(0.0f);
+  if (num_vertices > 0) {
+    low = high = vertices[0].position;
+  }
+  for (unsigned i = 1; i < num_vertices; i++) {
+    low = glm::min(low, vertices[i].position);
+    high = glm::max(high, vertices[i].position);
+  }
+  offset = low;
+  scale = high - low;
+  for (unsigned c = 0; c < 3; c++) {
+    if (scale[c] == 0.0f) scale[c] = 1.0f;
+  }
+
+  data.resize(num_vertices * sizeof(QuantizedVertex));
+  QuantizedVertex* packed = reinterpret_cast<QuantizedVertex*>(data.data());
+  for (unsigned i = 0; i < num_vertices; i++) {
+    glm::vec3 normalized = (vertices[i].position - offset) / scale;
+    for (unsigned c = 0; c < 3; c++) {
+      packed[i].position[c] = uint16_t(glm::clamp(normalized[c], 0.0f, 1.0f) * 65535.0f + 0.5f);
+    }
+    packed[i].position[3] = 0;
+    pack_common(vertices[i], packed[i]);
+  }
+}
@@ -0,0 +1,107 @@
+#include "texture_baker.h"
+#include "mapped_file.h"
+#include "thread_pool.h"
+
+#include <Magick++.h>
+#include <dirent.h>
+#include <cstring>
+
+// Default texture path variables, relative to the build directory
+const std::string SOURCE_PATH = "../textures/";
+
+/**
+ * Bakes one image into a compressed KTX file with a full mip chain
+ * @param  source_path - The directory the image is in
+ * @param  name        - The file name of the image
+ * @param  allow_bc7   - Use BC7 for color textures instead of BC1/BC3
+ * @return             True if the KTX file was written
+ */
+bool bake_texture(const std::string& source_path, const std::string& name, bool allow_bc7) {
+  uint64_t mtime, size;
+  if (!stat_file(source_path + name, mtime, size)) {
+    std::cout << "Missing texture " << name << std::endl;
+    return false;
+  }
+
+  TextureImage chain, baked;
+  try {
+    Magick::Image image(source_path + name);
+    Magick::Blob blob;
+    image.write(&blob, "RGBA", 8);
+
+    TextureBaker::GenerateMipChain(
+      static_cast<const uint8_t*>(blob.data()),
+      image.columns(),
+      image.rows(),
+      TextureBaker::IsNormalMap(name),
+      chain
+    );
+  } catch(Magick::Error& err) {
+    std::cout << "Failed to load texture " << name << ", Error: " << err.what() << std::endl;
+    return false;
+  }
+
+  TextureFormat format = TextureBaker::ChooseFormat(chain, TextureBaker::IsNormalMap(name), allow_bc7);
+  TextureBaker::Compress(chain, format, baked);
+
+  if (!TextureBaker::WriteKTX(BAKED_TEXTURE_PATH + name + ".ktx", baked, mtime, size)) {
+    std::cout << "Failed to write " << BAKED_TEXTURE_PATH << name << ".ktx" << std::endl;
+    return false;
+  }
+
+  std::cout << "Baked " << name << " (" << baked.levels.size() << " levels, "
+            << chain.data.size() / 1024 << " KiB -> " << baked.data.size() / 1024 << " KiB)" << std::endl;
+  return true;
+}
+
+int main(int argc, char** argv) {
+  Magick::InitializeMagick(*argv);
+
+  bool allow_bc7 = false;
+  std::vector<std::string> names;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--bc7") == 0) {
+      allow_bc7 = true;
+    } else {
+      names.push_back(argv[i]);
+    }
+  }
+
+  // With no names given bake every image in the texture directory
+  if (names.empty()) {
+    DIR* directory = opendir(SOURCE_PATH.c_str());
+    if (directory == nullptr) {
+      std::cout << "Unable to open " << SOURCE_PATH << std::endl;
+      return 1;
+    }
+    while (dirent* entry = readdir(directory)) {
+      std::string name = entry->d_name;
+      std::string extension = name.substr(name.find_last_of('.') + 1);
+      if (extension == "png" || extension == "jpg" || extension == "jpeg" || extension == "tga") {
+        names.push_back(name);
+      }
+    }
+    closedir(directory);
+  }
+
+  if (!make_directory(BAKED_TEXTURE_PATH)) {
+    std::cout << "Unable to create " << BAKED_TEXTURE_PATH << std::endl;
+    return 1;
+  }
+
+  // Bake every texture in parallel
+  std::vector<std::shared_future<bool> > results;
+  for (auto& i : names) {
+    std::string name = i;
+    results.push_back(ThreadPool::Get().Submit<bool>([name, allow_bc7]() {
+      return bake_texture(SOURCE_PATH, name, allow_bc7);
+    }));
+  }
+
+  int failures = 0;
+  for (auto& i : results) {
+    if (!i.get()) failures++;
+  }
+
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,88 @@
+#include "bvh.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <random>
+
+// Number of boxes and how many times each culling path runs over them
+#define BENCH_BOXES 100000
+#define BENCH_RUNS 100
+
+/**
+ * Times a culling path
+ * @param  cull - Runs the cull once and returns the visible count
+ * @return      Average nanoseconds per box
+ */
+template<class F>
+double time_cull(F cull, unsigned& visible) {
+  auto start = std::chrono::steady_clock::now();
+  for (unsigned i = 0; i < BENCH_RUNS; i++) {
+    visible = cull();
+  }
+  std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+  return elapsed.count() / (double(BENCH_RUNS) * BENCH_BOXES);
+}
+
+int main(int argc, char** argv) {
+  // Boxes scattered around a camera looking down -z, about a fifth of
+  // them end up inside the frustum
+  std::mt19937 random(1234);
+  std::uniform_real_distribution<float> position(-500.0f, 500.0f);
+  std::uniform_real_distribution<float> size(0.5f, 10.0f);
+
+  FrustumCuller culler;
+  Bvh scene;
+  for (unsigned i = 0; i < BENCH_BOXES; i++) {
+    Bounds bounds;
+    glm::vec3 center(position(random), position(random) * 0.1f, position(random));
+    glm::vec3 extents(size(random), size(random), size(random));
+    bounds.Add(center - extents, true);
+    bounds.Add(center + extents, false);
+    bounds.Finish();
+    unsigned index = culler.Add();
+    culler.Set(index, bounds);
+    scene.Insert(bounds, index);
+  }
+  scene.Build();
+
+  glm::mat4 projection = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, 400.0f);
+  glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 10.0f, 0.0f), glm::vec3(0.0f, 10.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+  Frustum frustum = Frustum::FromMatrix(projection * view);
+
+  unsigned scalar_visible = 0, simd_visible = 0;
+  double scalar_ns = time_cull([&]() { return culler.CullScalar(frustum); }, scalar_visible);
+  std::vector<bool> reference(BENCH_BOXES);
+  for (unsigned i = 0; i < BENCH_BOXES; i++) {
+    reference[i] = culler.IsVisible(i);
+  }
+  double simd_ns = time_cull([&]() { return culler.Cull(frustum); }, simd_visible);
+
+  std::vector<unsigned> items;
+  unsigned bvh_visible = 0, nodes_tested = 0;
+  double bvh_ns = time_cull([&]() {
+    items.clear();
+    nodes_tested = scene.QueryFrustum(frustum, items);
+    return unsigned(items.size());
+  }, bvh_visible);
+
+  // Every path must agree box for box
+  unsigned mismatches = 0;
+  std::vector<bool> found(BENCH_BOXES);
+  for (auto i : items) {
+    found[i] = true;
+  }
+  for (unsigned i = 0; i < BENCH_BOXES; i++) {
+    if (reference[i] != culler.IsVisible(i) || reference[i] != found[i]) mismatches++;
+  }
+
+  std::cout << BENCH_BOXES << " boxes, " << scalar_visible << " visible" << std::endl;
+  std::cout << "Scalar: " << scalar_ns << " ns per box" << std::endl;
+  std::cout << "SIMD:   " << simd_ns << " ns per box (" << scalar_ns / simd_ns << "x)" << std::endl;
+  std::cout << "BVH:    " << bvh_ns << " ns per box (" << scalar_ns / bvh_ns << "x, "
+            << nodes_tested << " nodes tested, height " << scene.GetHeight() << ")" << std::endl;
+  if (mismatches != 0 || scalar_visible != simd_visible || scalar_visible != bvh_visible) {
+    std::cout << mismatches << " boxes disagree" << std::endl;
+    return 1;
+  }
+  return 0;
+}
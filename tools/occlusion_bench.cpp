@@ -0,0 +1,123 @@
+#include "occlusion_culler.h"
+
+#include <chrono>
+#include <random>
+
+// Boxes scattered behind and around a row of walls, and how many times
+// the occlusion pass runs over them
+#define BENCH_BOXES 20000
+#define BENCH_WALLS 8
+#define BENCH_RUNS 100
+
+// Adds the six faces of a box, counter clockwise seen from outside
+static void add_box(OccluderMesh& mesh, const glm::vec3& min, const glm::vec3& max) {
+  unsigned base = mesh.vertices.size();
+  for (unsigned i = 0; i < 8; i++) {
+    mesh.vertices.push_back(glm::vec3((i & 1) ? max.x : min.x, (i & 2) ? max.y : min.y, (i & 4) ? max.z : min.z));
+  }
+  static const unsigned faces[] = {
+    0, 2, 3, 0, 3, 1,  4, 5, 7, 4, 7, 6,
+    0, 4, 6, 0, 6, 2,  1, 3, 7, 1, 7, 5,
+    0, 1, 5, 0, 5, 4,  2, 6, 7, 2, 7, 3
+  };
+  for (auto i : faces) {
+    mesh.indices.push_back(base + i);
+  }
+}
+
+int main(int argc, char** argv) {
+  // Walls 20 units in front of a camera looking down -z
+  OccluderMesh walls;
+  for (unsigned i = 0; i < BENCH_WALLS; i++) {
+    float x = -40.0f + i * 10.0f;
+    add_box(walls, glm::vec3(x, -5.0f, -21.0f), glm::vec3(x + 9.0f, 15.0f, -20.0f));
+  }
+
+  std::mt19937 random(1234);
+  std::uniform_real_distribution<float> position(-60.0f, 60.0f);
+  std::uniform_real_distribution<float> depth(-200.0f, -1.0f);
+  std::uniform_real_distribution<float> size(0.25f, 2.0f);
+  std::vector<Bounds> boxes(BENCH_BOXES);
+  for (auto& i : boxes) {
+    glm::vec3 center(position(random), position(random) * 0.1f + 5.0f, depth(random));
+    glm::vec3 extents(size(random));
+    i.Add(center - extents, true);
+    i.Add(center + extents, false);
+    i.Finish();
+  }
+
+  glm::mat4 projection = glm::perspective(glm::radians(60.0f), 2.0f, 0.1f, 400.0f);
+  glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 5.0f, 0.0f), glm::vec3(0.0f, 5.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+  glm::mat4 proj_view = projection * view;
+
+  OcclusionCuller culler;
+  culler.Initialize(256, 128);
+
+  unsigned occluded = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (unsigned run = 0; run < BENCH_RUNS; run++) {
+    culler.Clear();
+    culler.AddOccluder(walls, glm::mat4(1.0f));
+    culler.Rasterize(proj_view);
+  }
+  std::chrono::duration<double, std::micro> raster = std::chrono::steady_clock::now() - start;
+
+  start = std::chrono::steady_clock::now();
+  for (unsigned run = 0; run < BENCH_RUNS; run++) {
+    occluded = 0;
+    for (auto& i : boxes) {
+      if (!culler.TestBox(i)) occluded++;
+    }
+  }
+  std::chrono::duration<double, std::nano> test = std::chrono::steady_clock::now() - start;
+
+  // Check every hidden box by casting a ray through each pixel center it
+  // covers, at least one wall must be hit nearer than the box everywhere
+  float tan_half = std::tan(glm::radians(30.0f));
+  unsigned wrong = 0;
+  for (auto& i : boxes) {
+    if (culler.TestBox(i)) continue;
+
+    glm::vec2 low, high;
+    for (unsigned j = 0; j < 8; j++) {
+      glm::vec4 clip = proj_view * glm::vec4((j & 1) ? i.max.x : i.min.x, (j & 2) ? i.max.y : i.min.y, (j & 4) ? i.max.z : i.min.z, 1.0f);
+      glm::vec2 window((clip.x / clip.w * 0.5f + 0.5f) * culler.GetWidth(), (clip.y / clip.w * 0.5f + 0.5f) * culler.GetHeight());
+      low = j == 0 ? window : glm::min(low, window);
+      high = j == 0 ? window : glm::max(high, window);
+    }
+
+    bool hidden = true;
+    for (int y = std::max(0, int(low.y)); y <= std::min(int(culler.GetHeight()) - 1, int(high.y)) && hidden; y++) {
+      for (int x = std::max(0, int(low.x)); x <= std::min(int(culler.GetWidth()) - 1, int(high.x)) && hidden; x++) {
+        glm::vec3 direction(((x + 0.5f) / culler.GetWidth() * 2.0f - 1.0f) * tan_half * 2.0f,
+                            ((y + 0.5f) / culler.GetHeight() * 2.0f - 1.0f) * tan_half, -1.0f);
+
+        // Nearest wall along the ray as a distance down -z
+        float nearest = 1e30f;
+        for (unsigned w = 0; w < BENCH_WALLS; w++) {
+          glm::vec3 wall_min(-40.0f + w * 10.0f, -5.0f, -21.0f), wall_max(-31.0f + w * 10.0f, 15.0f, -20.0f);
+          float enter = 0.0f, exit = 1e30f;
+          for (unsigned c = 0; c < 3; c++) {
+            float origin = c == 1 ? 5.0f : 0.0f;
+            float t0 = (wall_min[c] - origin) / direction[c], t1 = (wall_max[c] - origin) / direction[c];
+            enter = std::max(enter, std::min(t0, t1));
+            exit = std::min(exit, std::max(t0, t1));
+          }
+          if (enter <= exit) nearest = std::min(nearest, enter);
+        }
+        hidden = nearest < -i.max.z;
+      }
+    }
+    if (!hidden) wrong++;
+  }
+
+  std::cout << BENCH_BOXES << " boxes, " << occluded << " occluded by " << culler.GetTriangleCount()
+            << " triangles on " << culler.GetThreadCount() << " threads" << std::endl;
+  std::cout << "Rasterize: " << raster.count() / BENCH_RUNS << " us" << std::endl;
+  std::cout << "Test:      " << test.count() / (double(BENCH_RUNS) * BENCH_BOXES) << " ns per box" << std::endl;
+  if (wrong != 0) {
+    std::cout << wrong << " visible boxes were occluded" << std::endl;
+    return 1;
+  }
+  return 0;
+}
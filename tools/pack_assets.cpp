@@ -0,0 +1,186 @@
+#include "asset_pack.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>
+#include <fstream>
+#include <iostream>
+#include <sys/stat.h>
+
+// Directories packed, relative to the build directory
+const std::string ROOT_PATH = "../";
+const char* PACKED_DIRECTORIES[] = { "shaders", "models", "textures", "cache" };
+
+// Compression must save at least this much to be worth a copy on load
+#define MIN_COMPRESSION_RATIO 0.9
+
+struct PackedAsset {
+  std::string name;
+  AssetPackEntry entry;
+  std::vector<uint8_t> data;
+};
+
+/**
+ * Recursively lists the files in a directory
+ * @param path  - The directory relative to ROOT_PATH
+ * @param names - Has the file names relative to ROOT_PATH appended
+ */
+void list_files(const std::string& path, std::vector<std::string>& names) {
+  DIR* directory = opendir((ROOT_PATH + path).c_str());
+  if (directory == nullptr) return;
+
+  while (dirent* entry = readdir(directory)) {
+    std::string name = entry->d_name;
+    if (name == "." || name == ".." || name[0] == '.') continue;
+
+    struct stat info;
+    std::string full = path + "/" + name;
+    if (stat((ROOT_PATH + full).c_str(), &info) != 0) continue;
+
+    if (S_ISDIR(info.st_mode)) {
+      list_files(full, names);
+    } else if (S_ISREG(info.st_mode)) {
+      names.push_back(full);
+    }
+  }
+  closedir(directory);
+}
+
+/**
+ * Reads and optionally compresses one asset
+ * @param  name        - The asset name relative to ROOT_PATH
+ * @param  compression - The compression to try
+ * @param  asset       - Set to the asset and its table of contents entry
+ * @return             False if the file couldn't be read
+ */
+bool pack_asset(const std::string& name, AssetCompression compression, PackedAsset& asset) {
+  asset.name = name;
+  memset(&asset.entry, 0, sizeof(asset.entry));
+  if (name.size() >= ASSET_PACK_NAME_LENGTH) {
+    std::cout << "Asset name too long " << name << std::endl;
+    return false;
+  }
+  memcpy(asset.entry.name, name.c_str(), name.size());
+  asset.entry.name_hash = hash_string(name);
+
+  MappedFile file;
+  if (!file.Open(ROOT_PATH + name)) {
+    // Empty files can't be mapped, pack them empty
+    uint64_t mtime, size;
+    if (!stat_file(ROOT_PATH + name, mtime, size) || size != 0) {
+      std::cout << "Unable to read " << name << std::endl;
+      return false;
+    }
+  }
+
+  asset.entry.size = file.Size();
+  asset.entry.content_hash = hash_bytes(file.Data(), file.Size());
+  asset.entry.compression = ASSET_UNCOMPRESSED;
+
+  // Mesh caches and baked textures are used in place, never compress them
+  std::string extension = name.substr(name.find_last_of('.') + 1);
+  bool zero_copy = extension == "mesh" || extension == "ktx";
+
+  if (compression != ASSET_UNCOMPRESSED && !zero_copy &&
+      AssetPack::Compress(compression, file.Data(), file.Size(), asset.data) &&
+      asset.data.size() < file.Size() * MIN_COMPRESSION_RATIO) {
+    asset.entry.compression = compression;
+  } else {
+    asset.data.assign(file.Data(), file.Data() + file.Size());
+  }
+  asset.entry.stored_size = asset.data.size();
+  return true;
+}
+
+int main(int argc, char** argv) {
+  AssetCompression compression = ASSET_UNCOMPRESSED;
+  std::string output = ASSET_PACK_PATH;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--lz4") == 0) {
+      compression = ASSET_LZ4;
+    } else if (strcmp(argv[i], "--zstd") == 0) {
+      compression = ASSET_ZSTD;
+    } else {
+      output = argv[i];
+    }
+  }
+
+  // Check the codec is built in before doing any work
+  std::vector<uint8_t> probe;
+  const uint8_t test[1] = { 0 };
+  if (!AssetPack::Compress(compression, test, 1, probe)) {
+    std::cout << "This build doesn't include the requested compression." << std::endl;
+    return 1;
+  }
+
+  std::vector<std::string> names;
+  for (auto i : PACKED_DIRECTORIES) {
+    list_files(i, names);
+  }
+
+  // Read and compress every asset in parallel
+  std::vector<PackedAsset> assets(names.size());
+  std::vector<std::shared_future<bool> > results;
+  for (unsigned i = 0; i < names.size(); i++) {
+    PackedAsset* asset = &assets[i];
+    std::string name = names[i];
+    results.push_back(ThreadPool::Get().Submit<bool>([name, compression, asset]() {
+      return pack_asset(name, compression, *asset);
+    }));
+  }
+  for (auto& i : results) {
+    if (!i.get()) return 1;
+  }
+
+  // The table of contents is sorted by name hash for binary searching
+  std::sort(assets.begin(), assets.end(), [](const PackedAsset& a, const PackedAsset& b) {
+    return a.entry.name_hash < b.entry.name_hash;
+  });
+
+  uint64_t offset = sizeof(AssetPackHeader) + assets.size() * sizeof(AssetPackEntry);
+  uint64_t total_size = 0, total_stored = 0;
+  for (auto& i : assets) {
+    offset = (offset + ASSET_PACK_ALIGNMENT - 1) & ~uint64_t(ASSET_PACK_ALIGNMENT - 1);
+    i.entry.offset = offset;
+    offset += i.entry.stored_size;
+    total_size += i.entry.size;
+    total_stored += i.entry.stored_size;
+  }
+
+  AssetPackHeader header;
+  header.magic = ASSET_PACK_MAGIC;
+  header.version = ASSET_PACK_VERSION;
+  header.num_entries = assets.size();
+  header.reserved = 0;
+
+  // Write to a temporary file and move it into place so the engine never
+  // maps a half written pack
+  std::string temp_path = output + ".tmp";
+  {
+    std::ofstream file(temp_path.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    for (auto& i : assets) {
+      file.write(reinterpret_cast<const char*>(&i.entry), sizeof(i.entry));
+    }
+    const char padding[ASSET_PACK_ALIGNMENT] = { 0 };
+    for (auto& i : assets) {
+      file.write(padding, i.entry.offset - uint64_t(file.tellp()));
+      file.write(reinterpret_cast<const char*>(i.data.data()), i.data.size());
+    }
+    if (!file.good()) {
+      std::cout << "Failed to write " << temp_path << std::endl;
+      return 1;
+    }
+  }
+
+  if (rename(temp_path.c_str(), output.c_str()) != 0) {
+    std::cout << "Failed to move " << temp_path << " to " << output << std::endl;
+    return 1;
+  }
+
+  std::cout << "Packed " << assets.size() << " assets into " << output << " ("
+            << total_size / 1024 << " KiB -> " << total_stored / 1024 << " KiB)" << std::endl;
+  return 0;
+}